@@ -0,0 +1,185 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <poll.h>
+#include <dirent.h>
+#include <unistd.h>
+
+#include "crc.h"
+#include "ccask_db.h"
+#include "ccask_config.h"
+#include "util.h"
+
+/**@file
+ * @brief ccask_bench compares the synchronous and io_uring query paths, and the durability
+ * 		  policies for sets, under concurrency.
+ *
+ * Every round, each of *clients* simulated clients has one query outstanding (90% gets of
+ * random keys, 10% sets), just like the server sees when that many connections are readable
+ * at once. The synchronous engine answers them one after another; the io_uring engine starts
+ * them all, submits them as one batch and waits for their completions on the eventfd. Like
+ * the server loop, every round ends with a group commit: under SYNC_ALWAYS every set pays for
+ * its own fdatasync, under SYNC_BATCH the round's sets share one.
+ *
+ * Mapped reads are off so gets of sealed files really go to the storage layer. The db's own
+ * chatter goes to stdout; results are printed to stderr.
+ *
+ * usage: ccask_bench [keys] [clients] [rounds]
+ */
+
+#define VALUE_BYTES 128
+
+typedef struct bench_stats {
+    size_t done;
+    size_t failed;
+} bench_stats;
+
+double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+uint64_t xorshift(uint64_t* s) {
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+/**@brief remove the data files of a previous run*/
+void clear_dir(const char* path) {
+    DIR* dir = opendir(path);
+    if (!dir) return;
+
+    char fn[512];
+    for (struct dirent* d = readdir(dir); d; d = readdir(dir)) {
+        if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0) continue;
+        snprintf(fn, sizeof(fn), "%s/%s", path, d->d_name);
+        unlink(fn);
+    }
+
+    closedir(dir);
+}
+
+uint8_t* make_cmd(uint8_t* buf, uint8_t cmd, uint32_t ksz, uint8_t* key, uint32_t vsz, uint8_t* val) {
+    u32_to_nwk_byte_arr(buf, 4 + 1 + 4 + 4 + ksz + vsz);
+    buf[4] = cmd;
+    u32_to_nwk_byte_arr(buf+5, ksz);
+    u32_to_nwk_byte_arr(buf+9, vsz);
+    memcpy(buf+13, key, ksz);
+    if (vsz) memcpy(buf+13+ksz, val, vsz);
+    return buf;
+}
+
+void count_result(bench_stats* st, ccask_result* res) {
+    uint8_t type = ccask_res_type(res);
+    if (type != GET_SUCCESS && type != SET_SUCCESS) st->failed++;
+    st->done++;
+    ccask_res_delete(res);
+}
+
+void collect(void* ctx, uint64_t tag, ccask_result* res) {
+    (void)tag;
+    count_result(ctx, res);
+}
+
+void run(const char* name, const char* path, bool use_uring, ccask_sync_policy policy, size_t keys, size_t clients, size_t rounds) {
+    clear_dir(path);
+
+    ccask_config_opts opts = ccask_config_defaults();
+    opts.keydir_size = 1 << 16;
+    opts.keydir_budget_mb = 1024;
+    opts.merge_pct = 100;
+    opts.use_mmap = false;
+    opts.use_uring = use_uring;
+    opts.sync_policy = policy;
+    opts.checkpoint_mb = 0;
+    ccask_config* cfg = ccask_config_new(&opts);
+    ccask_db* db = ccask_db_new(path, cfg);
+    if (!db) {
+        fprintf(stderr, "%s: failed to open %s\n", name, path);
+        exit(1);
+    }
+
+    if (use_uring && !ccask_db_async(db)) {
+        fprintf(stderr, "%s: io_uring unavailable, skipping\n", name);
+        ccask_db_delete(db);
+        ccask_config_delete(cfg);
+        return;
+    }
+
+    uint8_t val[VALUE_BYTES];
+    memset(val, 0xBE, sizeof(val));
+    for (uint64_t k = 0; k < keys; k++) {
+        if (!ccask_db_set(db, sizeof(k), (uint8_t*)&k, sizeof(val), val)) {
+            fprintf(stderr, "%s: preload failed\n", name);
+            exit(1);
+        }
+    }
+    ccask_db_flush(db, true);
+
+    size_t cmdsz = 13 + sizeof(uint64_t) + VALUE_BYTES;
+    uint8_t* cmds = malloc(clients * cmdsz);
+    uint64_t seed = 0x9E3779B97F4A7C15ull;
+    bench_stats st = { 0 };
+    struct pollfd pfd = { .fd = ccask_db_async_fd(db), .events = POLLIN };
+
+    double start = now_ms();
+    for (size_t r = 0; r < rounds; r++) {
+        size_t expected = st.done + clients;
+
+        for (size_t c = 0; c < clients; c++) {
+            uint64_t k = xorshift(&seed) % keys;
+            uint8_t* cmd = cmds + c * cmdsz;
+            if (xorshift(&seed) % 10 == 0) {
+                make_cmd(cmd, 1, sizeof(k), (uint8_t*)&k, sizeof(val), val);
+            } else {
+                make_cmd(cmd, 0, sizeof(k), (uint8_t*)&k, 0, 0);
+            }
+
+            ccask_result* res = 0;
+            if (!ccask_query_start(db, cmd, c, &res)) count_result(&st, res);
+        }
+
+        ccask_db_commit(db);
+        ccask_db_async_submit(db);
+        ccask_db_async_reap(db, collect, &st);
+        while (st.done < expected) {
+            poll(&pfd, 1, -1);
+            ccask_db_async_reap(db, collect, &st);
+        }
+    }
+    double ms = now_ms() - start;
+
+    fprintf(stderr, "%-10s %8zu clients %10.0f ops/s %10.3f ms/round %8zu failed\n",
+            name, clients, st.done / (ms / 1e3), ms / rounds, st.failed);
+
+    free(cmds);
+    ccask_db_delete(db);
+    ccask_config_delete(cfg);
+}
+
+int main(int argc, char** argv) {
+    size_t keys = argc > 1 ? strtoull(argv[1], 0, 10) : 100000;
+    size_t clients = argc > 2 ? strtoull(argv[2], 0, 10) : 64;
+    size_t rounds = argc > 3 ? strtoull(argv[3], 0, 10) : 2000;
+
+    if (keys == 0 || clients == 0 || rounds == 0) {
+        fprintf(stderr, "usage: %s [keys] [clients] [rounds]\n", argv[0]);
+        return 1;
+    }
+
+    crc_init();
+
+    run("sync", "CCASK_BENCH_SYNC", false, SYNC_NEVER, keys, clients, rounds);
+    run("io_uring", "CCASK_BENCH_URING", true, SYNC_NEVER, keys, clients, rounds);
+    run("always", "CCASK_BENCH_SYNC", false, SYNC_ALWAYS, keys, clients, rounds);
+    run("batch", "CCASK_BENCH_SYNC", false, SYNC_BATCH, keys, clients, rounds);
+    run("io_uring/b", "CCASK_BENCH_URING", true, SYNC_BATCH, keys, clients, rounds);
+
+    return 0;
+}
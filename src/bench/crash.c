@@ -0,0 +1,244 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <signal.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#include "crc.h"
+#include "ccask_db.h"
+#include "ccask_config.h"
+#include "util.h"
+
+/**@file
+ * @brief ccask_crash kills a writer in the middle of its appends and measures recovery.
+ *
+ * The directory is first preloaded with *keys* keys. Then, every round, a child process sets
+ * fresh keys under SYNC_ALWAYS, reporting each acknowledged set over a pipe, until it is
+ * killed with SIGKILL a random few milliseconds after its first one. To stand in for a power
+ * failure in the middle of an append, a random partial record is then added to the end of the
+ * last data file. The harness reopens the directory, timing the startup, and checks that
+ * every acknowledged set survived with a valid checksum.
+ *
+ * The db's own chatter goes to stdout; results are printed to stderr.
+ *
+ * usage: ccask_crash [keys] [rounds]
+ */
+
+#define CRASH_DIR "CCASK_CRASH"
+#define VALUE_BYTES 128
+
+double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+uint64_t xorshift(uint64_t* s) {
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+/**@brief remove the data files of a previous run*/
+void clear_dir(const char* path) {
+    DIR* dir = opendir(path);
+    if (!dir) return;
+
+    char fn[512];
+    for (struct dirent* d = readdir(dir); d; d = readdir(dir)) {
+        if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0) continue;
+        snprintf(fn, sizeof(fn), "%s/%s", path, d->d_name);
+        unlink(fn);
+    }
+
+    closedir(dir);
+}
+
+/**@brief total bytes of the files in *path*, and the id of its newest data file*/
+size_t dir_bytes(const char* path, size_t* last_fid) {
+    DIR* dir = opendir(path);
+    if (!dir) return 0;
+
+    char fn[512];
+    size_t bytes = 0;
+    *last_fid = 0;
+    for (struct dirent* d = readdir(dir); d; d = readdir(dir)) {
+        struct stat st;
+        snprintf(fn, sizeof(fn), "%s/%s", path, d->d_name);
+        if (stat(fn, &st) != 0 || !S_ISREG(st.st_mode)) continue;
+        bytes += st.st_size;
+
+        // data files are <dir>_<id>, with no suffix
+        char* id = strrchr(d->d_name, '_');
+        char* end = 0;
+        size_t fid = id ? strtoull(id + 1, &end, 10) : 0;
+        if (id && end != id + 1 && *end == '\0' && fid > *last_fid) *last_fid = fid;
+    }
+
+    closedir(dir);
+    return bytes;
+}
+
+void fill_value(uint8_t* val, uint64_t k) {
+    for (size_t i = 0; i < VALUE_BYTES; i++) val[i] = (k * 31 + i) & 0xff;
+}
+
+ccask_db* open_db(ccask_config* cfg) {
+    ccask_db* db = ccask_db_new(CRASH_DIR, cfg);
+    if (!db) {
+        fprintf(stderr, "ccask_crash: failed to open %s\n", CRASH_DIR);
+        exit(1);
+    }
+
+    return db;
+}
+
+/**@brief child body: set keys from *first* on, writing the count acknowledged to *out* after each*/
+void writer(ccask_config* cfg, uint64_t first, int out) {
+    ccask_db* db = open_db(cfg);
+    uint8_t val[VALUE_BYTES];
+
+    for (uint64_t n = 0;; n++) {
+        uint64_t k = first + n;
+        fill_value(val, k);
+        if (!ccask_db_set(db, sizeof(k), (uint8_t*)&k, sizeof(val), val)) _exit(1);
+
+        uint64_t acked = n + 1;
+        if (write(out, &acked, sizeof(acked)) != sizeof(acked)) _exit(1);
+    }
+}
+
+/**@brief add a random partial record to the end of data file *fid*, as if the machine had gone
+ * 		  down while it was being written
+ */
+void tear(size_t fid, uint64_t* seed) {
+    char fn[512];
+    snprintf(fn, sizeof(fn), "%s/%s_%zu", CRASH_DIR, CRASH_DIR, fid);
+
+    int fd = open(fn, O_WRONLY | O_APPEND);
+    if (fd < 0) return;
+
+    uint8_t junk[VALUE_BYTES];
+    size_t n = 1 + xorshift(seed) % (sizeof(junk) - 1);
+    for (size_t i = 0; i < n; i++) junk[i] = xorshift(seed);
+    if (write(fd, junk, n) < 0) perror("ccask_crash: write");
+
+    close(fd);
+}
+
+int main(int argc, char** argv) {
+    size_t keys = argc > 1 ? strtoull(argv[1], 0, 10) : 100000;
+    size_t rounds = argc > 2 ? strtoull(argv[2], 0, 10) : 10;
+
+    if (rounds == 0) {
+        fprintf(stderr, "usage: %s [keys] [rounds]\n", argv[0]);
+        return 1;
+    }
+
+    crc_init();
+    mkdir(CRASH_DIR, 0700);
+    clear_dir(CRASH_DIR);
+
+    ccask_config_opts opts = ccask_config_defaults();
+    opts.keydir_size = 1 << 16;
+    opts.keydir_budget_mb = 1024;
+    opts.merge_pct = 100;
+    opts.use_mmap = false;
+    opts.checkpoint_mb = 0;
+    opts.sync_policy = SYNC_NEVER;
+    ccask_config* fast = ccask_config_new(&opts);
+    opts.sync_policy = SYNC_ALWAYS;
+    ccask_config* safe = ccask_config_new(&opts);
+
+    uint8_t val[VALUE_BYTES];
+    ccask_db* db = open_db(fast);
+    for (uint64_t k = 0; k < keys; k++) {
+        fill_value(val, k);
+        if (!ccask_db_set(db, sizeof(k), (uint8_t*)&k, sizeof(val), val)) {
+            fprintf(stderr, "ccask_crash: preload failed\n");
+            return 1;
+        }
+    }
+    ccask_db_delete(db);
+
+    uint64_t seed = 0x9E3779B97F4A7C15ull;
+    uint64_t next = keys;
+    size_t failures = 0;
+
+    for (size_t r = 0; r < rounds; r++) {
+        int fds[2];
+        if (pipe(fds) != 0) {
+            perror("ccask_crash: pipe");
+            return 1;
+        }
+
+        pid_t pid = fork();
+        if (pid < 0) {
+            perror("ccask_crash: fork");
+            return 1;
+        }
+
+        if (pid == 0) {
+            close(fds[0]);
+            writer(safe, next, fds[1]);
+        }
+
+        // start the clock once the writer has loaded the directory and acknowledged a set
+        uint64_t acked = 0, n;
+        close(fds[1]);
+        if (read(fds[0], &acked, sizeof(acked)) != sizeof(acked)) {
+            fprintf(stderr, "ccask_crash: writer failed\n");
+            return 1;
+        }
+
+        struct timespec pause = { 0, (5 + xorshift(&seed) % 45) * 1000 * 1000 };
+        nanosleep(&pause, 0);
+        kill(pid, SIGKILL);
+        waitpid(pid, 0, 0);
+
+        while (read(fds[0], &n, sizeof(n)) == sizeof(n)) acked = n;
+        close(fds[0]);
+
+        size_t last_fid;
+        size_t bytes = dir_bytes(CRASH_DIR, &last_fid);
+        tear(last_fid, &seed);
+
+        double start = now_ms();
+        db = open_db(safe);
+        double ms = now_ms() - start;
+
+        // every acknowledged set was synced, so it must have survived whatever came after it
+        size_t lost = 0;
+        uint8_t buf[VALUE_BYTES + 16];
+        for (uint64_t k = next; k < next + acked; k++) {
+            ccask_get_result* gr = ccask_db_get(db, sizeof(k), (uint8_t*)&k);
+            fill_value(val, k);
+            if (!gr || ccask_gr_bytes(gr, buf, sizeof(buf)) == UINT32_MAX || buf[4] != GET_SUCCESS
+                    || ccask_gr_vsz(gr) != VALUE_BYTES || memcmp(ccask_gr_val(buf, gr), val, VALUE_BYTES) != 0) {
+                lost++;
+            }
+            ccask_gr_delete(gr);
+        }
+
+        fprintf(stderr, "round %3zu: %8.1f MB %6zu files %8" PRIu64 " acked %6zu lost %10.3f ms recovery\n",
+                r, bytes / (1024.0 * 1024.0), last_fid + 1, acked, lost, ms);
+
+        failures += lost;
+        next += acked;
+        ccask_db_delete(db);
+    }
+
+    ccask_config_delete(fast);
+    ccask_config_delete(safe);
+
+    if (failures) fprintf(stderr, "ccask_crash: %zu acknowledged sets lost\n", failures);
+    return failures ? 1 : 0;
+}
@@ -0,0 +1,95 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+
+#include "crc.h"
+
+/**@file
+ * @brief ccask_crc_bench measures the throughput of every checksum implementation.
+ *
+ * Each one checksums buffers of a range of sizes, from a small record's header and key to a
+ * large value, for about *ms* milliseconds per size.
+ *
+ * usage: ccask_crc_bench [ms]
+ */
+
+typedef struct crc_impl {
+    const char* name;
+    crc_fn fn;
+} crc_impl;
+
+double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+int main(int argc, char** argv) {
+    double budget = argc > 1 ? strtod(argv[1], 0) : 200;
+    if (budget <= 0) {
+        fprintf(stderr, "usage: %s [ms]\n", argv[0]);
+        return 1;
+    }
+
+    crc_init();
+
+    crc_impl impls[] = {
+        { "crc32 bytewise", crc32_bytewise },
+        { "crc32 slice-by-8", crc32_slice8 },
+        { "crc32 slice-by-16", crc32_slice16 },
+        { "crc32c bytewise", crc32c_bytewise },
+        { "crc32c slice-by-8", crc32c_slice8 },
+        { "crc32c slice-by-16", crc32c_slice16 },
+        { "crc32c sse4.2", crc32c_sse42 },
+    };
+    size_t impl_count = sizeof(impls) / sizeof(impls[0]);
+    size_t sizes[] = { 32, 256, 4096, 65536, 1 << 20 };
+    size_t size_count = sizeof(sizes) / sizeof(sizes[0]);
+
+    uint8_t* buf = malloc(sizes[size_count - 1]);
+    if (!buf) return 1;
+
+    uint64_t x = 0x9E3779B97F4A7C15ull;
+    for (size_t i = 0; i < sizes[size_count - 1]; i++) {
+        x ^= x << 13;
+        x ^= x >> 7;
+        x ^= x << 17;
+        buf[i] = x;
+    }
+
+    printf("crc32 dispatches to %s, crc32c to %s%s\n\n", crc_impl_name(CRC_32), crc_impl_name(CRC_32C),
+           crc_sse42_available() ? "" : " (no sse4.2: its row falls back to slice-by-16)");
+
+    printf("%-20s", "MB/s");
+    for (size_t s = 0; s < size_count; s++) printf("%10zu B", sizes[s]);
+    puts("");
+
+    uint32_t sink = 0;
+    for (size_t i = 0; i < impl_count; i++) {
+        printf("%-20s", impls[i].name);
+
+        for (size_t s = 0; s < size_count; s++) {
+            size_t bytes = 0;
+            double start = now_ms();
+            double elapsed = 0;
+
+            // check the clock every so often rather than after every call
+            while (elapsed < budget) {
+                for (size_t r = 0; r < 64; r++) {
+                    sink ^= impls[i].fn(sink, buf, sizes[s]);
+                    bytes += sizes[s];
+                }
+                elapsed = now_ms() - start;
+            }
+
+            printf("%12.0f", bytes / (elapsed / 1e3) / 1e6);
+        }
+
+        puts("");
+    }
+
+    free(buf);
+    return sink == 0x12345678; // keep the work from being optimized away
+}
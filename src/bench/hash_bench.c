@@ -0,0 +1,243 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "ccask_keydir.h"
+
+/**@file
+ * @brief ccask_hash_bench compares the keydir's hash functions: how fast, and how evenly they
+ * 		  spread realistic keys.
+ *
+ * Each hash is run over sets of *keys* keys shaped like the ones the keydir sees:
+ *
+ * - seq: short text ids, "user:0000000042"
+ * - int: 8-byte integers, 0, 1, 2, ...
+ * - url: 100 to 200 byte paths that share a long prefix and differ in a few digits
+ * - random: 16 to 64 random bytes
+ *
+ * For each, it reports
+ *
+ * - ns/key and MB/s over the whole set, for about *ms* milliseconds
+ * - the chi-squared of the keys over the groups of a keydir table sized for them, taking the
+ *   group index from the same hash bits the keydir does, divided by its degrees of freedom:
+ *   about 1 for an even spread, much more when keys pile into some groups
+ * - the same for the 7-bit tags kept in the control bytes
+ * - the most keys in one group, against the mean
+ * - full 64-bit collisions
+ * - avalanche: over a sample of keys, the worst bias of any hash bit from flipping with
+ *   probability 1/2 when one random key bit flips. Small (a few percent) is good.
+ *
+ * usage: ccask_hash_bench [keys] [ms]
+ */
+
+#define KD_GROUP 16             // slots per group, as in the keydir
+#define KD_LOAD_FACTOR 87       // percent of slots a table fills before it grows
+#define AVALANCHE_KEYS 20000
+
+typedef struct hash_impl {
+    const char* name;
+    ccask_kdhash_fn fn;
+} hash_impl;
+
+typedef struct key_set {
+    const char* name;
+    uint8_t* bytes;
+    size_t* off;
+    uint32_t* size;
+    size_t count;
+    size_t total;
+} key_set;
+
+double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+uint64_t xorshift(uint64_t* s) {
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+void key_set_add(key_set* ks, const uint8_t* key, uint32_t size) {
+    ks->off[ks->count] = ks->total;
+    ks->size[ks->count] = size;
+    memcpy(ks->bytes + ks->total, key, size);
+    ks->total += size;
+    ks->count++;
+}
+
+/**@brief a set of *n* keys of the given *kind*, each at most 200 bytes*/
+key_set* key_set_new(const char* kind, size_t n) {
+    key_set* ks = malloc(sizeof(key_set));
+    if (!ks) return 0;
+
+    *ks = (key_set) {
+        .name = kind,
+        .bytes = malloc(n * 200),
+        .off = malloc(n * sizeof(size_t)),
+        .size = malloc(n * sizeof(uint32_t)),
+    };
+    if (!ks->bytes || !ks->off || !ks->size) {
+        fprintf(stderr, "ccask_hash_bench: failed to allocate %zu keys\n", n);
+        exit(1);
+    }
+
+    uint64_t seed = 0x9E3779B97F4A7C15ull;
+    uint8_t key[256];
+    for (uint64_t k = 0; k < n; k++) {
+        if (strcmp(kind, "seq") == 0) {
+            key_set_add(ks, key, snprintf((char*)key, sizeof(key), "user:%010" PRIu64, k));
+        } else if (strcmp(kind, "int") == 0) {
+            key_set_add(ks, (uint8_t*)&k, sizeof(k));
+        } else if (strcmp(kind, "url") == 0) {
+            int len = snprintf((char*)key, sizeof(key), "https://storage.example.com/v2/tenants/acme-industries/"
+                               "buckets/telemetry-archive/objects/%08" PRIx64 "/", k);
+            uint32_t size = 100 + k % 101;
+            for (uint32_t i = len; i < size; i++) key[i] = 'a' + i % 26;
+            key_set_add(ks, key, size);
+        } else {
+            uint32_t size = 16 + xorshift(&seed) % 49;
+            for (uint32_t i = 0; i < size; i++) key[i] = xorshift(&seed);
+            key_set_add(ks, key, size);
+        }
+    }
+
+    return ks;
+}
+
+void key_set_delete(key_set* ks) {
+    free(ks->bytes);
+    free(ks->off);
+    free(ks->size);
+    free(ks);
+}
+
+int cmp_u64(const void* a, const void* b) {
+    uint64_t x = *(const uint64_t*)a, y = *(const uint64_t*)b;
+    return x < y ? -1 : x > y;
+}
+
+/**@brief chi-squared of *counts* over *bins* bins, divided by its degrees of freedom*/
+double chi2_df(const uint32_t* counts, size_t bins, size_t n) {
+    double expected = (double)n / bins, chi2 = 0;
+    for (size_t b = 0; b < bins; b++) chi2 += (counts[b] - expected) * (counts[b] - expected) / expected;
+
+    return chi2 / (bins - 1);
+}
+
+/**@brief the worst bias of any output bit of *fn* from 1/2 when one random input bit flips*/
+double avalanche(hash_impl* h, key_set* ks, uint64_t seed) {
+    size_t flips[64] = { 0 };
+    size_t trials = 0;
+    uint8_t key[256];
+    uint64_t rng = 0x2545F4914F6CDD1Dull;
+
+    for (size_t i = 0; i < ks->count && i < AVALANCHE_KEYS; i++) {
+        uint32_t size = ks->size[i];
+        if (size == 0) continue;
+        memcpy(key, ks->bytes + ks->off[i], size);
+
+        uint64_t before = h->fn(seed, size, key);
+        size_t bit = xorshift(&rng) % (size * 8);
+        key[bit / 8] ^= 1 << (bit % 8);
+        uint64_t diff = before ^ h->fn(seed, size, key);
+
+        for (int b = 0; b < 64; b++) flips[b] += (diff >> b) & 1;
+        trials++;
+    }
+
+    double worst = 0;
+    for (int b = 0; b < 64; b++) {
+        double bias = (double)flips[b] / trials - 0.5;
+        if (bias < 0) bias = -bias;
+        if (bias > worst) worst = bias;
+    }
+
+    return worst;
+}
+
+void run(hash_impl* h, key_set* ks, double budget, uint64_t seed) {
+    // throughput: the whole set, over and over
+    uint64_t sink = 0;
+    size_t hashed = 0, rounds = 0;
+    double start = now_ms(), elapsed = 0;
+    while (elapsed < budget) {
+        for (size_t i = 0; i < ks->count; i++) sink ^= h->fn(seed, ks->size[i], ks->bytes + ks->off[i]);
+        hashed += ks->count;
+        rounds++;
+        elapsed = now_ms() - start;
+    }
+
+    // spread over the groups and tags of a table the keydir would size for these keys
+    size_t slots = KD_GROUP;
+    while (slots / 100 * KD_LOAD_FACTOR < ks->count) slots *= 2;
+    size_t groups = slots / KD_GROUP;
+
+    uint32_t* group_counts = calloc(groups, sizeof(uint32_t));
+    uint32_t tag_counts[128] = { 0 };
+    uint64_t* hashes = malloc(ks->count * sizeof(uint64_t));
+    if (!group_counts || !hashes) {
+        fprintf(stderr, "ccask_hash_bench: failed to allocate counts\n");
+        exit(1);
+    }
+
+    for (size_t i = 0; i < ks->count; i++) {
+        uint64_t hv = h->fn(seed, ks->size[i], ks->bytes + ks->off[i]);
+        group_counts[(hv >> 7) & (groups - 1)]++;
+        tag_counts[hv & 0x7F]++;
+        hashes[i] = hv;
+    }
+
+    uint32_t most = 0;
+    for (size_t g = 0; g < groups; g++) {
+        if (group_counts[g] > most) most = group_counts[g];
+    }
+
+    size_t collisions = 0;
+    qsort(hashes, ks->count, sizeof(uint64_t), cmp_u64);
+    for (size_t i = 1; i < ks->count; i++) collisions += hashes[i] == hashes[i - 1];
+
+    printf("%-8s %-7s %8.1f %8.0f %11.2f %9.2f %6u/%-5.1f %6zu %10.4f\n", h->name, ks->name,
+           elapsed * 1e6 / hashed, (double)ks->total * rounds / (elapsed / 1e3) / 1e6,
+           chi2_df(group_counts, groups, ks->count), chi2_df(tag_counts, 128, ks->count),
+           most, (double)ks->count / groups, collisions, avalanche(h, ks, seed));
+
+    free(group_counts);
+    free(hashes);
+    if (sink == 0x12345678) puts(""); // keep the work from being optimized away
+}
+
+int main(int argc, char** argv) {
+    size_t keys = argc > 1 ? strtoull(argv[1], 0, 10) : 1000000;
+    double budget = argc > 2 ? strtod(argv[2], 0) : 500;
+
+    if (keys < 2 || budget <= 0) {
+        fprintf(stderr, "usage: %s [keys >= 2] [ms]\n", argv[0]);
+        return 1;
+    }
+
+    hash_impl impls[] = {
+        { "fnv1a", ccask_kdhash_fnv1a },
+        { "wyhash", ccask_kdhash_wyhash },
+    };
+    const char* kinds[] = { "seq", "int", "url", "random" };
+    uint64_t seed = ccask_keydir_seed();
+
+    printf("%zu keys per set, seed %016" PRIx64 "\n\n", keys, seed);
+    printf("%-8s %-7s %8s %8s %11s %9s %12s %6s %10s\n",
+           "hash", "keys", "ns/key", "MB/s", "groups chi2", "tags chi2", "max/mean", "colls", "avalanche");
+
+    for (size_t k = 0; k < sizeof(kinds) / sizeof(kinds[0]); k++) {
+        key_set* ks = key_set_new(kinds[k], keys);
+        for (size_t i = 0; i < sizeof(impls) / sizeof(impls[0]); i++) run(impls + i, ks, budget, seed);
+        key_set_delete(ks);
+    }
+
+    return 0;
+}
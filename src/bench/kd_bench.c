@@ -0,0 +1,148 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+
+#include "ccask_keydir.h"
+
+/**@file
+ * @brief ccask_kd_bench measures keydir get latency as a hot key is overwritten.
+ *
+ * The keydir is loaded with *keys* keys, timing the slowest single put: resizes are incremental,
+ * so no put should pay for rehashing the whole table. Then one key is set over and over again. After
+ * each step of overwrites, gets of the hot key and of random other keys are timed, along with
+ * the keydir's key count. Latency and count should both stay flat however often the hot key
+ * has been written.
+ *
+ * Keys are *key_bytes* long: the key's number followed by padding. With the load, the keydir's
+ * memory is reported per key, rows and key arena together. With *huge*, the keydir asks for
+ * transparent huge pages; with *digest*, it keeps key digests instead of keys; with *ordered*,
+ * it keeps its keys in order too, and a scan of every key in order is timed after the load. With
+ * *fnv*, it hashes with FNV-1a rather than the default wyhash.
+ *
+ * usage: ccask_kd_bench [keys] [gets] [key_bytes] [huge] [digest] [ordered] [fnv]
+ */
+
+double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+uint64_t xorshift(uint64_t* s) {
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+/**@brief write key number *k* into the first bytes of *key*, which holds its padding already*/
+uint8_t* make_key(uint8_t* key, uint64_t k) {
+    memcpy(key, &k, sizeof(k));
+    return key;
+}
+
+bool count_row(void* ctx, ccask_kdrow* kdr) {
+    (void)kdr;
+    (*(size_t*)ctx)++;
+    return true;
+}
+
+/**@brief mean ns per get of the hot key when *hot*, of random keys otherwise*/
+double time_gets(ccask_keydir* kd, size_t keys, size_t gets, uint8_t* key, uint32_t key_bytes, bool hot, uint64_t* seed) {
+    size_t found = 0;
+
+    double start = now_ms();
+    for (size_t i = 0; i < gets; i++) {
+        uint64_t k = hot ? 0 : xorshift(seed) % keys;
+        if (ccask_keydir_get(kd, key_bytes, make_key(key, k))) found++;
+    }
+    double ms = now_ms() - start;
+
+    if (found != gets) {
+        fprintf(stderr, "ccask_kd_bench: %zu of %zu gets missed\n", gets - found, gets);
+        exit(1);
+    }
+
+    return ms * 1e6 / gets;
+}
+
+int main(int argc, char** argv) {
+    size_t keys = argc > 1 ? strtoull(argv[1], 0, 10) : 100000;
+    size_t gets = argc > 2 ? strtoull(argv[2], 0, 10) : 1000000;
+    size_t key_bytes = argc > 3 ? strtoull(argv[3], 0, 10) : sizeof(uint64_t);
+    bool huge = false, digest = false, ordered = false, fnv = false;
+    for (int i = 4; i < argc; i++) {
+        huge |= strcmp(argv[i], "huge") == 0;
+        digest |= strcmp(argv[i], "digest") == 0;
+        ordered |= strcmp(argv[i], "ordered") == 0;
+        fnv |= strcmp(argv[i], "fnv") == 0;
+    }
+
+    if (keys == 0 || gets == 0 || key_bytes < sizeof(uint64_t) || key_bytes > UINT32_MAX) {
+        fprintf(stderr, "usage: %s [keys] [gets] [key_bytes >= 8] [huge] [digest] [ordered] [fnv]\n", argv[0]);
+        return 1;
+    }
+
+    uint8_t* key = malloc(key_bytes);
+    ccask_keydir* kd = ccask_keydir_new(1024, SIZE_MAX, huge, digest, ordered);
+    if (!key || !kd) {
+        fprintf(stderr, "ccask_kd_bench: failed to allocate keydir\n");
+        return 1;
+    }
+    if (fnv) ccask_keydir_set_hash(kd, ccask_kdhash_fnv1a, ccask_keydir_seed());
+    memset(key, 'k', key_bytes);
+
+    double worst = 0;
+    double load_start = now_ms();
+    for (uint64_t k = 0; k < keys; k++) {
+        double start = now_ms();
+        if (!ccask_keydir_put(kd, key_bytes, make_key(key, k), 0, 128, k * 128 % UINT32_MAX, 1, 0)) {
+            fprintf(stderr, "ccask_kd_bench: preload failed\n");
+            return 1;
+        }
+
+        double ms = now_ms() - start;
+        if (ms > worst) worst = ms;
+    }
+    double load_ms = now_ms() - load_start;
+
+    size_t bytes = ccask_keydir_bytes(kd);
+    printf("%10zu keys loaded %8.1f ns/put %8.3f ms slowest put %8.1f MiB keydir %8.1f B/key\n",
+           keys, load_ms * 1e6 / keys, worst, bytes / (1024.0 * 1024.0), (double)bytes / keys);
+
+    if (ordered) {
+        size_t scanned = 0;
+        double start = now_ms();
+        ccask_keydir_scan(kd, 0, 0, count_row, &scanned);
+        double ms = now_ms() - start;
+        printf("%10zu keys scanned in order %8.1f ns/key\n", scanned, ms * 1e6 / scanned);
+    }
+
+    uint64_t seed = 0x9E3779B97F4A7C15ull;
+    size_t written = 0;
+    size_t steps[] = { 0, 1000, 100000, 1000000, 10000000 };
+
+    for (size_t s = 0; s < sizeof(steps) / sizeof(steps[0]); s++) {
+        // overwrite the hot key (key 0) until it has been set steps[s] more times
+        double start = now_ms();
+        for (; written < steps[s]; written++) {
+            ccask_keydir_put(kd, key_bytes, make_key(key, 0), 0, 128, written * 128 % UINT32_MAX, written + 2, 0);
+        }
+        double put_ms = now_ms() - start;
+        size_t puts = s > 0 ? steps[s] - steps[s - 1] : 0;
+
+        double hot_ns = time_gets(kd, keys, gets, key, key_bytes, true, &seed);
+        double cold_ns = time_gets(kd, keys, gets, key, key_bytes, false, &seed);
+
+        printf("%10zu overwrites %8.1f ns/put %8.1f ns/get hot %8.1f ns/get random %10zu keys\n",
+               written, puts ? put_ms * 1e6 / puts : 0.0, hot_ns, cold_ns, ccask_keydir_count(kd));
+    }
+
+    ccask_keydir_delete(kd);
+    free(key);
+    return 0;
+}
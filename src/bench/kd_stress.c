@@ -0,0 +1,186 @@
+#define _DEFAULT_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdbool.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+
+#include "ccask_keydir.h"
+
+/**@file
+ * @brief ccask_kd_stress measures how keydir reads scale across threads while a writer works.
+ *
+ * The keydir is loaded with *keys* keys. Then, for 1, 2, 4... up to *max_threads* reader threads,
+ * each reader looks up random keys with ccask_keydir_read for *seconds*, while the main thread
+ * keeps writing: overwriting keys, removing and putting them back, and adding and removing
+ * fresh keys so the table resizes under the readers. Every row of a key carries a file id and
+ * value size derived from the key, so a read that comes back torn, or with another key's row,
+ * is caught. Misses are expected only for the keys the writer is between removing and putting
+ * back.
+ *
+ * Keys are *key_bytes* long: the key's number followed by padding, so long keys exercise reads
+ * that follow a row into the key arena.
+ *
+ * usage: ccask_kd_stress [keys] [max_threads] [seconds] [key_bytes]
+ */
+
+typedef struct stress_reader {
+    pthread_t thread;
+    ccask_keydir* kd;
+    size_t keys;
+    size_t key_bytes;
+    uint64_t seed;
+    size_t reads;
+    size_t misses;
+    size_t corrupt;
+} stress_reader;
+
+volatile int running;
+
+double now_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1e3 + ts.tv_nsec / 1e6;
+}
+
+uint64_t xorshift(uint64_t* s) {
+    *s ^= *s << 13;
+    *s ^= *s >> 7;
+    *s ^= *s << 17;
+    return *s;
+}
+
+/**@brief write key number *k* into the first bytes of *key*, which holds its padding already*/
+uint8_t* make_key(uint8_t* key, uint64_t k) {
+    memcpy(key, &k, sizeof(k));
+    return key;
+}
+
+// what every row of key k holds, whichever write put it there
+uint32_t fid_of(uint64_t k) {
+    return k & 0xFF;
+}
+
+uint32_t vsize_of(uint64_t k) {
+    return (k * 2654435761u) >> 8;
+}
+
+ccask_keydir* put_key(ccask_keydir* kd, uint8_t* key, uint32_t key_bytes, uint64_t k, size_t pos) {
+    return ccask_keydir_put(kd, key_bytes, make_key(key, k), fid_of(k), vsize_of(k), pos % UINT32_MAX, 1, 0);
+}
+
+void* read_keys(void* arg) {
+    stress_reader* r = arg;
+    uint8_t* key = malloc(r->key_bytes);
+    memset(key, 'k', r->key_bytes);
+
+    while (__atomic_load_n(&running, __ATOMIC_RELAXED)) {
+        for (size_t i = 0; i < 1024; i++) {
+            uint64_t k = xorshift(&r->seed) % r->keys;
+            ccask_kdloc loc;
+
+            if (!ccask_keydir_read(r->kd, r->key_bytes, make_key(key, k), &loc)) {
+                r->misses++;
+            } else if (loc.file_id != fid_of(k) || loc.value_size != vsize_of(k)) {
+                r->corrupt++;
+            }
+        }
+        r->reads += 1024;
+    }
+
+    free(key);
+    return 0;
+}
+
+int main(int argc, char** argv) {
+    size_t keys = argc > 1 ? strtoull(argv[1], 0, 10) : 1000000;
+    size_t max_threads = argc > 2 ? strtoull(argv[2], 0, 10) : 8;
+    double seconds = argc > 3 ? strtod(argv[3], 0) : 2;
+    size_t key_bytes = argc > 4 ? strtoull(argv[4], 0, 10) : sizeof(uint64_t);
+
+    if (keys == 0 || max_threads == 0 || seconds <= 0 || key_bytes < sizeof(uint64_t) || key_bytes > UINT32_MAX) {
+        fprintf(stderr, "usage: %s [keys] [max_threads] [seconds] [key_bytes >= 8]\n", argv[0]);
+        return 1;
+    }
+
+    uint8_t* key = malloc(key_bytes);
+    stress_reader* readers = calloc(max_threads, sizeof(stress_reader));
+    ccask_keydir* kd = ccask_keydir_new(1024, SIZE_MAX, false, false, false);
+    if (!key || !readers || !kd) {
+        fprintf(stderr, "ccask_kd_stress: failed to allocate keydir\n");
+        return 1;
+    }
+    memset(key, 'k', key_bytes);
+
+    for (uint64_t k = 0; k < keys; k++) {
+        if (!put_key(kd, key, key_bytes, k, k * 128)) {
+            fprintf(stderr, "ccask_kd_stress: preload failed\n");
+            return 1;
+        }
+    }
+
+    uint64_t seed = 0x9E3779B97F4A7C15ull;
+    double base = 0;
+    size_t corrupt = 0;
+
+    for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+        __atomic_store_n(&running, 1, __ATOMIC_RELAXED);
+        for (size_t t = 0; t < threads; t++) {
+            readers[t] = (stress_reader) {
+                .kd = kd, .keys = keys, .key_bytes = key_bytes, .seed = seed + t * 7919 + 1,
+            };
+            if (pthread_create(&readers[t].thread, 0, read_keys, readers + t) != 0) {
+                perror("ccask_kd_stress: pthread_create");
+                return 1;
+            }
+        }
+
+        // the writer: every round overwrites a key, removes another and puts it back, and
+        // churns a batch of fresh keys, which grows and shrinks the table under the readers
+        size_t writes = 0;
+        uint64_t fresh = keys;
+        double start = now_ms(), ms;
+        while ((ms = now_ms() - start) < seconds * 1e3) {
+            for (size_t i = 0; i < 256; i++, writes += 3) {
+                uint64_t k = xorshift(&seed) % keys;
+                put_key(kd, key, key_bytes, k, writes);
+
+                k = xorshift(&seed) % keys;
+                ccask_keydir_remove(kd, key_bytes, make_key(key, k));
+                put_key(kd, key, key_bytes, k, writes);
+            }
+
+            for (size_t i = 0; i < 64; i++, writes++) put_key(kd, key, key_bytes, fresh++, writes);
+            if (ccask_keydir_count(kd) > keys * 3 / 2) {
+                for (uint64_t k = keys; k < fresh; k++, writes++) ccask_keydir_remove(kd, key_bytes, make_key(key, k));
+                fresh = keys;
+            }
+        }
+
+        __atomic_store_n(&running, 0, __ATOMIC_RELAXED);
+        size_t reads = 0, misses = 0, bad = 0;
+        for (size_t t = 0; t < threads; t++) {
+            pthread_join(readers[t].thread, 0);
+            reads += readers[t].reads;
+            misses += readers[t].misses;
+            bad += readers[t].corrupt;
+        }
+
+        double rate = reads / (ms / 1e3);
+        if (threads == 1) base = rate;
+        printf("%4zu readers %12.0f reads/s %6.2fx %12.0f writes/s %8zu misses %4zu corrupt\n",
+               threads, rate, rate / base, writes / (ms / 1e3), misses, bad);
+
+        corrupt += bad;
+        if (threads * 2 <= threads) break;
+    }
+
+    ccask_keydir_delete(kd);
+    free(readers);
+    free(key);
+
+    if (corrupt) fprintf(stderr, "ccask_kd_stress: %zu corrupt reads\n", corrupt);
+    return corrupt ? 1 : 0;
+}
@@ -0,0 +1,417 @@
+#define _DEFAULT_SOURCE
+
+#include "ccask_checkpoint.h"
+#include "ccask_keydir.h"
+#include "crc.h"
+#include "util.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+
+/**@file
+ * @brief ccask_checkpoint.c implements reading and writing keydir checkpoints
+ *
+ * A checkpoint is a header, a table of the data files it covers indexed by file id, the
+ * entries and a trailer, all little-endian:
+ *
+ * 		header:  magic (4) | version (2) | flags (2) | hash seed (8) | next creation sequence (8) |
+ * 		         file count (4) | reserved (4)
+ * 		file:    creation sequence (8) | bytes covered (8) | dead bytes (8)
+ * 		entry:   key size (4) | file id (4) | value size (4) | value pos (4) | expiry (4) | key
+ * 		trailer: entry count (8) | magic (4) | crc (4)
+ *
+ * The crc is a CRC-32C of every byte before it. With the digest flag set the keydir kept key
+ * digests, and each entry holds the CCASK_KDROW_DIGEST_BYTES byte digest in place of its key;
+ * digests depend on the hash seed, so the keydir they are restored into has to use it too.
+ *
+ * Files are identified by creation sequence as well as id, since merges renumber them: a
+ * checkpoint only applies while every file it covers is still there, at least as long as it was.
+ */
+
+#define CHECKPOINT_MAGIC 0x0CCA2C50
+#define CHECKPOINT_VERSION 1
+#define CHECKPOINT_DIGEST 0x0001 // header flag: entries hold key digests
+#define CHECKPOINT_HEADER_BYTES (4 + 2 + 2 + 8 + 8 + 4 + 4)
+#define CHECKPOINT_FILE_BYTES (8 + 8 + 8)
+#define CHECKPOINT_ENTRY_BYTES (4 + 4 + 4 + 4 + 4)
+#define CHECKPOINT_TRAILER_BYTES (8 + 4 + 4)
+#define CHECKPOINT_BUF_BYTES (1024*1024) // entries buffered before they are written out
+
+struct ccask_checkpoint_writer {
+    char* path;
+    char* tmp;              // where entries are written until commit
+    int fd;
+    uint8_t* buf;
+    size_t len;
+    size_t cap;
+    size_t written;         // bytes of the file before buf
+    uint32_t crc;           // of those bytes
+    bool digest_keys;
+    uint64_t count;
+    bool failed;            // a write failed; the checkpoint cannot be committed
+};
+
+struct ccask_checkpoint {
+    uint8_t* map;
+    size_t size;
+    uint16_t flags;
+    uint64_t seed;
+    uint64_t next_seq;
+    uint32_t file_count;
+    const uint8_t* files;
+    const uint8_t* entries;
+    size_t entries_len;
+    uint64_t count;
+};
+
+/*-----------------utility functions-------------------*/
+
+void checkpoint_put_u16(uint8_t* dest, uint16_t src) {
+    dest[0] = src & 0xff;
+    dest[1] = src >> 8;
+}
+
+void checkpoint_put_u32(uint8_t* dest, uint32_t src) {
+    for (size_t i = 0; i < 4; i++) dest[i] = (src >> (8 * i)) & 0xff;
+}
+
+void checkpoint_put_u64(uint8_t* dest, uint64_t src) {
+    for (size_t i = 0; i < 8; i++) dest[i] = (src >> (8 * i)) & 0xff;
+}
+
+uint16_t checkpoint_get_u16(const uint8_t* src) {
+    return src[0] | src[1] << 8;
+}
+
+uint32_t checkpoint_get_u32(const uint8_t* src) {
+    uint32_t acc = 0;
+    for (size_t i = 0; i < 4; i++) acc |= (uint32_t)src[i] << (8 * i);
+    return acc;
+}
+
+uint64_t checkpoint_get_u64(const uint8_t* src) {
+    uint64_t acc = 0;
+    for (size_t i = 0; i < 8; i++) acc |= (uint64_t)src[i] << (8 * i);
+    return acc;
+}
+
+/**@brief bytes an entry's key takes up: the key, or its digest*/
+size_t checkpoint_key_bytes(bool digest_keys, uint32_t key_size) {
+    return digest_keys ? CCASK_KDROW_DIGEST_BYTES : key_size;
+}
+
+/**@brief write out *w*'s buffer, folding it into the running crc*/
+ccask_checkpoint_writer* checkpoint_flush(ccask_checkpoint_writer* w) {
+    if (w->failed) return 0;
+    if (w->len == 0) return w;
+
+    w->crc = crc_extend(CRC_32C, w->crc, w->buf, w->len);
+    if (pwrite_full(w->fd, w->buf, w->len, w->written) != 0) {
+        perror("ccask_checkpoint: write");
+        w->failed = true;
+        return 0;
+    }
+
+    w->written += w->len;
+    w->len = 0;
+    return w;
+}
+
+/**@brief make sure *w* has room for *n* more bytes, writing out what it holds if need be*/
+ccask_checkpoint_writer* checkpoint_reserve(ccask_checkpoint_writer* w, size_t n) {
+    if (w->failed) return 0;
+    if (n <= w->cap - w->len) return w;
+    if (!checkpoint_flush(w)) return 0;
+    if (n <= w->cap) return w;
+
+    // a key bigger than the whole buffer
+    uint8_t* buf = realloc(w->buf, n);
+    if (!buf) {
+        w->failed = true;
+        return 0;
+    }
+
+    w->buf = buf;
+    w->cap = n;
+    return w;
+}
+
+/*-----------------writer-------------------*/
+
+/**@brief start a checkpoint to be committed to *path*, covering *file_count* data files as
+ * 		  described by *files*, indexed by file id
+ */
+ccask_checkpoint_writer* ccask_checkpoint_writer_new(const char* path, bool digest_keys, uint64_t seed, uint64_t next_seq,
+        const ccask_checkpoint_file* files, uint32_t file_count) {
+    if (!path || (file_count && !files)) return 0;
+
+    ccask_checkpoint_writer* w = malloc(sizeof(ccask_checkpoint_writer));
+    if (!w) return 0;
+
+    *w = (ccask_checkpoint_writer) {
+        .path = malloc(strlen(path) + 1),
+        .tmp = malloc(strlen(path) + strlen(".tmp") + 1),
+        .fd = -1,
+        .buf = malloc(CHECKPOINT_BUF_BYTES),
+        .cap = CHECKPOINT_BUF_BYTES,
+        .digest_keys = digest_keys,
+    };
+
+    if (!w->path || !w->tmp || !w->buf) {
+        ccask_checkpoint_writer_delete(w);
+        return 0;
+    }
+
+    strcpy(w->path, path);
+    strcpy(w->tmp, path);
+    strcat(w->tmp, ".tmp");
+
+    w->fd = open(w->tmp, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (w->fd < 0) {
+        perror("ccask_checkpoint: open");
+        ccask_checkpoint_writer_delete(w);
+        return 0;
+    }
+
+    uint8_t* ptr = w->buf;
+    checkpoint_put_u32(ptr, CHECKPOINT_MAGIC);
+    checkpoint_put_u16(ptr + 4, CHECKPOINT_VERSION);
+    checkpoint_put_u16(ptr + 6, digest_keys ? CHECKPOINT_DIGEST : 0);
+    checkpoint_put_u64(ptr + 8, seed);
+    checkpoint_put_u64(ptr + 16, next_seq);
+    checkpoint_put_u32(ptr + 24, file_count);
+    checkpoint_put_u32(ptr + 28, 0);
+    w->len = CHECKPOINT_HEADER_BYTES;
+
+    for (uint32_t i = 0; i < file_count; i++) {
+        if (!checkpoint_reserve(w, CHECKPOINT_FILE_BYTES)) {
+            ccask_checkpoint_writer_delete(w);
+            return 0;
+        }
+
+        ptr = w->buf + w->len;
+        checkpoint_put_u64(ptr, files[i].seq);
+        checkpoint_put_u64(ptr + 8, files[i].bytes);
+        checkpoint_put_u64(ptr + 16, files[i].dead_bytes);
+        w->len += CHECKPOINT_FILE_BYTES;
+    }
+
+    return w;
+}
+
+/**@brief add the row of one key: *index_key* is the key itself, or in a digest-keyed checkpoint
+ * 		  the digest the keydir holds in its place
+ */
+ccask_checkpoint_writer* ccask_checkpoint_writer_add(ccask_checkpoint_writer* w, uint32_t key_size, const uint8_t* index_key,
+        uint32_t file_id, uint32_t value_size, size_t value_pos, uint32_t expiry) {
+    if (!w || !index_key || value_pos > UINT32_MAX) return 0;
+
+    size_t kbytes = checkpoint_key_bytes(w->digest_keys, key_size);
+    if (!checkpoint_reserve(w, CHECKPOINT_ENTRY_BYTES + kbytes)) return 0;
+
+    uint8_t* ptr = w->buf + w->len;
+    checkpoint_put_u32(ptr, key_size);
+    checkpoint_put_u32(ptr + 4, file_id);
+    checkpoint_put_u32(ptr + 8, value_size);
+    checkpoint_put_u32(ptr + 12, value_pos);
+    checkpoint_put_u32(ptr + 16, expiry);
+    memcpy(ptr + CHECKPOINT_ENTRY_BYTES, index_key, kbytes);
+
+    w->len += CHECKPOINT_ENTRY_BYTES + kbytes;
+    w->count++;
+
+    return w;
+}
+
+/**@brief finish the checkpoint, sync it and atomically move it to the writer's path.
+ *
+ * @return 0 on success, -1 on error. The writer is not freed either way.
+ */
+int ccask_checkpoint_writer_commit(ccask_checkpoint_writer* w) {
+    if (!w || !checkpoint_reserve(w, CHECKPOINT_TRAILER_BYTES)) return -1;
+
+    uint8_t* ptr = w->buf + w->len;
+    checkpoint_put_u64(ptr, w->count);
+    checkpoint_put_u32(ptr + 8, CHECKPOINT_MAGIC);
+    w->len += 12;
+    w->crc = crc_extend(CRC_32C, w->crc, w->buf, w->len);
+    checkpoint_put_u32(ptr + 12, w->crc);
+
+    if (pwrite_full(w->fd, w->buf, w->len + 4, w->written) != 0 || fsync(w->fd) != 0) {
+        perror("ccask_checkpoint: write");
+        w->failed = true;
+        return -1;
+    }
+
+    close(w->fd);
+    w->fd = -1;
+
+    if (rename(w->tmp, w->path) != 0) {
+        perror("ccask_checkpoint: rename");
+        unlink(w->tmp);
+        w->failed = true;
+        return -1;
+    }
+
+    return 0;
+}
+
+/**@brief free *w*, discarding its temporary file if it was never committed*/
+void ccask_checkpoint_writer_delete(ccask_checkpoint_writer* w) {
+    if (w) {
+        if (w->fd >= 0) {
+            close(w->fd);
+            unlink(w->tmp);
+        }
+        free(w->path);
+        free(w->tmp);
+        free(w->buf);
+        free(w);
+    }
+}
+
+/*-----------------reader-------------------*/
+
+/**@brief map the checkpoint at *path* and check all of it, so that loading it cannot fail part way.
+ *
+ * @return the checkpoint, or 0 if it is missing, from another version or damaged
+ */
+ccask_checkpoint* ccask_checkpoint_open(const char* path) {
+    if (!path) return 0;
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) return 0;
+
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (size_t)st.st_size < CHECKPOINT_HEADER_BYTES + CHECKPOINT_TRAILER_BYTES) {
+        close(fd);
+        return 0;
+    }
+
+    size_t size = st.st_size;
+    uint8_t* map = mmap(0, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return 0;
+
+    // read once front to back to check it, then once more to load it
+    madvise(map, size, MADV_SEQUENTIAL);
+
+    ccask_checkpoint* cp = malloc(sizeof(ccask_checkpoint));
+    if (!cp) {
+        munmap(map, size);
+        return 0;
+    }
+
+    uint8_t* trailer = map + size - CHECKPOINT_TRAILER_BYTES;
+    *cp = (ccask_checkpoint) {
+        .map = map,
+        .size = size,
+        .flags = checkpoint_get_u16(map + 6),
+        .seed = checkpoint_get_u64(map + 8),
+        .next_seq = checkpoint_get_u64(map + 16),
+        .file_count = checkpoint_get_u32(map + 24),
+        .files = map + CHECKPOINT_HEADER_BYTES,
+        .count = checkpoint_get_u64(trailer),
+    };
+
+    size_t body = size - CHECKPOINT_HEADER_BYTES - CHECKPOINT_TRAILER_BYTES;
+    if (checkpoint_get_u32(map) != CHECKPOINT_MAGIC
+            || checkpoint_get_u16(map + 4) != CHECKPOINT_VERSION
+            || checkpoint_get_u32(trailer + 8) != CHECKPOINT_MAGIC
+            || cp->file_count > body / CHECKPOINT_FILE_BYTES
+            || checkpoint_get_u32(trailer + 12) != crc_extend(CRC_32C, 0, map, size - 4)) {
+        ccask_checkpoint_close(cp);
+        return 0;
+    }
+
+    cp->entries = cp->files + (size_t)cp->file_count * CHECKPOINT_FILE_BYTES;
+    cp->entries_len = body - (size_t)cp->file_count * CHECKPOINT_FILE_BYTES;
+
+    // walk once to check every entry is in bounds before handing any of them out
+    bool digest_keys = ccask_checkpoint_digest(cp);
+    size_t pos = 0, len = cp->entries_len;
+    uint64_t seen = 0;
+    while (len - pos >= CHECKPOINT_ENTRY_BYTES) {
+        size_t kbytes = checkpoint_key_bytes(digest_keys, checkpoint_get_u32(cp->entries + pos));
+        if (len - pos - CHECKPOINT_ENTRY_BYTES < kbytes) break;
+
+        pos += CHECKPOINT_ENTRY_BYTES + kbytes;
+        seen++;
+    }
+
+    if (pos != len || seen != cp->count) {
+        ccask_checkpoint_close(cp);
+        return 0;
+    }
+
+    return cp;
+}
+
+bool ccask_checkpoint_digest(const ccask_checkpoint* cp) {
+    return cp->flags & CHECKPOINT_DIGEST;
+}
+
+uint64_t ccask_checkpoint_seed(const ccask_checkpoint* cp) {
+    return cp->seed;
+}
+
+uint64_t ccask_checkpoint_next_seq(const ccask_checkpoint* cp) {
+    return cp->next_seq;
+}
+
+uint32_t ccask_checkpoint_file_count(const ccask_checkpoint* cp) {
+    return cp->file_count;
+}
+
+/**@brief what the checkpoint covers of data file *fid*; all zero for a file it has no record of*/
+ccask_checkpoint_file ccask_checkpoint_file_at(const ccask_checkpoint* cp, uint32_t fid) {
+    if (fid >= cp->file_count) return (ccask_checkpoint_file) {
+        0
+    };
+
+    const uint8_t* ptr = cp->files + (size_t)fid * CHECKPOINT_FILE_BYTES;
+    return (ccask_checkpoint_file) {
+        .seq = checkpoint_get_u64(ptr),
+        .bytes = checkpoint_get_u64(ptr + 8),
+        .dead_bytes = checkpoint_get_u64(ptr + 16),
+    };
+}
+
+uint64_t ccask_checkpoint_count(const ccask_checkpoint* cp) {
+    return cp->count;
+}
+
+/**@brief call *fn* for each entry of *cp* in file order
+ *
+ * @return 0 once every entry has been passed to *fn*, otherwise the nonzero value it returned
+ */
+int ccask_checkpoint_load(ccask_checkpoint* cp, ccask_checkpoint_fn fn, void* ctx) {
+    if (!cp || !fn) return -1;
+
+    bool digest_keys = ccask_checkpoint_digest(cp);
+    int res = 0;
+    for (size_t pos = 0; pos < cp->entries_len && res == 0;) {
+        const uint8_t* ptr = cp->entries + pos;
+        uint32_t ksz = checkpoint_get_u32(ptr);
+
+        res = fn(ctx, ksz, ptr + CHECKPOINT_ENTRY_BYTES, checkpoint_get_u32(ptr + 4), checkpoint_get_u32(ptr + 8),
+                 checkpoint_get_u32(ptr + 12), checkpoint_get_u32(ptr + 16));
+
+        pos += CHECKPOINT_ENTRY_BYTES + checkpoint_key_bytes(digest_keys, ksz);
+    }
+
+    return res;
+}
+
+void ccask_checkpoint_close(ccask_checkpoint* cp) {
+    if (cp) {
+        munmap(cp->map, cp->size);
+        free(cp);
+    }
+}
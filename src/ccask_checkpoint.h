@@ -0,0 +1,49 @@
+#ifndef _CCASK_CHECKPOINT_H
+#define _CCASK_CHECKPOINT_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+/**@file
+ * @brief a checkpoint is a snapshot of the whole keydir, loaded at startup in one sequential
+ * 		  read. Only records appended after it was taken have to be read from the data files.
+ */
+
+#define CHECKPOINT_NAME "ccask.checkpoint"
+
+// what a checkpoint covers of one data file
+typedef struct ccask_checkpoint_file {
+    uint64_t seq;           // the file's creation sequence, 0 if there was no such file
+    uint64_t bytes;         // bytes of the file whose records are in the checkpoint
+    uint64_t dead_bytes;    // of those, bytes of superseded records
+} ccask_checkpoint_file;
+
+typedef struct ccask_checkpoint_writer ccask_checkpoint_writer;
+typedef struct ccask_checkpoint ccask_checkpoint;
+
+// called once per entry; return nonzero to stop iteration. *index_key* is the key, or in a
+// digest-keyed checkpoint its CCASK_KDROW_DIGEST_BYTES byte digest.
+typedef int (*ccask_checkpoint_fn)(void* ctx, uint32_t key_size, const uint8_t* index_key, uint32_t file_id,
+                                   uint32_t value_size, size_t value_pos, uint32_t expiry);
+
+// writer: entries are streamed to a temporary file and only become visible at *path* on commit
+ccask_checkpoint_writer* ccask_checkpoint_writer_new(const char* path, bool digest_keys, uint64_t seed, uint64_t next_seq,
+        const ccask_checkpoint_file* files, uint32_t file_count);
+ccask_checkpoint_writer* ccask_checkpoint_writer_add(ccask_checkpoint_writer* w, uint32_t key_size, const uint8_t* index_key,
+        uint32_t file_id, uint32_t value_size, size_t value_pos, uint32_t expiry);
+int ccask_checkpoint_writer_commit(ccask_checkpoint_writer* w);
+void ccask_checkpoint_writer_delete(ccask_checkpoint_writer* w);
+
+// reader: open maps and validates the whole file; nothing is handed out from a damaged one
+ccask_checkpoint* ccask_checkpoint_open(const char* path);
+bool ccask_checkpoint_digest(const ccask_checkpoint* cp);
+uint64_t ccask_checkpoint_seed(const ccask_checkpoint* cp);
+uint64_t ccask_checkpoint_next_seq(const ccask_checkpoint* cp);
+uint32_t ccask_checkpoint_file_count(const ccask_checkpoint* cp);
+ccask_checkpoint_file ccask_checkpoint_file_at(const ccask_checkpoint* cp, uint32_t fid);
+uint64_t ccask_checkpoint_count(const ccask_checkpoint* cp);
+int ccask_checkpoint_load(ccask_checkpoint* cp, ccask_checkpoint_fn fn, void* ctx);
+void ccask_checkpoint_close(ccask_checkpoint* cp);
+
+#endif
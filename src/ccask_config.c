@@ -1,14 +1,42 @@
 #include "ccask_config.h"
+#include <stdbool.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <stdint.h>
 
 #define DEFAULT_PORT "29456"
 #define DEFAULT_KDSIZE 1024
 #define DEFAULT_MAXCONN 5
 #define DEFAULT_MAXMSG 1024
 #define DEFAULT_IPV UNSPEC
-#define DEFAULT_KDMAX 32768 // 1024 * (2^5) i.e. can expand the keydir 5 times
+#define DEFAULT_KDBUDGET_MB 4096 // memory the keydir may grow into: 2^25 slots, ~29M keys
+#define DEFAULT_MERGE_PCT 50 // merge once half of the bytes in sealed files are dead
+#define DEFAULT_LOAD_THREADS 4 // threads used to load data files at startup
+#define DEFAULT_MMAP true // serve reads of sealed files from memory mappings
+#define DEFAULT_URING false // perform disk I/O for queries through io_uring
+#define DEFAULT_SYNC SYNC_BATCH // acknowledge writes once a group commit has synced them
+#define DEFAULT_SYNC_MS 1000 // sync period of the interval policy
+#define DEFAULT_KD_HUGEPAGES false // back the keydir with transparent huge pages
+#define DEFAULT_KD_DIGEST false // index keys by digest instead of keeping them in memory
+#define DEFAULT_KD_ORDERED false // keep keys in order too, for scans
+#define DEFAULT_CHECKPOINT_MB 64 // checkpoint the keydir once this much has been appended since the last one
+#define DEFAULT_BACKUP_DIR 0 // where BACKUP may write; unset refuses every BACKUP
+
+char* sync_string(ccask_sync_policy sp) {
+    switch(sp) {
+    case SYNC_NEVER:
+        return "never";
+    case SYNC_INTERVAL:
+        return "interval";
+    case SYNC_BATCH:
+        return "batch";
+    case SYNC_ALWAYS:
+        return "always";
+    default:
+        return "unknown";
+    }
+}
 
 char* ipv_string(ccask_ip_v ipv) {
     switch(ipv) {
@@ -26,10 +54,21 @@ char* ipv_string(ccask_ip_v ipv) {
 struct ccask_config {
     char* port;
     size_t keydir_size;
-    size_t keydir_max_size;
+    size_t keydir_budget_mb;
     size_t maxconn;
     size_t max_msg_size;
     ccask_ip_v ipv;
+    size_t merge_pct;
+    size_t load_threads;
+    bool use_mmap;
+    bool use_uring;
+    ccask_sync_policy sync_policy;
+    size_t sync_ms;
+    bool kd_hugepages;
+    bool kd_digest;
+    bool kd_ordered;
+    size_t checkpoint_mb;
+    char* backup_dir;
 };
 
 char* PORT = "CCASK_PORT";
@@ -37,28 +76,76 @@ char* KDSIZE = "CCASK_KDSIZE";
 char* MAXCONN = "CCASK_MAXCONN";
 char* MAXMSG = "CCASK_MAX_MSG_SIZE";
 char* IPV = "CCASK_IPV";
-char* KDMAX = "CCASK_KDMAXSIZE";
+char* KDMAX = "CCASK_KDMAXSIZE"; // replaced by CCASK_KDBUDGET_MB; only warned about
+char* KDBUDGET = "CCASK_KDBUDGET_MB";
+char* MERGEPCT = "CCASK_MERGE_PCT";
+char* LOADTHREADS = "CCASK_LOAD_THREADS";
+char* MMAP = "CCASK_MMAP";
+char* URING = "CCASK_URING";
+char* SYNC = "CCASK_SYNC";
+char* SYNCMS = "CCASK_SYNC_MS";
+char* KDHUGEPAGES = "CCASK_KDHUGEPAGES";
+char* KDDIGEST = "CCASK_KDDIGEST";
+char* KDORDERED = "CCASK_KDORDERED";
+char* CHECKPOINTMB = "CCASK_CHECKPOINT_MB";
+char* BACKUPDIR = "CCASK_BACKUP_DIR";
 
-ccask_config* ccask_config_init(ccask_config* cf, char* port, size_t keydir_size, size_t maxconn, size_t max_msg_size,
-                                ccask_ip_v ipv, size_t keydir_max_size) {
-    if (cf) {
+/**@brief the settings a config has unless told otherwise*/
+ccask_config_opts ccask_config_defaults(void) {
+    return (ccask_config_opts) {
+        .port = DEFAULT_PORT,
+        .keydir_size = DEFAULT_KDSIZE,
+        .maxconn = DEFAULT_MAXCONN,
+        .max_msg_size = DEFAULT_MAXMSG,
+        .ipv = DEFAULT_IPV,
+        .keydir_budget_mb = DEFAULT_KDBUDGET_MB,
+        .merge_pct = DEFAULT_MERGE_PCT,
+        .load_threads = DEFAULT_LOAD_THREADS,
+        .use_mmap = DEFAULT_MMAP,
+        .use_uring = DEFAULT_URING,
+        .sync_policy = DEFAULT_SYNC,
+        .sync_ms = DEFAULT_SYNC_MS,
+        .kd_hugepages = DEFAULT_KD_HUGEPAGES,
+        .kd_digest = DEFAULT_KD_DIGEST,
+        .kd_ordered = DEFAULT_KD_ORDERED,
+        .checkpoint_mb = DEFAULT_CHECKPOINT_MB,
+        .backup_dir = DEFAULT_BACKUP_DIR,
+    };
+}
+
+ccask_config* ccask_config_init(ccask_config* cf, const ccask_config_opts* opts) {
+    if (cf && opts && opts->port) {
         *cf = (ccask_config) {
-            .port = malloc(strlen(port)),
-            .keydir_size = keydir_size,
-            .maxconn = maxconn,
-            .max_msg_size = max_msg_size,
-            .ipv = ipv,
-            .keydir_max_size = keydir_max_size
+            .port = malloc(strlen(opts->port) + 1),
+            .keydir_size = opts->keydir_size,
+            .maxconn = opts->maxconn,
+            .max_msg_size = opts->max_msg_size,
+            .ipv = opts->ipv,
+            .keydir_budget_mb = opts->keydir_budget_mb,
+            .merge_pct = opts->merge_pct,
+            .load_threads = opts->load_threads,
+            .use_mmap = opts->use_mmap,
+            .use_uring = opts->use_uring,
+            .sync_policy = opts->sync_policy,
+            .sync_ms = opts->sync_ms,
+            .kd_hugepages = opts->kd_hugepages,
+            .kd_digest = opts->kd_digest,
+            .kd_ordered = opts->kd_ordered,
+            .checkpoint_mb = opts->checkpoint_mb,
+            .backup_dir = opts->backup_dir ? malloc(strlen(opts->backup_dir) + 1) : 0,
         };
 
-        if (cf->port) {
-            strcpy(cf->port, port);
+        if (cf->port && (cf->backup_dir || !opts->backup_dir)) {
+            strcpy(cf->port, opts->port);
+            if (opts->backup_dir) strcpy(cf->backup_dir, opts->backup_dir);
         } else {
+            free(cf->port);
+            free(cf->backup_dir);
             *cf = (ccask_config) {
                 0
             };
         }
-    } else {
+    } else if (cf) {
         *cf = (ccask_config) {
             0
         };
@@ -67,10 +154,10 @@ ccask_config* ccask_config_init(ccask_config* cf, char* port, size_t keydir_size
     return cf;
 }
 
-ccask_config* ccask_config_new(char* port, size_t keydir_size, size_t maxconn, size_t max_msg_size, ccask_ip_v ipv, size_t keydir_max_size) {
+ccask_config* ccask_config_new(const ccask_config_opts* opts) {
     ccask_config* cf = malloc(sizeof(ccask_config));
     if (!cf) return 0;
-    cf = ccask_config_init(cf, port, keydir_size, maxconn, max_msg_size, ipv, keydir_max_size);
+    cf = ccask_config_init(cf, opts);
     return cf;
 }
 
@@ -82,6 +169,18 @@ ccask_config* ccask_config_from_env() {
     char* maxmsg_str = getenv(MAXMSG);
     char* ipv_str = getenv(IPV);
     char* kdmax_str = getenv(KDMAX);
+    char* kdbudget_str = getenv(KDBUDGET);
+    char* mergepct_str = getenv(MERGEPCT);
+    char* loadthreads_str = getenv(LOADTHREADS);
+    char* mmap_str = getenv(MMAP);
+    char* uring_str = getenv(URING);
+    char* sync_str = getenv(SYNC);
+    char* syncms_str = getenv(SYNCMS);
+    char* hugepages_str = getenv(KDHUGEPAGES);
+    char* digest_str = getenv(KDDIGEST);
+    char* ordered_str = getenv(KDORDERED);
+    char* checkpoint_str = getenv(CHECKPOINTMB);
+    char* backup_str = getenv(BACKUPDIR);
 
 
     char* port = 0;
@@ -132,21 +231,158 @@ ccask_config* ccask_config_from_env() {
         }
     }
 
-    size_t kdmax = DEFAULT_KDMAX;
     if (kdmax_str) {
-        kdmax = strtoull(kdmax_str, NULL, 10);
-        if (kdmax == 0) {
-            fprintf(stderr, "config: CCASK_KDMAX env value %s unrecognized; using default %ul\n", kdmax_str, DEFAULT_KDMAX);
-            kdmax = DEFAULT_KDMAX;
+        fprintf(stderr, "config: CCASK_KDMAXSIZE is no longer used; the keydir grows within CCASK_KDBUDGET_MB\n");
+    }
+
+    size_t kdbudget = DEFAULT_KDBUDGET_MB;
+    if (kdbudget_str) {
+        kdbudget = strtoull(kdbudget_str, NULL, 10);
+        if (kdbudget == 0) {
+            fprintf(stderr, "config: CCASK_KDBUDGET_MB env value %s invalid; using default %u\n", kdbudget_str, DEFAULT_KDBUDGET_MB);
+            kdbudget = DEFAULT_KDBUDGET_MB;
         }
     }
 
-    return ccask_config_new(port, kdsize, maxconn, maxmsg, ipv, kdmax);
+    size_t mergepct = DEFAULT_MERGE_PCT;
+    if (mergepct_str) {
+        mergepct = strtoull(mergepct_str, NULL, 10);
+        if (mergepct == 0 || mergepct > 100) {
+            fprintf(stderr, "config: CCASK_MERGE_PCT env value %s invalid; using default %u\n", mergepct_str, DEFAULT_MERGE_PCT);
+            mergepct = DEFAULT_MERGE_PCT;
+        }
+    }
+
+    size_t loadthreads = DEFAULT_LOAD_THREADS;
+    if (loadthreads_str) {
+        loadthreads = strtoull(loadthreads_str, NULL, 10);
+        if (loadthreads == 0) {
+            fprintf(stderr, "config: CCASK_LOAD_THREADS env value %s invalid; using default %u\n", loadthreads_str, DEFAULT_LOAD_THREADS);
+            loadthreads = DEFAULT_LOAD_THREADS;
+        }
+    }
+
+    bool use_mmap = DEFAULT_MMAP;
+    if (mmap_str) {
+        if (strcmp(mmap_str, "1") == 0 || strcmp(mmap_str, "on") == 0) {
+            use_mmap = true;
+        } else if (strcmp(mmap_str, "0") == 0 || strcmp(mmap_str, "off") == 0) {
+            use_mmap = false;
+        } else {
+            fprintf(stderr, "config: CCASK_MMAP env value %s unrecognized; using default %s\n", mmap_str, DEFAULT_MMAP ? "on" : "off");
+        }
+    }
+
+    bool use_uring = DEFAULT_URING;
+    if (uring_str) {
+        if (strcmp(uring_str, "1") == 0 || strcmp(uring_str, "on") == 0) {
+            use_uring = true;
+        } else if (strcmp(uring_str, "0") == 0 || strcmp(uring_str, "off") == 0) {
+            use_uring = false;
+        } else {
+            fprintf(stderr, "config: CCASK_URING env value %s unrecognized; using default %s\n", uring_str, DEFAULT_URING ? "on" : "off");
+        }
+    }
+
+    ccask_sync_policy sync = DEFAULT_SYNC;
+    if (sync_str) {
+        if (strcmp(sync_str, "never") == 0) {
+            sync = SYNC_NEVER;
+        } else if (strcmp(sync_str, "interval") == 0) {
+            sync = SYNC_INTERVAL;
+        } else if (strcmp(sync_str, "batch") == 0) {
+            sync = SYNC_BATCH;
+        } else if (strcmp(sync_str, "always") == 0) {
+            sync = SYNC_ALWAYS;
+        } else {
+            fprintf(stderr, "config: CCASK_SYNC env value %s unrecognized; using default %s\n", sync_str, sync_string(DEFAULT_SYNC));
+        }
+    }
+
+    size_t syncms = DEFAULT_SYNC_MS;
+    if (syncms_str) {
+        syncms = strtoull(syncms_str, NULL, 10);
+        if (syncms == 0) {
+            fprintf(stderr, "config: CCASK_SYNC_MS env value %s invalid; using default %u\n", syncms_str, DEFAULT_SYNC_MS);
+            syncms = DEFAULT_SYNC_MS;
+        }
+    }
+
+    bool kd_hugepages = DEFAULT_KD_HUGEPAGES;
+    if (hugepages_str) {
+        if (strcmp(hugepages_str, "1") == 0 || strcmp(hugepages_str, "on") == 0) {
+            kd_hugepages = true;
+        } else if (strcmp(hugepages_str, "0") == 0 || strcmp(hugepages_str, "off") == 0) {
+            kd_hugepages = false;
+        } else {
+            fprintf(stderr, "config: CCASK_KDHUGEPAGES env value %s unrecognized; using default %s\n", hugepages_str, DEFAULT_KD_HUGEPAGES ? "on" : "off");
+        }
+    }
+
+    bool kd_digest = DEFAULT_KD_DIGEST;
+    if (digest_str) {
+        if (strcmp(digest_str, "1") == 0 || strcmp(digest_str, "on") == 0) {
+            kd_digest = true;
+        } else if (strcmp(digest_str, "0") == 0 || strcmp(digest_str, "off") == 0) {
+            kd_digest = false;
+        } else {
+            fprintf(stderr, "config: CCASK_KDDIGEST env value %s unrecognized; using default %s\n", digest_str, DEFAULT_KD_DIGEST ? "on" : "off");
+        }
+    }
+
+    bool kd_ordered = DEFAULT_KD_ORDERED;
+    if (ordered_str) {
+        if (strcmp(ordered_str, "1") == 0 || strcmp(ordered_str, "on") == 0) {
+            kd_ordered = true;
+        } else if (strcmp(ordered_str, "0") == 0 || strcmp(ordered_str, "off") == 0) {
+            kd_ordered = false;
+        } else {
+            fprintf(stderr, "config: CCASK_KDORDERED env value %s unrecognized; using default %s\n", ordered_str, DEFAULT_KD_ORDERED ? "on" : "off");
+        }
+    }
+
+    if (kd_ordered && kd_digest) {
+        fprintf(stderr, "config: an ordered keydir keeps its keys; ignoring CCASK_KDDIGEST\n");
+        kd_digest = false;
+    }
+
+    // 0 turns checkpoints off
+    size_t checkpoint_mb = DEFAULT_CHECKPOINT_MB;
+    if (checkpoint_str) {
+        char* end = 0;
+        checkpoint_mb = strtoull(checkpoint_str, &end, 10);
+        if (end == checkpoint_str || *end != '\0') {
+            fprintf(stderr, "config: CCASK_CHECKPOINT_MB env value %s invalid; using default %u\n", checkpoint_str, DEFAULT_CHECKPOINT_MB);
+            checkpoint_mb = DEFAULT_CHECKPOINT_MB;
+        }
+    }
+
+    ccask_config_opts opts = {
+        .port = port,
+        .keydir_size = kdsize,
+        .maxconn = maxconn,
+        .max_msg_size = maxmsg,
+        .ipv = ipv,
+        .keydir_budget_mb = kdbudget,
+        .merge_pct = mergepct,
+        .load_threads = loadthreads,
+        .use_mmap = use_mmap,
+        .use_uring = use_uring,
+        .sync_policy = sync,
+        .sync_ms = syncms,
+        .kd_hugepages = kd_hugepages,
+        .kd_digest = kd_digest,
+        .kd_ordered = kd_ordered,
+        .checkpoint_mb = checkpoint_mb,
+        .backup_dir = backup_str ? backup_str : DEFAULT_BACKUP_DIR,
+    };
+    return ccask_config_new(&opts);
 }
 
 void ccask_config_destroy(ccask_config* cf) {
     if(cf) {
         free(cf->port);
+        free(cf->backup_dir);
         *cf = (ccask_config) {
             0
         };
@@ -159,13 +395,24 @@ void ccask_config_delete(ccask_config* cf) {
 }
 
 void ccask_config_print(ccask_config* cf) {
-    printf("port: %s\tkeydir size: %zu\tmax connection count: %zu\nmax message size: %zu B\tIP type: %s\nkeydir max size: %zu\n",
+    printf("port: %s\tkeydir size: %zu\tmax connection count: %zu\nmax message size: %zu B\tIP type: %s\nkeydir budget: %zu MiB\tmerge at: %zu%% dead\nstartup load threads: %zu\tmmap reads: %s\tio_uring: %s\nsync policy: %s\tsync interval: %zu ms\tkeydir huge pages: %s\nkeydir digests: %s\tordered keydir: %s\tcheckpoint every: %zu MiB\nbackup dir: %s\n",
            cf->port,
            cf->keydir_size,
            cf->maxconn,
            cf->max_msg_size,
            ipv_string(cf->ipv),
-           cf->keydir_max_size);
+           cf->keydir_budget_mb,
+           cf->merge_pct,
+           cf->load_threads,
+           cf->use_mmap ? "on" : "off",
+           cf->use_uring ? "on" : "off",
+           sync_string(cf->sync_policy),
+           cf->sync_ms,
+           cf->kd_hugepages ? "on" : "off",
+           cf->kd_digest ? "on" : "off",
+           cf->kd_ordered ? "on" : "off",
+           cf->checkpoint_mb,
+           cf->backup_dir ? cf->backup_dir : "none (BACKUP off)");
 }
 
 int ccask_config_port(char* dest, ccask_config* src, size_t destlen) {
@@ -192,6 +439,53 @@ ccask_ip_v ccask_config_ipv(const ccask_config* src) {
     return src->ipv;
 }
 
-size_t ccask_config_kdmax(const ccask_config* src) {
-    return src->keydir_max_size;
+/**@brief the memory the keydir may grow into, in bytes*/
+size_t ccask_config_kdbudget(const ccask_config* src) {
+    return src->keydir_budget_mb > SIZE_MAX >> 20 ? SIZE_MAX : src->keydir_budget_mb << 20;
+}
+
+size_t ccask_config_merge_pct(const ccask_config* src) {
+    return src->merge_pct;
+}
+
+size_t ccask_config_load_threads(const ccask_config* src) {
+    return src->load_threads;
+}
+
+bool ccask_config_mmap(const ccask_config* src) {
+    return src->use_mmap;
+}
+
+bool ccask_config_uring(const ccask_config* src) {
+    return src->use_uring;
+}
+
+ccask_sync_policy ccask_config_sync(const ccask_config* src) {
+    return src->sync_policy;
+}
+
+size_t ccask_config_sync_ms(const ccask_config* src) {
+    return src->sync_ms;
+}
+
+bool ccask_config_kd_hugepages(const ccask_config* src) {
+    return src->kd_hugepages;
+}
+
+bool ccask_config_kd_digest(const ccask_config* src) {
+    return src->kd_digest;
+}
+
+bool ccask_config_kd_ordered(const ccask_config* src) {
+    return src->kd_ordered;
+}
+
+/**@brief bytes appended between keydir checkpoints, 0 if checkpoints are off*/
+size_t ccask_config_checkpoint_bytes(const ccask_config* src) {
+    return src->checkpoint_mb > SIZE_MAX >> 20 ? SIZE_MAX : src->checkpoint_mb << 20;
+}
+
+/**@brief the directory BACKUP writes backups under, or NULL if BACKUP is off*/
+const char* ccask_config_backup_dir(const ccask_config* src) {
+    return src->backup_dir;
 }
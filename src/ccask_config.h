@@ -2,6 +2,7 @@
 #define _CONFIG_H
 
 #include <stddef.h>
+#include <stdbool.h>
 
 enum ccask_ip_v {
     INET4,
@@ -9,13 +10,42 @@ enum ccask_ip_v {
     UNSPEC
 };
 
+// when appended records are synced to disk; writes are acknowledged once they are
+enum ccask_sync_policy {
+    SYNC_NEVER,     // never sync; the OS writes back when it likes
+    SYNC_INTERVAL,  // sync every CCASK_SYNC_MS milliseconds
+    SYNC_BATCH,     // sync once per batch of writes (one server loop iteration)
+    SYNC_ALWAYS     // sync after every write
+};
+
 typedef struct ccask_config ccask_config;
 typedef enum ccask_ip_v ccask_ip_v;
+typedef enum ccask_sync_policy ccask_sync_policy;
+
+// the settings a config is made from: take ccask_config_defaults() and assign the ones to change
+typedef struct ccask_config_opts {
+    const char* port;
+    size_t keydir_size;         // initial keydir slots
+    size_t maxconn;
+    size_t max_msg_size;
+    ccask_ip_v ipv;
+    size_t keydir_budget_mb;    // memory the keydir may grow into
+    size_t merge_pct;           // dead share of sealed files that starts a merge
+    size_t load_threads;        // threads loading data files at startup
+    bool use_mmap;
+    bool use_uring;
+    ccask_sync_policy sync_policy;
+    size_t sync_ms;             // sync period of SYNC_INTERVAL
+    bool kd_hugepages;
+    bool kd_digest;
+    bool kd_ordered;
+    size_t checkpoint_mb;       // appended between keydir checkpoints; 0 turns them off
+    const char* backup_dir;     // where BACKUP may write; NULL refuses every BACKUP
+} ccask_config_opts;
 
-ccask_config* ccask_config_init(ccask_config* cf, char* port, size_t keydir_size, size_t maxconn, size_t max_msg_size,
-                                ccask_ip_v ipv, size_t keydir_max_size);
-ccask_config* ccask_config_new(char* port, size_t keydir_size, size_t maxconn, size_t max_msg_size, ccask_ip_v ipv,
-                               size_t keydir_max_size);
+ccask_config_opts ccask_config_defaults(void);
+ccask_config* ccask_config_init(ccask_config* cf, const ccask_config_opts* opts);
+ccask_config* ccask_config_new(const ccask_config_opts* opts);
 ccask_config* ccask_config_from_env();
 
 void ccask_config_delete(ccask_config* cf);
@@ -28,6 +58,17 @@ size_t ccask_config_kdsize(const ccask_config* src);
 size_t ccask_config_maxconn(const ccask_config* src);
 size_t ccask_config_maxmsg(const ccask_config* src);
 ccask_ip_v ccask_config_ipv(const ccask_config* src);
-size_t ccask_config_kdmax(const ccask_config* src);
+size_t ccask_config_kdbudget(const ccask_config* src);
+size_t ccask_config_merge_pct(const ccask_config* src);
+size_t ccask_config_load_threads(const ccask_config* src);
+bool ccask_config_mmap(const ccask_config* src);
+bool ccask_config_uring(const ccask_config* src);
+ccask_sync_policy ccask_config_sync(const ccask_config* src);
+size_t ccask_config_sync_ms(const ccask_config* src);
+bool ccask_config_kd_hugepages(const ccask_config* src);
+bool ccask_config_kd_digest(const ccask_config* src);
+bool ccask_config_kd_ordered(const ccask_config* src);
+size_t ccask_config_checkpoint_bytes(const ccask_config* src);
+const char* ccask_config_backup_dir(const ccask_config* src);
 
 #endif
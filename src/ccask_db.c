@@ -3,7 +3,9 @@
 #include "ccask_db.h"
 #include "ccask_keydir.h"
 #include "ccask_header.h"
-#include "ccask_kv.h"
+#include "ccask_hint.h"
+#include "ccask_checkpoint.h"
+#include "ccask_uring.h"
 #include "crc.h"
 #include "util.h"
 
@@ -13,12 +15,17 @@
 #include <time.h>
 #include <stdlib.h>
 #include <string.h>
+#include <limits.h>
 #include <errno.h>
 #include <dirent.h>
 #include <unistd.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
 #include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
 
 /**@file
  * @brief ccask_db.c implements useful DB operations (get, set, populate from file)
@@ -27,37 +34,186 @@
 // TODO: change commands to an enum
 #define GET_CMD 0
 #define SET_CMD 1
+#define MERGE_CMD 2
+#define DEL_CMD 3
+#define SET_TTL_CMD 4 // like SET_CMD, with a ttl in seconds (4 bytes) between the sizes and the key
+#define BACKUP_CMD 5 // the key names the directory to back up to, under CCASK_BACKUP_DIR
+#define SCAN_CMD 6 // the key is the start key, the value an end key or prefix; a limit (4) and flags (1) come ahead of them
+#define SCAN_PREFIX 0x01 // SCAN_CMD flag: the value is a prefix every key scanned starts with, not an end key
+#define SCAN_BATCH_BYTES (4*1024*1024) // records whose values a scan reads at a time, in file order
 
 #define LOCKFILE_NAME "ccask.lock"
+#define MERGE_SUFFIX ".merge"
+#define BACKUP_SPARE_FILES 16 // file ids a backup must leave unused, for writes and merges to go on
+#define MERGE_HINT_SUFFIX ".merge" HINT_SUFFIX
+#define UPGRADE_SUFFIX ".upgrade.tmp"
+#define MERGE_STEP_BYTES (1024*1024) // source bytes examined per ccask_db_merge_step call
+#define URING_ENTRIES 256 // bound on queries in flight on the io_uring
+#define WBUF_MAX_BYTES (1024*1024) // appends buffered before they are written out regardless of the sync policy
+#define DIRECT_WRITE_BYTES (16*1024) // values at least this big are written from the caller's memory, not buffered
+#define COMMIT_OP 0xFF // ccask_db_op cmd of a group commit
+#define EXPIRE_STEP_BUCKETS 1024 // keydir buckets swept for expired keys per ccask_db_expire_step call
+
+#define FORMAT_VERSION 2 // data file format written by this version, see ccask_db_header_write
+
+#define VALUE_BYTES(vsz) ((vsz) == CCASK_TOMBSTONE ? 0 : (vsz))
 
 // Response formats
 
 // struct defs
 
+typedef struct ccask_merge ccask_merge;
+typedef struct ccask_db_op ccask_db_op;
+
 struct ccask_db {
     ccask_keydir* keydir;   // The keydir structure for this ccask instance
+    bool digest_keys;       // the keydir only holds key digests, so gets check the key on disk
 
     // active file information
     size_t file_pos;        // Cursor pos in the file
     size_t file_id;
     size_t bytes_written;
-    FILE* file;             // Pointer to the file we are writing
+    int fd;                 // Descriptor of the file we are writing
 
     // db dir information
     char* path;             // Path to the DB dir
+    char* base;             // Last component of path; data files are named <path>/<base>_<file_id>
+    char* lock_path;        // Path of the lockfile we created, if any
     DIR* dir;               // Pointer to the DB file dir
-    FILE* files[MAX_FILES]; // collection of all files in this ccask
+    int fds[MAX_FILES];     // descriptors of all files in this ccask, -1 where there is none
+    uint8_t* maps[MAX_FILES]; // read-only mappings of sealed files, if mmap reads are enabled
+    bool use_mmap;
+    size_t file_start[MAX_FILES]; // offset of each file's first record, past its file header
+    crc_type file_crc[MAX_FILES]; // checksum used by each file's records
+    uint16_t file_version[MAX_FILES]; // format version, i.e. record layout, of each file
+    uint64_t file_seq[MAX_FILES]; // creation sequence of each file, 0 for files older than v2
+    uint64_t next_seq;            // creation sequence of the next file created
+    crc_type crc;                 // checksum used for the records of new files
+
+    // space accounting used to decide when a merge is worthwhile
+    size_t file_bytes[MAX_FILES]; // bytes of records in each file
+    size_t dead_bytes[MAX_FILES]; // bytes of records in each file that have been superseded
+    size_t merge_pct;             // dead percentage of sealed bytes that triggers a merge
+    ccask_merge* merge;           // the in-progress merge, if any
+
+    // expiry (see ccask_db_expire_step)
+    bool expiring;                // some key has been indexed with a ttl
+    size_t expire_cursor;         // next keydir bucket to sweep for expired keys
+
+    // asynchronous queries
+    ccask_uring* ring;            // 0 if queries are served synchronously
+    ccask_db_op* inflight;        // ops handed to the ring and not completed yet
+    size_t inflight_count;
+    ccask_db_op* done_head;       // completed ops waiting for ccask_db_async_reap, oldest first
+    ccask_db_op* done_tail;
+
+    // group commit (see ccask_db_commit)
+    ccask_sync_policy sync_policy;
+    size_t sync_ms;
+    uint8_t* wbuf;                // appended records not handed to the kernel yet; they end at file_pos
+    size_t wbuf_len;
+    size_t wbuf_cap;
+    uint64_t write_seq;           // appends accepted so far
+    uint64_t durable_seq;         // appends known to have reached stable storage
+    struct timespec last_sync;
+    ccask_db_op* commit;          // the commit queued on the ring, if any
+    ccask_db_op* waiting_head;    // sets and deletes whose acks wait for a sync, oldest first
+    ccask_db_op* waiting_tail;
+
+    // keydir checkpoints (see ccask_db_checkpoint)
+    size_t checkpoint_bytes;      // appended bytes between background checkpoints, 0 if they are off
+    uint64_t appended;            // bytes appended since startup
+    uint64_t checkpoint_mark;     // appended as of the last checkpoint written
+    bool checkpoint_stale;        // the keydir changed under the last checkpoint other than by appends
+    pid_t checkpoint_pid;         // the process writing a checkpoint in the background, if any
+    uint64_t checkpoint_pending;  // appended as of the checkpoint it is writing
+
+    char* backup_dir;             // where BACKUP_CMD may put backups, 0 if it may not
+};
+
+/* Sequential reads (startup scans, merges) go through a window buffer over a data file's
+ * descriptor instead of a syscall per header, key and value. The window is refilled with
+ * pread so it never touches shared file offsets.
+ */
+typedef struct ccask_reader {
+    int fd;
+    size_t end;             // bytes of the file that may be read
+    uint8_t* buf;
+    size_t cap;
+    size_t start;           // file offset of buf[0]
+    size_t len;             // valid bytes in buf
+} ccask_reader;
+
+/* A merge rewrites the live records of every sealed file into new output files.
+ *
+ * It runs incrementally (see ccask_db_merge_step) so the server can keep answering
+ * requests in between steps. Until the merge is swapped in, the keydir keeps pointing at
+ * the source files; the relocations needed to point it at the outputs are collected here.
+ */
+typedef struct ccask_merge_reloc {
+    uint32_t key_size;
+    uint8_t* key;
+    uint32_t old_fid;
+    size_t old_pos;
+    uint32_t out_index;     // output file the record was copied to
+    size_t new_pos;
+    size_t record_bytes;
+} ccask_merge_reloc;
+
+struct ccask_merge {
+    uint32_t srcs[MAX_FILES];   // ids of the sealed files being merged, ascending
+    size_t src_count;
+    size_t src_index;           // index into srcs of the file being read
+    size_t src_pos;             // read position in that file
+    size_t active_id;           // db->file_id when the merge started
+
+    int outs[MAX_FILES];        // output files, written as <base>_<index>.merge
+    ccask_hint_writer* hints[MAX_FILES]; // and their hint files, <base>_<index>.merge.hint
+    size_t out_bytes[MAX_FILES];
+    uint64_t out_seq[MAX_FILES];
+    size_t out_count;
+
+    ccask_merge_reloc* relocs;
+    size_t reloc_count;
+    size_t reloc_cap;
+
+    ccask_reader in;            // read window over the source being read
+};
+
+/* An asynchronous query (see ccask_query_start), from the moment its read is queued or its
+ * write is buffered until its result is handed to ccask_db_async_reap's caller. Group commits
+ * in flight on the ring are ops too.
+ */
+struct ccask_db_op {
+    uint64_t tag;           // the caller's identifier for the query, handed back with its result
+    uint8_t cmd;            // GET_CMD, SET_CMD, DEL_CMD or COMMIT_OP
+    uint32_t key_size;
+    uint32_t value_size;
+    uint32_t fid;
+    size_t pos;
+    uint8_t* buf;           // the record being read or written
+    size_t len;
+    int32_t res;            // result of the read or write, as returned by the syscall
+    crc_type crc;           // checksum type of the record read
+    uint16_t version;       // and its format version
+    uint64_t seq;           // write_seq covered by a commit, or that a set or delete waits on
+    bool sync;              // a commit also syncs the file
+    ccask_db_op* next;
 };
 
 struct ccask_get_result {
     uint32_t value_size;
     uint8_t* value;
     bool crc_passed;
+    bool owned;         // false if value points into a file mapping rather than our own copy
 };
 
+typedef struct ccask_scan ccask_scan;
+
 struct ccask_result {
     response_type type;
     ccask_get_result* gr; // null if type != GET_SUCCESS
+    ccask_scan* scan;     // null if type != SCAN_SUCCESS
 };
 
 //ccask_get_result functions
@@ -67,6 +223,7 @@ ccask_get_result* ccask_gr_init(ccask_get_result* gr, uint32_t value_size, uint8
             .value_size = value_size,
             .value = malloc(value_size),
             .crc_passed = crc_passed,
+            .owned = true,
         };
 
         memcpy(gr->value, value, value_size);
@@ -85,6 +242,25 @@ ccask_get_result* ccask_gr_new(uint32_t value_size, uint8_t* value, bool crc_pas
     return gr;
 }
 
+/**@brief make a get result that refers to *value* in place instead of copying it.
+ *
+ * Used for values read from a mapped data file; the value stays valid until that file is merged
+ * away or the db is destroyed, so the result must be consumed before either can happen.
+ */
+ccask_get_result* ccask_gr_borrow(uint32_t value_size, uint8_t* value, bool crc_passed) {
+    ccask_get_result* gr = malloc(sizeof(ccask_get_result));
+    if (!gr) return 0;
+
+    *gr = (ccask_get_result) {
+        .value_size = value_size,
+        .value = value,
+        .crc_passed = crc_passed,
+        .owned = false,
+    };
+
+    return gr;
+}
+
 /**@brief getter for ccask_get_result value size*/
 uint32_t ccask_gr_vsz(const ccask_get_result* gr) {
     return gr->value_size;
@@ -101,7 +277,7 @@ uint8_t* ccask_gr_val(uint8_t* dest, const ccask_get_result* src) {
 
 void ccask_gr_destroy(ccask_get_result* gr) {
     if (gr) {
-        free(gr->value);
+        if (gr->owned) free(gr->value);
         *gr = (ccask_get_result) {
             0
         };
@@ -174,585 +350,3457 @@ uint32_t ccask_gr_bytes(ccask_get_result* gr, uint8_t* buf, size_t buflen) {
 
 //ccask_db functions
 
-// internal ccask_db initialization APIs
-// used to populate the keydir when the software starts iff a ccask file is present
+/**@brief return a malloc'd path <dir>/<base>_<fid><suffix>, or 0 on error*/
+char* ccask_dir_filename(const char* dir, const char* base, size_t fid, const char* suffix) {
+    if (!suffix) suffix = "";
 
-/**@brief internal fn to populate next keydir entry*/
-ccask_db* ccask_db_popnext(ccask_db* db, int index) {
-    FILE* file = db->files[index];
-    if (!file) return 0;
+    // dir + / + base + _ + up to 20 digits + suffix + \0
+    size_t len = strlen(dir) + 1 + strlen(base) + 1 + 20 + strlen(suffix) + 1;
+    char* fn = malloc(len);
+    if (!fn) return 0;
 
-    size_t pos = ftell(file);
-    uint8_t* hdrb = malloc(HEADER_BYTES);
-    size_t hdr_n = fread(hdrb, 1, HEADER_BYTES, file);
-    if (hdr_n < HEADER_BYTES) {
-        free(hdrb);
+    if (snprintf(fn, len, "%s/%s_%zu%s", dir, base, fid, suffix) < 0) {
+        free(fn);
         return 0;
     }
 
-    ccask_header* hdr = ccask_header_new(0, 0, 0, 0);
-    if (!ccask_header_deserialize(hdr, hdrb)) {
-        free(hdrb);
-        ccask_header_delete(hdr);
-        return 0;
-    }
+    return fn;
+}
 
-    uint32_t ksz = ccask_header_ksz(hdr);
-    uint32_t vsz = ccask_header_vsz(hdr);
+/**@brief return a malloc'd path of the data file *fid* with an optional *suffix* (e.g. ".merge"), or 0 on error*/
+char* ccask_db_filename(const ccask_db* db, size_t fid, const char* suffix) {
+    if (!db) return 0;
 
-    uint8_t* kvb = malloc(ksz + vsz);
-    size_t kv_n = fread(kvb, 1, ksz+vsz, file);
-    if (kv_n < ksz+vsz) {
-        free(hdrb);
-        free(kvb);
-        ccask_header_delete(hdr);
-        return 0; // read error TODO: handle
-    }
+    return ccask_dir_filename(db->path, db->base, fid, suffix);
+}
 
-    ccask_kv* kv = ccask_kv_new(0, 0, 0, 0);
-    if (!ccask_kv_deserialize(ksz, vsz, kv, kvb)) {
-        free(hdrb);
-        free(kvb);
-        ccask_header_delete(hdr);
-        ccask_kv_delete(kv);
-        return 0; // parse error TODO
-    }
+/**@brief if *name* is a file belonging to *db* return its file id and set *suffix* to whatever
+ * 		  follows the id in the name; otherwise return SIZE_MAX
+ */
+size_t ccask_db_parse_filename(const ccask_db* db, const char* name, const char** suffix) {
+    size_t blen = strlen(db->base);
+    if (strncmp(name, db->base, blen) != 0 || name[blen] != '_') return SIZE_MAX;
 
-    uint8_t* key = malloc(ksz);
-    key = ccask_kv_key(key, kv);
+    const char* digits = name + blen + 1;
+    if (*digits < '0' || *digits > '9') return SIZE_MAX;
 
-    // TODO: file ID
-    ccask_kdrow* kdr = ccask_kdrow_new(ksz, key, index, vsz, pos, time(NULL));
-    ccask_kdrow_print(kdr);
-    if (!ccask_keydir_insert(db->keydir, kdr)) {
-        free(key);
-        free(hdrb);
-        free(kvb);
+    char* end = 0;
+    unsigned long long fid = strtoull(digits, &end, 10);
+    if (suffix) *suffix = end;
 
-        ccask_header_delete(hdr);
-        ccask_kv_delete(kv);
-        ccask_kdrow_delete(kdr);
-        return 0; // keydir insert error TODO
-    }
+    return fid;
+}
+
+/**@brief bytes taken up in file *fid* by a record with these sizes*/
+size_t ccask_db_record_bytes(const ccask_db* db, size_t fid, uint32_t key_size, uint32_t value_size) {
+    return ccask_record_bytes(fid < MAX_FILES ? db->file_version[fid] : FORMAT_VERSION, key_size, value_size);
+}
 
-    free(hdrb);
-    free(kvb);
-    free(key);
+/**@brief whether a record written at *ts* with *ttl* has expired by *now*; a ttl of 0 never expires*/
+bool ttl_expired(time_t ts, uint32_t ttl, time_t now) {
+    return ttl != 0 && now >= ts + (time_t)ttl;
+}
+
+/**@brief point *key* at its record in file *fid*, charging the record it supersedes (if any) to that file's dead bytes*/
+ccask_db* ccask_db_index(ccask_db* db, uint32_t key_size, uint8_t* key, uint32_t fid, uint32_t value_size, size_t value_pos, time_t ts, uint32_t ttl) {
+    // note the record this supersedes before the put, which may move rows, and charge it only once the put succeeds
+    ccask_kdrow* old = ccask_keydir_get(db->keydir, key_size, key);
+    uint32_t old_fid = old ? ccask_kdrow_fid(old) : UINT32_MAX;
+    uint32_t old_vsize = old ? ccask_kdrow_vsize(old) : 0;
 
-    ccask_header_delete(hdr);
-    ccask_kv_delete(kv);
-    ccask_kdrow_delete(kdr);
+    if (!ccask_keydir_put(db->keydir, key_size, key, fid, value_size, value_pos, ts, ttl)) return 0;
+    if (old_fid < MAX_FILES) db->dead_bytes[old_fid] += ccask_db_record_bytes(db, old_fid, key_size, old_vsize);
+    if (ttl) db->expiring = true;
 
     return db;
 }
 
-/**@brief given a malloc'd and initialized db and a valid file populates the keydir*/
-ccask_db* ccask_db_populate(ccask_db* db) {
-    if (!db) return 0;
+/**@brief drop *key* from the keydir as of a record in file *fid* that ends it, either a tombstone
+ * 		  or an expired value of *value_size* bytes, charging both that record and the record it
+ * 		  supersedes to dead bytes
+ */
+void ccask_db_unindex(ccask_db* db, uint32_t fid, uint32_t key_size, uint8_t* key, uint32_t value_size) {
+    ccask_kdrow* old = ccask_keydir_get(db->keydir, key_size, key);
+    if (old) {
+        uint32_t old_fid = ccask_kdrow_fid(old);
+        if (old_fid < MAX_FILES) db->dead_bytes[old_fid] += ccask_db_record_bytes(db, old_fid, key_size, ccask_kdrow_vsize(old));
+        ccask_keydir_remove(db->keydir, key_size, key);
+    }
 
-    errno = 0;
-    struct dirent* pDirent;
+    // neither a tombstone nor an expired value is ever live
+    if (fid < MAX_FILES) db->dead_bytes[fid] += ccask_db_record_bytes(db, fid, key_size, value_size);
+}
 
-    for (pDirent = readdir(db->dir); pDirent; pDirent = readdir(db->dir)) {
-        if (strcmp(".", pDirent->d_name) == 0
-                || strcmp("..", pDirent->d_name) == 0
-                || strcmp(LOCKFILE_NAME, pDirent->d_name) == 0)
+/**@brief map sealed data file *fid* for reads if mmap reads are enabled. A file that cannot be
+ * 		  mapped is still read with pread, so failures are only reported.
+ */
+void ccask_db_map(ccask_db* db, size_t fid) {
+    if (!db->use_mmap || db->maps[fid] || db->fds[fid] < 0 || db->file_bytes[fid] == 0) return;
 
-            continue;
+    void* map = mmap(0, db->file_bytes[fid], PROT_READ, MAP_SHARED, db->fds[fid], 0);
+    if (map == MAP_FAILED) {
+        perror("ccask_db: mmap");
+        errno = 0;
+        return;
+    }
 
-        // we will treat every file in the directory as if it were a ccask file
-        // TODO: introduce magic number or other file ID method
-        size_t pathlen = strlen(db->path) + strlen(pDirent->d_name) + 1 + 1; // path len + filename len + / + \0
-        char* path = malloc(pathlen);
-        printf("file ID: %zu file name: %s\n", db->file_id, pDirent->d_name);
+    db->maps[fid] = map;
+}
 
-        path = strcpy(path, db->path);
-        path = strcat(path, "/");
-        path = strncat(path, pDirent->d_name, strlen(pDirent->d_name));
-        if (!path) return 0;
+void ccask_db_unmap(ccask_db* db, size_t fid) {
+    if (db->maps[fid]) munmap(db->maps[fid], db->file_bytes[fid]);
+    db->maps[fid] = 0;
+}
 
-        FILE *f = fopen(path, "rb");
-        if (!f) {
-            fprintf(stderr, "fopen(%s,...)\n", path);
-            perror("fopen");
-            exit(1);
-        }
+#define READER_WINDOW_BYTES (64*1024)
 
-        db->files[db->file_id] = f;
-        db->file_id++;
-    }
+/**@brief set up *r* to read the first *end* bytes of *fd**/
+ccask_reader* ccask_reader_init(ccask_reader* r, int fd, size_t end) {
+    *r = (ccask_reader) {
+        .fd = fd,
+        .end = end,
+    };
 
-    if (errno != 0) {
-        perror("readdir");
-        exit(1);
+    return r;
+}
+
+void ccask_reader_destroy(ccask_reader* r) {
+    free(r->buf);
+    *r = (ccask_reader) {
+        .fd = -1,
+    };
+}
+
+/**@brief return a pointer to *n* bytes at offset *pos*, valid until the next call, or 0 if they
+ * 		  cannot be read or lie past the end of the reader
+ */
+uint8_t* ccask_reader_at(ccask_reader* r, size_t pos, size_t n) {
+    if (pos > r->end || n > r->end - pos) return 0;
+    if (pos >= r->start && pos + n <= r->start + r->len) return r->buf + (pos - r->start);
+
+    size_t want = n > READER_WINDOW_BYTES ? n : READER_WINDOW_BYTES;
+    if (want > r->end - pos) want = r->end - pos;
+
+    if (want > r->cap) {
+        uint8_t* buf = realloc(r->buf, want);
+        if (!buf) return 0;
+        r->buf = buf;
+        r->cap = want;
     }
 
+    r->start = pos;
+    r->len = 0;
+    if (pread_full(r->fd, r->buf, want, pos) != 0) return 0;
+    r->len = want;
 
-    for (size_t i = 0; i < MAX_FILES; i++) {
-        if (!db->files[i]) break;
+    return r->buf;
+}
 
-        ccask_db* iter = ccask_db_popnext(db, i);
+/* Every data file starts with a file header, all little-endian. Format version 2 (the current
+ * one, CCASK_FILE_HEADER_BYTES long) is
+ *
+ * 		magic (4) | format version (2) | checksum type (2) | creation sequence (8) | reserved (12) | crc (4)
+ *
+ * and version 1 (CCASK_FILE_HEADER_V1_BYTES long) is
+ *
+ * 		magic (4) | format version (1) (2) | checksum type (2) | reserved (4) | crc (4)
+ *
+ * The crc is a CRC-32 of the header bytes before it. The version also decides the record layout
+ * (see ccask_header.h). Files written before there were file headers start directly with their
+ * first record; they use the v1 record layout and CRC-32.
+ *
+ * The creation sequence increases with every file the db creates, merge outputs included, so
+ * unlike the file id it is never reused for different contents.
+ */
 
-        while(iter) {
-            iter = ccask_db_popnext(db, i);
-        }
-    }
+/**@brief write the file header of a new data file whose records use *type* checksums
+ *
+ * @return 0 on success, -1 on error
+ */
+int ccask_db_header_write(int fd, crc_type type, uint64_t seq) {
+    uint8_t hdr[CCASK_FILE_HEADER_BYTES] = { 0 };
+    uint32_t magic = CCASK_MAGIC_NUMBER;
 
-    return db;
+    for (size_t i = 0; i < 4; i++) hdr[i] = (magic >> (8 * i)) & 0xff;
+    hdr[4] = FORMAT_VERSION & 0xff;
+    hdr[5] = FORMAT_VERSION >> 8;
+    hdr[6] = type & 0xff;
+    hdr[7] = type >> 8;
+    for (size_t i = 0; i < 8; i++) hdr[8 + i] = (seq >> (8 * i)) & 0xff;
+
+    uint32_t crc = crc_compute(hdr, CCASK_FILE_HEADER_BYTES - 4);
+    for (size_t i = 0; i < 4; i++) hdr[CCASK_FILE_HEADER_BYTES - 4 + i] = (crc >> (8 * i)) & 0xff;
+
+    return pwrite_full(fd, hdr, sizeof(hdr), 0);
 }
 
+/**@brief read the file header of data file *fid*, if it has one, into file_start, file_crc,
+ * 		  file_version and file_seq. Files written by a newer, incompatible version are fatal.
+ */
+void ccask_db_header_read(ccask_db* db, size_t fid) {
+    db->file_start[fid] = 0;
+    db->file_crc[fid] = CRC_32;
+    db->file_version[fid] = 1;
+    db->file_seq[fid] = 0;
 
-/**@brief this function is registered with on_exit to ensure the lockfile is cleared in normal termination circumstances*/
-void delete_lockfile(int status, void* lfpath) {
-    if (lfpath == NULL) {
-        fprintf(stderr, "ccask: failed to delete lockfile\n");
-    }
+    uint8_t hdr[CCASK_FILE_HEADER_BYTES];
+    size_t n = db->file_bytes[fid] < sizeof(hdr) ? db->file_bytes[fid] : sizeof(hdr);
+    if (n < CCASK_FILE_HEADER_V1_BYTES || pread_full(db->fds[fid], hdr, n, 0) != 0) return;
 
-    char* lfpath_s = (char*)lfpath;
-    int res;
+    uint32_t magic = 0;
+    for (size_t i = 0; i < 4; i++) magic |= (uint32_t)hdr[i] << (8 * i);
+    uint16_t version = hdr[4] | hdr[5] << 8;
+    uint16_t type = hdr[6] | hdr[7] << 8;
 
-    errno = 0;
+    size_t hdr_bytes = version == 1 ? CCASK_FILE_HEADER_V1_BYTES : CCASK_FILE_HEADER_BYTES;
+    if (magic != CCASK_MAGIC_NUMBER || hdr_bytes > n) return;
 
-    res = remove(lfpath_s);
-    if (res == -1) {
-        fprintf(stderr, "ccask: failed to delete lockfile\n");
-        perror("remove");
+    uint32_t crc = 0;
+    for (size_t i = 0; i < 4; i++) crc |= (uint32_t)hdr[hdr_bytes - 4 + i] << (8 * i);
+
+    // a record of an old file could start with the magic number, but not with a valid header
+    if (crc != crc_compute(hdr, hdr_bytes - 4)) return;
+
+    if (version < 1 || version > FORMAT_VERSION || !crc_type_valid(type)) {
+        fprintf(stderr, "ccask_db: data file %zu has unsupported format version %u, checksum %u\n", fid, version, type);
+        exit(1);
     }
 
-    free(lfpath);
+    db->file_start[fid] = hdr_bytes;
+    db->file_crc[fid] = type;
+    db->file_version[fid] = version;
+    if (version >= 2) {
+        for (size_t i = 0; i < 8; i++) db->file_seq[fid] |= (uint64_t)hdr[8 + i] << (8 * i);
+        if (db->file_seq[fid] >= db->next_seq) db->next_seq = db->file_seq[fid] + 1;
+    }
 }
 
-#define DIR_LOCKED 0
-#define DIR_LOCK_CREATED 1
-#define DIR_ERROR 2
-/**@brief this function is an internal API used by ccask_db_init to determine whether
- * 		 the ccask directory is already locked.
- *
- * 		 If the lockfile exists in the directory, return DIR_LOCKED
- *
- * 		 If the lockfile does not exist, create it and return DIR_LOCK_CREATED
- **/
-int dir_lock(ccask_db* db) {
-    if (db == NULL) return DIR_ERROR;
+/**@brief create data file *fn* with its file header; returns its descriptor or -1.
+ * 		  *seq* is set to the file's creation sequence.
+ */
+int ccask_db_create(ccask_db* db, const char* fn, uint64_t* seq) {
+    int fd = open(fn, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) return -1;
+
+    *seq = db->next_seq++;
+    if (ccask_db_header_write(fd, db->crc, *seq) != 0) {
+        close(fd);
+        return -1;
+    }
 
-    char* fn;
-    int res, fd;
-    size_t fnlen;
-    FILE* fp;
+    return fd;
+}
 
-    pid_t p = getpid();
-    mode_t m = S_IRUSR | S_IWUSR;
-    errno = 0;
+/**@brief set up the accounting of *fd*, just created with ccask_db_create as creation sequence
+ * 		  *seq*, as the active file
+ */
+void ccask_db_activate(ccask_db* db, int fd, uint64_t seq) {
+    db->fd = fd;
+    db->fds[db->file_id] = fd;
+    db->file_start[db->file_id] = CCASK_FILE_HEADER_BYTES;
+    db->file_crc[db->file_id] = db->crc;
+    db->file_version[db->file_id] = FORMAT_VERSION;
+    db->file_seq[db->file_id] = seq;
+    db->file_bytes[db->file_id] = CCASK_FILE_HEADER_BYTES;
+    db->dead_bytes[db->file_id] = 0;
+    db->bytes_written = CCASK_FILE_HEADER_BYTES;
+    db->file_pos = CCASK_FILE_HEADER_BYTES;
+}
 
-    fnlen = strlen(db->path) + strlen(LOCKFILE_NAME) + 2;
+// internal ccask_db initialization APIs
+// used to populate the keydir when the software starts iff a ccask file is present
 
-    fn = malloc(fnlen + 2);
-    res = snprintf(fn, fnlen, "%s/%s", db->path, LOCKFILE_NAME);
+bool crc_check_row(const uint8_t* row, uint16_t version, crc_type type, uint32_t key_size, uint32_t value_size);
 
-    if (res < 0) return DIR_ERROR;
+/**@brief return the record at *pos* of data file *fid* through *r* if it is complete and its
+ * 		  checksum matches, otherwise 0. *rsz* is set to its size.
+ */
+uint8_t* ccask_db_valid_record(ccask_db* db, ccask_reader* r, size_t fid, size_t pos, size_t* rsz) {
+    uint16_t version = db->file_version[fid];
+    uint8_t* rec = ccask_reader_at(r, pos, ccask_record_header_bytes(version));
+    if (!rec) return 0;
 
-    fd = open(fn, O_WRONLY | O_CREAT | O_EXCL, m);
-    if(fd == EEXIST) {
-        return DIR_LOCKED;
-    } else if (fd < 0) {
-        return DIR_ERROR;
-    }
+    ccask_record_header tmp;
+    const ccask_record_header* hdr = ccask_record_header_view(version, rec, &tmp);
+    uint32_t ksz = ccask_record_ksz(hdr);
+    uint32_t vsz = ccask_record_vsz(hdr);
 
-    fp = fdopen(fd, "w");
+    *rsz = ccask_record_bytes(version, ksz, vsz);
+    if (*rsz > db->file_bytes[fid] - pos) return 0;
 
-    fprintf(fp, "%d", p);
-    fflush(fp);
-    fclose(fp);
+    rec = ccask_reader_at(r, pos, *rsz);
+    return rec && crc_check_row(rec, version, db->file_crc[fid], ksz, vsz) ? rec : 0;
+}
 
-    if(on_exit(delete_lockfile, fn) != 0) {
-        delete_lockfile(0, (void*)fn);
-        exit(1);
+/**@brief find the first valid record of data file *fid* after the corrupt one at *pos*.
+ *
+ * Every offset a record could start at is tried in turn: each aligned one in v2 files, each
+ * byte in older ones.
+ *
+ * @return its position, or SIZE_MAX if there is none
+ */
+size_t ccask_db_resync(ccask_db* db, ccask_reader* r, size_t fid, size_t pos) {
+    size_t step = db->file_version[fid] >= 2 ? CCASK_RECORD_ALIGN : 1;
+    size_t rsz;
+
+    for (pos += step; pos < db->file_bytes[fid]; pos += step) {
+        if (ccask_db_valid_record(db, r, fid, pos, &rsz)) return pos;
     }
 
-    // we can't free the memory allocated for fn, since delete_lockfile will need it later
-    return DIR_LOCK_CREATED;
+    return SIZE_MAX;
 }
 
-ccask_db* ccask_db_init(ccask_db* db, const char* path, ccask_config* cfg) {
-    if (db && path) {
-        *db = (ccask_db) {
-            .path = malloc(strlen(path)),
-            .file_pos = 0,
-            .file_id = 0,
-            .bytes_written = 0,
-            .keydir = ccask_keydir_new(ccask_config_kdsize(cfg), ccask_config_kdmax(cfg)),
-            .file = 0,
-            .dir = 0,
-            .files = { 0 },
-        };
-
-        db->path = strncpy(db->path, path, strlen(path));
-        DIR* dir = opendir(path);
-        if (dir == 0) {
-            // we were unable to open the dir
-            if (errno == ENOENT && strcmp(db->path, "") != 0) {
-                // directory does not exist, try to create it
-                errno = 0;
-                int res = mkdir(path, 0700);
-                if (res == -1) {
-                    perror("mkdir");
-                    exit(1);
-                }
+/**@brief walk the records of data file *index* from the one at *from*, calling *fn* with each
+ * 		  record's header fields, key and position.
+ *
+ * Unless *verify*, values are skipped over and the walk ends at the first record that does not
+ * fit in the file. With *verify*, every record's checksum is checked as well, and a corrupt
+ * region is reported and skipped up to the next valid record; the walk ends where no valid
+ * record follows.
+ *
+ * @return the number of bytes up to the end of the last record scanned, or SIZE_MAX if the
+ * 		   file could not be read
+ */
+size_t ccask_db_scan_from(ccask_db* db, size_t index, size_t from, bool verify, ccask_hint_fn fn, void* ctx) {
+    if (db->fds[index] < 0) return 0;
+
+    ccask_reader r;
+    ccask_reader_init(&r, db->fds[index], db->file_bytes[index]);
+
+    uint16_t version = db->file_version[index];
+    size_t hdr_bytes = ccask_record_header_bytes(version);
+    size_t pos = from;
+    size_t end = db->file_bytes[index];
+    uint8_t* hdrb;
+    ccask_record_header tmp;
+
+    while (hdr_bytes <= end - pos) {
+        size_t rsz;
+        if (verify && !ccask_db_valid_record(db, &r, index, pos, &rsz)) {
+            size_t next = ccask_db_resync(db, &r, index, pos);
+            if (next == SIZE_MAX) break;
+
+            fprintf(stderr, "ccask_db: file %zu: skipping %zu corrupt bytes at %zu\n", index, next - pos, pos);
+            pos = next;
+        }
 
-                dir = opendir(path);
-                if (dir == 0) {
-                    perror("opendir");
-                    exit(1);
-                }
-            } else {
-                perror("opendir");
-                exit(1);
-            }
+        if (!(hdrb = ccask_reader_at(&r, pos, hdr_bytes))) {
+            pos = SIZE_MAX;
+            break;
         }
 
-        db->dir = dir;
+        const ccask_record_header* hdr = ccask_record_header_view(version, hdrb, &tmp);
+        uint32_t ksz = ccask_record_ksz(hdr);
+        uint32_t vsz = ccask_record_vsz(hdr);
+        time_t ts = ccask_record_timestamp(hdr);
+        uint32_t ttl = ccask_record_ttl(hdr);
+        rsz = ccask_record_bytes(version, ksz, vsz);
 
-        int res = dir_lock(db);
+        // torn record at the end of the file
+        if (rsz > end - pos) break;
 
-        if (res == DIR_LOCKED || res == DIR_ERROR) {
-            fprintf(stderr, "ccask error: failure to obtain ccask lock. is a ccask instance running on this dir?\n");
-            return NULL;
+        uint8_t* key = ccask_reader_at(&r, pos + hdr_bytes, ksz);
+        if (!key) {
+            pos = SIZE_MAX;
+            break;
         }
 
-        if (!ccask_db_populate(db)) *db = (ccask_db) {
-            0
-        };
+        if (fn(ctx, ts, ttl, ksz, key, vsz, pos) != 0) break;
 
-        char* new_filename = malloc(strlen(path) + 1 + strlen(path) + MAX_FILE_CHARS);
-        res = snprintf(new_filename, strlen(path) + strlen(path) + 1 + MAX_FILE_CHARS, "%s/%s_%zu", path, path, db->file_id);
-        if (res < 0) {
-            fprintf(stderr, "error constructing new filename\n");
-            exit(1);
+        pos += rsz;
+    }
+
+    ccask_reader_destroy(&r);
+
+    return pos;
+}
+
+/**@brief ccask_db_scan_from the first record of data file *index**/
+size_t ccask_db_scan(ccask_db* db, size_t index, bool verify, ccask_hint_fn fn, void* ctx) {
+    return ccask_db_scan_from(db, index, db->file_start[index], verify, fn, ctx);
+}
+
+/* At startup every sealed file is first loaded into a partial keydir: a flat list of its
+ * entries in file order. Partials can be built concurrently by a pool of loader threads (each
+ * file is touched by exactly one of them), but they are applied to the keydir strictly in file
+ * id order so that newer records still override older ones.
+ */
+typedef struct ccask_partial_entry {
+    time_t timestamp;
+    uint32_t ttl;
+    uint32_t key_size;
+    uint32_t value_size;
+    size_t value_pos;
+    size_t key_off;             // offset of the key in the partial's key buffer
+} ccask_partial_entry;
+
+typedef struct ccask_partial {
+    ccask_partial_entry* entries;
+    size_t count;
+    size_t cap;
+
+    uint8_t* keys;
+    size_t keys_len;
+    size_t keys_cap;
+
+    ccask_hint_writer* hint;    // when non-null, every entry is also added to this hint
+    size_t from;                // where loading starts: past what a checkpoint covers, if anything
+    bool failed;                // an allocation failed; the partial is incomplete
+    bool done;                  // set by the loader thread once the partial is built
+} ccask_partial;
+
+/**@brief ccask_hint_fn that appends an entry to a ccask_partial (and optionally its hint writer)*/
+int ccask_partial_add(void* ctx, time_t timestamp, uint32_t ttl, uint32_t key_size, uint8_t* key, uint32_t value_size, size_t value_pos) {
+    ccask_partial* p = ctx;
+
+    if (p->count == p->cap) {
+        size_t cap = p->cap ? p->cap * 2 : 256;
+        ccask_partial_entry* entries = realloc(p->entries, cap * sizeof(ccask_partial_entry));
+        if (!entries) {
+            p->failed = true;
+            return 1;
         }
+        p->entries = entries;
+        p->cap = cap;
+    }
 
-        errno = 0;
-        FILE* new_file = fopen(new_filename, "w+b");
-        if (!new_file) {
-            fprintf(stderr, "%s\n", new_filename);
-            perror("fopen");
-            exit(1);
+    if (p->keys_len + key_size > p->keys_cap) {
+        size_t cap = p->keys_cap ? p->keys_cap : 4096;
+        while (cap < p->keys_len + key_size) cap *= 2;
+        uint8_t* keys = realloc(p->keys, cap);
+        if (!keys) {
+            p->failed = true;
+            return 1;
         }
+        p->keys = keys;
+        p->keys_cap = cap;
+    }
 
-        printf("new file %s open for writing\n", new_filename);
-        free(new_filename);
+    memcpy(p->keys + p->keys_len, key, key_size);
+    p->entries[p->count++] = (ccask_partial_entry) {
+        .timestamp = timestamp,
+        .ttl = ttl,
+        .key_size = key_size,
+        .value_size = value_size,
+        .value_pos = value_pos,
+        .key_off = p->keys_len,
+    };
+    p->keys_len += key_size;
 
-        db->file = new_file;
-        db->files[db->file_id] = new_file;
-    } else {
-        *db = (ccask_db) {
-            0
-        };
+    if (p->hint && !ccask_hint_writer_add(p->hint, timestamp, ttl, key_size, key, value_size, value_pos)) {
+        // a missing hint only costs us a scan at the next startup
+        ccask_hint_writer_delete(p->hint);
+        p->hint = 0;
     }
 
-    return db;
+    return 0;
 }
 
-ccask_db* ccask_db_new(const char* path, ccask_config* cfg) {
-    ccask_db* db = malloc(sizeof(ccask_db));
-    ccask_db* db_res = ccask_db_init(db, path, cfg);
-    if(db_res == NULL) ccask_db_destroy(db);
-    return db_res;
+void ccask_partial_destroy(ccask_partial* p) {
+    free(p->entries);
+    free(p->keys);
+    ccask_hint_writer_delete(p->hint);
+    *p = (ccask_partial) {
+        0
+    };
 }
 
-void ccask_db_destroy(ccask_db* db) {
-    if (db) {
-        free(db->path);
-        //free(db->keydir);
-        ccask_keydir_delete(db->keydir);
-        if(db->file) fclose(db->file);
-        *db = (ccask_db) {
-            0
-        };
-    }
+/**@brief ccask_hint_fn that only adds an entry to a hint writer*/
+int ccask_db_hint_entry(void* ctx, time_t timestamp, uint32_t ttl, uint32_t key_size, uint8_t* key, uint32_t value_size, size_t value_pos) {
+    return ccask_hint_writer_add(ctx, timestamp, ttl, key_size, key, value_size, value_pos) ? 0 : 1;
 }
 
-void ccask_db_delete(ccask_db* db) {
-    ccask_db_destroy(db);
-    free(db);
+/**@brief write a hint for data file *fid*, as it is on disk, to *fn*. Returns 0 on success, -1 on error*/
+int ccask_db_hint_write_to(ccask_db* db, size_t fid, const char* fn) {
+    ccask_hint_writer* w = ccask_hint_writer_new(fn);
+    if (!w) return -1;
+
+    int res = -1;
+    if (ccask_db_scan(db, fid, false, ccask_db_hint_entry, w) == db->file_bytes[fid]) {
+        res = ccask_hint_writer_commit(w, db->file_bytes[fid]);
+    }
+
+    ccask_hint_writer_delete(w);
+    return res;
 }
 
-/**@brief opens a new file for *db* or fails and quits the ccask process*/
-void ccask_db_newfile(ccask_db* db) {
-    db->file_id++;
-    if (db->file_id == UINT32_MAX) {
-        fprintf(stderr, "ccask_db: too many files\n");
-        exit(1);
+/**@brief write the hint file for sealed data file *fid*; failures are reported but not fatal*/
+void ccask_db_hint_write(ccask_db* db, size_t fid) {
+    char* fn = ccask_db_filename(db, fid, HINT_SUFFIX);
+    if (!fn || ccask_db_hint_write_to(db, fid, fn) != 0) {
+        fprintf(stderr, "ccask_db: failed to write hint for file %zu\n", fid);
     }
 
-    char* new_filename = malloc(strlen(db->path) + 1 + strlen(db->path) + MAX_FILE_CHARS);
-    int res = snprintf(new_filename, strlen(db->path) + strlen(db->path) + 1 + MAX_FILE_CHARS, "%s/%s_%zu", db->path, db->path, db->file_id);
-    if (res < 0) {
-        fprintf(stderr, "error constructing new filename\n");
-        exit(1);
+    free(fn);
+}
+
+/**@brief deal with the bytes of data file *fid* from *valid_end* on, which hold no valid record.
+ *
+ * In the last file, the active one when the db was shut down, they are what was being appended
+ * at a crash, so they are cut off. In any other file they are only reported.
+ */
+void ccask_db_truncate_tail(ccask_db* db, size_t fid, size_t valid_end) {
+    size_t tail = db->file_bytes[fid] - valid_end;
+
+    if (fid + 1 != db->file_id) {
+        fprintf(stderr, "ccask_db: file %zu: ignoring %zu bytes of corrupt records at its end\n", fid, tail);
+        return;
     }
 
-    errno = 0;
-    FILE* new_file = fopen(new_filename, "w+b");
-    if (!new_file) {
-        fprintf(stderr, "%s\n", new_filename);
-        perror("fopen");
-        exit(1);
+    char* fn = ccask_db_filename(db, fid, 0);
+    if (!fn || truncate(fn, valid_end) != 0) {
+        fprintf(stderr, "ccask_db: file %zu: failed to truncate incomplete records\n", fid);
+        perror("truncate");
+        free(fn);
+        return;
     }
 
-    printf("ccask_db_newfile: new file %s open for writing\n", new_filename);
+    fprintf(stderr, "ccask_db: file %zu: truncated %zu bytes of incomplete records at %zu\n", fid, tail, valid_end);
+    db->file_bytes[fid] = valid_end;
+    free(fn);
+}
 
-    db->file = new_file;
-    db->files[db->file_id] = new_file;
-    db->bytes_written = 0;
+/**@brief load the records of data file *fid* from *p->from* on, the ones a checkpoint does not
+ * 		  cover, into partial *p*. They are checked just like a full scan checks them; no hint is
+ * 		  written since the partial does not describe the whole file.
+ */
+ccask_partial* ccask_db_replay_file(ccask_db* db, size_t fid, ccask_partial* p) {
+    size_t scanned = ccask_db_scan_from(db, fid, p->from, true, ccask_partial_add, p);
+    if (scanned == SIZE_MAX) {
+        fprintf(stderr, "ccask_db: failed to read file %zu\n", fid);
+        p->failed = true;
+    } else if (scanned < db->file_bytes[fid]) {
+        ccask_db_truncate_tail(db, fid, scanned);
+    }
 
-    free(new_filename);
+    printf("file ID: %zu replayed %zu entries past the checkpoint\n", fid, p->count);
+    return p->failed ? 0 : p;
 }
 
-size_t ccask_db_fid(const ccask_db* db) {
-    if(!db) return SIZE_MAX;
-    return db->file_id;
+/**@brief load sealed data file *fid* into partial *p*, from its hint file if a valid one exists.
+ *
+ * Otherwise the data file is scanned and a hint is written for it along the way. Only touches
+ * state belonging to *fid*, so different files may be loaded concurrently.
+ */
+ccask_partial* ccask_db_load_file(ccask_db* db, size_t fid, ccask_partial* p) {
+    if (p->from > db->file_start[fid]) return ccask_db_replay_file(db, fid, p);
+
+    char* hint_fn = ccask_db_filename(db, fid, HINT_SUFFIX);
+    if (!hint_fn) {
+        p->failed = true;
+        return 0;
+    }
+
+    if (ccask_hint_load(hint_fn, db->file_bytes[fid], ccask_partial_add, p) == 0) {
+        printf("file ID: %zu loaded %zu entries from hint\n", fid, p->count);
+        free(hint_fn);
+        return p;
+    }
+
+    // a hint that failed part way through may have added entries already
+    free(p->entries);
+    free(p->keys);
+    *p = (ccask_partial) {
+        .hint = ccask_hint_writer_new(hint_fn),
+        .from = p->from,
+    };
+    free(hint_fn);
+
+    size_t scanned = ccask_db_scan(db, fid, true, ccask_partial_add, p);
+    if (scanned == SIZE_MAX) {
+        fprintf(stderr, "ccask_db: failed to read file %zu\n", fid);
+        p->failed = true;
+    } else if (scanned < db->file_bytes[fid]) {
+        ccask_db_truncate_tail(db, fid, scanned);
+    }
+
+    printf("file ID: %zu scanned %zu of %zu bytes\n", fid, scanned, db->file_bytes[fid]);
+
+    // the hint only describes the valid records; corrupt regions are reported once, not at every startup
+    if (p->hint && !p->failed) ccask_hint_writer_commit(p->hint, db->file_bytes[fid]);
+    ccask_hint_writer_delete(p->hint);
+    p->hint = 0;
+
+    return p->failed ? 0 : p;
+}
+
+/**@brief insert every entry of partial *p*, built from file *fid*, into the keydir. Values that
+ * 		  have expired by *now* end their key just like tombstones do.
+ */
+ccask_db* ccask_db_apply_partial(ccask_db* db, size_t fid, ccask_partial* p, time_t now) {
+    if (p->failed) return 0;
+
+    for (size_t i = 0; i < p->count; i++) {
+        ccask_partial_entry* e = p->entries + i;
+        uint8_t* key = p->keys + e->key_off;
+
+        if (e->value_size == CCASK_TOMBSTONE || ttl_expired(e->timestamp, e->ttl, now)) {
+            ccask_db_unindex(db, fid, e->key_size, key, e->value_size);
+            continue;
+        }
+
+        if (!ccask_db_index(db, e->key_size, key, fid, e->value_size, e->value_pos, e->timestamp, e->ttl)) return 0;
+    }
+
+    return db;
+}
+
+typedef struct ccask_loader {
+    ccask_db* db;
+    ccask_partial* partials;    // indexed by file id
+    const size_t* from;         // where each file's records start, SIZE_MAX for none
+    size_t next;                // next file id to hand to a loader thread
+    pthread_mutex_t lock;
+    pthread_cond_t cond;        // signalled whenever a partial is done
+} ccask_loader;
+
+/**@brief loader thread body: claim files in id order and build their partials until none are left*/
+void* ccask_loader_run(void* arg) {
+    ccask_loader* ld = arg;
+
+    for (;;) {
+        pthread_mutex_lock(&ld->lock);
+        while (ld->next < ld->db->file_id && ld->from[ld->next] == SIZE_MAX) ld->next++;
+        if (ld->next >= ld->db->file_id) {
+            pthread_mutex_unlock(&ld->lock);
+            return 0;
+        }
+        size_t fid = ld->next++;
+        pthread_mutex_unlock(&ld->lock);
+
+        ld->partials[fid].from = ld->from[fid];
+        ccask_db_load_file(ld->db, fid, ld->partials + fid);
+
+        pthread_mutex_lock(&ld->lock);
+        ld->partials[fid].done = true;
+        pthread_cond_broadcast(&ld->cond);
+        pthread_mutex_unlock(&ld->lock);
+    }
+}
+
+/**@brief build the keydir from the records of every data file from *from*[file id] on, using up
+ * 		  to *threads* loader threads. Files whose *from* is SIZE_MAX are left out.
+ */
+ccask_db* ccask_db_load_all(ccask_db* db, size_t threads, const size_t* from) {
+    time_t now = time(NULL);
+    size_t nfiles = 0;
+    for (size_t i = 0; i < db->file_id; i++) {
+        if (from[i] != SIZE_MAX) nfiles++;
+    }
+
+    if (threads > nfiles) threads = nfiles;
+
+    if (threads <= 1) {
+        for (size_t i = 0; i < db->file_id; i++) {
+            if (from[i] == SIZE_MAX) continue;
+
+            ccask_partial p = {
+                .from = from[i],
+            };
+            ccask_db* res = ccask_db_load_file(db, i, &p) ? ccask_db_apply_partial(db, i, &p, now) : 0;
+            ccask_partial_destroy(&p);
+            if (!res) return 0;
+        }
+
+        return db;
+    }
+
+    ccask_loader ld = {
+        .db = db,
+        .partials = calloc(db->file_id, sizeof(ccask_partial)),
+        .from = from,
+        .next = 0,
+    };
+
+    if (!ld.partials) return 0;
+
+    pthread_mutex_init(&ld.lock, 0);
+    pthread_cond_init(&ld.cond, 0);
+
+    pthread_t* tids = malloc(threads * sizeof(pthread_t));
+    size_t started = 0;
+    for (; tids && started < threads; started++) {
+        if (pthread_create(tids + started, 0, ccask_loader_run, &ld) != 0) break;
+    }
+
+    // with no threads at all, load everything from this one
+    if (started == 0) ccask_loader_run(&ld);
+
+    ccask_db* res = db;
+    for (size_t i = 0; i < db->file_id; i++) {
+        if (from[i] == SIZE_MAX) continue;
+
+        pthread_mutex_lock(&ld.lock);
+        while (!ld.partials[i].done) pthread_cond_wait(&ld.cond, &ld.lock);
+        pthread_mutex_unlock(&ld.lock);
+
+        if (res && !ccask_db_apply_partial(db, i, ld.partials + i, now)) res = 0;
+        ccask_partial_destroy(ld.partials + i);
+    }
+
+    for (size_t i = 0; i < started; i++) pthread_join(tids[i], 0);
+
+    printf("ccask_db: loaded %zu files with %zu threads\n", nfiles, started);
+
+    free(tids);
+    free(ld.partials);
+    pthread_mutex_destroy(&ld.lock);
+    pthread_cond_destroy(&ld.cond);
+
+    return res;
+}
+
+/* A checkpoint (see ccask_checkpoint.h) saves the whole keydir along with how far into each
+ * data file it goes, so a restart restores the keydir in one sequential read and only loads
+ * the records appended after it. It is identified with the files it covers by their creation
+ * sequence, so it simply stops applying once a merge has replaced them; a checkpoint that does
+ * not apply, or is damaged, is ignored in favour of loading every file.
+ *
+ * The server writes checkpoints in the background (see ccask_db_checkpoint_step): a forked
+ * child gets a copy-on-write snapshot of the keydir to write out while the parent keeps
+ * serving queries. A clean shutdown writes one in the foreground.
+ */
+
+/**@brief return a malloc'd path of the db's checkpoint, with an optional *suffix*, or 0 on error*/
+char* ccask_db_checkpoint_path(const ccask_db* db, const char* suffix) {
+    if (!suffix) suffix = "";
+
+    size_t len = strlen(db->path) + 1 + strlen(CHECKPOINT_NAME) + strlen(suffix) + 1;
+    char* fn = malloc(len);
+    if (fn) snprintf(fn, len, "%s/%s%s", db->path, CHECKPOINT_NAME, suffix);
+
+    return fn;
+}
+
+/**@brief whether a checkpoint can identify every file: files older than v2 have no creation sequence*/
+bool ccask_db_checkpointable(const ccask_db* db) {
+    for (size_t i = 0; i <= db->file_id && i < MAX_FILES; i++) {
+        if (db->fds[i] >= 0 && db->file_seq[i] == 0) return false;
+    }
+
+    return true;
+}
+
+typedef struct ccask_checkpoint_ctx {
+    ccask_checkpoint_writer* w;
+    bool failed;
+} ccask_checkpoint_ctx;
+
+/**@brief ccask_kdrow_fn that adds a row to a checkpoint*/
+void ccask_db_checkpoint_row(void* ctx, ccask_kdrow* kdr) {
+    ccask_checkpoint_ctx* c = ctx;
+    if (c->failed) return;
+
+    time_t expiry = ccask_kdrow_expiry(kdr);
+    if (!ccask_checkpoint_writer_add(c->w, ccask_kdrow_ksize(kdr), ccask_kdrow_index_key(kdr), ccask_kdrow_fid(kdr),
+                                     ccask_kdrow_vsize(kdr), ccask_kdrow_vpos(kdr), expiry > UINT32_MAX ? UINT32_MAX : expiry)) {
+        c->failed = true;
+    }
+}
+
+/**@brief write a checkpoint of the keydir as it stands, covering every record appended to the
+ * 		  files so far. Every file it covers is synced first, sealed ones too since SYNC_NEVER
+ * 		  and SYNC_INTERVAL may have left them unsynced, so that a checkpoint never covers
+ * 		  records a crash could still take away. Buffered appends must have been written out.
+ *
+ * @return 0 on success, -1 on error
+ */
+int ccask_db_checkpoint_write(ccask_db* db) {
+    if (!ccask_db_checkpointable(db)) return -1;
+
+    uint32_t count = db->file_id + 1;
+    for (uint32_t i = 0; i < count; i++) {
+        if (db->fds[i] >= 0 && fdatasync(db->fds[i]) != 0) return -1;
+    }
+
+    ccask_checkpoint_file files[MAX_FILES];
+    for (uint32_t i = 0; i < count; i++) {
+        files[i] = (ccask_checkpoint_file) {
+            0
+        };
+        if (db->fds[i] < 0) continue;
+
+        files[i] = (ccask_checkpoint_file) {
+            .seq = db->file_seq[i],
+            .bytes = db->file_bytes[i],
+            .dead_bytes = db->dead_bytes[i],
+        };
+    }
+
+    char* fn = ccask_db_checkpoint_path(db, 0);
+    ccask_checkpoint_ctx ctx = {
+        .w = fn ? ccask_checkpoint_writer_new(fn, db->digest_keys, ccask_keydir_hash_seed(db->keydir), db->next_seq, files, count) : 0,
+    };
+    free(fn);
+    if (!ctx.w) return -1;
+
+    ccask_keydir_foreach(db->keydir, ccask_db_checkpoint_row, &ctx);
+    int res = ctx.failed ? -1 : ccask_checkpoint_writer_commit(ctx.w);
+
+    ccask_checkpoint_writer_delete(ctx.w);
+    return res;
+}
+
+/**@brief wait for (or with *block* false, check on) a background checkpoint*/
+void ccask_db_checkpoint_reap(ccask_db* db, bool block) {
+    if (db->checkpoint_pid <= 0) return;
+
+    int status = 0;
+    pid_t pid = waitpid(db->checkpoint_pid, &status, block ? 0 : WNOHANG);
+    if (pid == 0) return;
+
+    if (pid == db->checkpoint_pid && WIFEXITED(status) && WEXITSTATUS(status) == 0) {
+        printf("ccask_db: checkpoint written\n");
+        db->checkpoint_mark = db->checkpoint_pending;
+    } else {
+        // try again once as much has been appended again, not on every loop iteration
+        fprintf(stderr, "ccask_db: background checkpoint failed\n");
+        db->checkpoint_mark = db->appended;
+    }
+
+    db->checkpoint_pid = 0;
+}
+
+/**@brief write a checkpoint now, waiting for one in the background to finish first.
+ *
+ * @return 0 on success, -1 on error (e.g. the db still has files older than format v2)
+ */
+int ccask_db_checkpoint(ccask_db* db) {
+    if (!db || db->fd < 0) return -1;
+
+    ccask_db_checkpoint_reap(db, true);
+    ccask_db_flush(db, true);
+    if (ccask_db_checkpoint_write(db) != 0) {
+        fprintf(stderr, "ccask_db: failed to write checkpoint\n");
+        return -1;
+    }
+
+    db->checkpoint_mark = db->appended;
+    db->checkpoint_stale = false;
+    return 0;
+}
+
+/**@brief start writing a checkpoint in a child process; ccask_db_checkpoint_step reaps it.
+ *
+ * @return 0 if one was started, -1 if one is running already, a merge is or it could not be
+ */
+int ccask_db_checkpoint_start(ccask_db* db) {
+    if (!db || db->fd < 0 || db->checkpoint_pid > 0 || db->merge || !ccask_db_checkpointable(db)) return -1;
+
+    // the child inherits our stdio buffers; it leaves with _exit, so they are only flushed here
+    ccask_db_flush(db, false);
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        perror("ccask_db: fork");
+        return -1;
+    }
+
+    // _exit: the child must not run our exit handlers, which would remove the lockfile
+    if (pid == 0) _exit(ccask_db_checkpoint_write(db) == 0 ? 0 : 1);
+
+    db->checkpoint_pid = pid;
+    db->checkpoint_pending = db->appended;
+    db->checkpoint_stale = false;
+    return 0;
+}
+
+/**@brief the server loop's share of checkpointing: reap a finished background checkpoint, and
+ * 		  start the next once CCASK_CHECKPOINT_MB have been appended since the last or the last
+ * 		  no longer applies, e.g. after a merge. None is started while a merge runs, since the
+ * 		  merge is about to make it stale.
+ *
+ * @return 1 while a checkpoint is being written, 0 otherwise
+ */
+int ccask_db_checkpoint_step(ccask_db* db) {
+    if (!db || db->checkpoint_bytes == 0) return 0;
+
+    ccask_db_checkpoint_reap(db, false);
+    if (db->checkpoint_pid > 0) return 1;
+
+    if (db->checkpoint_stale || db->appended - db->checkpoint_mark >= db->checkpoint_bytes) ccask_db_checkpoint_start(db);
+
+    return db->checkpoint_pid > 0;
+}
+
+typedef struct ccask_restore {
+    ccask_db* db;
+    ccask_checkpoint* cp;
+    time_t now;
+    size_t restored;
+    size_t expired;
+} ccask_restore;
+
+/**@brief ccask_checkpoint_fn that puts an entry back in the keydir, unless it has expired since*/
+int ccask_db_restore_entry(void* ctx, uint32_t key_size, const uint8_t* index_key, uint32_t file_id,
+                           uint32_t value_size, size_t value_pos, uint32_t expiry) {
+    ccask_restore* r = ctx;
+    ccask_db* db = r->db;
+
+    if (ccask_checkpoint_file_at(r->cp, file_id).seq == 0) return 1;
+
+    if (expiry != 0 && r->now >= expiry) {
+        db->dead_bytes[file_id] += ccask_db_record_bytes(db, file_id, key_size, value_size);
+        r->expired++;
+        return 0;
+    }
+
+    if (!ccask_keydir_restore(db->keydir, key_size, index_key, file_id, value_size, value_pos, expiry)) return 1;
+    if (expiry) db->expiring = true;
+
+    r->restored++;
+    return 0;
+}
+
+/**@brief restore the keydir from the db's checkpoint, if it still applies to the data files found.
+ *
+ * *from* holds where loading each file would start; where the checkpoint covers a file it is
+ * moved past the records covered, or set to SIZE_MAX if the whole file is, and so is any file
+ * with nothing to load. A checkpoint is only a cache: if restoring fails part way, the keydir
+ * is replaced with an empty one made from *cfg* and *from* is put back, so every file is loaded.
+ *
+ * @return 1 if the keydir was restored, 0 if there is no checkpoint that applies or it could not
+ * 		   be restored (the keydir is empty), -1 if no empty keydir could be made
+ */
+int ccask_db_checkpoint_restore(ccask_db* db, size_t* from, ccask_config* cfg) {
+    char* fn = ccask_db_checkpoint_path(db, 0);
+    if (!fn) return 0;
+
+    ccask_checkpoint* cp = ccask_checkpoint_open(fn);
+    if (!cp && access(fn, F_OK) == 0) fprintf(stderr, "ccask_db: ignoring damaged checkpoint %s\n", fn);
+    free(fn);
+    errno = 0;
+    if (!cp) return 0;
+
+    // every file covered must still be there, at least as long; every other file must be newer
+    bool applies = ccask_checkpoint_digest(cp) == db->digest_keys && ccask_checkpoint_file_count(cp) <= MAX_FILES;
+    size_t files = db->file_id > ccask_checkpoint_file_count(cp) ? db->file_id : ccask_checkpoint_file_count(cp);
+    for (size_t i = 0; i < files && applies; i++) {
+        ccask_checkpoint_file f = ccask_checkpoint_file_at(cp, i);
+        bool found = i < db->file_id && db->fds[i] >= 0;
+
+        if (f.seq) {
+            applies = found && db->file_seq[i] == f.seq && f.bytes >= db->file_start[i] && f.bytes <= db->file_bytes[i];
+        } else if (found) {
+            applies = db->file_seq[i] != 0 && db->file_seq[i] >= ccask_checkpoint_next_seq(cp);
+        }
+    }
+
+    if (!applies) {
+        printf("ccask_db: checkpoint does not match the data files; loading them all\n");
+        ccask_checkpoint_close(cp);
+        return 0;
+    }
+
+    // digests only identify keys under the seed they were made with
+    if (db->digest_keys) ccask_keydir_set_hash(db->keydir, ccask_kdhash_wyhash, ccask_checkpoint_seed(cp));
+
+    for (size_t i = 0; i < db->file_id; i++) {
+        if (db->fds[i] < 0) continue;
+
+        ccask_checkpoint_file f = ccask_checkpoint_file_at(cp, i);
+        if (f.seq) {
+            from[i] = f.bytes;
+            db->dead_bytes[i] = f.dead_bytes;
+        }
+        if (from[i] >= db->file_bytes[i]) from[i] = SIZE_MAX;
+    }
+
+    ccask_restore r = {
+        .db = db,
+        .cp = cp,
+        .now = time(NULL),
+    };
+
+    int res = ccask_checkpoint_load(cp, ccask_db_restore_entry, &r);
+    ccask_checkpoint_close(cp);
+    if (res == 0) {
+        printf("ccask_db: restored %zu keys from checkpoint (%zu expired since)\n", r.restored, r.expired);
+        return 1;
+    }
+
+    // an entry outside the files covered, or one the keydir has no room for: start over without it
+    fprintf(stderr, "ccask_db: failed to restore the keydir from its checkpoint; loading the data files instead\n");
+    ccask_keydir_delete(db->keydir);
+    db->keydir = ccask_keydir_new(ccask_config_kdsize(cfg), ccask_config_kdbudget(cfg), ccask_config_kd_hugepages(cfg),
+                                  ccask_config_kd_digest(cfg), ccask_config_kd_ordered(cfg));
+    if (!db->keydir) return -1;
+
+    db->expiring = false;
+    for (size_t i = 0; i < db->file_id; i++) {
+        db->dead_bytes[i] = 0;
+        from[i] = db->fds[i] >= 0 ? db->file_start[i] : SIZE_MAX;
+    }
+
+    return 0;
+}
+
+/**@brief given a malloc'd and initialized db and a valid file populates the keydir, loading
+ * 		  data files on up to CCASK_LOAD_THREADS threads
+ */
+ccask_db* ccask_db_populate(ccask_db* db, ccask_config* cfg) {
+    if (!db) return 0;
+
+    errno = 0;
+    struct dirent* pDirent;
+
+    for (pDirent = readdir(db->dir); pDirent; pDirent = readdir(db->dir)) {
+        if (strcmp(".", pDirent->d_name) == 0
+                || strcmp("..", pDirent->d_name) == 0
+                || strcmp(LOCKFILE_NAME, pDirent->d_name) == 0
+                || strcmp(CHECKPOINT_NAME, pDirent->d_name) == 0)
+
+            continue;
+
+        if (strcmp(CHECKPOINT_NAME ".tmp", pDirent->d_name) == 0) {
+            // a checkpoint that was never committed; the last one committed is intact
+            char* path = ccask_db_checkpoint_path(db, ".tmp");
+            fprintf(stderr, "ccask_db_populate: removing incomplete file %s\n", path);
+            unlink(path);
+            free(path);
+            continue;
+        }
+
+        // data files are named <base>_<file id>; the id, not readdir order, decides recency
+        const char* suffix = 0;
+        size_t fid = ccask_db_parse_filename(db, pDirent->d_name, &suffix);
+        if (fid == SIZE_MAX) {
+            fprintf(stderr, "ccask_db_populate: skipping unrecognized file %s\n", pDirent->d_name);
+            continue;
+        }
+
+        size_t slen = strlen(suffix);
+        if (strncmp(suffix, MERGE_SUFFIX, strlen(MERGE_SUFFIX)) == 0
+                || (slen >= 4 && strcmp(suffix + slen - 4, ".tmp") == 0)) {
+            // output of a merge or hint write that never completed; the files it would have replaced are intact
+            char* path = ccask_db_filename(db, fid, suffix);
+            fprintf(stderr, "ccask_db_populate: removing incomplete file %s\n", path);
+            unlink(path);
+            free(path);
+            continue;
+        }
+
+        // hint files are picked up when their data file is loaded
+        if (*suffix != '\0') continue;
+
+        if (fid >= MAX_FILES) {
+            fprintf(stderr, "ccask_db_populate: file id %zu exceeds MAX_FILES\n", fid);
+            exit(1);
+        }
+
+        char* path = ccask_db_filename(db, fid, 0);
+        if (!path) return 0;
+        printf("file ID: %zu file name: %s\n", fid, pDirent->d_name);
+
+        int fd = open(path, O_RDONLY);
+        if (fd < 0) {
+            fprintf(stderr, "open(%s,...)\n", path);
+            perror("open");
+            exit(1);
+        }
+
+        free(path);
+
+        struct stat st;
+        if (fstat(fd, &st) == 0) db->file_bytes[fid] = st.st_size;
+
+        db->fds[fid] = fd;
+        ccask_db_header_read(db, fid);
+        if (fid + 1 > db->file_id) db->file_id = fid + 1;
+    }
+
+    if (errno != 0) {
+        perror("readdir");
+        exit(1);
+    }
+
+    // load every file from its first record, or from wherever the checkpoint leaves off
+    size_t from[MAX_FILES];
+    for (size_t i = 0; i < db->file_id; i++) from[i] = db->fds[i] >= 0 ? db->file_start[i] : SIZE_MAX;
+
+    int restored = ccask_db_checkpoint_restore(db, from, cfg);
+    if (restored < 0 || !ccask_db_load_all(db, ccask_config_load_threads(cfg), from)) return 0;
+
+    // the checkpoint still describes the keydir only if nothing was loaded on top of it
+    db->checkpoint_stale = restored == 0;
+    for (size_t i = 0; i < db->file_id; i++) {
+        if (from[i] != SIZE_MAX) db->checkpoint_stale = true;
+    }
+
+    // every file found at startup is sealed; the active file is created after this
+    for (size_t i = 0; i < db->file_id; i++) ccask_db_map(db, i);
+
+    return db;
+}
+
+
+/**@brief this function is registered with on_exit to ensure the lockfile is cleared in normal termination circumstances*/
+void delete_lockfile(int status, void* lfpath) {
+    (void)status;
+    if (lfpath == NULL) {
+        fprintf(stderr, "ccask: failed to delete lockfile\n");
+    }
+
+    char* lfpath_s = (char*)lfpath;
+    int res;
+
+    errno = 0;
+
+    res = remove(lfpath_s);
+    // ccask_db_destroy releases the lock itself when the db is shut down cleanly
+    if (res == -1 && errno != ENOENT) {
+        fprintf(stderr, "ccask: failed to delete lockfile\n");
+        perror("remove");
+    }
+
+    free(lfpath);
+}
+
+#define DIR_LOCKED 0
+#define DIR_LOCK_CREATED 1
+#define DIR_ERROR 2
+/**@brief is the lockfile at *fn* held by a process that no longer exists?*/
+bool dir_lock_stale(const char* fn) {
+    FILE* fp = fopen(fn, "r");
+    if (!fp) return false;
+
+    int pid = 0;
+    bool read = fscanf(fp, "%d", &pid) == 1;
+    fclose(fp);
+
+    // a lockfile without a pid may be in the middle of being created
+    return read && pid > 0 && kill(pid, 0) != 0 && errno == ESRCH;
+}
+
+/**@brief this function is an internal API used by ccask_db_init to determine whether
+ * 		 the ccask directory is already locked.
+ *
+ * 		 If the lockfile exists in the directory, return DIR_LOCKED, unless the process that
+ * 		 created it is gone: then it is removed and taken over
+ *
+ * 		 If the lockfile does not exist, create it and return DIR_LOCK_CREATED
+ **/
+int dir_lock(ccask_db* db) {
+    if (db == NULL) return DIR_ERROR;
+
+    char* fn;
+    int res, fd;
+    size_t fnlen;
+    FILE* fp;
+
+    pid_t p = getpid();
+    mode_t m = S_IRUSR | S_IWUSR;
+    errno = 0;
+
+    fnlen = strlen(db->path) + strlen(LOCKFILE_NAME) + 2;
+
+    fn = malloc(fnlen + 2);
+    res = snprintf(fn, fnlen, "%s/%s", db->path, LOCKFILE_NAME);
+
+    if (res < 0) return DIR_ERROR;
+
+    fd = open(fn, O_WRONLY | O_CREAT | O_EXCL, m);
+    if (fd < 0 && errno == EEXIST && dir_lock_stale(fn)) {
+        // left behind by an instance that crashed
+        fprintf(stderr, "ccask: removing stale lockfile %s\n", fn);
+        unlink(fn);
+        errno = 0;
+        fd = open(fn, O_WRONLY | O_CREAT | O_EXCL, m);
+    }
+
+    if (fd < 0 && errno == EEXIST) {
+        free(fn);
+        return DIR_LOCKED;
+    } else if (fd < 0) {
+        free(fn);
+        return DIR_ERROR;
+    }
+
+    fp = fdopen(fd, "w");
+
+    fprintf(fp, "%d", p);
+    fflush(fp);
+    fclose(fp);
+
+    if(on_exit(delete_lockfile, fn) != 0) {
+        delete_lockfile(0, (void*)fn);
+        exit(1);
+    }
+
+    // we can't free the memory allocated for fn, since delete_lockfile will need it later
+    db->lock_path = malloc(strlen(fn) + 1);
+    if (db->lock_path) strcpy(db->lock_path, fn);
+
+    return DIR_LOCK_CREATED;
+}
+
+ccask_db* ccask_db_init(ccask_db* db, const char* path, ccask_config* cfg) {
+    if (db && path) {
+        *db = (ccask_db) {
+            .path = malloc(strlen(path) + 1),
+            .file_pos = 0,
+            .file_id = 0,
+            .bytes_written = 0,
+            .keydir = ccask_keydir_new(ccask_config_kdsize(cfg), ccask_config_kdbudget(cfg), ccask_config_kd_hugepages(cfg),
+                                       ccask_config_kd_digest(cfg), ccask_config_kd_ordered(cfg)),
+            .digest_keys = ccask_config_kd_digest(cfg) && !ccask_config_kd_ordered(cfg),
+            .fd = -1,
+            .dir = 0,
+            .maps = { 0 },
+            .use_mmap = ccask_config_mmap(cfg),
+            .file_start = { 0 },
+            .file_crc = { 0 },
+            .file_version = { 0 },
+            .file_seq = { 0 },
+            .next_seq = 1,
+            .crc = CRC_32C,
+            .ring = 0,
+            .inflight = 0,
+            .inflight_count = 0,
+            .done_head = 0,
+            .done_tail = 0,
+            .sync_policy = ccask_config_sync(cfg),
+            .sync_ms = ccask_config_sync_ms(cfg),
+            .wbuf = 0,
+            .wbuf_len = 0,
+            .wbuf_cap = 0,
+            .write_seq = 0,
+            .durable_seq = 0,
+            .commit = 0,
+            .waiting_head = 0,
+            .waiting_tail = 0,
+            .file_bytes = { 0 },
+            .dead_bytes = { 0 },
+            .merge_pct = ccask_config_merge_pct(cfg),
+            .merge = 0,
+            .expiring = false,
+            .expire_cursor = 0,
+            .checkpoint_bytes = ccask_config_checkpoint_bytes(cfg),
+            .appended = 0,
+            .checkpoint_mark = 0,
+            .checkpoint_stale = false,
+            .checkpoint_pid = 0,
+            .checkpoint_pending = 0,
+            .backup_dir = 0,
+        };
+
+        db->path = strcpy(db->path, path);
+        if (ccask_config_backup_dir(cfg)) {
+            db->backup_dir = malloc(strlen(ccask_config_backup_dir(cfg)) + 1);
+            if (db->backup_dir) strcpy(db->backup_dir, ccask_config_backup_dir(cfg));
+        }
+        for (size_t i = 0; i < MAX_FILES; i++) db->fds[i] = -1;
+
+        // strip trailing slashes, then take the last path component as the data file prefix
+        size_t plen = strlen(db->path);
+        while (plen > 1 && db->path[plen-1] == '/') db->path[--plen] = '\0';
+        const char* base = strrchr(db->path, '/');
+        base = base ? base + 1 : db->path;
+        db->base = malloc(strlen(base) + 1);
+        strcpy(db->base, base);
+
+        DIR* dir = opendir(path);
+        if (dir == 0) {
+            // we were unable to open the dir
+            if (errno == ENOENT && strcmp(db->path, "") != 0) {
+                // directory does not exist, try to create it
+                errno = 0;
+                int res = mkdir(path, 0700);
+                if (res == -1) {
+                    perror("mkdir");
+                    exit(1);
+                }
+
+                dir = opendir(path);
+                if (dir == 0) {
+                    perror("opendir");
+                    exit(1);
+                }
+            } else {
+                perror("opendir");
+                exit(1);
+            }
+        }
+
+        db->dir = dir;
+
+        int res = dir_lock(db);
+
+        if (res == DIR_LOCKED || res == DIR_ERROR) {
+            fprintf(stderr, "ccask error: failure to obtain ccask lock. is a ccask instance running on this dir?\n");
+            ccask_db_destroy(db);
+            return NULL;
+        }
+
+        struct timespec start, end;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+
+        if (!ccask_db_populate(db, cfg)) {
+            // releases the lock and closes whatever was opened; db is left zeroed
+            fprintf(stderr, "ccask error: failed to load the data files in %s\n", db->path);
+            ccask_db_destroy(db);
+            return NULL;
+        }
+
+        clock_gettime(CLOCK_MONOTONIC, &end);
+        double ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+        printf("ccask_db: keydir populated from %zu files in %.3f ms\n", db->file_id, ms);
+
+        if (db->file_id >= MAX_FILES) {
+            fprintf(stderr, "ccask_db: too many files\n");
+            exit(1);
+        }
+
+        char* new_filename = ccask_db_filename(db, db->file_id, 0);
+        if (!new_filename) {
+            fprintf(stderr, "error constructing new filename\n");
+            exit(1);
+        }
+
+        errno = 0;
+        uint64_t seq;
+        int new_fd = ccask_db_create(db, new_filename, &seq);
+        if (new_fd < 0) {
+            fprintf(stderr, "%s\n", new_filename);
+            perror("open");
+            exit(1);
+        }
+
+        printf("new file %s open for writing (%s records, %s)\n", new_filename, crc_type_name(db->crc), crc_impl_name(db->crc));
+        free(new_filename);
+
+        ccask_db_activate(db, new_fd, seq);
+        clock_gettime(CLOCK_MONOTONIC, &db->last_sync);
+
+        if (ccask_config_uring(cfg)) {
+            db->ring = ccask_uring_new(URING_ENTRIES);
+            if (!db->ring) fprintf(stderr, "ccask_db: io_uring unavailable; using synchronous I/O\n");
+        }
+    } else {
+        *db = (ccask_db) {
+            0
+        };
+    }
+
+    return db;
+}
+
+ccask_db* ccask_db_new(const char* path, ccask_config* cfg) {
+    ccask_db* db = malloc(sizeof(ccask_db));
+    if (!db) return NULL;
+
+    // a failed init has already released everything it took
+    ccask_db* db_res = ccask_db_init(db, path, cfg);
+    if(db_res == NULL) free(db);
+    return db_res;
+}
+
+void ccask_merge_abort(ccask_db* db);
+void ccask_db_async_drain(ccask_db* db);
+void ccask_db_flush(ccask_db* db, bool sync);
+void ccask_db_op_delete(ccask_db_op* op);
+uint8_t* ccask_db_pending_row(const ccask_db* db, uint32_t fid, size_t pos);
+
+void ccask_db_destroy(ccask_db* db) {
+    if (db) {
+        if (db->merge) ccask_merge_abort(db);
+
+        // a clean shutdown saves the next startup from loading what was appended since the last checkpoint
+        ccask_db_checkpoint_reap(db, true);
+        if (db->fd >= 0 && db->checkpoint_bytes && ccask_db_checkpointable(db)
+                && (db->checkpoint_stale || db->appended != db->checkpoint_mark)) {
+            ccask_db_checkpoint(db);
+        }
+
+        // every buffered or queued write must land before the files are closed; unclaimed results are dropped
+        if (db->fd >= 0) ccask_db_flush(db, db->sync_policy != SYNC_NEVER);
+        while (db->done_head) {
+            ccask_db_op* op = db->done_head;
+            db->done_head = op->next;
+            ccask_db_op_delete(op);
+        }
+        ccask_uring_delete(db->ring);
+        free(db->wbuf);
+
+        //free(db->keydir);
+        ccask_keydir_delete(db->keydir);
+
+        // db->fd is also the last entry of db->fds
+        for (size_t i = 0; i < MAX_FILES; i++) {
+            ccask_db_unmap(db, i);
+            if (db->fds[i] >= 0) close(db->fds[i]);
+        }
+
+        if (db->dir) closedir(db->dir);
+
+        if (db->lock_path) {
+            remove(db->lock_path);
+            free(db->lock_path);
+        }
+
+        free(db->path);
+        free(db->base);
+        free(db->backup_dir);
+        *db = (ccask_db) {
+            0
+        };
+    }
+}
+
+void ccask_db_delete(ccask_db* db) {
+    ccask_db_destroy(db);
+    free(db);
+}
+
+/**@brief opens a new file for *db* or fails and quits the ccask process*/
+void ccask_db_newfile(ccask_db* db) {
+    // the current file is sealed from here on, so write it out and index it for the next startup
+    ccask_db_flush(db, db->sync_policy != SYNC_NEVER);
+    ccask_db_hint_write(db, db->file_id);
+    ccask_db_map(db, db->file_id);
+
+    db->file_id++;
+    if (db->file_id >= MAX_FILES) {
+        fprintf(stderr, "ccask_db: too many files\n");
+        exit(1);
+    }
+
+    char* new_filename = ccask_db_filename(db, db->file_id, 0);
+    if (!new_filename) {
+        fprintf(stderr, "error constructing new filename\n");
+        exit(1);
+    }
+
+    errno = 0;
+    uint64_t seq;
+    int new_fd = ccask_db_create(db, new_filename, &seq);
+    if (new_fd < 0) {
+        fprintf(stderr, "%s\n", new_filename);
+        perror("open");
+        exit(1);
+    }
+
+    printf("ccask_db_newfile: new file %s open for writing\n", new_filename);
+
+    ccask_db_activate(db, new_fd, seq);
+
+    free(new_filename);
+}
+
+size_t ccask_db_fid(const ccask_db* db) {
+    if(!db) return SIZE_MAX;
+    return db->file_id;
+}
+
+/**@brief fill in the record header *hdr* for an append. The CRC is extended over the header,
+ * 		  key and value where they lie, so neither is copied to compute it.
+ *
+ * A *value_size* of CCASK_TOMBSTONE makes a tombstone: the header and key with no value.
+ */
+ccask_record_header* ccask_db_record_header(ccask_record_header* hdr, crc_type type, time_t ts, uint32_t ttl, uint32_t key_size, uint8_t* key, uint32_t value_size, uint8_t* value) {
+    uint32_t value_bytes = VALUE_BYTES(value_size);
+    ccask_record_header_init(hdr, ts, ttl, key_size, value_size);
+
+    // calc the crc -- assuming crc_init has been called elsewhere.
+    uint32_t crc = crc_extend(type, 0, (uint8_t*)hdr + sizeof(uint32_t), sizeof(*hdr) - sizeof(uint32_t));
+    crc = crc_extend(type, crc, key, key_size);
+    if (value_bytes) crc = crc_extend(type, crc, value, value_bytes);
+    ccask_record_set_crc(hdr, crc);
+
+    return hdr;
+}
+
+/**@brief claim *row_size* bytes at the end of the active file and return their position*/
+size_t ccask_db_reserve(ccask_db* db, size_t row_size) {
+    size_t value_pos = db->file_pos;
+    db->file_pos += row_size;
+    db->bytes_written += row_size;
+    db->file_bytes[db->file_id] += row_size;
+    db->appended += row_size;
+
+    return value_pos;
+}
+
+/**@brief make room for *n* more bytes in the write buffer, writing out what it holds first once
+ * 		  it has grown past WBUF_MAX_BYTES
+ */
+uint8_t* ccask_db_wbuf_reserve(ccask_db* db, size_t n) {
+    if (db->wbuf_len > 0 && db->wbuf_len + n > WBUF_MAX_BYTES) ccask_db_flush(db, false);
+    if (db->wbuf_len + n <= db->wbuf_cap) return db->wbuf + db->wbuf_len;
+
+    size_t cap = db->wbuf_cap ? db->wbuf_cap : 4096;
+    while (cap < db->wbuf_len + n) cap *= 2;
+
+    uint8_t* buf = realloc(db->wbuf, cap);
+    if (!buf) return 0;
+
+    db->wbuf = buf;
+    db->wbuf_cap = cap;
+    return db->wbuf + db->wbuf_len;
+}
+
+/**@brief append a record to the active file, moving to a new file first if it would not fit.
+ *
+ * The record goes to the write buffer and reaches the file with the next ccask_db_commit or
+ * ccask_db_flush; until then gets are served from the buffer. Under SYNC_ALWAYS it is written
+ * and synced before this returns.
+ *
+ * A *value_size* of CCASK_TOMBSTONE writes a tombstone: the header and key with no value.
+ * A nonzero *ttl* makes the record expire *ttl* seconds after *ts*.
+ *
+ * @return the position of the record in the active file, or SIZE_MAX if it could not be written
+ */
+size_t ccask_db_append(ccask_db* db, time_t ts, uint32_t ttl, uint32_t key_size, uint8_t* key, uint32_t value_size, uint8_t* value) {
+    size_t row_size = ccask_record_bytes(FORMAT_VERSION, key_size, value_size);
+
+    // check to see if we have room in the file for this row
+    // if not, we need to go to a new file
+    if(db->bytes_written + row_size > MAX_FILE_BYTES || db->bytes_written + row_size < db->bytes_written) ccask_db_newfile(db);
+
+    uint32_t value_bytes = VALUE_BYTES(value_size);
+    size_t pad = row_size - sizeof(ccask_record_header) - key_size - value_bytes;
+    ccask_record_header hdr;
+    ccask_db_record_header(&hdr, db->crc, ts, ttl, key_size, key, value_size, value);
+
+    if (value_bytes >= DIRECT_WRITE_BYTES) {
+        // big values skip the buffer: whatever is buffered, the header, the key and the value go
+        // out in one writev straight from the caller's memory
+        static uint8_t zeros[CCASK_RECORD_ALIGN];
+        struct iovec iov[5] = {
+            { .iov_base = db->wbuf, .iov_len = db->wbuf_len },
+            { .iov_base = &hdr, .iov_len = sizeof(hdr) },
+            { .iov_base = key, .iov_len = key_size },
+            { .iov_base = value, .iov_len = value_bytes },
+            { .iov_base = zeros, .iov_len = pad },
+        };
+
+        ccask_db_async_drain(db);
+        if (pwritev_full(db->fd, iov, 5, db->file_pos - db->wbuf_len) != 0) {
+            perror("ccask_db_append: pwritev");
+            return SIZE_MAX;
+        }
+        db->wbuf_len = 0;
+    } else {
+        uint8_t* row = ccask_db_wbuf_reserve(db, row_size);
+        if (!row) return SIZE_MAX;
+
+        memcpy(row, &hdr, sizeof(hdr));
+        memcpy(row+sizeof(hdr), key, key_size);
+        if (value_bytes) memcpy(row+sizeof(hdr)+key_size, value, value_bytes);
+        memset(row+row_size-pad, 0, pad);
+        db->wbuf_len += row_size;
+    }
+    db->write_seq++;
+
+    size_t value_pos = ccask_db_reserve(db, row_size);
+    if (db->sync_policy == SYNC_ALWAYS) ccask_db_flush(db, true);
+
+    return value_pos;
+}
+
+/**@brief kick off a merge once enough of the sealed data is garbage; the caller (i.e. the server loop) drives it*/
+void ccask_db_maybe_merge(ccask_db* db) {
+    if (!db->merge && ccask_db_dead_pct(db) >= db->merge_pct) ccask_db_merge_start(db);
+}
+
+/**@brief ccask_kdrow_fn that charges the record of an expired row to its file's dead bytes*/
+void ccask_db_expired_row(void* ctx, ccask_kdrow* kdr) {
+    ccask_db* db = ctx;
+    uint32_t fid = ccask_kdrow_fid(kdr);
+
+    if (fid < MAX_FILES) db->dead_bytes[fid] += ccask_db_record_bytes(db, fid, ccask_kdrow_ksize(kdr), ccask_kdrow_vsize(kdr));
+}
+
+/**@brief return the keydir row of *key*, or 0 if there is none or it has expired. An expired row
+ * 		  is dropped on the spot, so the check costs no disk access.
+ */
+ccask_kdrow* ccask_db_lookup(ccask_db* db, uint32_t key_size, uint8_t* key) {
+    ccask_kdrow* kdr = ccask_keydir_get(db->keydir, key_size, key);
+    time_t expiry = ccask_kdrow_expiry(kdr);
+    if (expiry == 0 || time(NULL) < expiry) return kdr;
+
+    ccask_db_expired_row(db, kdr);
+    ccask_keydir_remove(db->keydir, key_size, key);
+    return 0;
+}
+
+/**@brief sweep the next EXPIRE_STEP_BUCKETS keydir buckets for expired keys and drop them.
+ *
+ * Gets never return an expired value whether or not it has been swept; sweeping reclaims the
+ * keydir memory of keys that are not read again and charges their records to dead bytes so a
+ * merge purges them from disk. The server loop calls this once per iteration.
+ *
+ * @return the number of keys dropped
+ */
+size_t ccask_db_expire_step(ccask_db* db) {
+    if (!db || !db->expiring) return 0;
+
+    size_t expired = ccask_keydir_expire(db->keydir, &db->expire_cursor, EXPIRE_STEP_BUCKETS, time(NULL), ccask_db_expired_row, db);
+    if (expired) ccask_db_maybe_merge(db);
+
+    return expired;
+}
+
+/**@brief whether any key has been given a ttl, i.e. whether ccask_db_expire_step has work to do*/
+bool ccask_db_expiring(const ccask_db* db) {
+    return db && db->expiring;
+}
+
+/**
+ * set implementation
+ * 1) calc crc
+ * 2) at file_pos write crc timestamp keysize valuesize key value
+ * 3) create and insert a keydir entry
+ *
+ * Keydir value_pos should be file_pos prior to write
+ */
+ccask_db* ccask_db_set(ccask_db* db, uint32_t key_size, uint8_t* key, uint32_t value_size, uint8_t* value) {
+    return ccask_db_set_ttl(db, key_size, key, value_size, value, 0);
+}
+
+/**@brief set *key* to a value that expires *ttl* seconds from now; a *ttl* of 0 never expires.
+ *
+ * Once expired the key reads as missing, its keydir entry is dropped by the first get or
+ * ccask_db_expire_step to come across it and its record by the next merge.
+ */
+ccask_db* ccask_db_set_ttl(ccask_db* db, uint32_t key_size, uint8_t* key, uint32_t value_size, uint8_t* value, uint32_t ttl) {
+    if (!db || value_size == CCASK_TOMBSTONE) return 0;
+
+    // a key the keydir's budget leaves no room for is refused before its record is written
+    if (!ccask_keydir_room(db->keydir, key_size, key)) return 0;
+
+    time_t ts = time(NULL);
+    size_t value_pos = ccask_db_append(db, ts, ttl, key_size, key, value_size, value);
+    if (value_pos == SIZE_MAX) return 0;
+
+    // now create the keydir entry; the keydir makes the only copy of the key
+    uint32_t fid = db->file_id;
+    if(!ccask_db_index(db, key_size, key, fid, value_size, value_pos, ts, ttl)) {
+        // the record is on disk and would win the next replay: follow it with a tombstone, so the
+        // key reads after a restart as it does now, and write both off as dead
+        db->dead_bytes[fid] += ccask_db_record_bytes(db, fid, key_size, value_size);
+        if (ccask_db_append(db, ts, 0, key_size, key, CCASK_TOMBSTONE, 0) != SIZE_MAX)
+            ccask_db_unindex(db, db->file_id, key_size, key, CCASK_TOMBSTONE);
+        return 0;
+    }
+
+    ccask_db_maybe_merge(db);
+
+    return db;
+}
+
+/**
+ * delete implementation
+ * 1) make sure the key exists and has not expired
+ * 2) append a tombstone (header + key, value size CCASK_TOMBSTONE) so the delete survives a restart
+ * 3) remove the key from the keydir
+ *
+ * Merge drops both the tombstone and every older version of the key.
+ * Returns 0 if the key does not exist or the tombstone could not be written.
+ */
+ccask_db* ccask_db_del(ccask_db* db, uint32_t key_size, uint8_t* key) {
+    if (!db || !ccask_db_lookup(db, key_size, key)) return 0;
+
+    size_t pos = ccask_db_append(db, time(NULL), 0, key_size, key, CCASK_TOMBSTONE, 0);
+    if (pos == SIZE_MAX) return 0;
+
+    ccask_db_unindex(db, db->file_id, key_size, key, CCASK_TOMBSTONE);
+    ccask_db_maybe_merge(db);
+
+    return db;
+}
+
+/**@brief check the record at *row*, of format *version*, in place: its sizes must match the
+ * 		  keydir's and its checksum, of type *type*, must match the bytes that follow it
+ */
+bool crc_check_row(const uint8_t* row, uint16_t version, crc_type type, uint32_t key_size, uint32_t value_size) {
+    ccask_record_header tmp;
+    const ccask_record_header* hdr = ccask_record_header_view(version, row, &tmp);
+    size_t hdr_bytes = ccask_record_header_bytes(version);
+
+    return ccask_record_ksz(hdr) == key_size && ccask_record_vsz(hdr) == value_size
+           && ccask_record_crc(hdr) == crc_extend(type, 0, row + sizeof(uint32_t), hdr_bytes - sizeof(uint32_t) + key_size + VALUE_BYTES(value_size));
+}
+
+/**@brief whether *row*, a record of format *version*, holds *key*. Only a digest-keyed keydir
+ * 		  can point a key at another key's record, when the digests of the two collide.
+ */
+bool ccask_db_row_is(const ccask_db* db, const uint8_t* row, uint16_t version, uint32_t key_size, const uint8_t* key) {
+    return !db->digest_keys || memcmp(row + ccask_record_header_bytes(version), key, key_size) == 0;
+}
+
+/**
+ * get implementation
+ * 1) try to get kdrow from keydir (ccask_db_lookup(...)); an expired one is a miss
+ * 2) from kdrow, we additionally get value_size, file_id, value_pos
+ * 3) if the file is mapped, the record is already in memory at value_pos; otherwise read the
+ *    whole record with a single pread. There is no shared cursor, so gets may run concurrently
+ * 4) with a digest-keyed keydir, a record for another key is a miss
+ * 5) check the sizes and crc of the record where it lies
+ * 6) return the value & crc result. Values from a mapping are not copied (see ccask_gr_borrow)
+ */
+ccask_get_result* ccask_db_get(ccask_db* db, uint32_t key_size, uint8_t* key) {
+    if (!db) return 0;
+
+    ccask_kdrow* kdr = ccask_db_lookup(db, key_size, key);
+    if (!kdr) {
+        return 0;
+    }
+
+    uint32_t file_id = ccask_kdrow_fid(kdr);
+    uint32_t value_size = ccask_kdrow_vsize(kdr);
+    size_t value_pos = ccask_kdrow_vpos(kdr);
+
+    if (file_id == UINT32_MAX || value_size == UINT32_MAX || value_pos == SIZE_MAX) {
+        return 0;
+    }
+
+    if (file_id >= MAX_FILES || db->fds[file_id] < 0) return 0;
+
+    uint16_t version = db->file_version[file_id];
+    crc_type type = db->file_crc[file_id];
+    size_t value_off = ccask_record_header_bytes(version) + key_size;
+    size_t row_size = value_off + value_size;
+    ccask_get_result* gr = 0;
+    uint8_t* pending = ccask_db_pending_row(db, file_id, value_pos);
+
+    if (pending) {
+        if (!ccask_db_row_is(db, pending, version, key_size, key)) return 0;
+        gr = ccask_gr_new(value_size, pending + value_off, crc_check_row(pending, version, type, key_size, value_size));
+    } else if (db->maps[file_id]) {
+        if (value_pos > db->file_bytes[file_id] || row_size > db->file_bytes[file_id] - value_pos) return 0;
+
+        uint8_t* row_ptr = db->maps[file_id] + value_pos;
+        if (!ccask_db_row_is(db, row_ptr, version, key_size, key)) return 0;
+        gr = ccask_gr_borrow(value_size, row_ptr + value_off, crc_check_row(row_ptr, version, type, key_size, value_size));
+    } else {
+        uint8_t* row_ptr = malloc(row_size);
+        if (!row_ptr) return 0;
+
+        if (pread_full(db->fds[file_id], row_ptr, row_size, value_pos) != 0) {
+            fprintf(stderr, "ccask_db_get: short read of %zu bytes at %zu in file %u\n", row_size, value_pos, file_id);
+            if (errno) perror("pread");
+            errno = 0;
+            free(row_ptr);
+            return 0;
+        }
+
+        if (ccask_db_row_is(db, row_ptr, version, key_size, key)) {
+            gr = ccask_gr_new(value_size, row_ptr + value_off, crc_check_row(row_ptr, version, type, key_size, value_size));
+        }
+        free(row_ptr);
+    }
+
+    return gr;
+}
+
+/**************
+ *
+ * asynchronous queries and group commit
+ *
+ * With CCASK_URING on, gets that have to go to disk are queued on an io_uring instead of being
+ * performed in place. The server starts the queries of every readable connection, submits them
+ * in one batch per poll iteration and sends each response once its completion has been reaped.
+ *
+ * Sets and deletes update the keydir and append their record to the write buffer right away,
+ * so later queries observe them in order; until it is written a record is served from the
+ * buffer. Once per poll iteration ccask_db_commit writes out everything buffered with a single
+ * write and, as the sync policy asks, a single fdatasync, and only then are the sets and
+ * deletes it covers acknowledged:
+ *
+ * 		SYNC_NEVER:    acknowledged when buffered; the kernel decides when data reaches the disk
+ * 		SYNC_INTERVAL: acknowledged after the next sync, at most one every sync_ms milliseconds
+ * 		SYNC_BATCH:    acknowledged after the sync that ends the poll iteration they arrived in
+ * 		SYNC_ALWAYS:   each write is synced on its own before it is acknowledged
+ *
+ * With a ring the commit's write and sync are queued too, linked so the sync only runs once the
+ * write is complete; one commit is in flight at a time. Anything that needs the active file to
+ * be complete on disk (sealing it, swapping in a merge, shutting down) flushes or drains first.
+ *
+ **************/
+
+ccask_db_op* ccask_db_op_new(uint64_t tag, uint8_t cmd, uint32_t key_size, uint32_t value_size) {
+    ccask_db_op* op = malloc(sizeof(ccask_db_op));
+    if (!op) return 0;
+
+    *op = (ccask_db_op) {
+        .tag = tag,
+        .cmd = cmd,
+        .key_size = key_size,
+        .value_size = value_size,
+        .res = -1,
+    };
+
+    return op;
+}
+
+void ccask_db_op_delete(ccask_db_op* op) {
+    if (op) free(op->buf);
+    free(op);
+}
+
+/**@brief if the record at (*fid*, *pos*) has not been written yet, return its bytes*/
+uint8_t* ccask_db_pending_row(const ccask_db* db, uint32_t fid, size_t pos) {
+    size_t wbuf_pos = db->file_pos - db->wbuf_len;
+    if (fid == db->file_id && pos >= wbuf_pos && pos < db->file_pos) return db->wbuf + (pos - wbuf_pos);
+
+    ccask_db_op* op = db->commit;
+    if (op && fid == op->fid && pos >= op->pos && pos < op->pos + op->len) return op->buf + (pos - op->pos);
+
+    return 0;
+}
+
+void ccask_db_op_push_done(ccask_db* db, ccask_db_op* op) {
+    op->next = 0;
+    if (db->done_tail) {
+        db->done_tail->next = op;
+    } else {
+        db->done_head = op;
+    }
+    db->done_tail = op;
+}
+
+void ccask_db_op_unlink(ccask_db* db, ccask_db_op* op) {
+    for (ccask_db_op** p = &db->inflight; *p; p = &(*p)->next) {
+        if (*p == op) {
+            *p = op->next;
+            break;
+        }
+    }
+}
+
+/**@brief hand every set and delete covered by the last sync to the done list*/
+void ccask_db_release_waiting(ccask_db* db) {
+    bool released = false;
+
+    while (db->waiting_head && db->waiting_head->seq <= db->durable_seq) {
+        ccask_db_op* op = db->waiting_head;
+        db->waiting_head = op->next;
+        if (!db->waiting_head) db->waiting_tail = 0;
+
+        op->res = 0;
+        ccask_db_op_push_done(db, op);
+        released = true;
+    }
+
+    if (released) ccask_uring_notify(db->ring);
+}
+
+/**@brief handle a completion of the commit in flight: the write part of a write + sync pair
+ * 		  (*write_part*), or the last of its operations.
+ *
+ * Anything the ring could not do is finished synchronously. A record that cannot be made
+ * durable leaves nothing sensible to acknowledge, so that is fatal, as for ccask_db_flush.
+ */
+void ccask_db_commit_complete(ccask_db* db, ccask_db_op* op, bool write_part, int32_t res) {
+    int fd = db->fds[op->fid];
+    db->inflight_count--;
+
+    // the write completes on its own if no sync is linked to it
+    if ((write_part || !op->sync) && op->len > 0 && (res < 0 || (size_t)res != op->len)) {
+        if (pwrite_full(fd, op->buf, op->len, op->pos) != 0) {
+            perror("ccask_db: commit write");
+            exit(1);
+        }
+    }
+
+    if (write_part) return;
+
+    // a sync cancelled because its write came up short is redone now that the write is complete
+    if (op->sync && res < 0) {
+        if (fdatasync(fd) != 0) {
+            perror("ccask_db: fdatasync");
+            exit(1);
+        }
+    }
+
+    if (op->sync) {
+        if (op->seq > db->durable_seq) db->durable_seq = op->seq;
+        clock_gettime(CLOCK_MONOTONIC, &db->last_sync);
+    }
+
+    ccask_db_op_unlink(db, op);
+    db->commit = 0;
+    ccask_db_op_delete(op);
+    ccask_db_release_waiting(db);
+}
+
+/**@brief ccask_uring_fn: move a completed op from the in-flight list to the done list*/
+void ccask_db_op_complete(void* ctx, uint64_t user_data, int32_t res) {
+    ccask_db* db = ctx;
+    ccask_db_op* op = (ccask_db_op*)(uintptr_t)(user_data & ~(uint64_t)1);
+
+    if (op->cmd == COMMIT_OP) {
+        ccask_db_commit_complete(db, op, user_data & 1, res);
+        return;
+    }
+
+    op->res = res;
+    ccask_db_op_unlink(db, op);
+    db->inflight_count--;
+    ccask_db_op_push_done(db, op);
+}
+
+/**@brief wait for every in-flight op to complete. Their results stay queued for ccask_db_async_reap*/
+void ccask_db_async_drain(ccask_db* db) {
+    if (!db->ring || !db->inflight) return;
+
+    while (db->inflight) {
+        if (ccask_uring_submit(db->ring, 1) < 0) {
+            fprintf(stderr, "ccask_db: io_uring failed\n");
+            exit(1);
+        }
+
+        ccask_uring_reap(db->ring, ccask_db_op_complete, db);
+    }
+
+    // reaping cleared the eventfd; raise it again so the owner collects what we just completed
+    ccask_uring_notify(db->ring);
+}
+
+/**@brief wait until the ring has room for *n* more operations*/
+void ccask_db_ring_reserve(ccask_db* db, size_t n) {
+    // the ring only has room for so many ops at once, and a full completion queue stalls it
+    while (db->inflight && db->inflight_count + n > ccask_uring_entries(db->ring)) {
+        if (ccask_uring_submit(db->ring, 1) < 0) break;
+        ccask_uring_reap(db->ring, ccask_db_op_complete, db);
+        ccask_uring_notify(db->ring);
+    }
+}
+
+/**@brief hand the read of *op* to the ring; if that is impossible it is performed synchronously instead*/
+void ccask_db_op_queue(ccask_db* db, ccask_db_op* op) {
+    ccask_db_ring_reserve(db, 1);
+
+    int fd = db->fds[op->fid];
+    if (ccask_uring_prep_read(db->ring, fd, op->buf, op->len, op->pos, (uintptr_t)op) == 0) {
+        op->next = db->inflight;
+        db->inflight = op;
+        db->inflight_count++;
+        return;
+    }
+
+    op->res = pread_full(fd, op->buf, op->len, op->pos) == 0 ? (int32_t)op->len : -1;
+
+    ccask_db_op_push_done(db, op);
+    ccask_uring_notify(db->ring);
+}
+
+/**@brief write out the write buffer and, if *sync*, make everything appended so far durable.
+ *
+ * Waits for a commit in flight first. Failure to write or sync the active file is fatal: the
+ * keydir already points at the records and acknowledgements may already have gone out.
+ */
+void ccask_db_flush(ccask_db* db, bool sync) {
+    ccask_db_async_drain(db);
+
+    if (db->wbuf_len > 0) {
+        // positional write: the active file has no cursor of its own, file_pos is the only one
+        if (pwrite_full(db->fd, db->wbuf, db->wbuf_len, db->file_pos - db->wbuf_len) != 0) {
+            perror("ccask_db_flush: pwrite");
+            exit(1);
+        }
+
+        db->wbuf_len = 0;
+    }
+
+    if (sync && db->durable_seq < db->write_seq) {
+        if (fdatasync(db->fd) != 0) {
+            perror("ccask_db_flush: fdatasync");
+            exit(1);
+        }
+
+        db->durable_seq = db->write_seq;
+        clock_gettime(CLOCK_MONOTONIC, &db->last_sync);
+    }
+
+    ccask_db_release_waiting(db);
+}
+
+size_t ccask_db_ms_since_sync(const ccask_db* db) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    double ms = (now.tv_sec - db->last_sync.tv_sec) * 1e3 + (now.tv_nsec - db->last_sync.tv_nsec) / 1e6;
+    return ms > 0 ? (size_t)ms : 0;
+}
+
+/**@brief does the sync policy call for a sync at this commit?*/
+bool ccask_db_sync_due(const ccask_db* db) {
+    if (db->durable_seq >= db->write_seq) return false;
+
+    switch (db->sync_policy) {
+    case SYNC_BATCH:
+    case SYNC_ALWAYS:
+        return true;
+    case SYNC_INTERVAL:
+        return ccask_db_ms_since_sync(db) >= db->sync_ms;
+    default:
+        return false;
+    }
+}
+
+/**@brief group commit: write out every record appended since the last commit in one write and,
+ * 		  if the sync policy calls for it, make them durable with one fdatasync. The sets and
+ * 		  deletes this covers are then acknowledged through ccask_db_async_reap.
+ *
+ * The server calls this once per poll iteration. With a ring, the write and sync are queued
+ * and go out with the next ccask_db_async_submit; records appended while a commit is in
+ * flight wait for the next one.
+ */
+void ccask_db_commit(ccask_db* db) {
+    if (!db || db->commit) return;
+
+    bool sync = ccask_db_sync_due(db);
+    if (db->wbuf_len == 0 && !sync) return;
+
+    if (!db->ring) {
+        ccask_db_flush(db, sync);
+        return;
+    }
+
+    ccask_db_op* op = ccask_db_op_new(0, COMMIT_OP, 0, 0);
+    if (!op) {
+        ccask_db_flush(db, sync);
+        return;
+    }
+
+    ccask_db_ring_reserve(db, 2);
+
+    // the commit takes the buffer over; appends from here on start a new one
+    op->fid = db->file_id;
+    op->pos = db->file_pos - db->wbuf_len;
+    op->buf = db->wbuf;
+    op->len = db->wbuf_len;
+    op->seq = db->write_seq;
+    op->sync = sync;
+    db->wbuf = 0;
+    db->wbuf_len = 0;
+    db->wbuf_cap = 0;
+
+    uint64_t user_data = (uintptr_t)op;
+    size_t queued = 0;
+    bool ok = true;
+
+    if (op->len > 0) {
+        ok = ccask_uring_prep_write(db->ring, db->fd, op->buf, op->len, op->pos, sync ? user_data | 1 : user_data) == 0;
+        if (ok) queued++;
+        if (ok && sync) ccask_uring_link(db->ring);
+    }
+
+    if (ok && sync) {
+        ok = ccask_uring_prep_fsync(db->ring, db->fd, true, user_data) == 0;
+        if (ok) queued++;
+    }
+
+    // ccask_db_ring_reserve made room for both, so a failure here means the ring is broken
+    if (!ok) {
+        fprintf(stderr, "ccask_db: io_uring failed\n");
+        exit(1);
+    }
+
+    op->next = db->inflight;
+    db->inflight = op;
+    db->inflight_count += queued;
+    db->commit = op;
+}
+
+/**@brief milliseconds until ccask_db_commit next has a sync to do, or -1 if nothing is waiting
+ * 		  on a timer. The server uses it as its poll timeout.
+ */
+int ccask_db_commit_timeout(const ccask_db* db) {
+    if (!db || db->commit || db->sync_policy != SYNC_INTERVAL || db->durable_seq >= db->write_seq) return -1;
+
+    size_t elapsed = ccask_db_ms_since_sync(db);
+    return elapsed >= db->sync_ms ? 0 : (int)(db->sync_ms - elapsed);
+}
+
+/**@brief queue the acknowledgement of the set or delete just applied until it is durable*/
+ccask_db_op* ccask_db_op_wait(ccask_db* db, uint64_t tag, uint8_t cmd) {
+    ccask_db_op* op = ccask_db_op_new(tag, cmd, 0, 0);
+    if (!op) return 0;
+
+    op->seq = db->write_seq;
+    if (db->waiting_tail) {
+        db->waiting_tail->next = op;
+    } else {
+        db->waiting_head = op;
+    }
+    db->waiting_tail = op;
+
+    return op;
+}
+
+/**@brief start the query in *cmd* on behalf of *tag*.
+ *
+ * Queries that can be answered without waiting on the disk are answered right away: *res* is
+ * set exactly as ccask_query_interp would return it. Otherwise the query is queued and its
+ * result is delivered later by ccask_db_async_reap.
+ *
+ * @return true if the query was queued
+ */
+bool ccask_query_start(ccask_db* db, uint8_t* cmd, uint64_t tag, ccask_result** res) {
+    *res = 0;
+    if (!db || !cmd) return false;
+
+    uint8_t cmd_byte = cmd[4];
+    uint32_t ksz = NWK_BYTE_ARR_U32((cmd+5));
+    uint32_t vsz = NWK_BYTE_ARR_U32((cmd+9));
+    uint32_t ttl = cmd_byte == SET_TTL_CMD ? NWK_BYTE_ARR_U32((cmd+13)) : 0;
+    uint8_t* key = cmd + (cmd_byte == SET_TTL_CMD ? 17 : 13);
+    uint8_t* val = key + ksz;
+
+    // without a sync to wait for, sets and deletes are acknowledged as soon as they are applied
+    bool group = db->sync_policy == SYNC_INTERVAL || db->sync_policy == SYNC_BATCH;
+    bool set = cmd_byte == SET_CMD || cmd_byte == SET_TTL_CMD;
+
+    if (group && (set || cmd_byte == DEL_CMD)) {
+        bool ok = set ? ccask_db_set_ttl(db, ksz, key, vsz, val, ttl) != 0 : ccask_db_del(db, ksz, key) != 0;
+
+        // a failed write has nothing to wait for, and sealing a file may already have synced it
+        if (!ok || db->durable_seq >= db->write_seq) {
+            if (set) *res = ccask_res_new(ok ? SET_SUCCESS : SET_FAIL);
+            else *res = ccask_res_new(ok ? DEL_SUCCESS : DEL_FAIL);
+            return false;
+        }
+
+        if (!ccask_db_op_wait(db, tag, set ? SET_CMD : DEL_CMD)) {
+            // the record is applied; without memory to track it, answer once it is durable
+            ccask_db_flush(db, true);
+            *res = ccask_res_new(set ? SET_SUCCESS : DEL_SUCCESS);
+            return false;
+        }
+
+        return true;
+    }
+
+    if (cmd_byte == GET_CMD && db->ring) {
+        ccask_kdrow* kdr = ccask_db_lookup(db, ksz, key);
+        uint32_t fid = kdr ? ccask_kdrow_fid(kdr) : UINT32_MAX;
+
+        // misses, mapped files and records still being written don't need the disk
+        if (!kdr || fid >= MAX_FILES || db->fds[fid] < 0 || db->maps[fid]
+                || ccask_db_pending_row(db, fid, ccask_kdrow_vpos(kdr))) {
+            *res = ccask_query_interp(db, cmd);
+            return false;
+        }
+
+        ccask_db_op* op = ccask_db_op_new(tag, GET_CMD, ksz, ccask_kdrow_vsize(kdr));
+        if (op) {
+            op->fid = fid;
+            op->crc = db->file_crc[fid];
+            op->version = db->file_version[fid];
+            op->pos = ccask_kdrow_vpos(kdr);
+            op->len = ccask_record_header_bytes(op->version) + ksz + op->value_size;
+            op->buf = malloc(op->len + (db->digest_keys ? ksz : 0));
+
+            // a digest-keyed keydir can't vouch for the record's key, so the key asked for is
+            // kept past the end of the read to check it against
+            if (op->buf && db->digest_keys) memcpy(op->buf + op->len, key, ksz);
+        }
+
+        if (!op || !op->buf) {
+            free(op);
+            *res = ccask_res_new(GET_FAIL);
+            return false;
+        }
+
+        ccask_db_op_queue(db, op);
+        return true;
+    }
+
+    *res = ccask_query_interp(db, cmd);
+    return false;
+}
+
+/**@brief build the response to a completed op*/
+ccask_result* ccask_db_op_result(ccask_db* db, ccask_db_op* op) {
+    // sets and deletes only complete once they are durable
+    if (op->cmd == SET_CMD) return ccask_res_new(SET_SUCCESS);
+    if (op->cmd == DEL_CMD) return ccask_res_new(DEL_SUCCESS);
+
+    if (op->res < 0 || (size_t)op->res != op->len) return ccask_res_new(GET_FAIL);
+    if (!ccask_db_row_is(db, op->buf, op->version, op->key_size, op->buf + op->len)) return ccask_res_new(GET_FAIL);
+
+    ccask_result* res = ccask_res_new(GET_SUCCESS);
+    res->gr = ccask_gr_new(op->value_size, op->buf + ccask_record_header_bytes(op->version) + op->key_size,
+                           crc_check_row(op->buf, op->version, op->crc, op->key_size, op->value_size));
+    return res;
+}
+
+/**@brief submit every query and commit queued since the last call in a single batch
+ *
+ * @return the number of operations submitted, or -1 on error
+ */
+int ccask_db_async_submit(ccask_db* db) {
+    if (!db || !db->ring) return 0;
+    return ccask_uring_submit(db->ring, 0);
+}
+
+/**@brief hand the result of every completed query to *fn*, which takes ownership of it
+ *
+ * @return the number of results delivered
+ */
+size_t ccask_db_async_reap(ccask_db* db, ccask_query_fn fn, void* ctx) {
+    if (!db) return 0;
+
+    if (db->ring) ccask_uring_reap(db->ring, ccask_db_op_complete, db);
+
+    size_t n = 0;
+    while (db->done_head) {
+        ccask_db_op* op = db->done_head;
+        db->done_head = op->next;
+        if (!db->done_head) db->done_tail = 0;
+
+        fn(ctx, op->tag, ccask_db_op_result(db, op));
+        ccask_db_op_delete(op);
+        n++;
+    }
+
+    return n;
+}
+
+/**@brief wait until at least one query has completed*/
+void ccask_db_async_wait(ccask_db* db) {
+    if (!db || !db->ring || db->done_head || !db->inflight) return;
+
+    if (ccask_uring_submit(db->ring, 1) < 0) {
+        fprintf(stderr, "ccask_db: io_uring failed\n");
+        exit(1);
+    }
+}
+
+/**@brief descriptor that becomes readable when queries complete, or -1 if queries are synchronous*/
+int ccask_db_async_fd(const ccask_db* db) {
+    return db && db->ring ? ccask_uring_eventfd(db->ring) : -1;
+}
+
+bool ccask_db_async(const ccask_db* db) {
+    return db && db->ring;
+}
+
+/**************
+ *
+ * merge / compaction
+ *
+ * Every sealed file (id below db->file_id when the merge starts) is read record by record;
+ * records the keydir still points at are copied into output files named <base>_<n>.merge.
+ * When every source has been read, ccask_merge_finish swaps the outputs in: the keydir
+ * is pointed at the copies, the outputs take over the lowest file ids, the sources are
+ * unlinked and any files written since the merge started are renumbered to follow the
+ * outputs, so file ids stay dense and ordered by recency.
+ *
+ **************/
+
+/**@brief percentage of the bytes in sealed files that belong to superseded records*/
+size_t ccask_db_dead_pct(const ccask_db* db) {
+    if (!db) return 0;
+
+    size_t total = 0, dead = 0;
+    for (size_t i = 0; i < db->file_id && i < MAX_FILES; i++) {
+        total += db->file_bytes[i];
+        dead += db->dead_bytes[i];
+    }
+
+    if (total == 0) return 0;
+    return (dead * 100) / total;
+}
+
+bool ccask_db_merging(const ccask_db* db) {
+    return db && db->merge;
+}
+
+/**@brief free a merge and unlink any output files it created*/
+void ccask_merge_abort(ccask_db* db) {
+    ccask_merge* m = db->merge;
+    if (!m) return;
+
+    for (size_t i = 0; i < m->out_count; i++) {
+        close(m->outs[i]);
+        char* fn = ccask_db_filename(db, i, MERGE_SUFFIX);
+        if (fn) unlink(fn);
+        free(fn);
+
+        ccask_hint_writer_delete(m->hints[i]);
+        fn = ccask_db_filename(db, i, MERGE_HINT_SUFFIX);
+        if (fn) unlink(fn);
+        free(fn);
+    }
+
+    for (size_t i = 0; i < m->reloc_count; i++) {
+        free(m->relocs[i].key);
+    }
+
+    free(m->relocs);
+    ccask_reader_destroy(&m->in);
+    free(m);
+    db->merge = 0;
+}
+
+/**@brief begin merging every sealed file. Returns db if a merge is running (or there was nothing to merge), 0 on error*/
+ccask_db* ccask_db_merge_start(ccask_db* db) {
+    if (!db) return 0;
+    if (db->merge) return db;
+
+    ccask_merge* m = calloc(1, sizeof(ccask_merge));
+    if (!m) return 0;
+
+    for (size_t i = 0; i < db->file_id && i < MAX_FILES; i++) {
+        if (db->fds[i] >= 0) m->srcs[m->src_count++] = i;
+    }
+
+    if (m->src_count == 0) {
+        free(m);
+        return db;
+    }
+
+    m->active_id = db->file_id;
+    ccask_reader_init(&m->in, db->fds[m->srcs[0]], db->file_bytes[m->srcs[0]]);
+    m->src_pos = db->file_start[m->srcs[0]];
+    db->merge = m;
+
+    printf("ccask_db_merge: merging %zu sealed files (%zu%% dead)\n", m->src_count, ccask_db_dead_pct(db));
+    return db;
+}
+
+/**@brief open the next merge output file; returns -1 if one cannot be created*/
+int ccask_merge_newout(ccask_db* db) {
+    ccask_merge* m = db->merge;
+
+    // outputs take over the ids of the sources, so there can never be more of them
+    if (m->out_count >= m->src_count) {
+        fprintf(stderr, "ccask_db_merge: more output files than source files\n");
+        return -1;
+    }
+
+    char* fn = ccask_db_filename(db, m->out_count, MERGE_SUFFIX);
+    if (!fn) return -1;
+
+    int out = ccask_db_create(db, fn, m->out_seq + m->out_count);
+    if (out < 0) {
+        fprintf(stderr, "%s\n", fn);
+        perror("open");
+        free(fn);
+        return -1;
+    }
+
+    free(fn);
+
+    fn = ccask_db_filename(db, m->out_count, MERGE_HINT_SUFFIX);
+    m->hints[m->out_count] = ccask_hint_writer_new(fn);
+    free(fn);
+
+    m->outs[m->out_count] = out;
+    m->out_bytes[m->out_count] = CCASK_FILE_HEADER_BYTES;
+    m->out_count++;
+
+    return out;
+}
+
+/**@brief remember that the record for *key* at (old_fid, old_pos) now lives in the current output at new_pos*/
+ccask_merge_reloc* ccask_merge_add_reloc(ccask_merge* m, uint32_t key_size, const uint8_t* key,
+        uint32_t old_fid, size_t old_pos, size_t new_pos, size_t record_bytes) {
+    if (m->reloc_count == m->reloc_cap) {
+        size_t cap = m->reloc_cap ? m->reloc_cap * 2 : 64;
+        ccask_merge_reloc* relocs = realloc(m->relocs, cap * sizeof(ccask_merge_reloc));
+        if (!relocs) return 0;
+        m->relocs = relocs;
+        m->reloc_cap = cap;
+    }
+
+    uint8_t* kcpy = malloc(key_size);
+    if (!kcpy) return 0;
+    memcpy(kcpy, key, key_size);
+
+    ccask_merge_reloc* r = m->relocs + m->reloc_count++;
+    *r = (ccask_merge_reloc) {
+        .key_size = key_size,
+        .key = kcpy,
+        .old_fid = old_fid,
+        .old_pos = old_pos,
+        .out_index = m->out_count - 1,
+        .new_pos = new_pos,
+        .record_bytes = record_bytes,
+    };
+
+    return r;
+}
+
+/**@brief write record *rec* of data file *fid* to *fd* at *pos* in the current format.
+ *
+ * Records of older formats, or with another checksum type than new files, are re-encoded on the
+ * way, unless they are corrupt: those must stay detectably corrupt, so they get the complement
+ * of their new checksum.
+ *
+ * @return the bytes written, or 0 on error
+ */
+size_t ccask_db_rewrite_record(ccask_db* db, size_t fid, const uint8_t* rec, int fd, size_t pos) {
+    uint16_t version = db->file_version[fid];
+    ccask_record_header tmp;
+    const ccask_record_header* src = ccask_record_header_view(version, rec, &tmp);
+    uint32_t ksz = ccask_record_ksz(src);
+    uint32_t vsz = ccask_record_vsz(src);
+    size_t rsz = ccask_record_bytes(FORMAT_VERSION, ksz, vsz);
+
+    if (version == FORMAT_VERSION && db->file_crc[fid] == db->crc) {
+        return pwrite_full(fd, rec, rsz, pos) == 0 ? rsz : 0;
+    }
+
+    uint8_t* key = (uint8_t*)rec + ccask_record_header_bytes(version);
+    uint8_t* value = key + ksz;
+    uint32_t value_bytes = VALUE_BYTES(vsz);
+
+    ccask_record_header hdr;
+    ccask_db_record_header(&hdr, db->crc, ccask_record_timestamp(src), ccask_record_ttl(src), ksz, key, vsz, value);
+    if (!crc_check_row(rec, version, db->file_crc[fid], ksz, vsz)) ccask_record_set_crc(&hdr, ~ccask_record_crc(&hdr));
+
+    static uint8_t zeros[CCASK_RECORD_ALIGN];
+    struct iovec iov[4] = {
+        { .iov_base = &hdr, .iov_len = sizeof(hdr) },
+        { .iov_base = key, .iov_len = ksz },
+        { .iov_base = value, .iov_len = value_bytes },
+        { .iov_base = zeros, .iov_len = rsz - sizeof(hdr) - ksz - value_bytes },
+    };
+
+    return pwritev_full(fd, iov, 4, pos) == 0 ? rsz : 0;
+}
+
+/**@brief swap the merge outputs in for their sources. Returns 0 on success, -1 on error*/
+int ccask_merge_finish(ccask_db* db) {
+    ccask_merge* m = db->merge;
+
+    // in-flight ops refer to files by the ids we are about to change
+    ccask_db_async_drain(db);
+
+    for (size_t i = 0; i < m->out_count; i++) {
+        if (fsync(m->outs[i]) != 0) {
+            perror("ccask_db_merge: flush");
+            return -1;
+        }
+
+        // a missing hint only costs a scan at the next startup
+        if (m->hints[i] && ccask_hint_writer_commit(m->hints[i], m->out_bytes[i]) != 0) {
+            fprintf(stderr, "ccask_db_merge: failed to write hint for output %zu\n", i);
+        }
+    }
+
+    // 1) point the keydir at the copies, unless a key was rewritten while the merge ran
+    size_t out_dead[MAX_FILES] = { 0 };
+    for (size_t i = 0; i < m->reloc_count; i++) {
+        ccask_merge_reloc* r = m->relocs + i;
+        if (!ccask_keydir_move(db->keydir, r->key_size, r->key, r->old_fid, r->old_pos, r->out_index, r->new_pos)) {
+            out_dead[r->out_index] += r->record_bytes;
+        }
+    }
+
+    // 2) files created since the merge started move down to follow the outputs
+    uint32_t remap[MAX_FILES];
+    for (size_t i = 0; i < MAX_FILES; i++) remap[i] = i;
+
+    size_t next_id = m->out_count;
+    for (size_t i = m->active_id; i <= db->file_id; i++) {
+        if (db->fds[i] >= 0) remap[i] = next_id++;
+    }
+
+    ccask_keydir_remap(db->keydir, remap, db->file_id + 1);
+
+    // 3) on disk: outputs replace the lowest ids, remaining sources go away, newer files shift down
+    int fds[MAX_FILES];
+    uint8_t* maps[MAX_FILES] = { 0 };
+    size_t file_bytes[MAX_FILES] = { 0 };
+    size_t dead_bytes[MAX_FILES] = { 0 };
+    size_t file_start[MAX_FILES] = { 0 };
+    crc_type file_crc[MAX_FILES] = { 0 };
+    uint16_t file_version[MAX_FILES] = { 0 };
+    uint64_t file_seq[MAX_FILES] = { 0 };
+    for (size_t i = 0; i < MAX_FILES; i++) fds[i] = -1;
+
+    // the merge's read window may still refer to a source descriptor
+    ccask_reader_destroy(&m->in);
+
+    for (size_t i = 0; i < m->src_count; i++) {
+        ccask_db_unmap(db, m->srcs[i]);
+        close(db->fds[m->srcs[i]]);
+        db->fds[m->srcs[i]] = -1;
+
+        // source hints go first so no hint can outlive the data it describes
+        char* fn = ccask_db_filename(db, m->srcs[i], HINT_SUFFIX);
+        unlink(fn);
+        free(fn);
+    }
+
+    for (size_t i = 0; i < m->out_count; i++) {
+        char* from = ccask_db_filename(db, i, MERGE_SUFFIX);
+        char* to = ccask_db_filename(db, i, 0);
+        if (rename(from, to) != 0) {
+            fprintf(stderr, "ccask_db_merge: rename %s -> %s\n", from, to);
+            perror("rename");
+            exit(1);
+        }
+
+        free(from);
+        free(to);
+
+        from = ccask_db_filename(db, i, MERGE_HINT_SUFFIX);
+        to = ccask_db_filename(db, i, HINT_SUFFIX);
+        rename(from, to);
+        free(from);
+        free(to);
+
+        fds[i] = m->outs[i];
+        file_bytes[i] = m->out_bytes[i];
+        dead_bytes[i] = out_dead[i];
+        file_start[i] = CCASK_FILE_HEADER_BYTES;
+        file_crc[i] = db->crc;
+        file_version[i] = FORMAT_VERSION;
+        file_seq[i] = m->out_seq[i];
+    }
+
+    for (size_t i = 0; i < m->src_count; i++) {
+        if (m->srcs[i] < m->out_count) continue; // already replaced by an output
+
+        char* fn = ccask_db_filename(db, m->srcs[i], 0);
+        if (unlink(fn) != 0) perror("ccask_db_merge: unlink");
+        free(fn);
+    }
+
+    for (size_t i = m->active_id; i <= db->file_id; i++) {
+        if (db->fds[i] < 0) continue;
+
+        if (remap[i] != i) {
+            char* from = ccask_db_filename(db, i, 0);
+            char* to = ccask_db_filename(db, remap[i], 0);
+            if (rename(from, to) != 0) {
+                fprintf(stderr, "ccask_db_merge: rename %s -> %s\n", from, to);
+                perror("rename");
+                exit(1);
+            }
+
+            free(from);
+            free(to);
+
+            // sealed files written during the merge have hints too; the active file does not
+            from = ccask_db_filename(db, i, HINT_SUFFIX);
+            to = ccask_db_filename(db, remap[i], HINT_SUFFIX);
+            rename(from, to);
+            free(from);
+            free(to);
+        }
+
+        fds[remap[i]] = db->fds[i];
+        maps[remap[i]] = db->maps[i];
+        file_bytes[remap[i]] = db->file_bytes[i];
+        dead_bytes[remap[i]] = db->dead_bytes[i];
+        file_start[remap[i]] = db->file_start[i];
+        file_crc[remap[i]] = db->file_crc[i];
+        file_version[remap[i]] = db->file_version[i];
+        file_seq[remap[i]] = db->file_seq[i];
+    }
+
+    memcpy(db->fds, fds, sizeof(fds));
+    memcpy(db->maps, maps, sizeof(maps));
+    memcpy(db->file_bytes, file_bytes, sizeof(file_bytes));
+    memcpy(db->dead_bytes, dead_bytes, sizeof(dead_bytes));
+    memcpy(db->file_start, file_start, sizeof(file_start));
+    memcpy(db->file_crc, file_crc, sizeof(file_crc));
+    memcpy(db->file_version, file_version, sizeof(file_version));
+    memcpy(db->file_seq, file_seq, sizeof(file_seq));
+    db->file_id = remap[db->file_id];
+
+    for (size_t i = 0; i < m->out_count; i++) ccask_db_map(db, i);
+
+    printf("ccask_db_merge: %zu sealed files merged into %zu; active file is now %zu\n",
+           m->src_count, m->out_count, db->file_id);
+
+    // the files the last checkpoint covers are gone
+    db->checkpoint_stale = true;
+
+    // the outputs now belong to db->fds, so the abort path must not touch them
+    for (size_t i = 0; i < m->out_count; i++) ccask_hint_writer_delete(m->hints[i]);
+    m->out_count = 0;
+    ccask_merge_abort(db);
+
+    return 0;
+}
+
+/**@brief copy live records from the merge sources to its outputs, examining at most MERGE_STEP_BYTES
+ * 		  of source data per call.
+ *
+ * @return 1 while the merge has more work to do, 0 once it has been swapped in (or if no merge is
+ * 		   running), and -1 if the merge failed and was abandoned. A failed merge leaves the db untouched.
+ */
+int ccask_db_merge_step(ccask_db* db) {
+    if (!db || !db->merge) return 0;
+
+    ccask_merge* m = db->merge;
+    size_t budget = MERGE_STEP_BYTES;
+
+    while (budget > 0) {
+        if (m->src_index == m->src_count) {
+            if (ccask_merge_finish(db) != 0) {
+                ccask_merge_abort(db);
+                return -1;
+            }
+
+            return 0;
+        }
+
+        uint32_t fid = m->srcs[m->src_index];
+
+        if (m->src_pos >= db->file_bytes[fid]) {
+            m->src_index++;
+            m->src_pos = 0;
+            if (m->src_index < m->src_count) {
+                uint32_t next = m->srcs[m->src_index];
+                ccask_reader_destroy(&m->in);
+                ccask_reader_init(&m->in, db->fds[next], db->file_bytes[next]);
+                m->src_pos = db->file_start[next];
+            }
+            continue;
+        }
+
+        // every record of a source must be accounted for, otherwise the keydir could be left
+        // pointing at a file we are about to delete
+        uint16_t version = db->file_version[fid];
+        uint8_t* rec = ccask_reader_at(&m->in, m->src_pos, ccask_record_header_bytes(version));
+        if (!rec) {
+            fprintf(stderr, "ccask_db_merge: short header in file %u at %zu\n", fid, m->src_pos);
+            ccask_merge_abort(db);
+            return -1;
+        }
+
+        ccask_record_header tmp;
+        const ccask_record_header* hdr = ccask_record_header_view(version, rec, &tmp);
+        time_t ts = ccask_record_timestamp(hdr);
+        uint32_t ttl = ccask_record_ttl(hdr);
+        uint32_t ksz = ccask_record_ksz(hdr);
+        uint32_t vsz = ccask_record_vsz(hdr);
+        size_t rsz = ccask_record_bytes(version, ksz, vsz);
+
+        bool fits = rsz <= db->file_bytes[fid] - m->src_pos;
+        rec = fits ? ccask_reader_at(&m->in, m->src_pos, rsz) : 0;
+        if (fits && !rec) {
+            fprintf(stderr, "ccask_db_merge: short read in file %u at %zu\n", fid, m->src_pos);
+            ccask_merge_abort(db);
+            return -1;
+        }
+
+        uint8_t* key = fits ? rec + ccask_record_header_bytes(version) : 0;
+        // an expired record is dropped from the keydir here, so it is not live and is not copied
+        ccask_kdrow* kdr = fits ? ccask_db_lookup(db, ksz, key) : 0;
+        bool live = kdr && ccask_kdrow_fid(kdr) == fid && ccask_kdrow_vpos(kdr) == m->src_pos;
+
+        // the sizes of a corrupt record can't be trusted to find the next one; startup skipped
+        // the same region, so the keydir does not point into it
+        if (!live && (!fits || !crc_check_row(rec, version, db->file_crc[fid], ksz, vsz))) {
+            size_t next = ccask_db_resync(db, &m->in, fid, m->src_pos);
+            if (next == SIZE_MAX) next = db->file_bytes[fid];
+
+            fprintf(stderr, "ccask_db_merge: file %u: skipping %zu corrupt bytes at %zu\n", fid, next - m->src_pos, m->src_pos);
+            budget = next - m->src_pos > budget ? 0 : budget - (next - m->src_pos);
+            m->src_pos = next;
+            continue;
+        }
+
+        if (live) {
+            size_t out_rsz = ccask_record_bytes(FORMAT_VERSION, ksz, vsz);
+            int out = m->out_count ? m->outs[m->out_count-1] : -1;
+            if (out < 0 || m->out_bytes[m->out_count-1] + out_rsz > MAX_FILE_BYTES) out = ccask_merge_newout(db);
+
+            size_t new_pos = out >= 0 ? m->out_bytes[m->out_count-1] : 0;
+            if (out < 0 || ccask_db_rewrite_record(db, fid, rec, out, new_pos) != out_rsz
+                    || !ccask_merge_add_reloc(m, ksz, key, fid, m->src_pos, new_pos, out_rsz)) {
+                ccask_merge_abort(db);
+                return -1;
+            }
+
+            ccask_hint_writer** hint = m->hints + m->out_count - 1;
+            if (*hint && !ccask_hint_writer_add(*hint, ts, ttl, ksz, key, vsz, new_pos)) {
+                ccask_hint_writer_delete(*hint);
+                *hint = 0;
+            }
+
+            m->out_bytes[m->out_count-1] += out_rsz;
+        }
+
+        m->src_pos += rsz;
+        budget = rsz > budget ? 0 : budget - rsz;
+    }
+
+    return 1;
 }
 
-/**
- * set implementation
- * 1) calc crc
- * 2) at file_pos write crc timestamp keysize valuesize key value
- * 3) create and insert a keydir entry
+/**@brief run a merge of every sealed file to completion
  *
- * Keydir value_pos should be file_pos prior to write
+ * A merge that is already running only covers the files that were sealed when it started,
+ * so it is finished first and a fresh one is run over everything sealed since.
  */
-ccask_db* ccask_db_set(ccask_db* db, uint32_t key_size, uint8_t* key, uint32_t value_size, uint8_t* value) {
-    time_t ts = time(NULL);
+ccask_db* ccask_db_merge(ccask_db* db) {
+    if (!db) return 0;
 
-    // allocate a byte array large enough for the
-    size_t row_size = sizeof(uint32_t) + sizeof(ts) + sizeof(key_size) + key_size + sizeof(value_size) + value_size;
+    int res;
+    while ((res = ccask_db_merge_step(db)) == 1);
+    if (res != 0) return 0;
 
-    // check to see if we have room in the file for this row
-    // if not, we need to go to a new file
-    if(db->bytes_written + row_size > MAX_FILE_BYTES || db->bytes_written + row_size < db->bytes_written) ccask_db_newfile(db);
+    if (!ccask_db_merge_start(db)) return 0;
+    while ((res = ccask_db_merge_step(db)) == 1);
 
-    uint8_t* row = malloc(row_size);
-
-    // copy each piece to the byte array
-    // TODO: here is where we really want to use the *_serialize methods
-    // but it doesn't really make sense since we need to construct most
-    // of the row in order to calculate the CRC. Is there a better way to do this?
-    size_t index = sizeof(uint32_t); // start offset from the CRC
-    memcpy(row+index, &ts, sizeof(ts));
-    index += sizeof(ts);
-    memcpy(row+index, &key_size, sizeof(key_size));
-    index += sizeof(key_size);
-    memcpy(row+index, &value_size, sizeof(value_size));
-    index += sizeof(value_size);
-    memcpy(row+index, key, key_size);
-    index += key_size;
-    memcpy(row+index, value, value_size);
+    return res == 0 ? db : 0;
+}
 
-    // calc the crc -- assuming crc_init has been called elsewhere.
-    uint32_t crc = crc_compute(row+sizeof(uint32_t), row_size-sizeof(uint32_t));
-    memcpy(row, &crc, sizeof(crc));
+/**************
+ *
+ * snapshot iterators
+ *
+ * A ccask_db_iterator walks the keyspace as it stood when the iterator was created. Creating
+ * one writes out the write buffer and copies the location of every live key, sorted by file id
+ * and position so the values are read sequentially through a read window, and duplicates the
+ * descriptor of every data file. Keys are copied too, unless the keydir only holds their
+ * digests; then each is read from its record when asked for. Sets, deletes and merges that follow don't disturb it: records
+ * are never modified in place, and a file that a merge unlinks stays readable through the
+ * duplicate until the iterator is deleted.
+ *
+ * With an ordered keydir, ccask_db_iterator_from and ccask_db_iterator_range take the snapshot
+ * from a start key on, up to an end key, or across the keys with a prefix, and keep its entries
+ * in key order instead.
+ *
+ **************/
 
-    if (ftell(db->file) != db->file_pos) {
-        if(fseek(db->file, db->file_pos, SEEK_SET) == -1) {
-            perror("seek error");
-            errno = 0;
-            return 0;
+typedef struct ccask_iter_entry {
+    uint32_t file_id;
+    uint32_t key_size;
+    uint32_t value_size;
+    size_t value_pos;
+    size_t key_off;             // offset of the key in the iterator's key buffer
+} ccask_iter_entry;
+
+struct ccask_db_iterator {
+    ccask_iter_entry* entries;  // sorted by file id, then position; or by key, in an ordered snapshot
+    size_t count;
+    size_t cap;
+    size_t next;                // index of the entry ccask_db_iterator_next moves to
+
+    uint8_t* keys;              // with digest_keys, just the key of the current entry
+    size_t keys_len;
+    size_t keys_cap;
+    bool digest_keys;
+
+    time_t now;                 // keys that expired by the snapshot are left out
+    bool failed;                // an allocation failed while the snapshot was taken
+
+    // the bounds of an ordered snapshot, only looked at while it is taken
+    uint32_t end_size;          // 0 for none
+    const uint8_t* end;
+    bool prefix;                // end is a prefix of every key rather than past the last one
+    size_t limit;               // 0 for none
+
+    // the data files as of the snapshot
+    int fds[MAX_FILES];
+    size_t file_bytes[MAX_FILES];
+    crc_type file_crc[MAX_FILES];
+    uint16_t file_version[MAX_FILES];
+
+    ccask_reader in;            // read window over the file of the current entry
+    uint32_t in_fid;
+};
+
+/**@brief ccask_kdrow_fn that adds a keydir row to the snapshot of a ccask_db_iterator*/
+void ccask_db_iterator_add(void* ctx, ccask_kdrow* kdr) {
+    ccask_db_iterator* it = ctx;
+    uint32_t ksz = ccask_kdrow_ksize(kdr);
+    uint32_t copy = it->digest_keys ? 0 : ksz;
+    time_t expiry = ccask_kdrow_expiry(kdr);
+
+    if (it->failed || ccask_kdrow_fid(kdr) >= MAX_FILES || (expiry != 0 && it->now >= expiry)) return;
+
+    if (it->count == it->cap) {
+        size_t cap = it->cap ? it->cap * 2 : 256;
+        ccask_iter_entry* entries = realloc(it->entries, cap * sizeof(ccask_iter_entry));
+        if (!entries) {
+            it->failed = true;
+            return;
         }
+        it->entries = entries;
+        it->cap = cap;
     }
 
-    size_t n = fwrite(row, 1, row_size, db->file);
-    db->bytes_written += row_size;
+    if (it->keys_len + copy > it->keys_cap) {
+        size_t cap = it->keys_cap ? it->keys_cap : 4096;
+        while (cap < it->keys_len + copy) cap *= 2;
+        uint8_t* keys = realloc(it->keys, cap);
+        if (!keys) {
+            it->failed = true;
+            return;
+        }
+        it->keys = keys;
+        it->keys_cap = cap;
+    }
 
-    // if we didn't write a full row, just return a null pointer.
-    // we won't reset the file_pos or create a keydir entry.
-    // so we will try to overwrite whatever we wrote with the next ccask_db_set
-    // TODO: real error handling in this function so the caller can react appropriately
-    if(n != row_size) return 0;
+    if (copy) memcpy(it->keys + it->keys_len, ccask_kdrow_key(kdr), copy);
+    it->entries[it->count++] = (ccask_iter_entry) {
+        .file_id = ccask_kdrow_fid(kdr),
+        .key_size = ksz,
+        .value_size = ccask_kdrow_vsize(kdr),
+        .value_pos = ccask_kdrow_vpos(kdr),
+        .key_off = it->keys_len,
+    };
+    it->keys_len += copy;
+}
 
-    size_t value_pos = db->file_pos;
-    db->file_pos = ftell(db->file);
+/**@brief order keys like an ordered keydir: as memcmp, with a key ahead of any longer one it begins*/
+int ccask_key_cmp(uint32_t a_size, const uint8_t* a, uint32_t b_size, const uint8_t* b) {
+    uint32_t n = a_size < b_size ? a_size : b_size;
+    int c = n ? memcmp(a, b, n) : 0;
+    if (c != 0) return c;
 
-    // now create the keydir entry
-    ccask_kdrow* kdr = ccask_kdrow_new(key_size, key, db->file_id, value_size, value_pos, ts);
-    if(!ccask_keydir_insert(db->keydir, kdr)) return 0;
+    return a_size < b_size ? -1 : a_size > b_size;
+}
 
-    free(row);
-    ccask_kdrow_delete(kdr); // I believe it is safe to do this bc ccask_keydir_insert ends up allocating its own memory.
+/**@brief ccask_kdscan_fn that adds keydir rows to the snapshot of a ccask_db_iterator in key
+ * 		  order, up to its bounds
+ */
+bool ccask_db_iterator_add_ordered(void* ctx, ccask_kdrow* kdr) {
+    ccask_db_iterator* it = ctx;
+    uint32_t ksz = ccask_kdrow_ksize(kdr);
+    uint8_t* key = ccask_kdrow_key(kdr);
+
+    // keys come in order, so the first one out of bounds ends the snapshot
+    if (it->limit && it->count == it->limit) return false;
+    if (it->end_size && it->prefix && (ksz < it->end_size || memcmp(key, it->end, it->end_size) != 0)) return false;
+    if (it->end_size && !it->prefix && ccask_key_cmp(ksz, key, it->end_size, it->end) >= 0) return false;
+
+    ccask_db_iterator_add(ctx, kdr);
+    return !it->failed;
+}
 
+int ccask_iter_entry_cmp(const void* a, const void* b) {
+    const ccask_iter_entry* x = a;
+    const ccask_iter_entry* y = b;
 
-    return db;
+    if (x->file_id != y->file_id) return x->file_id < y->file_id ? -1 : 1;
+    if (x->value_pos != y->value_pos) return x->value_pos < y->value_pos ? -1 : 1;
+    return 0;
 }
 
-/**@brief take each byte from a uint32_t and write it to the index in a uint8_t* */
-// TODO: dedup this between here and ccask_header
-uint8_t* split_uint32t_bytewise(uint8_t* dest, uint32_t src, size_t index) {
-    if (!dest) return 0;
+/**@brief take a snapshot of every key of *db*, or with *ordered* of the keys in key order from
+ * 		  *start* on, within the bounds of ccask_db_iterator_range
+ */
+ccask_db_iterator* ccask_db_iterator_open(ccask_db* db, bool ordered, uint32_t start_size, uint8_t* start,
+        uint32_t end_size, uint8_t* end, bool prefix, size_t limit) {
+    if (!db || (ordered && !ccask_keydir_ordered(db->keydir))) return 0;
+
+    ccask_db_iterator* it = malloc(sizeof(ccask_db_iterator));
+    if (!it) return 0;
+
+    *it = (ccask_db_iterator) {
+        .now = time(NULL),
+        .in_fid = UINT32_MAX,
+        .digest_keys = db->digest_keys,
+        .end_size = end_size,
+        .end = end,
+        .prefix = prefix,
+        .limit = limit,
+    };
+    for (size_t i = 0; i < MAX_FILES; i++) it->fds[i] = -1;
+    ccask_reader_init(&it->in, -1, 0);
+
+    // records still in the write buffer have to be in the file to be read from it
+    ccask_db_flush(db, false);
 
-    dest[index] = (src & 0x000000ff);
-    dest[index+1] = (src & 0x0000ff00) >> 8;
-    dest[index+2] = (src & 0x00ff0000) >> 16;
-    dest[index+3] = (src & 0xff000000) >> 24;
+    for (size_t i = 0; i < MAX_FILES && !it->failed; i++) {
+        if (db->fds[i] < 0) continue;
 
-    return dest;
-}
+        it->fds[i] = dup(db->fds[i]);
+        if (it->fds[i] < 0) {
+            perror("ccask_db_iterator: dup");
+            it->failed = true;
+        }
 
-/**@brief take each byte from a time_t and write it to the index in a uint8_t*. */
-uint8_t* split_timet_bytewise(uint8_t* dest, time_t src, size_t index) {
-    if (!dest) return 0;
+        it->file_bytes[i] = db->file_bytes[i];
+        it->file_crc[i] = db->file_crc[i];
+        it->file_version[i] = db->file_version[i];
+    }
 
-    size_t tsz = sizeof(time_t);
-    uint8_t* ptr = dest + index;
+    // keys with a prefix start no earlier than the prefix itself
+    if (prefix && end_size && ccask_key_cmp(start_size, start, end_size, end) < 0) {
+        start_size = end_size;
+        start = end;
+    }
 
-    for (size_t i = tsz-1; i < tsz; --i) {
-        time_t mask = 0xff << (i * 8);
-        time_t offset = 8 * i;
-        ptr[index+i] = (src & mask) >> offset;
+    if (!it->failed && ordered) {
+        ccask_keydir_scan(db->keydir, start_size, start, ccask_db_iterator_add_ordered, it);
+    } else if (!it->failed) {
+        ccask_keydir_foreach(db->keydir, ccask_db_iterator_add, it);
     }
 
-    return dest;
+    if (it->failed) {
+        ccask_db_iterator_delete(it);
+        return 0;
+    }
+
+    if (!ordered) qsort(it->entries, it->count, sizeof(ccask_iter_entry), ccask_iter_entry_cmp);
+
+    return it;
 }
 
-/**@brief given a header struct and key-value struct, return true if the CRC in the header
- * 		  matches the CRC computed for the header and key-value.
+/**@brief take a snapshot of *db* to iterate over. Returns 0 on error.
+ *
+ * The iterator starts before its first entry; move to it with ccask_db_iterator_next.
  */
-bool crc_check(const ccask_header* hdr, const ccask_kv* kv) {
-    if (!hdr || !kv) return false;
+ccask_db_iterator* ccask_db_iterator_new(ccask_db* db) {
+    return ccask_db_iterator_open(db, false, 0, 0, 0, 0, false, 0);
+}
 
-    time_t ts = ccask_header_timestamp(hdr);
-    uint32_t ksz = ccask_header_ksz(hdr);
-    uint32_t vsz = ccask_header_vsz(hdr);
-    uint32_t crc = ccask_header_crc(hdr);
+/**@brief take a snapshot of the keys of *db* from *start* on (all of them when *start_size* is
+ * 		  0), to iterate over in key order. Returns 0 on error, or if the keydir is not ordered.
+ */
+ccask_db_iterator* ccask_db_iterator_from(ccask_db* db, uint32_t start_size, uint8_t* start) {
+    return ccask_db_iterator_open(db, true, start_size, start, 0, 0, false, 0);
+}
 
-    if (ksz != ccask_kv_ksz(kv)) return false;
-    if (vsz != ccask_kv_vsz(kv)) return false;
+/**@brief ccask_db_iterator_from, stopping before *end* or, with *prefix*, taking only the keys
+ * 		  that start with *end*; and after *limit* keys, unless it is 0. An *end_size* of 0
+ * 		  sets no bound.
+ */
+ccask_db_iterator* ccask_db_iterator_range(ccask_db* db, uint32_t start_size, uint8_t* start, uint32_t end_size, uint8_t* end,
+        bool prefix, size_t limit) {
+    return ccask_db_iterator_open(db, true, start_size, start, end_size, end, prefix, limit);
+}
 
-    uint8_t* key = malloc(ksz);
-    uint8_t* val = malloc(vsz);
-    key = ccask_kv_key(key, kv);
-    val = ccask_kv_value(val, kv);
+/**@brief move to the next entry. Returns false once every entry has been visited*/
+bool ccask_db_iterator_next(ccask_db_iterator* it) {
+    if (!it || it->next >= it->count) return false;
 
-    // create a buffer that can hold everything but the CRC
-    size_t row_size = HEADER_BYTES + ksz + vsz - sizeof(uint32_t);
-    uint8_t* row_ptr = malloc(row_size);
+    it->next++;
+    return true;
+}
 
-    size_t index = 0;
-    split_timet_bytewise(row_ptr, ts, index);
-    index += sizeof(time_t);
-    split_uint32t_bytewise(row_ptr, ccask_header_ksz(hdr), index);
-    index += sizeof(uint32_t);
-    split_uint32t_bytewise(row_ptr, ccask_header_vsz(hdr), index);
-    index += sizeof(uint32_t);
-    memcpy(row_ptr + index, key, ksz);
-    index += ksz;
-    memcpy(row_ptr + index, val, vsz);
-    index += vsz;
+/**@brief the current entry, or 0 before the first one*/
+const ccask_iter_entry* ccask_db_iterator_entry(const ccask_db_iterator* it) {
+    return it && it->next > 0 ? it->entries + it->next - 1 : 0;
+}
+
+uint32_t ccask_db_iterator_ksz(const ccask_db_iterator* it) {
+    const ccask_iter_entry* e = ccask_db_iterator_entry(it);
+    return e ? e->key_size : 0;
+}
 
-    uint32_t computed_crc = crc_compute(row_ptr, row_size);
+/**@brief the first *bytes* of the record of entry *e*, read through the iterator's window, or 0*/
+uint8_t* ccask_db_iterator_record(ccask_db_iterator* it, const ccask_iter_entry* e, size_t bytes) {
+    uint32_t fid = e->file_id;
+    if (fid != it->in_fid) {
+        ccask_reader_destroy(&it->in);
+        ccask_reader_init(&it->in, it->fds[fid], it->file_bytes[fid]);
+        it->in_fid = fid;
+    }
 
-    free(row_ptr);
-    free(key);
-    free(val);
+    return ccask_reader_at(&it->in, e->value_pos, bytes);
+}
 
-    if (computed_crc == crc) return true;
+/**@brief the key of the current entry. It stays valid until the iterator is deleted or, when
+ * 		  the keydir only holds digests and the key is read from its record, until it moves on.
+ */
+const uint8_t* ccask_db_iterator_key(ccask_db_iterator* it) {
+    const ccask_iter_entry* e = ccask_db_iterator_entry(it);
+    if (!e) return 0;
+    if (!it->digest_keys) return it->keys + e->key_off;
+
+    size_t key_off = ccask_record_header_bytes(it->file_version[e->file_id]);
+    uint8_t* rec = ccask_db_iterator_record(it, e, key_off + e->key_size);
+    if (!rec) return 0;
+
+    if (e->key_size > it->keys_cap) {
+        uint8_t* keys = realloc(it->keys, e->key_size);
+        if (!keys) return 0;
+        it->keys = keys;
+        it->keys_cap = e->key_size;
+    }
 
-    return false;
+    memcpy(it->keys, rec + key_off, e->key_size);
+    return it->keys;
 }
 
-/**
- * get implementation
- * 1) try to get kdrow from keydir (ccask_keydir_get(...))
- * 2) from kdrow, we additionally get value_size, file_id, value_pos
- * 3) now from our file pointer, we seek to value_pos.
- * 4) read 32 bit crc
- * 5) read 32 bit tstamp, 32bit ksz, 32bit valuesz, key_size bytes key, value_size bytes value.
- * 6) calc crc of values from (5)
- * 7) compare read crc and calc'd crc
- * 8) return the value & crc result.
+/**@brief read the value of the current entry as it was at the snapshot, like ccask_db_get.
+ * 		  Returns 0 if it cannot be read.
  */
-ccask_get_result* ccask_db_get(ccask_db* db, uint32_t key_size, uint8_t* key) {
-    if (!db) return 0;
+ccask_get_result* ccask_db_iterator_get(ccask_db_iterator* it) {
+    const ccask_iter_entry* e = ccask_db_iterator_entry(it);
+    if (!e) return 0;
 
-    ccask_kdrow* kdr = ccask_keydir_get(db->keydir, key_size, key);
-    if (!kdr) {
-        return 0;
+    uint32_t fid = e->file_id;
+    uint16_t version = it->file_version[fid];
+    size_t value_off = ccask_record_header_bytes(version) + e->key_size;
+    uint8_t* rec = ccask_db_iterator_record(it, e, value_off + e->value_size);
+    if (!rec) return 0;
+
+    return ccask_gr_new(e->value_size, rec + value_off, crc_check_row(rec, version, it->file_crc[fid], e->key_size, e->value_size));
+}
+
+/**@brief the number of keys in the snapshot*/
+size_t ccask_db_iterator_count(const ccask_db_iterator* it) {
+    return it ? it->count : 0;
+}
+
+void ccask_db_iterator_delete(ccask_db_iterator* it) {
+    if (!it) return;
+
+    ccask_reader_destroy(&it->in);
+    for (size_t i = 0; i < MAX_FILES; i++) {
+        if (it->fds[i] >= 0) close(it->fds[i]);
     }
 
-    uint32_t file_id = ccask_kdrow_fid(kdr);
-    uint32_t value_size = ccask_kdrow_vsize(kdr);
-    size_t value_pos = ccask_kdrow_vpos(kdr);
+    free(it->entries);
+    free(it->keys);
+    free(it);
+}
 
-    if (file_id == UINT32_MAX || value_size == UINT32_MAX || value_pos == SIZE_MAX) {
-        return 0;
+/**************
+ *
+ * scans
+ *
+ * A SCAN query is answered from an ordered snapshot of the keys it covers (see
+ * ccask_db_iterator_range), which ccask_res_bytes renders one response at a time, in key order:
+ *
+ * 		msgsz | SCAN_SUCCESS | pair count (4) | { key size (4) | value size (4) | key | value } ...
+ *
+ * for as many responses as the pairs need, then a SCAN_DONE status response; or SCAN_FAIL
+ * instead, once a value can't be read or a pair won't fit in a response on its own. Values are
+ * read a batch of up to SCAN_BATCH_BYTES of records at a time, sorted by file and position
+ * within the batch, so a long scan reads forwards through the files and mostly out of the read
+ * window, whatever order its keys were written in.
+ *
+ **************/
+
+uint32_t ccask_sr_bytes(response_type rt, uint8_t* buf, size_t buflen);
+
+typedef struct ccask_scan_read {
+    uint32_t file_id;
+    size_t value_pos;
+    size_t index;               // of the snapshot entry read
+} ccask_scan_read;
+
+struct ccask_scan {
+    ccask_db_iterator* it;
+    size_t next;                // the first entry not rendered yet
+    size_t batch_start;         // the entries whose values have been read
+    size_t batch_end;
+    uint8_t* values;
+    size_t* value_off;          // offset of the value of each entry of the batch in values
+    bool failed;
+    bool finished;              // the last response has been rendered
+};
+
+ccask_scan* ccask_scan_new(ccask_db_iterator* it) {
+    ccask_scan* sc = malloc(sizeof(ccask_scan));
+    if (!sc) return 0;
+
+    *sc = (ccask_scan) {
+        .it = it,
+    };
+    return sc;
+}
+
+void ccask_scan_delete(ccask_scan* sc) {
+    if (!sc) return;
+
+    ccask_db_iterator_delete(sc->it);
+    free(sc->values);
+    free(sc->value_off);
+    free(sc);
+}
+
+int ccask_scan_read_cmp(const void* a, const void* b) {
+    const ccask_scan_read* x = a;
+    const ccask_scan_read* y = b;
+
+    if (x->file_id != y->file_id) return x->file_id < y->file_id ? -1 : 1;
+    if (x->value_pos != y->value_pos) return x->value_pos < y->value_pos ? -1 : 1;
+    return 0;
+}
+
+/**@brief read the values of the next batch of entries, from sc->next on, in file order.
+ * 		  Returns false if one can't be read or fails its checksum.
+ */
+bool ccask_scan_load(ccask_scan* sc) {
+    ccask_db_iterator* it = sc->it;
+    size_t first = sc->next, end = first;
+    size_t record_bytes = 0, value_bytes = 0;
+
+    for (; end < it->count; end++) {
+        ccask_iter_entry* e = it->entries + end;
+        size_t bytes = ccask_record_header_bytes(it->file_version[e->file_id]) + e->key_size + e->value_size;
+        if (end > first && record_bytes + bytes > SCAN_BATCH_BYTES) break;
+
+        record_bytes += bytes;
+        value_bytes += e->value_size;
     }
 
-    FILE* file = db->files[file_id];
+    size_t n = end - first;
+    ccask_scan_read* reads = malloc(n * sizeof(ccask_scan_read));
+    free(sc->values);
+    free(sc->value_off);
+    sc->values = malloc(value_bytes + 1);
+    sc->value_off = malloc(n * sizeof(size_t));
+    sc->batch_start = sc->batch_end = first;
+
+    if (!reads || !sc->values || !sc->value_off) {
+        free(reads);
+        return false;
+    }
 
-    if (fseek(file, value_pos, SEEK_SET) != 0) {
-        perror("seek error");
-        errno = 0;
-        return 0;
+    size_t off = 0;
+    for (size_t i = 0; i < n; i++) {
+        ccask_iter_entry* e = it->entries + first + i;
+        reads[i] = (ccask_scan_read) {
+            .file_id = e->file_id, .value_pos = e->value_pos, .index = first + i,
+        };
+        sc->value_off[i] = off;
+        off += e->value_size;
+    }
+    qsort(reads, n, sizeof(ccask_scan_read), ccask_scan_read_cmp);
+
+    bool ok = true;
+    for (size_t i = 0; i < n && ok; i++) {
+        ccask_iter_entry* e = it->entries + reads[i].index;
+        uint16_t version = it->file_version[e->file_id];
+        size_t value_off = ccask_record_header_bytes(version) + e->key_size;
+        uint8_t* rec = ccask_db_iterator_record(it, e, value_off + e->value_size);
+
+        ok = rec && crc_check_row(rec, version, it->file_crc[e->file_id], e->key_size, e->value_size);
+        if (ok) memcpy(sc->values + sc->value_off[reads[i].index - first], rec + value_off, e->value_size);
     }
 
-    size_t row_size = HEADER_BYTES + value_size + key_size;
+    free(reads);
+    if (ok) sc->batch_end = end;
+    return ok;
+}
 
-    uint8_t* row_ptr = malloc(row_size);
-    size_t read_size = fread(row_ptr, row_size, 1, file);
+/**@brief render the next response of a scan into *buf*: as many pairs as fit, or once they have
+ * 		  all gone, the status that ends it. Returns UINT32_MAX once the scan is over or if not
+ * 		  even the status fits.
+ */
+uint32_t ccask_scan_bytes(ccask_scan* sc, uint8_t* buf, size_t buflen) {
+    ccask_db_iterator* it = sc->it;
+    if (sc->finished) return UINT32_MAX;
+    if (buflen > UINT32_MAX) buflen = UINT32_MAX;
+
+    size_t len = sizeof(uint32_t) + 1 + sizeof(uint32_t);
+    uint32_t pairs = 0;
+
+    while (!sc->failed && sc->next < it->count && len <= buflen) {
+        if (sc->next == sc->batch_end && !ccask_scan_load(sc)) {
+            sc->failed = true;
+            break;
+        }
 
-    if (read_size < 1) {
-        printf("read size: %zu\n", read_size);
-        for (size_t i = 0; i < read_size*row_size; i++) {
-            printf("0x%.02x ", row_ptr[i]);
+        ccask_iter_entry* e = it->entries + sc->next;
+        size_t pair = 2 * sizeof(uint32_t) + e->key_size + e->value_size;
+        if (pair > buflen - len) {
+            // a pair too big for any response can never be sent
+            if (pairs == 0) sc->failed = true;
+            break;
         }
-        puts("");
-        free(row_ptr);
 
-        int ferr = ferror(file);
-        printf("ferror: %d\n", ferr);
+        u32_to_nwk_byte_arr(buf + len, e->key_size);
+        u32_to_nwk_byte_arr(buf + len + 4, e->value_size);
+        memcpy(buf + len + 8, it->keys + e->key_off, e->key_size);
+        memcpy(buf + len + 8 + e->key_size, sc->values + sc->value_off[sc->next - sc->batch_start], e->value_size);
 
-        if(ferr) perror("fread");
+        len += pair;
+        pairs++;
+        sc->next++;
+    }
 
-        int fe = feof(file);
-        printf("feof: %d\n", fe);
+    if (pairs == 0) {
+        sc->finished = true;
+        return ccask_sr_bytes(sc->failed ? SCAN_FAIL : SCAN_DONE, buf, buflen);
+    }
 
-        int ft = ftell(file);
-        printf("ftell: %d\n", ft);
+    u32_to_nwk_byte_arr(buf, len);
+    buf[4] = SCAN_SUCCESS;
+    u32_to_nwk_byte_arr(buf + 5, pairs);
+    return len;
+}
 
-        printf("file_id: %u\n", file_id);
+/**************
+ *
+ * online backup
+ *
+ * ccask_db_backup copies a live db into an empty directory in between queries. Sealed files
+ * never change, so the active file is sealed first, as if it had filled up, and then every file
+ * and its hint is hard linked into the backup. Nothing is copied, so a backup takes as long as a
+ * rotation and a link per file whatever the size of the data, and the backup has to be on the
+ * same filesystem as the db. Later merges only unlink or rename over the live directory's
+ * names, which leaves the links alone. The backup is a complete db directory without a
+ * lockfile: ccask_db_new opens it as is.
+ *
+ * Over the wire, BACKUP only names the backup: it is made under CCASK_BACKUP_DIR, and refused
+ * if that is not set, so clients cannot have files written anywhere else.
+ *
+ **************/
 
-        return 0;
+/**@brief link sealed data file *fid* and its hint into backup directory *dir* as <dir>/<base>_<fid>.
+ *
+ * @return 0 on success, -1 on error. A hint that can't be linked or written is only reported:
+ * 		   its absence costs a scan when the backup is opened.
+ */
+int ccask_db_backup_file(ccask_db* db, size_t fid, const char* dir, const char* base) {
+    char* src = ccask_db_filename(db, fid, 0);
+    char* src_hint = ccask_db_filename(db, fid, HINT_SUFFIX);
+    char* dst = ccask_dir_filename(dir, base, fid, 0);
+    char* dst_hint = ccask_dir_filename(dir, base, fid, HINT_SUFFIX);
+    int res = src && src_hint && dst && dst_hint ? 0 : -1;
+
+    if (res == 0 && link(src, dst) != 0) {
+        perror("ccask_db_backup: link");
+        fprintf(stderr, "ccask_db_backup: failed to back up file %zu\n", fid);
+        res = -1;
     }
 
-    ccask_header* hdr = ccask_header_new(0, 0, 0, 0);
-    if (!ccask_header_deserialize(hdr, row_ptr)) {
-        ccask_header_delete(hdr);
+    if (res == 0 && link(src_hint, dst_hint) != 0 && ccask_db_hint_write_to(db, fid, dst_hint) != 0) {
+        fprintf(stderr, "ccask_db_backup: failed to write hint for file %zu\n", fid);
+    }
 
-        free(row_ptr);
-        return 0;
+    errno = 0;
+    free(src);
+    free(src_hint);
+    free(dst);
+    free(dst_hint);
+    return res;
+}
+
+/**@brief back *db* up into *dir*, which is created if needed and must be empty. It is refused
+ * 		  if sealing the active file would leave fewer than BACKUP_SPARE_FILES file ids unused.
+ *
+ * @return the number of data files backed up, or -1 on error. A failed backup may leave some
+ * 		   files behind in *dir*.
+ */
+int ccask_db_backup(ccask_db* db, const char* dir) {
+    if (!db || !dir) return -1;
+
+    // sealing the active file takes a file id, and running out of them stops the server
+    bool seal = db->file_pos > db->file_start[db->file_id];
+    if (seal && db->file_id + 1 + BACKUP_SPARE_FILES >= MAX_FILES) {
+        fprintf(stderr, "ccask_db_backup: only %zu file ids left; merge before backing up\n", MAX_FILES - 1 - db->file_id);
+        return -1;
+    }
+
+    if (mkdir(dir, 0700) != 0 && errno != EEXIST) {
+        perror("ccask_db_backup: mkdir");
+        return -1;
     }
+    errno = 0;
 
-    ccask_kv* kv = ccask_kv_new(0, 0, 0, 0);
-    if (!ccask_kv_deserialize(key_size, value_size, kv, (row_ptr+HEADER_BYTES))) {
-        ccask_header_delete(hdr);
-        ccask_kv_delete(kv);
+    DIR* d = opendir(dir);
+    if (!d) {
+        perror("ccask_db_backup: opendir");
+        return -1;
+    }
 
-        free(row_ptr);
-        return 0;
+    bool empty = true;
+    for (struct dirent* e = readdir(d); e && empty; e = readdir(d)) {
+        empty = strcmp(e->d_name, ".") == 0 || strcmp(e->d_name, "..") == 0;
     }
+    closedir(d);
 
-    uint8_t* value = malloc(value_size);
-    value = ccask_kv_value(value, kv);
+    if (!empty) {
+        fprintf(stderr, "ccask_db_backup: %s is not empty\n", dir);
+        return -1;
+    }
 
-    bool crc_flag = crc_check(hdr, kv);
-    ccask_get_result* gr = ccask_gr_new(value_size, value, crc_flag);
+    // the backup's data files are named after its own directory, like any db's
+    char* path = malloc(strlen(dir) + 1);
+    if (!path) return -1;
+    strcpy(path, dir);
+    size_t plen = strlen(path);
+    while (plen > 1 && path[plen-1] == '/') path[--plen] = '\0';
+    const char* base = strrchr(path, '/');
+    base = base ? base + 1 : path;
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    // seal the active file, unless it has no records yet, so that every file backed up is sealed
+    if (seal) ccask_db_newfile(db);
+
+    int files = 0;
+    for (size_t fid = 0; fid < db->file_id && files >= 0; fid++) {
+        if (db->fds[fid] < 0) continue;
+        files = ccask_db_backup_file(db, fid, path, base) == 0 ? files + 1 : -1;
+    }
 
-    ccask_gr_print(gr);
+    // make the new directory entries durable too
+    int dfd = open(path, O_RDONLY | O_DIRECTORY);
+    if (dfd < 0 || fsync(dfd) != 0) {
+        perror("ccask_db_backup: fsync");
+        files = -1;
+    }
+    if (dfd >= 0) close(dfd);
 
-    ccask_kv_delete(kv);
-    ccask_header_delete(hdr);
-    free(row_ptr);
-    free(value);
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double ms = (end.tv_sec - start.tv_sec) * 1e3 + (end.tv_nsec - start.tv_nsec) / 1e6;
+    if (files >= 0) printf("ccask_db: backed up %d files to %s in %.3f ms\n", files, path, ms);
 
-    return gr;
+    free(path);
+    return files;
+}
+
+/**@brief the directory a client's BACKUP named *name* goes to: <CCASK_BACKUP_DIR>/<name>.
+ *
+ * @return a malloc'd path, or NULL if BACKUP is off or *name* is anything but one plain path
+ * 		   component (empty, ".", "..", or holding a '/' or NUL)
+ */
+char* ccask_db_backup_path(const ccask_db* db, uint32_t name_size, const uint8_t* name) {
+    if (!db || !db->backup_dir || name_size == 0 || name_size > NAME_MAX) return NULL;
+    if (memchr(name, '/', name_size) || memchr(name, '\0', name_size)) return NULL;
+    if ((name_size == 1 && name[0] == '.') || (name_size == 2 && name[0] == '.' && name[1] == '.')) return NULL;
+
+    size_t rlen = strlen(db->backup_dir);
+    char* path = malloc(rlen + name_size + 2);
+    if (!path) return NULL;
+
+    memcpy(path, db->backup_dir, rlen);
+    path[rlen] = '/';
+    memcpy(path + rlen + 1, name, name_size);
+    path[rlen + 1 + name_size] = '\0';
+    return path;
+}
+
+/**************
+ *
+ * offline format upgrade
+ *
+ * ccask_db_upgrade rewrites every data file of an older format version in the current one,
+ * record by record and in place of the original, so its records keep their order and file id.
+ * Each file is written to <base>_<id>.upgrade.tmp and renamed over the original once complete;
+ * an interrupted upgrade leaves the original intact and the temporary file is removed at the
+ * next startup.
+ *
+ **************/
+
+/**@brief rewrite sealed data file *fid* in the current format, on disk and in *db*'s accounting.
+ * 		  The keydir is not updated: the db must not serve queries afterwards.
+ *
+ * @return 0 on success, -1 on error
+ */
+int ccask_db_upgrade_file(ccask_db* db, size_t fid) {
+    char* fn = ccask_db_filename(db, fid, 0);
+    char* tmp_fn = ccask_db_filename(db, fid, UPGRADE_SUFFIX);
+    char* hint_fn = ccask_db_filename(db, fid, HINT_SUFFIX);
+    if (!fn || !tmp_fn || !hint_fn) {
+        free(fn);
+        free(tmp_fn);
+        free(hint_fn);
+        return -1;
+    }
+
+    uint64_t seq;
+    int out = ccask_db_create(db, tmp_fn, &seq);
+    if (out < 0) perror("ccask_db_upgrade: open");
+
+    uint16_t version = db->file_version[fid];
+    size_t hdr_bytes = ccask_record_header_bytes(version);
+    size_t pos = db->file_start[fid];
+    size_t out_pos = CCASK_FILE_HEADER_BYTES;
+    size_t records = 0, corrupt = 0;
+
+    ccask_reader r;
+    ccask_reader_init(&r, db->fds[fid], db->file_bytes[fid]);
+
+    uint8_t* rec;
+    while (out >= 0 && (rec = ccask_reader_at(&r, pos, hdr_bytes))) {
+        ccask_record_header tmp;
+        const ccask_record_header* hdr = ccask_record_header_view(version, rec, &tmp);
+        uint32_t ksz = ccask_record_ksz(hdr);
+        uint32_t vsz = ccask_record_vsz(hdr);
+        size_t rsz = ccask_record_bytes(version, ksz, vsz);
+
+        if (rsz > db->file_bytes[fid] - pos || !(rec = ccask_reader_at(&r, pos, rsz))) break;
+        if (!crc_check_row(rec, version, db->file_crc[fid], ksz, vsz)) corrupt++;
+
+        size_t n = ccask_db_rewrite_record(db, fid, rec, out, out_pos);
+        if (n == 0) {
+            perror("ccask_db_upgrade: write");
+            close(out);
+            out = -1;
+            break;
+        }
+
+        out_pos += n;
+        pos += rsz;
+        records++;
+    }
+
+    ccask_reader_destroy(&r);
+
+    // the old hint goes first so no hint can outlive the data it describes
+    if (out < 0 || fsync(out) != 0 || (unlink(hint_fn) != 0 && errno != ENOENT) || rename(tmp_fn, fn) != 0) {
+        fprintf(stderr, "ccask_db_upgrade: failed to upgrade %s\n", fn);
+        if (out >= 0) close(out);
+        unlink(tmp_fn);
+        free(fn);
+        free(tmp_fn);
+        free(hint_fn);
+        return -1;
+    }
+
+    if (pos < db->file_bytes[fid]) {
+        fprintf(stderr, "ccask_db_upgrade: %s: dropped %zu bytes of incomplete records at the end\n", fn, db->file_bytes[fid] - pos);
+    }
+
+    printf("ccask_db_upgrade: %s: %zu records (%zu corrupt) rewritten from format v%u to v%u\n",
+           fn, records, corrupt, version, FORMAT_VERSION);
+
+    ccask_db_unmap(db, fid);
+    close(db->fds[fid]);
+    db->fds[fid] = out;
+    db->file_bytes[fid] = out_pos;
+    db->file_start[fid] = CCASK_FILE_HEADER_BYTES;
+    db->file_crc[fid] = db->crc;
+    db->file_version[fid] = FORMAT_VERSION;
+    db->file_seq[fid] = seq;
+    ccask_db_hint_write(db, fid);
+
+    free(fn);
+    free(tmp_fn);
+    free(hint_fn);
+    return 0;
+}
+
+/**@brief convert every data file of the db at *path* that was written in an older format to
+ * 		  the current one. Meant to be run offline: it takes the directory lock like a server.
+ *
+ * @return the number of files upgraded, or -1 on error
+ */
+int ccask_db_upgrade(const char* path, ccask_config* cfg) {
+    struct stat st;
+    if (!path || stat(path, &st) != 0 || !S_ISDIR(st.st_mode)) {
+        fprintf(stderr, "ccask_db_upgrade: %s is not a ccask directory\n", path ? path : "(null)");
+        return -1;
+    }
+
+    ccask_db* db = ccask_db_new(path, cfg);
+    if (!db) return -1;
+
+    // the keydir keeps pointing into the old layout, so it must not be checkpointed at close
+    db->checkpoint_bytes = 0;
+
+    int upgraded = 0;
+    for (size_t fid = 0; fid < db->file_id; fid++) {
+        if (db->fds[fid] < 0 || db->file_version[fid] >= FORMAT_VERSION) continue;
+
+        if (ccask_db_upgrade_file(db, fid) != 0) {
+            upgraded = -1;
+            break;
+        }
+
+        upgraded++;
+    }
+
+    ccask_db_delete(db);
+    return upgraded;
 }
 
 /**************
@@ -769,6 +3817,7 @@ ccask_result* ccask_res_init(ccask_result* res, response_type type) {
         *res = (ccask_result) {
             .type = type,
             .gr = 0,
+            .scan = 0,
         };
     } else {
         *res = (ccask_result) {
@@ -786,6 +3835,7 @@ ccask_result* ccask_res_new(response_type type) {
 
 void ccask_res_destroy(ccask_result* res) {
     if (res->gr) ccask_gr_delete(res->gr);
+    ccask_scan_delete(res->scan);
     *res = (ccask_result) {
         0
     };
@@ -820,48 +3870,61 @@ uint32_t ccask_res_vsz(const ccask_result* res) {
     return ccask_gr_vsz(res->gr);
 }
 
+/**@brief ccask_sr_bytes renders a status-only response as msgsz|result_type|msglen|msg*/
 uint32_t ccask_sr_bytes(response_type rt, uint8_t* buf, size_t buflen) {
-    if (rt == SET_SUCCESS) {
-        char* msg = "SET succeeded";
-        uint32_t len = strlen(msg);
-        uint32_t msgsz = sizeof(uint32_t) + sizeof(uint8_t) + sizeof(uint32_t) + len;
-        if (buflen < msgsz) return UINT32_MAX;
-
-        uint32_t msgszn = htonl(msgsz);
-        memcpy(buf, &msgszn, sizeof(msgszn));
-        buf += sizeof(msgszn);
-
-        *buf = SET_SUCCESS;
-        buf++;
-
-        uint32_t lenn = htonl(len);
-        memcpy(buf, &lenn, sizeof(lenn));
-        buf += sizeof(lenn);
-
-        memcpy(buf, msg, len);
-        return msgsz;
-    } else if (rt == SET_FAIL) {
-        char* msg = "SET failed";
-        uint32_t len = strlen(msg);
-        uint32_t msgsz = sizeof(uint32_t) + sizeof(uint8_t) + sizeof(uint32_t) + len;
-        if (buflen < msgsz) return UINT32_MAX;
+    char* msg = 0;
+    switch(rt) {
+    case SET_SUCCESS:
+        msg = "SET succeeded";
+        break;
+    case SET_FAIL:
+        msg = "SET failed";
+        break;
+    case MERGE_SUCCESS:
+        msg = "MERGE started";
+        break;
+    case MERGE_FAIL:
+        msg = "MERGE failed";
+        break;
+    case DEL_SUCCESS:
+        msg = "DEL succeeded";
+        break;
+    case DEL_FAIL:
+        msg = "DEL failed";
+        break;
+    case BACKUP_SUCCESS:
+        msg = "BACKUP succeeded";
+        break;
+    case BACKUP_FAIL:
+        msg = "BACKUP failed";
+        break;
+    case SCAN_DONE:
+        msg = "SCAN complete";
+        break;
+    case SCAN_FAIL:
+        msg = "SCAN failed";
+        break;
+    default:
+        return UINT32_MAX;
+    }
 
-        uint32_t msgszn = htonl(msgsz);
-        memcpy(buf, &msgszn, sizeof(msgszn));
-        buf += sizeof(msgszn);
+    uint32_t len = strlen(msg);
+    uint32_t msgsz = sizeof(uint32_t) + sizeof(uint8_t) + sizeof(uint32_t) + len;
+    if (buflen < msgsz) return UINT32_MAX;
 
-        *buf = SET_FAIL;
-        buf++;
+    uint32_t msgszn = htonl(msgsz);
+    memcpy(buf, &msgszn, sizeof(msgszn));
+    buf += sizeof(msgszn);
 
-        uint32_t lenn = htonl(len);
-        memcpy(buf, &lenn, sizeof(lenn));
-        buf += sizeof(lenn);
+    *buf = rt;
+    buf++;
 
-        memcpy(buf, msg, len);
-        return msgsz;
-    }
+    uint32_t lenn = htonl(len);
+    memcpy(buf, &lenn, sizeof(lenn));
+    buf += sizeof(lenn);
 
-    return UINT32_MAX;
+    memcpy(buf, msg, len);
+    return msgsz;
 }
 
 uint32_t ccask_res_bytes(ccask_result* res, uint8_t* buf, size_t buflen) {
@@ -873,13 +3936,28 @@ uint32_t ccask_res_bytes(ccask_result* res, uint8_t* buf, size_t buflen) {
         return ccask_gr_bytes(res->gr, buf, buflen);
     case SET_SUCCESS:
     case SET_FAIL:
+    case MERGE_SUCCESS:
+    case MERGE_FAIL:
+    case DEL_SUCCESS:
+    case DEL_FAIL:
+    case BACKUP_SUCCESS:
+    case BACKUP_FAIL:
+    case SCAN_DONE:
+    case SCAN_FAIL:
         return ccask_sr_bytes(res->type, buf, buflen);
+    case SCAN_SUCCESS:
+        return ccask_scan_bytes(res->scan, buf, buflen);
     case BAD_COMMAND:
     default:
         return UINT32_MAX;
     }
 }
 
+/**@brief whether *res* has more responses to render: only a scan takes more than one*/
+bool ccask_res_more(const ccask_result* res) {
+    return res && res->scan && !res->scan->finished;
+}
+
 /**@brief given a byte array representing a query return a ccask_result representing the request or 0 if the request is invalid*/
 ccask_result* ccask_query_interp(ccask_db* db, uint8_t* cmd) {
     if (!db || !cmd) return 0;
@@ -895,23 +3973,29 @@ ccask_result* ccask_query_interp(ccask_db* db, uint8_t* cmd) {
     uint32_t vsz = NWK_BYTE_ARR_U32((cmd+index));
     index += 4;
 
-
-    uint8_t* key = 0;
-    if (ksz > 0) {
-        key = malloc(ksz);
-        memcpy(key, cmd+index, ksz);
-        index += ksz;
+    // SET_TTL_CMD carries the ttl in seconds ahead of the key, SCAN_CMD its limit and flags
+    uint32_t ttl = 0;
+    if (cmd_byte == SET_TTL_CMD) {
+        ttl = NWK_BYTE_ARR_U32((cmd+index));
+        index += 4;
     }
 
-    uint8_t* val = 0;
-    if (vsz > 0) {
-        val = malloc(vsz);
-        memcpy(val, cmd+index, vsz);
-        index += vsz;
+    uint32_t limit = 0;
+    uint8_t flags = 0;
+    if (cmd_byte == SCAN_CMD) {
+        limit = NWK_BYTE_ARR_U32((cmd+index));
+        flags = cmd[index + 4];
+        index += 5;
     }
 
+    // the key and value are used where they lie in the request buffer
+    uint8_t* key = ksz > 0 ? cmd+index : 0;
+    index += ksz;
+    uint8_t* val = vsz > 0 ? cmd+index : 0;
+
 
     ccask_get_result* gr = 0;
+    ccask_scan* scan = 0;
     response_type rt = BAD_COMMAND;
     switch(cmd_byte) {
     case GET_CMD:
@@ -919,17 +4003,40 @@ ccask_result* ccask_query_interp(ccask_db* db, uint8_t* cmd) {
         rt = gr == 0 ? GET_FAIL : GET_SUCCESS;
         break;
     case SET_CMD:
-        db = ccask_db_set(db, ksz, key, vsz, val);
+    case SET_TTL_CMD:
+        db = ccask_db_set_ttl(db, ksz, key, vsz, val, ttl);
         rt = db == 0 ? SET_FAIL : SET_SUCCESS;
         break;
+    case MERGE_CMD:
+        rt = ccask_db_merge_start(db) == 0 ? MERGE_FAIL : MERGE_SUCCESS;
+        break;
+    case DEL_CMD:
+        rt = ccask_db_del(db, ksz, key) == 0 ? DEL_FAIL : DEL_SUCCESS;
+        break;
+    case BACKUP_CMD: {
+        // clients only name the backup; where it goes is up to the server's config
+        char* dir = ccask_db_backup_path(db, ksz, key);
+        rt = dir && ccask_db_backup(db, dir) >= 0 ? BACKUP_SUCCESS : BACKUP_FAIL;
+        free(dir);
+        break;
+    }
+    case SCAN_CMD: {
+        // the keys are read where they lie, so they have to lie within the message
+        ccask_db_iterator* it = 0;
+        if ((size_t)index + vsz <= msgsz) it = ccask_db_iterator_range(db, ksz, key, vsz, val, flags & SCAN_PREFIX, limit);
+
+        scan = it ? ccask_scan_new(it) : 0;
+        if (!scan) ccask_db_iterator_delete(it);
+        rt = scan ? SCAN_SUCCESS : SCAN_FAIL;
+        break;
+    }
     default:
         break;
     }
 
     ccask_result* res = ccask_res_new(rt);
     res->gr = gr;
+    res->scan = scan;
 
-    free(key);
-    free(val);
     return res;
 }
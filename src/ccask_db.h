@@ -10,10 +10,15 @@
 #define MAX_FILES 256
 #define MAX_FILE_CHARS 4 // number of digits in MAX_FILES + 1 for \0
 #define CCASK_MAGIC_NUMBER 0x0CCA2CFF
+#define CCASK_FILE_HEADER_BYTES 32 // every data file starts with a header; see ccask_db_header_write
+#define CCASK_FILE_HEADER_V1_BYTES 16 // the header of format version 1 files
 
 // if we are compiling tests, we want to have a small max-file-size for easier testing
+// (either uncomment the line below or pass -DMAX_FILE_BYTES=1024)
 //#define MAX_FILE_BYTES 1024
+#ifndef MAX_FILE_BYTES
 #define MAX_FILE_BYTES 512*(1024)*(1024) // 512 MB
+#endif
 
 
 enum response_type {
@@ -21,14 +26,27 @@ enum response_type {
     GET_FAIL,
     SET_SUCCESS,
     SET_FAIL,
-    BAD_COMMAND
+    BAD_COMMAND,
+    MERGE_SUCCESS,
+    MERGE_FAIL,
+    DEL_SUCCESS,
+    DEL_FAIL,
+    BACKUP_SUCCESS,
+    BACKUP_FAIL,
+    SCAN_SUCCESS,   // one response of a scan's pairs; more follow
+    SCAN_DONE,      // the last response of a scan
+    SCAN_FAIL
 };
 
 typedef struct ccask_db ccask_db;
 typedef struct ccask_get_result ccask_get_result;
 typedef struct ccask_result ccask_result;
+typedef struct ccask_db_iterator ccask_db_iterator;
 typedef enum response_type response_type;
 
+// receives the result of an asynchronous query along with the tag it was started with
+typedef void (*ccask_query_fn)(void* ctx, uint64_t tag, ccask_result* res);
+
 // ccask_db functions
 
 // initializer / destructors
@@ -40,6 +58,42 @@ void ccask_db_delete(ccask_db* db);
 // get / set
 ccask_db* ccask_db_set(ccask_db* db, uint32_t key_size, uint8_t* key, uint32_t value_size, uint8_t* value);
 ccask_get_result* ccask_db_get(ccask_db* db, uint32_t key_size, uint8_t* key);
+ccask_db* ccask_db_del(ccask_db* db, uint32_t key_size, uint8_t* key);
+
+// expiry: a ttl of 0 never expires
+ccask_db* ccask_db_set_ttl(ccask_db* db, uint32_t key_size, uint8_t* key, uint32_t value_size, uint8_t* value, uint32_t ttl);
+size_t ccask_db_expire_step(ccask_db* db);
+bool ccask_db_expiring(const ccask_db* db);
+
+// merge / compaction
+ccask_db* ccask_db_merge_start(ccask_db* db);
+int ccask_db_merge_step(ccask_db* db);
+ccask_db* ccask_db_merge(ccask_db* db);
+bool ccask_db_merging(const ccask_db* db);
+size_t ccask_db_dead_pct(const ccask_db* db);
+
+// snapshot iterators, in file id and position order; from a start key in key order with an ordered keydir
+ccask_db_iterator* ccask_db_iterator_new(ccask_db* db);
+ccask_db_iterator* ccask_db_iterator_from(ccask_db* db, uint32_t start_size, uint8_t* start);
+ccask_db_iterator* ccask_db_iterator_range(ccask_db* db, uint32_t start_size, uint8_t* start, uint32_t end_size, uint8_t* end,
+        bool prefix, size_t limit);
+bool ccask_db_iterator_next(ccask_db_iterator* it);
+uint32_t ccask_db_iterator_ksz(const ccask_db_iterator* it);
+const uint8_t* ccask_db_iterator_key(ccask_db_iterator* it);
+ccask_get_result* ccask_db_iterator_get(ccask_db_iterator* it);
+size_t ccask_db_iterator_count(const ccask_db_iterator* it);
+void ccask_db_iterator_delete(ccask_db_iterator* it);
+
+// keydir checkpoints (CCASK_CHECKPOINT_MB)
+int ccask_db_checkpoint(ccask_db* db);
+int ccask_db_checkpoint_start(ccask_db* db);
+int ccask_db_checkpoint_step(ccask_db* db);
+
+// online backup
+int ccask_db_backup(ccask_db* db, const char* dir);
+
+// offline format upgrade
+int ccask_db_upgrade(const char* path, ccask_config* cfg);
 
 // getters
 size_t ccask_db_fid(const ccask_db* db);
@@ -47,6 +101,7 @@ size_t ccask_db_fid(const ccask_db* db);
 // ccask_get_result functions
 ccask_get_result* ccask_gr_init(ccask_get_result* gr, uint32_t value_size, uint8_t* value, bool crc_passed);
 ccask_get_result* ccask_gr_new(uint32_t value_size, uint8_t* value, bool crc_passed);
+ccask_get_result* ccask_gr_borrow(uint32_t value_size, uint8_t* value, bool crc_passed);
 uint32_t ccask_gr_vsz(const ccask_get_result* gr);
 uint8_t* ccask_gr_val(uint8_t* dest, const ccask_get_result* src);
 void ccask_gr_destroy(ccask_get_result* gr);
@@ -54,6 +109,7 @@ void ccask_gr_delete(ccask_get_result* gr);
 void ccask_gr_print(ccask_get_result* gr);
 uint32_t ccask_gr_bytes(ccask_get_result* gr, uint8_t* buf, size_t buflen);
 uint32_t ccask_res_bytes(ccask_result* res, uint8_t* buf, size_t buflen);
+bool ccask_res_more(const ccask_result* res);     // a scan renders one response per call until this is false
 
 // query interp
 ccask_result* ccask_res_init(ccask_result* res, response_type type);
@@ -67,4 +123,17 @@ uint8_t* ccask_res_value(uint8_t* dest, const ccask_result* res);
 uint32_t ccask_res_vsz(const ccask_result* res);
 ccask_result* ccask_query_interp(ccask_db* db, uint8_t* cmd);
 
+// asynchronous queries (CCASK_URING)
+bool ccask_query_start(ccask_db* db, uint8_t* cmd, uint64_t tag, ccask_result** res);
+int ccask_db_async_submit(ccask_db* db);
+size_t ccask_db_async_reap(ccask_db* db, ccask_query_fn fn, void* ctx);
+void ccask_db_async_wait(ccask_db* db);
+int ccask_db_async_fd(const ccask_db* db);
+bool ccask_db_async(const ccask_db* db);
+
+// group commit (CCASK_SYNC)
+void ccask_db_commit(ccask_db* db);
+void ccask_db_flush(ccask_db* db, bool sync);
+int ccask_db_commit_timeout(const ccask_db* db);
+
 #endif
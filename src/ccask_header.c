@@ -1,8 +1,12 @@
+#define _DEFAULT_SOURCE
+
 #include "ccask_header.h"
 #include <stddef.h>
 #include <stdlib.h>
 #include <stdio.h>
 #include <inttypes.h>
+#include <string.h>
+#include <endian.h>
 #include <time.h>
 
 /**@file
@@ -48,55 +52,29 @@ void ccask_header_delete(ccask_header* c) {
     free(c);
 }
 
-uint8_t* split_uint32_bytewise(uint8_t* dest, uint32_t src) {
-    if (dest) {
-        dest[3] = (src & 0x000000ff);
-        dest[2] = (src & 0x0000ff00) >> 8;
-        dest[1] = (src & 0x00ff0000) >> 16;
-        dest[0] = (src & 0xff000000) >> 24;
-    }
-
-    return dest;
-}
-
-uint32_t combine_uint8_to32(uint8_t* src) {
-    return src[0] | (src[1] << 8) | (src[2] << 16) | (src[3]) << 24;
-}
-
-time_t combine_uint8_totimet(uint8_t* src) {
-    size_t tsz = sizeof(time_t);
-    time_t acc = 0;
-    for (size_t i = 0; i < tsz; ++i) {
-        size_t offset = 8 * i;
-        acc |= src[i] << offset;
-    }
-
-    return acc;
-}
-
+/**@brief write *src* to *dest* in the v1 record header layout: the fields in host byte order,
+ * 		  exactly as v1 records were appended
+ */
 uint8_t* ccask_header_serialize(uint8_t* dest, const ccask_header* src) {
-    if (!dest) return 0;
+    if (!dest || !src) return 0;
 
-    if(!split_uint32_bytewise(dest, src->crc)) return 0;
-    if(!split_uint32_bytewise(dest+4, src->timestamp)) return 0;
-    if(!split_uint32_bytewise(dest+8, src->key_size)) return 0;
-    if(!split_uint32_bytewise(dest+12, src->value_size)) return 0;
+    memcpy(dest, &src->crc, 4);
+    memcpy(dest+4, &src->timestamp, 8);
+    memcpy(dest+12, &src->key_size, 4);
+    memcpy(dest+16, &src->value_size, 4);
 
     return dest;
 }
 
 
+/**@brief read a v1 record header from *data* (see ccask_header_serialize)*/
 ccask_header* ccask_header_deserialize(ccask_header* dest, uint8_t* data) {
-    if (!dest) return 0;
+    if (!dest || !data) return 0;
 
-    size_t index = 0;
-    dest->crc = combine_uint8_to32(data);
-    index += 4;
-    dest->timestamp = combine_uint8_totimet(data+index);
-    index += sizeof(time_t);
-    dest->key_size = combine_uint8_to32(data+index);
-    index += 4;
-    dest->value_size = combine_uint8_to32(data+index);
+    memcpy(&dest->crc, data, 4);
+    memcpy(&dest->timestamp, data+4, 8);
+    memcpy(&dest->key_size, data+12, 4);
+    memcpy(&dest->value_size, data+16, 4);
 
     return dest;
 }
@@ -142,3 +120,86 @@ void ccask_header_print(const ccask_header* src) {
            src->key_size,
            src->value_size);
 }
+
+/*-----------------record headers by format version-------------------*/
+
+_Static_assert(sizeof(ccask_record_header) == CCASK_RECORD_HEADER_BYTES, "v2 record header must not be padded");
+_Static_assert(sizeof(time_t) == 8, "v1 records hold an 8 byte time_t");
+
+/**@brief bytes in the header of a record of data file format *version**/
+size_t ccask_record_header_bytes(uint16_t version) {
+    return version < 2 ? HEADER_BYTES : CCASK_RECORD_HEADER_BYTES;
+}
+
+/**@brief bytes a record of format *version* takes up in its file, padding included. A
+ * 		  *value_size* of CCASK_TOMBSTONE is a tombstone, which has no value.
+ */
+size_t ccask_record_bytes(uint16_t version, uint32_t key_size, uint32_t value_size) {
+    size_t bytes = ccask_record_header_bytes(version) + key_size + (value_size == CCASK_TOMBSTONE ? 0 : value_size);
+    if (version < 2) return bytes;
+
+    return (bytes + CCASK_RECORD_ALIGN - 1) & ~(size_t)(CCASK_RECORD_ALIGN - 1);
+}
+
+/**@brief fill in the v2 record header *h*; the crc is left 0 for ccask_record_set_crc. A *ttl*
+ * 		  of 0 means the record never expires.
+ */
+ccask_record_header* ccask_record_header_init(ccask_record_header* h, time_t timestamp, uint32_t ttl, uint32_t key_size, uint32_t value_size) {
+    if (h) {
+        *h = (ccask_record_header) {
+            .crc = 0,
+            .key_size = htole32(key_size),
+            .value_size = htole32(value_size),
+            .ttl = htole32(ttl),
+            .timestamp = htole64(timestamp),
+        };
+    }
+
+    return h;
+}
+
+/**@brief return the record header at *data*, a record of format *version*, as a v2 header.
+ *
+ * An aligned v2 header is returned where it lies; anything else is converted into *tmp*.
+ */
+const ccask_record_header* ccask_record_header_view(uint16_t version, const uint8_t* data, ccask_record_header* tmp) {
+    if (!data) return 0;
+
+    if (version >= 2) {
+        if ((uintptr_t)data % _Alignof(ccask_record_header) == 0) return (const ccask_record_header*)data;
+
+        memcpy(tmp, data, sizeof(*tmp));
+        return tmp;
+    }
+
+    ccask_header v1;
+    ccask_header_deserialize(&v1, (uint8_t*)data);
+    ccask_record_header_init(tmp, v1.timestamp, 0, v1.key_size, v1.value_size);
+    tmp->crc = htole32(v1.crc);
+
+    return tmp;
+}
+
+uint32_t ccask_record_crc(const ccask_record_header* h) {
+    return le32toh(h->crc);
+}
+
+void ccask_record_set_crc(ccask_record_header* h, uint32_t crc) {
+    h->crc = htole32(crc);
+}
+
+time_t ccask_record_timestamp(const ccask_record_header* h) {
+    return (time_t)le64toh(h->timestamp);
+}
+
+uint32_t ccask_record_ttl(const ccask_record_header* h) {
+    return le32toh(h->ttl);
+}
+
+uint32_t ccask_record_ksz(const ccask_record_header* h) {
+    return le32toh(h->key_size);
+}
+
+uint32_t ccask_record_vsz(const ccask_record_header* h) {
+    return le32toh(h->value_size);
+}
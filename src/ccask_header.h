@@ -5,10 +5,36 @@
 #include <inttypes.h>
 #include <time.h>
 
+// a record whose value size is CCASK_TOMBSTONE marks its key as deleted and carries no value
+#define CCASK_TOMBSTONE UINT32_MAX
+
+/* Record layouts by data file format version (see ccask_db_header_write):
+ *
+ * v1: crc (4) | timestamp (8) | key size (4) | value size (4) | key | value
+ *     in host byte order, records packed back to back. HEADER_BYTES long.
+ * v2: a ccask_record_header | key | value | zero padding up to the next multiple of
+ *     CCASK_RECORD_ALIGN. Every field is little-endian and naturally aligned, so a record
+ *     header that lies on an aligned address can be used where it lies.
+ *
+ * In both, the crc covers everything from the end of the crc field to the end of the value.
+ * Only v2 records can expire: v1 has no ttl field. The v2 ttl field was reserved as 0 before
+ * expiry existed, so older v2 files read as records that never expire.
+ */
+#define CCASK_RECORD_ALIGN 8
+#define CCASK_RECORD_HEADER_BYTES 24 // of the current format, v2
+
 typedef struct ccask_header ccask_header;
 extern size_t HEADER_SIZE;
 extern size_t HEADER_BYTES;
 
+typedef struct ccask_record_header {
+    uint32_t crc;
+    uint32_t key_size;
+    uint32_t value_size;
+    uint32_t ttl;           // seconds after timestamp the record expires, 0 for never
+    int64_t timestamp;      // seconds since the epoch
+} ccask_record_header;
+
 
 // initializers / destructors
 ccask_header* ccask_header_init(ccask_header* c, uint32_t crc, time_t timestamp, uint32_t key_size, uint32_t value_size);
@@ -16,7 +42,7 @@ ccask_header* ccask_header_new(uint32_t crc, time_t timestamp, uint32_t key_size
 void ccask_header_destroy(ccask_header* c);
 void ccask_header_delete(ccask_header* c);
 
-// serialize/deserialize
+// serialize/deserialize (v1 layout)
 uint8_t* ccask_header_serialize(uint8_t* dest, const ccask_header* src);
 ccask_header* ccask_header_deserialize(ccask_header* dest, uint8_t* data);
 
@@ -29,4 +55,17 @@ uint32_t ccask_header_vsz(const ccask_header* src);
 // print/debug
 void ccask_header_print(const ccask_header* src);
 
+// record headers of any format version
+size_t ccask_record_header_bytes(uint16_t version);
+size_t ccask_record_bytes(uint16_t version, uint32_t key_size, uint32_t value_size);
+ccask_record_header* ccask_record_header_init(ccask_record_header* h, time_t timestamp, uint32_t ttl, uint32_t key_size, uint32_t value_size);
+const ccask_record_header* ccask_record_header_view(uint16_t version, const uint8_t* data, ccask_record_header* tmp);
+
+uint32_t ccask_record_crc(const ccask_record_header* h);
+void ccask_record_set_crc(ccask_record_header* h, uint32_t crc);
+time_t ccask_record_timestamp(const ccask_record_header* h);
+uint32_t ccask_record_ttl(const ccask_record_header* h);
+uint32_t ccask_record_ksz(const ccask_record_header* h);
+uint32_t ccask_record_vsz(const ccask_record_header* h);
+
 #endif
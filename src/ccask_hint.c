@@ -0,0 +1,246 @@
+#define _DEFAULT_SOURCE
+
+#include "ccask_hint.h"
+#include "crc.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+
+/**@file
+ * @brief ccask_hint.c implements reading and writing hint files
+ *
+ * A hint file is a sequence of entries followed by a trailer, all little-endian:
+ *
+ * 		entry:   timestamp (8) | key size (4) | value size (4) | value pos (8) | ttl (4) | key
+ * 		trailer: entry count (8) | data file size (8) | magic (4) | crc (4)
+ *
+ * The crc covers every byte before it. The data file size ties the hint to the exact data
+ * file it was built from; a hint whose size does not match is ignored. The data file's id
+ * is not stored since merges renumber files: it is implied by the hint's file name.
+ */
+
+#define HINT_MAGIC 0x0CCA2C42 // hints written before entries carried a ttl (magic ...41) are rebuilt
+#define HINT_ENTRY_BYTES (8 + 4 + 4 + 8 + 4)
+#define HINT_TRAILER_BYTES (8 + 8 + 4 + 4)
+
+struct ccask_hint_writer {
+    char* path;
+    uint8_t* buf;
+    size_t len;
+    size_t cap;
+    uint64_t count;
+};
+
+/*-----------------utility functions-------------------*/
+
+void hint_put_u32(uint8_t* dest, uint32_t src) {
+    for (size_t i = 0; i < 4; i++) dest[i] = (src >> (8 * i)) & 0xff;
+}
+
+void hint_put_u64(uint8_t* dest, uint64_t src) {
+    for (size_t i = 0; i < 8; i++) dest[i] = (src >> (8 * i)) & 0xff;
+}
+
+uint32_t hint_get_u32(const uint8_t* src) {
+    uint32_t acc = 0;
+    for (size_t i = 0; i < 4; i++) acc |= (uint32_t)src[i] << (8 * i);
+    return acc;
+}
+
+uint64_t hint_get_u64(const uint8_t* src) {
+    uint64_t acc = 0;
+    for (size_t i = 0; i < 8; i++) acc |= (uint64_t)src[i] << (8 * i);
+    return acc;
+}
+
+/**@brief make sure *w* has room for *n* more bytes*/
+ccask_hint_writer* hint_reserve(ccask_hint_writer* w, size_t n) {
+    if (w->len + n <= w->cap) return w;
+
+    size_t cap = w->cap ? w->cap : 4096;
+    while (cap < w->len + n) cap *= 2;
+
+    uint8_t* buf = realloc(w->buf, cap);
+    if (!buf) return 0;
+
+    w->buf = buf;
+    w->cap = cap;
+    return w;
+}
+
+/*-----------------writer-------------------*/
+
+ccask_hint_writer* ccask_hint_writer_new(const char* path) {
+    if (!path) return 0;
+
+    ccask_hint_writer* w = malloc(sizeof(ccask_hint_writer));
+    if (!w) return 0;
+
+    *w = (ccask_hint_writer) {
+        .path = malloc(strlen(path) + 1),
+        .buf = 0,
+        .len = 0,
+        .cap = 0,
+        .count = 0,
+    };
+
+    if (!w->path) {
+        free(w);
+        return 0;
+    }
+
+    strcpy(w->path, path);
+    return w;
+}
+
+ccask_hint_writer* ccask_hint_writer_add(ccask_hint_writer* w, time_t timestamp, uint32_t ttl, uint32_t key_size,
+        const uint8_t* key, uint32_t value_size, size_t value_pos) {
+    if (!w || !hint_reserve(w, HINT_ENTRY_BYTES + key_size)) return 0;
+
+    uint8_t* ptr = w->buf + w->len;
+    hint_put_u64(ptr, (uint64_t)timestamp);
+    hint_put_u32(ptr + 8, key_size);
+    hint_put_u32(ptr + 12, value_size);
+    hint_put_u64(ptr + 16, value_pos);
+    hint_put_u32(ptr + 24, ttl);
+    memcpy(ptr + HINT_ENTRY_BYTES, key, key_size);
+
+    w->len += HINT_ENTRY_BYTES + key_size;
+    w->count++;
+
+    return w;
+}
+
+/**@brief write the buffered entries to a temporary file and atomically move it to the writer's path.
+ *
+ * @param data_bytes the size of the data file the hint describes
+ * @return 0 on success, -1 on error. The writer is not freed either way.
+ */
+int ccask_hint_writer_commit(ccask_hint_writer* w, size_t data_bytes) {
+    if (!w || !hint_reserve(w, HINT_TRAILER_BYTES)) return -1;
+
+    uint8_t* ptr = w->buf + w->len;
+    hint_put_u64(ptr, w->count);
+    hint_put_u64(ptr + 8, data_bytes);
+    hint_put_u32(ptr + 16, HINT_MAGIC);
+    hint_put_u32(ptr + 20, crc_compute(w->buf, w->len + 20));
+    size_t total = w->len + HINT_TRAILER_BYTES;
+
+    char* tmp = malloc(strlen(w->path) + strlen(".tmp") + 1);
+    if (!tmp) return -1;
+    strcpy(tmp, w->path);
+    strcat(tmp, ".tmp");
+
+    FILE* f = fopen(tmp, "wb");
+    if (!f) {
+        perror("ccask_hint: fopen");
+        free(tmp);
+        return -1;
+    }
+
+    int res = 0;
+    if (fwrite(w->buf, 1, total, f) != total || fflush(f) != 0 || fsync(fileno(f)) != 0) {
+        perror("ccask_hint: write");
+        res = -1;
+    }
+
+    fclose(f);
+
+    if (res == 0 && rename(tmp, w->path) != 0) {
+        perror("ccask_hint: rename");
+        res = -1;
+    }
+
+    if (res != 0) unlink(tmp);
+
+    free(tmp);
+    return res;
+}
+
+void ccask_hint_writer_delete(ccask_hint_writer* w) {
+    if (w) {
+        free(w->path);
+        free(w->buf);
+        free(w);
+    }
+}
+
+/*-----------------reader-------------------*/
+
+/**@brief validate the hint file at *path* and call *fn* for each of its entries in file order.
+ *
+ * Nothing is passed to *fn* unless the whole file is intact and was built from a data file of
+ * exactly *data_bytes* bytes.
+ *
+ * @return 0 if the hint was loaded, -1 if it is missing, stale or corrupt, and otherwise the
+ * 		   nonzero value returned by *fn*
+ */
+int ccask_hint_load(const char* path, size_t data_bytes, ccask_hint_fn fn, void* ctx) {
+    if (!path || !fn) return -1;
+
+    FILE* f = fopen(path, "rb");
+    if (!f) return -1;
+
+    struct stat st;
+    if (fstat(fileno(f), &st) != 0 || (size_t)st.st_size < HINT_TRAILER_BYTES) {
+        fclose(f);
+        return -1;
+    }
+
+    size_t total = st.st_size;
+    uint8_t* buf = malloc(total);
+    if (!buf || fread(buf, 1, total, f) != total) {
+        free(buf);
+        fclose(f);
+        return -1;
+    }
+
+    fclose(f);
+
+    size_t len = total - HINT_TRAILER_BYTES;
+    uint8_t* trailer = buf + len;
+    uint64_t count = hint_get_u64(trailer);
+
+    if (hint_get_u32(trailer + 16) != HINT_MAGIC
+            || hint_get_u64(trailer + 8) != data_bytes
+            || hint_get_u32(trailer + 20) != crc_compute(buf, len + 20)) {
+        free(buf);
+        return -1;
+    }
+
+    // walk once to check every entry is in bounds before handing any of them out
+    size_t pos = 0;
+    uint64_t seen = 0;
+    while (pos < len) {
+        if (len - pos < HINT_ENTRY_BYTES) break;
+
+        uint32_t ksz = hint_get_u32(buf + pos + 8);
+        if (len - pos - HINT_ENTRY_BYTES < ksz) break;
+
+        pos += HINT_ENTRY_BYTES + ksz;
+        seen++;
+    }
+
+    if (pos != len || seen != count) {
+        free(buf);
+        return -1;
+    }
+
+    int res = 0;
+    for (pos = 0; pos < len && res == 0;) {
+        uint8_t* ptr = buf + pos;
+        uint32_t ksz = hint_get_u32(ptr + 8);
+
+        res = fn(ctx, (time_t)hint_get_u64(ptr), hint_get_u32(ptr + 24), ksz, ptr + HINT_ENTRY_BYTES,
+                 hint_get_u32(ptr + 12), hint_get_u64(ptr + 16));
+
+        pos += HINT_ENTRY_BYTES + ksz;
+    }
+
+    free(buf);
+    return res;
+}
@@ -0,0 +1,31 @@
+#ifndef _CCASK_HINT_H
+#define _CCASK_HINT_H
+
+#include <stddef.h>
+#include <inttypes.h>
+#include <time.h>
+
+/**@file
+ * @brief hint files are a compact index of a sealed data file, loaded at startup instead of
+ * 		  scanning the data file itself.
+ */
+
+#define HINT_SUFFIX ".hint"
+
+typedef struct ccask_hint_writer ccask_hint_writer;
+
+// called once per hint entry; return nonzero to stop iteration
+typedef int (*ccask_hint_fn)(void* ctx, time_t timestamp, uint32_t ttl, uint32_t key_size, uint8_t* key,
+                             uint32_t value_size, size_t value_pos);
+
+// writer: entries are buffered and only become visible at *path* on commit
+ccask_hint_writer* ccask_hint_writer_new(const char* path);
+ccask_hint_writer* ccask_hint_writer_add(ccask_hint_writer* w, time_t timestamp, uint32_t ttl, uint32_t key_size,
+        const uint8_t* key, uint32_t value_size, size_t value_pos);
+int ccask_hint_writer_commit(ccask_hint_writer* w, size_t data_bytes);
+void ccask_hint_writer_delete(ccask_hint_writer* w);
+
+// reader
+int ccask_hint_load(const char* path, size_t data_bytes, ccask_hint_fn fn, void* ctx);
+
+#endif
@@ -1,116 +1,540 @@
 
 /* The keydir is a hash table from keys -> file_id, value_size, value_pos, timestamp
  *
- * Hash function: FNV-1a
- * Collision resolution: separate chaining
+ * Hash function: wyhash, seeded per process; swappable (see ccask_keydir_set_hash)
+ * Collision resolution: open addressing, Swiss table style
  *
- * TODO: make the hash function swappable via fn pointer in the ccask_keydir struct (for easy testing)
+ * Rows live directly in one array of slots, with a parallel array of one control byte per slot:
+ * CTRL_EMPTY, CTRL_DELETED, or the tag of the key in a full slot: 7 bits of its hash plus CTRL_FULL.
+ * Slots come in groups of KD_GROUP. A lookup hashes to a group and matches the key's tag against
+ * all of the group's control bytes at once (with SSE2 where available), comparing keys only in
+ * slots whose tag matches. Groups are probed triangularly (g, g+1, g+3, g+6, ...), which visits
+ * every group once since the group count is a power of two; a group with an empty slot ends the
+ * probe, which is why removal leaves CTRL_DELETED behind unless that group already has one.
+ *
+ * Resizing is incremental: a resize allocates the new table and keeps the old one alongside it.
+ * Every key lives in exactly one of the two; new keys go to the new table and each keydir call
+ * moves the rows of KD_MIGRATE_SLOTS more old slots over, until the old table is empty and is
+ * freed. No call pays for more than that, however large the table. Growth is bounded by a memory
+ * budget covering both tables and out-of-row keys rather than by a count of slots.
+ *
+ * Rows are packed into 32 bytes: file offsets are 32-bit (data files roll over long before
+ * 4 GiB), file ids 16-bit, and the timestamp and ttl are folded into one 32-bit expiry time.
+ * Keys of up to KD_INLINE_KEY bytes live in the row itself; longer ones keep a prefix in the row
+ * and the rest in the keydir's arena (see kd_arena). Tables and arena chunks are mapped directly
+ * and can be backed by transparent huge pages.
+ *
+ * A digest-keyed keydir keeps no keys at all: each row holds the first KD_INLINE_KEY bytes of
+ * the key's 128-bit MurmurHash3 digest in place of the key, and the key size is flagged with
+ * KDROW_DIGEST. Two keys of the same size whose digests agree in those 112 bits share a row; the
+ * db tells them apart by checking the key of the record a row points at.
+ *
+ * An ordered keydir keeps a B+tree of its keys as well, so ccask_keydir_scan can visit rows in
+ * key order from any start key (see the ordered index below).
+ *
+ * A keydir has a single writer, but any number of threads may look keys up with
+ * ccask_keydir_read at the same time, without taking a lock. Each group of slots has a sequence
+ * count that the writer makes odd while it changes the group; readers copy a row out and read
+ * the group again if its count moved. Resizes swap tables under a sequence count of their own,
+ * and rows move into the new table before they leave the old one, which readers look in first.
+ * Memory readers may still be looking at (the tables a resize leaves behind, rows it releases,
+ * malloc'd keys) is retired rather than freed: readers announce themselves in the current epoch,
+ * and the writer only frees what was retired two epochs ago once no reader is left from before.
+ *
+ * Every keydir hashes with a seed, by default one drawn at random once per process, so clients
+ * can't pick keys that all land in one probe sequence. The default hash reads the key 8 or 16
+ * bytes at a time; the digests of a digest-keyed keydir are seeded the same way.
  */
 
+#define _DEFAULT_SOURCE
+
 #include <stdlib.h>
 #include <stddef.h>
 #include <inttypes.h>
 #include <string.h>
 #include <stdio.h>
 #include <time.h>
+#include <stdbool.h>
+#include <sched.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/random.h>
 
 #include "ccask_keydir.h"
 
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
 /**@file
  * @brief ccask_keydir implements the keydir and kdrow structs and methods
  */
 
 /*-----------struct defs---------------------*/
+#define KD_INLINE_KEY CCASK_KDROW_DIGEST_BYTES  // keys up to this long are stored in the row itself, like digests
+#define KD_KEY_PREFIX 6     // bytes of a longer key kept in the row, ahead of the pointer to it
+#define KDROW_DIGEST 0x80000000u    // set in the key size of a row that holds a digest of its key
+
 struct ccask_kdrow {
     uint32_t key_size;
-    uint8_t* key;
-    uint32_t file_id;
     uint32_t value_size;
-    size_t value_pos;
-    time_t timestamp;
-    ccask_kdrow* next;
+    uint32_t value_pos;
+    uint32_t expiry;        // time the entry expires, 0 for never
+    uint16_t file_id;
+    // the key if it fits; otherwise its first KD_KEY_PREFIX bytes, then a pointer to all of it;
+    // or, flagged by KDROW_DIGEST, the key's digest
+    uint8_t key[KD_INLINE_KEY];
 };
 
-struct ccask_keydir {
-    uint8_t load_factor; // load_factor / 100 == ratio of entires in table -> size
-    size_t size;
-    size_t entry_count;
-    size_t max_size;
+#define KD_GROUP 16         // slots whose control bytes are matched together
+#define CTRL_EMPTY 0x00     // never used since the table was last rehashed
+#define CTRL_DELETED 0x01   // used and since removed; probes continue past it
+#define CTRL_FULL 0x80      // set in the tag of every full slot, 0x80 - 0xFF, and in no other byte
+// CTRL_EMPTY is 0 so freshly mapped, zeroed pages are an empty table without being touched
+
+#define KD_MIGRATE_SLOTS 128    // old slots moved to the new table per keydir call while resizing
+#define KD_RELEASE_BYTES (1 << 21)  // moved rows are unmapped in chunks of this many bytes
+
+// one array of slots and its control bytes; the keydir has two while it is being resized
+typedef struct kd_table {
+    size_t size;            // slots: a power of two, and at least KD_GROUP
+    uint8_t* ctrl;
+    uint32_t* seq;          // one per group, odd while the writer is changing the group
     ccask_kdrow* entries;
+    size_t released;        // bytes at the start of entries already unmapped by a resize
+} kd_table;
+
+#define KD_ARENA_CHUNK (1 << 21)    // the arena maps memory in chunks of this size, one huge page
+#define KD_SLAB_MAX 512             // keys longer than this bypass the arena and are malloc'd
+#define KD_SLAB_ALIGN 8             // arena blocks come in size classes of this granularity
+
+// the keys too long for their rows. Blocks are carved from big mapped chunks by size class, and
+// freed blocks wait on their class's free list for the next key of that class; chunks are only
+// unmapped with the keydir.
+typedef struct kd_arena {
+    uint8_t** chunks;
+    size_t chunk_count;
+    size_t chunk_cap;
+    size_t used;                // bytes carved from the newest chunk
+    uint8_t* free[KD_SLAB_MAX / KD_SLAB_ALIGN + 1];
+    size_t bytes;               // chunks mapped plus keys malloc'd
+    bool huge;
+} kd_arena;
+
+#define KD_STRIPES 32       // reader counters, spread over threads to keep them off each other's lines
+
+// a count of readers in one epoch parity, padded so no two share a cache line
+typedef struct kd_stripe {
+    uint64_t count;
+    uint8_t pad[120];
+} kd_stripe;
+
+// memory retired by the writer that a reader may still be looking at
+typedef struct kd_retired {
+    void* p;
+    size_t bytes;           // mapped bytes to unmap, or 0 for a malloc'd block
+} kd_retired;
+
+typedef struct kd_limbo {
+    kd_retired* items;
+    size_t count;
+    size_t cap;
+} kd_limbo;
+
+struct ccask_keydir {
+    uint8_t load_factor; // percent of slots that may be full or deleted before the table is rehashed
+    size_t entry_count;     // keys in both tables
+    size_t deleted;         // slots of cur marked CTRL_DELETED
+    size_t max_bytes;       // memory budget: both tables while resizing, plus the arena
+    bool huge;              // back tables with transparent huge pages
+    bool digest_keys;       // rows hold key digests rather than keys
+    bool ordered;           // keys are kept in a B+tree too, for ccask_keydir_scan
+    ccask_kdhash_fn hash;
+    uint64_t seed;
+    struct kd_node* root;   // the tree, 0 until the first key
+    size_t tree_bytes;      // its nodes; long separators are in the arena
+    kd_arena arena;
+    kd_table cur;
+    kd_table old;           // the table being resized away from; size 0 when there is none
+    size_t old_count;       // rows still in old
+    size_t migrated;        // slots of old already moved to cur
+
+    // lock-free readers (see ccask_keydir_read)
+    uint32_t layout;        // odd while cur and old are being swapped
+    uint64_t epoch;
+    kd_stripe readers[2][KD_STRIPES];   // readers inside each parity of epoch
+    kd_limbo limbo[3];      // memory retired in each of the last three epochs
 };
 
 size_t KDROW_SIZE = sizeof(ccask_kdrow);
 
 /*-----------------utility functions-------------------*/
 
-/**@brief FNV-1a hash of the key *key* of length *key_size*.
+uint64_t rotl64(uint64_t x, int r) {
+    return (x << r) | (x >> (64 - r));
+}
+
+uint64_t fmix64(uint64_t k) {
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+/**@brief FNV-1a hash of the key *key* of length *key_size*, its offset basis xored with *seed*.
  *
  * [FNV-1a hash](https://en.wikipedia.org/wiki/Fowler%E2%80%93Noll%E2%80%93Vo_hash_function)
  *
- * @param key array of key_size bytes
- * @param key_size size of the key in bytes
+ * A byte at a time, so slow on long keys, and the seed hardly makes collisions harder to find:
+ * kept for comparison. The low bits of FNV-1a only depend on the low bits of each byte, so the
+ * high half is folded into them: the tag and the group index are both taken from the low bits.
  */
-size_t hash(uint32_t key_size, uint8_t* key, size_t table_size) {
-    size_t hash = 14695981039346656037ULL; // FNV offset basis constant
+uint64_t ccask_kdhash_fnv1a(uint64_t seed, uint32_t key_size, const uint8_t* key) {
+    uint64_t hash = 14695981039346656037ULL ^ seed; // FNV offset basis constant
 
     for (uint32_t i = 0; i < key_size; i++) {
         hash ^= key[i];
         hash *= 1099511628211; // FNV 64bit prime constant
     }
 
-    return hash % table_size;
+    return hash ^ (hash >> 32);
 }
 
-ccask_kdrow* init_entries(size_t size, ccask_kdrow* entries) {
-    ccask_kdrow* ptr = entries;
-    for (size_t i = 0; i < size; i++) {
-        ptr = entries + i;
-        ptr = ccask_kdrow_init(ptr, 0, 0, 0, 0, 0, 0);
-    }
+/**@brief the 128-bit product of *a* and *b*, its low half left in *a* and its high half in *b**/
+void kd_mum(uint64_t* a, uint64_t* b) {
+#ifdef __SIZEOF_INT128__
+    __uint128_t r = (__uint128_t)*a * *b;
+    *a = (uint64_t)r;
+    *b = (uint64_t)(r >> 64);
+#else
+    uint64_t ha = *a >> 32, hb = *b >> 32, la = (uint32_t)*a, lb = (uint32_t)*b;
+    uint64_t rh = ha * hb, rm0 = ha * lb, rm1 = hb * la, rl = la * lb;
+    uint64_t t = rl + (rm0 << 32), c = t < rl;
+    uint64_t lo = t + (rm1 << 32);
+    c += lo < t;
+    *a = lo;
+    *b = rh + (rm0 >> 32) + (rm1 >> 32) + c;
+#endif
+}
 
-    return entries;
+uint64_t kd_mix(uint64_t a, uint64_t b) {
+    kd_mum(&a, &b);
+    return a ^ b;
 }
 
-/*---------------kdrow functions-------------*/
-ccask_kdrow* ccask_kdrow_init(ccask_kdrow* kdr, uint32_t key_size, uint8_t* key,
-                              uint32_t file_id, uint32_t value_size, uint32_t value_pos, time_t timestamp) {
-    if (kdr) {
-        uint8_t* nkey = 0;
-        if (key_size > 0) {
-            nkey = malloc(key_size);
-            memcpy(nkey, key, key_size);
+uint64_t kd_read8(const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+uint64_t kd_read4(const uint8_t* p) {
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+/**@brief wyhash (final version 4) of the key *key* of length *key_size*, with seed *seed*.
+ *
+ * [wyhash](https://github.com/wangyi-fudan/wyhash)
+ *
+ * Keys of up to 16 bytes take two overlapping loads and one multiply; longer ones are consumed
+ * 16 bytes per multiply, or 48 bytes in three independent lanes once there are more than 48.
+ * Assumes a little-endian machine, like the rest of the keydir.
+ */
+uint64_t ccask_kdhash_wyhash(uint64_t seed, uint32_t key_size, const uint8_t* key) {
+    const uint64_t s0 = 0x2d358dccaa6c78a5ULL, s1 = 0x8bb84b93962eacc9ULL;
+    const uint64_t s2 = 0x4b33a62ed433d4a3ULL, s3 = 0x4d5a2da51de1aa47ULL;
+    const uint8_t* p = key;
+    uint64_t a, b;
+
+    seed ^= kd_mix(seed ^ s0, s1);
+    if (key_size <= 16) {
+        if (key_size >= 4) {
+            size_t mid = (key_size >> 3) << 2;
+            a = (kd_read4(p) << 32) | kd_read4(p + mid);
+            b = (kd_read4(p + key_size - 4) << 32) | kd_read4(p + key_size - 4 - mid);
+        } else if (key_size > 0) {
+            a = ((uint64_t)p[0] << 16) | ((uint64_t)p[key_size >> 1] << 8) | p[key_size - 1];
+            b = 0;
+        } else {
+            a = b = 0;
         }
-        *kdr = (ccask_kdrow) {
-            .key_size = key_size,
-            .key = nkey,
-            .file_id = file_id,
-            .value_size = value_size,
-            .value_pos = value_pos,
-            .timestamp = timestamp,
-            .next = 0,
-        };
     } else {
-        *kdr = (ccask_kdrow) {
-            0
-        };
+        size_t i = key_size;
+        if (i > 48) {
+            uint64_t see1 = seed, see2 = seed;
+            do {
+                seed = kd_mix(kd_read8(p) ^ s1, kd_read8(p + 8) ^ seed);
+                see1 = kd_mix(kd_read8(p + 16) ^ s2, kd_read8(p + 24) ^ see1);
+                see2 = kd_mix(kd_read8(p + 32) ^ s3, kd_read8(p + 40) ^ see2);
+                p += 48;
+                i -= 48;
+            } while (i > 48);
+            seed ^= see1 ^ see2;
+        }
+
+        while (i > 16) {
+            seed = kd_mix(kd_read8(p) ^ s1, kd_read8(p + 8) ^ seed);
+            p += 16;
+            i -= 16;
+        }
+
+        a = kd_read8(p + i - 16);
+        b = kd_read8(p + i - 8);
     }
 
+    a ^= s1;
+    b ^= seed;
+    kd_mum(&a, &b);
+    return kd_mix(a ^ s0 ^ key_size, b ^ s1);
+}
+
+/**@brief the seed keydirs hash with unless told otherwise: drawn at random on first use, then
+ * 		  the same for the life of the process
+ */
+uint64_t ccask_keydir_seed(void) {
+    static uint64_t process_seed;
+
+    uint64_t seed = __atomic_load_n(&process_seed, __ATOMIC_RELAXED);
+    if (seed) return seed;
+
+    if (getrandom(&seed, sizeof(seed), 0) != sizeof(seed)) {
+        // no entropy to be had (e.g. an old kernel): the clock and pid are harder to guess than 0
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        seed = fmix64((uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec) ^ fmix64(getpid());
+    }
+    if (seed == 0) seed = 1;
+
+    // if two threads race to set it, both use whichever seed won
+    uint64_t unset = 0;
+    if (!__atomic_compare_exchange_n(&process_seed, &unset, seed, false, __ATOMIC_RELAXED, __ATOMIC_RELAXED)) seed = unset;
+    return seed;
+}
+
+/**@brief write the 128-bit MurmurHash3 (x64 variant) digest of *key*, with seed *seed*, to *digest*.
+ *
+ * [MurmurHash3](https://github.com/aappleby/smhasher/blob/master/src/MurmurHash3.cpp)
+ *
+ * The tail is zero-padded to a full block: a zero lane mixes to zero, so this matches the
+ * reference's byte-by-byte tail on little-endian machines.
+ */
+void digest128(uint64_t seed, uint32_t key_size, const uint8_t* key, uint8_t digest[16]) {
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+    uint64_t h1 = seed, h2 = seed;
+    uint8_t tail[16] = { 0 };
+    uint64_t k1, k2;
+    uint32_t i = 0;
+
+    for (; key_size - i >= 16; i += 16) {
+        memcpy(&k1, key + i, 8);
+        memcpy(&k2, key + i + 8, 8);
+
+        k1 *= c1;
+        k1 = rotl64(k1, 31);
+        k1 *= c2;
+        h1 ^= k1;
+        h1 = rotl64(h1, 27) + h2;
+        h1 = h1 * 5 + 0x52dce729;
+
+        k2 *= c2;
+        k2 = rotl64(k2, 33);
+        k2 *= c1;
+        h2 ^= k2;
+        h2 = rotl64(h2, 31) + h1;
+        h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    memcpy(tail, key + i, key_size - i);
+    memcpy(&k1, tail, 8);
+    memcpy(&k2, tail + 8, 8);
+    k2 *= c2;
+    k2 = rotl64(k2, 33);
+    k2 *= c1;
+    h2 ^= k2;
+    k1 *= c1;
+    k1 = rotl64(k1, 31);
+    k1 *= c2;
+    h1 ^= k1;
+
+    h1 ^= key_size;
+    h2 ^= key_size;
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix64(h1);
+    h2 = fmix64(h2);
+    h1 += h2;
+    h2 += h1;
+
+    memcpy(digest, &h1, 8);
+    memcpy(digest + 8, &h2, 8);
+}
+
+/**@brief *n* rounded up to a power of two no smaller than KD_GROUP, saturating at the largest one*/
+size_t keydir_slots(size_t n) {
+    size_t slots = KD_GROUP;
+    while (slots < n && slots * 2 > slots) slots *= 2;
+
+    return slots;
+}
+
+#ifdef __SSE2__
+/**@brief bitmask of the slots of the group at *ctrl* whose control byte is *byte*, bit i for slot i*/
+uint32_t group_match(const uint8_t* ctrl, uint8_t byte) {
+    __m128i group = _mm_loadu_si128((const __m128i*)ctrl);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(group, _mm_set1_epi8((char)byte)));
+}
+
+/**@brief bitmask of the empty or deleted slots of the group at *ctrl*, i.e. those without CTRL_FULL*/
+uint32_t group_match_free(const uint8_t* ctrl) {
+    return ~_mm_movemask_epi8(_mm_loadu_si128((const __m128i*)ctrl)) & 0xFFFF;
+}
+#else
+uint32_t group_match(const uint8_t* ctrl, uint8_t byte) {
+    uint32_t bits = 0;
+    for (uint32_t i = 0; i < KD_GROUP; i++) bits |= (uint32_t)(ctrl[i] == byte) << i;
+    return bits;
+}
+
+uint32_t group_match_free(const uint8_t* ctrl) {
+    uint32_t bits = 0;
+    for (uint32_t i = 0; i < KD_GROUP; i++) bits |= (uint32_t)!(ctrl[i] & CTRL_FULL) << i;
+    return bits;
+}
+#endif
+
+/**@brief start a change guarded by the sequence count *seq*; only the writer calls this*/
+void seq_write_begin(uint32_t* seq) {
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+}
+
+void seq_write_end(uint32_t* seq) {
+    __atomic_store_n(seq, *seq + 1, __ATOMIC_RELEASE);
+}
+
+/**@brief the sequence count *seq* once no change is under way, for seq_read_valid*/
+uint32_t seq_read_begin(const uint32_t* seq) {
+    uint32_t s;
+    for (unsigned spins = 0; (s = __atomic_load_n(seq, __ATOMIC_ACQUIRE)) & 1; spins++) {
+        // the writer may have been preempted in the middle of its change
+        if (spins >= 64) sched_yield();
+    }
+
+    return s;
+}
+
+/**@brief whether nothing guarded by *seq* has changed since seq_read_begin returned *s*/
+bool seq_read_valid(const uint32_t* seq, uint32_t s) {
+    __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    return __atomic_load_n(seq, __ATOMIC_RELAXED) == s;
+}
+
+/*---------------kdrow functions-------------*/
+
+/**@brief whether a row with this (possibly flagged) key size keeps its key out of the row*/
+bool kdrow_spills(uint32_t key_size) {
+    return key_size > KD_INLINE_KEY && !(key_size & KDROW_DIGEST);
+}
+
+/**@brief the bytes of *kdr*'s key (or digest), wherever they are stored*/
+uint8_t* kdrow_key(ccask_kdrow* kdr) {
+    if (!kdrow_spills(kdr->key_size)) return kdr->key;
+
+    uint8_t* ptr;
+    memcpy(&ptr, kdr->key + KD_KEY_PREFIX, sizeof(ptr));
+    return ptr;
+}
+
+/**@brief whether *kdr* holds *key*. A long key's prefix is checked before its pointer is followed.*/
+bool kdrow_matches(ccask_kdrow* kdr, uint32_t key_size, const uint8_t* key) {
+    if (kdr->key_size != key_size) return false;
+    if (key_size & KDROW_DIGEST) return memcmp(key, kdr->key, KD_INLINE_KEY) == 0;
+    if (key_size <= KD_INLINE_KEY) return memcmp(key, kdr->key, key_size) == 0;
+
+    return memcmp(key, kdr->key, KD_KEY_PREFIX) == 0 && memcmp(key, kdrow_key(kdr), key_size) == 0;
+}
+
+/**@brief store *key* in *kdr*: in the row if it fits, otherwise in *copy*, which must hold key_size bytes*/
+void kdrow_set_key(ccask_kdrow* kdr, uint32_t key_size, const uint8_t* key, uint8_t* copy) {
+    kdr->key_size = key_size;
+    if (key_size & KDROW_DIGEST) {
+        memcpy(kdr->key, key, KD_INLINE_KEY);
+        return;
+    }
+    if (key_size <= KD_INLINE_KEY) {
+        if (key_size > 0) memcpy(kdr->key, key, key_size);
+        return;
+    }
+
+    memcpy(copy, key, key_size);
+    memcpy(kdr->key, key, KD_KEY_PREFIX);
+    memcpy(kdr->key + KD_KEY_PREFIX, &copy, sizeof(copy));
+}
+
+/**@brief the hash of *key* in *kd*'s table*/
+uint64_t kd_hash(const ccask_keydir* kd, uint32_t key_size, const uint8_t* key) {
+    return kd->hash(kd->seed, key_size, key);
+}
+
+/**@brief the table hash of *kdr*, a row of *kd*: a digest is already one*/
+uint64_t kdrow_hash(const ccask_keydir* kd, ccask_kdrow* kdr) {
+    if (!(kdr->key_size & KDROW_DIGEST)) return kd_hash(kd, kdr->key_size, kdrow_key(kdr));
+
+    uint64_t h;
+    memcpy(&h, kdr->key, sizeof(h));
+    return h;
+}
+
+/**@brief fold a record's timestamp and ttl into an expiry time, saturating in 2106*/
+uint32_t kdrow_expiry_of(time_t timestamp, uint32_t ttl) {
+    if (ttl == 0) return 0;
+
+    int64_t expiry = (int64_t)timestamp + ttl;
+    return expiry > UINT32_MAX ? UINT32_MAX : expiry < 1 ? 1 : expiry;
+}
+
+/**@brief ccask_kdrow_init builds a standalone row, whose long key is malloc'd (a keydir keeps
+ * 		  the long keys of its own rows in its arena). Returns 0 if the file id or offset does
+ * 		  not fit a packed row.
+ */
+ccask_kdrow* ccask_kdrow_init(ccask_kdrow* kdr, uint32_t key_size, uint8_t* key,
+                              uint32_t file_id, uint32_t value_size, size_t value_pos) {
+    if (!kdr) return 0;
+
+    *kdr = (ccask_kdrow) {
+        0
+    };
+    if (file_id > UINT16_MAX || value_pos > UINT32_MAX || (key_size & KDROW_DIGEST)) return 0;
+
+    uint8_t* copy = key_size > KD_INLINE_KEY ? malloc(key_size) : 0;
+    if (key_size > KD_INLINE_KEY && !copy) return 0;
+
+    kdr->file_id = file_id;
+    kdr->value_size = value_size;
+    kdr->value_pos = value_pos;
+    kdrow_set_key(kdr, key_size, key, copy);
+
     return kdr;
 }
 
 ccask_kdrow* ccask_kdrow_new(uint32_t key_size, uint8_t* key, uint32_t file_id,
-                             uint32_t value_size, uint32_t value_pos, time_t timestamp) {
+                             uint32_t value_size, size_t value_pos) {
     ccask_kdrow* kdr = malloc(sizeof(ccask_kdrow));
+    if (ccask_kdrow_init(kdr, key_size, key, file_id, value_size, value_pos)) return kdr;
 
-    return ccask_kdrow_init(kdr, key_size, key, file_id, value_size, value_pos, timestamp);
+    free(kdr);
+    return 0;
 }
 
-/**@brief zeroes out a ccask_kdrow obj and frees any allocated memory*/
+/**@brief zeroes out a standalone ccask_kdrow obj and frees any allocated memory*/
 void ccask_kdrow_destroy(ccask_kdrow* kdr) {
     if (kdr) {
-        if(kdr->next) ccask_kdrow_delete(kdr->next);
-        kdr->next = 0;
-        free(kdr->key);
+        if (kdrow_spills(kdr->key_size)) free(kdrow_key(kdr));
         *kdr = (ccask_kdrow) {
             0
         };
@@ -124,19 +548,20 @@ void ccask_kdrow_delete(ccask_kdrow* kdr) {
     }
 }
 
+/**@brief copy *src* into the standalone row *dest*, replacing the key it held*/
 ccask_kdrow* ccask_kdrow_copy(ccask_kdrow* dest, const ccask_kdrow* src) {
     if (!dest || !src) return 0;
 
-    dest->key_size = src->key_size;
+    uint8_t* copy = kdrow_spills(src->key_size) ? malloc(src->key_size) : 0;
+    if (kdrow_spills(src->key_size) && !copy) return 0;
+
+    if (kdrow_spills(dest->key_size)) free(kdrow_key(dest));
+    kdrow_set_key(dest, src->key_size, kdrow_key((ccask_kdrow*)src), copy);
+
     dest->file_id = src->file_id;
     dest->value_size = src->value_size;
     dest->value_pos = src->value_pos;
-    dest->timestamp = src->timestamp;
-    dest->next = src->next;
-
-    if (dest->key) free(dest->key);
-    dest->key = malloc(dest->key_size);
-    memcpy(dest->key, src->key, dest->key_size);
+    dest->expiry = src->expiry;
 
     return dest;
 }
@@ -147,6 +572,26 @@ uint32_t ccask_kdrow_fid(ccask_kdrow* kdr) {
     return kdr->file_id;
 }
 
+/**@brief *kdr*'s key, or 0 if the row only holds a digest of it*/
+uint8_t* ccask_kdrow_key(ccask_kdrow* kdr) {
+    if (!kdr || (kdr->key_size & KDROW_DIGEST)) return 0;
+
+    return kdrow_key(kdr);
+}
+
+/**@brief what *kdr* is indexed by: its key, or in a digest-keyed keydir its digest*/
+const uint8_t* ccask_kdrow_index_key(ccask_kdrow* kdr) {
+    if (!kdr) return 0;
+
+    return kdrow_key(kdr);
+}
+
+uint32_t ccask_kdrow_ksize(ccask_kdrow* kdr) {
+    if (!kdr) return UINT32_MAX;
+
+    return kdr->key_size & ~KDROW_DIGEST;
+}
+
 uint32_t ccask_kdrow_vsize(ccask_kdrow* kdr) {
     if (!kdr) return UINT32_MAX;
 
@@ -159,26 +604,643 @@ size_t ccask_kdrow_vpos(ccask_kdrow* kdr) {
     return kdr->value_pos;
 }
 
+/**@brief the time at which *kdr* expires, or 0 if it never does*/
+time_t ccask_kdrow_expiry(ccask_kdrow* kdr) {
+    if (!kdr) return 0;
+
+    return kdr->expiry;
+}
+
+/**@brief move *kdr* to *value_pos* in file *file_id*, leaving the key, sizes and expiry untouched.
+ * 		  Returns 0 if the new location does not fit a packed row.
+ */
+ccask_kdrow* ccask_kdrow_relocate(ccask_kdrow* kdr, uint32_t file_id, size_t value_pos) {
+    if (!kdr || file_id > UINT16_MAX || value_pos > UINT32_MAX) return 0;
+
+    kdr->file_id = file_id;
+    kdr->value_pos = value_pos;
+
+    return kdr;
+}
+
 void ccask_kdrow_print(ccask_kdrow* kdr) {
-    printf("File ID: %u Key size: %u Value pos: %zu Value size: %u ", kdr->file_id, kdr->key_size, kdr->value_pos, kdr->value_size);
-    printf("Key: [ ");
-    for (uint32_t i = 0; i < kdr->key_size; i++) {
-        printf("%hhx ", kdr->key[i]);
+    uint32_t key_size = kdr->key_size & ~KDROW_DIGEST;
+    printf("File ID: %u Key size: %u Value pos: %u Value size: %u ", kdr->file_id, key_size, kdr->value_pos, kdr->value_size);
+    printf(kdr->key_size & KDROW_DIGEST ? "Digest: [ " : "Key: [ ");
+    uint8_t* key = kdrow_key(kdr);
+    for (uint32_t i = 0; i < (kdr->key_size & KDROW_DIGEST ? KD_INLINE_KEY : key_size); i++) {
+        printf("%hhx ", key[i]);
     }
-    printf("] Timestamp: %ld\n", kdr->timestamp);
+    printf("] Expiry: %u\n", kdr->expiry);
 }
 
 /*------------------keydir functions------------------*/
-ccask_keydir* ccask_keydir_init(ccask_keydir* kd, size_t size, size_t max_size) {
+
+/**@brief *bytes* of zeroed memory for a table array or arena chunk, backed by transparent huge
+ * 		  pages if *huge* is set. Tables are mapped directly rather than malloc'd so a resize can
+ * 		  hand the rows it has moved back to the kernel piece by piece.
+ */
+void* kd_alloc(size_t bytes, bool huge) {
+    void* p = mmap(0, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) return 0;
+
+#ifdef MADV_HUGEPAGE
+    // only a hint: where transparent huge pages are off the mapping keeps small pages
+    if (huge) madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+
+    return p;
+}
+
+void kd_free(void* p, size_t bytes) {
+    if (p) munmap(p, bytes);
+}
+
+/**@brief the memory a table of *size* slots takes*/
+size_t kd_table_bytes(size_t size) {
+    return size * (sizeof(ccask_kdrow) + 1) + size / KD_GROUP * sizeof(uint32_t);
+}
+
+/**@brief allocate *size* empty slots for *t*. Returns 0 on success; -2 when the allocation
+ * 		  fails; -3 when the size would overflow.
+ */
+int kd_table_init(kd_table* t, size_t size, bool huge) {
+    if (size * sizeof(ccask_kdrow) / sizeof(ccask_kdrow) != size) return -3;
+
+    *t = (kd_table) {
+        .size = size,
+        .ctrl = kd_alloc(size, huge),
+        .seq = kd_alloc(size / KD_GROUP * sizeof(uint32_t), huge),
+        .entries = kd_alloc(sizeof(ccask_kdrow) * size, huge),
+    };
+
+    if (!t->ctrl || !t->seq || !t->entries) {
+        kd_free(t->ctrl, size);
+        kd_free(t->seq, size / KD_GROUP * sizeof(uint32_t));
+        kd_free(t->entries, sizeof(ccask_kdrow) * size);
+        *t = (kd_table) {
+            0
+        };
+        return -2;
+    }
+
+    return 0;
+}
+
+/**@brief free *t*'s arrays, and the malloc'd keys of its rows if *rows* is set (arena keys go
+ * 		  with the arena)
+ */
+void kd_table_destroy(kd_table* t, bool rows) {
+    for (size_t i = 0; rows && i < t->size; i++) {
+        uint32_t key_size = t->entries[i].key_size;
+        if ((t->ctrl[i] & CTRL_FULL) && kdrow_spills(key_size) && key_size > KD_SLAB_MAX) free(kdrow_key(t->entries + i));
+    }
+
+    kd_free(t->ctrl, t->size);
+    kd_free(t->seq, t->size / KD_GROUP * sizeof(uint32_t));
+    if (t->entries) kd_free((uint8_t*)t->entries + t->released, sizeof(ccask_kdrow) * t->size - t->released);
+    *t = (kd_table) {
+        0
+    };
+}
+
+/**@brief the slot of *t* holding *key*, whose hash is *h*, or SIZE_MAX if *t* does not have it*/
+size_t kd_table_find(const kd_table* t, uint32_t key_size, uint8_t* key, uint64_t h) {
+    size_t mask = t->size / KD_GROUP - 1;
+    size_t group = (h >> 7) & mask;
+    uint8_t tag = CTRL_FULL | (h & 0x7F);
+
+    for (size_t i = 0; t->size && i <= mask; i++) {
+        const uint8_t* ctrl = t->ctrl + group * KD_GROUP;
+
+        for (uint32_t bits = group_match(ctrl, tag); bits; bits &= bits - 1) {
+            size_t slot = group * KD_GROUP + __builtin_ctz(bits);
+            ccask_kdrow* row = t->entries + slot;
+            if (kdrow_matches(row, key_size, key)) return slot;
+        }
+
+        if (group_match(ctrl, CTRL_EMPTY)) return SIZE_MAX;
+        group = (group + i + 1) & mask;
+    }
+
+    return SIZE_MAX;
+}
+
+/**@brief copy the location of *key*, whose hash is *h*, to *loc* if *t* has it. Safe while the
+ * 		  writer changes *t*: each group is read again until its sequence count holds still.
+ */
+bool kd_table_read(const kd_table* t, uint32_t key_size, uint8_t* key, uint64_t h, ccask_kdloc* loc) {
+    if (t->size == 0) return false;
+
+    size_t mask = t->size / KD_GROUP - 1;
+    size_t group = (h >> 7) & mask;
+    uint8_t tag = CTRL_FULL | (h & 0x7F);
+
+    for (size_t i = 0; i <= mask;) {
+        const uint8_t* ctrl = t->ctrl + group * KD_GROUP;
+        uint32_t seq = seq_read_begin(t->seq + group);
+        bool found = false;
+        ccask_kdrow row;
+
+        for (uint32_t bits = group_match(ctrl, tag); bits && !found; bits &= bits - 1) {
+            row = t->entries[group * KD_GROUP + __builtin_ctz(bits)];
+
+            // a long key's pointer is only followed once the row it came from is known to be whole
+            if (kdrow_spills(row.key_size) && !seq_read_valid(t->seq + group, seq)) break;
+            found = kdrow_matches(&row, key_size, key);
+        }
+        bool empty = group_match(ctrl, CTRL_EMPTY) != 0;
+
+        if (!seq_read_valid(t->seq + group, seq)) continue;
+        if (found) {
+            *loc = (ccask_kdloc) {
+                .file_id = row.file_id,
+                .value_size = row.value_size,
+                .value_pos = row.value_pos,
+                .expiry = row.expiry,
+            };
+            return true;
+        }
+        if (empty) return false;
+
+        group = (group + i + 1) & mask;
+        i++;
+    }
+
+    return false;
+}
+
+/**@brief the first empty or deleted slot of *t* on the probe sequence of hash *h*, or SIZE_MAX
+ * 		  if every slot is full
+ */
+size_t kd_table_free_slot(const kd_table* t, uint64_t h) {
+    size_t mask = t->size / KD_GROUP - 1;
+    size_t group = (h >> 7) & mask;
+
+    for (size_t i = 0; i <= mask; i++) {
+        uint32_t bits = group_match_free(t->ctrl + group * KD_GROUP);
+        if (bits) return group * KD_GROUP + __builtin_ctz(bits);
+
+        group = (group + i + 1) & mask;
+    }
+
+    return SIZE_MAX;
+}
+
+/**@brief a block for a key of *len* bytes, or 0 if memory runs out*/
+uint8_t* kd_arena_alloc(kd_arena* a, uint32_t len) {
+    if (len > KD_SLAB_MAX) {
+        uint8_t* p = malloc(len);
+        if (p) a->bytes += len;
+        return p;
+    }
+
+    size_t cls = (len + KD_SLAB_ALIGN - 1) / KD_SLAB_ALIGN;
+    uint8_t* p = a->free[cls];
+    if (p) {
+        memcpy(&a->free[cls], p, sizeof(p));
+        return p;
+    }
+
+    size_t block = cls * KD_SLAB_ALIGN;
+    if (a->chunk_count == 0 || a->used + block > KD_ARENA_CHUNK) {
+        if (a->chunk_count == a->chunk_cap) {
+            size_t cap = a->chunk_cap ? a->chunk_cap * 2 : 16;
+            uint8_t** chunks = realloc(a->chunks, cap * sizeof(uint8_t*));
+            if (!chunks) return 0;
+
+            a->chunks = chunks;
+            a->chunk_cap = cap;
+        }
+
+        uint8_t* chunk = kd_alloc(KD_ARENA_CHUNK, a->huge);
+        if (!chunk) return 0;
+
+        a->chunks[a->chunk_count++] = chunk;
+        a->used = 0;
+        a->bytes += KD_ARENA_CHUNK;
+    }
+
+    p = a->chunks[a->chunk_count - 1] + a->used;
+    a->used += block;
+    return p;
+}
+
+/**@brief give back the block of a key of *len* bytes; it heads its size class's free list*/
+void kd_arena_free(kd_arena* a, uint8_t* p, uint32_t len) {
+    if (len > KD_SLAB_MAX) {
+        free(p);
+        a->bytes -= len;
+        return;
+    }
+
+    size_t cls = (len + KD_SLAB_ALIGN - 1) / KD_SLAB_ALIGN;
+    memcpy(p, &a->free[cls], sizeof(p));
+    a->free[cls] = p;
+}
+
+void kd_arena_destroy(kd_arena* a) {
+    for (size_t i = 0; i < a->chunk_count; i++) kd_free(a->chunks[i], KD_ARENA_CHUNK);
+    free(a->chunks);
+    *a = (kd_arena) {
+        0
+    };
+}
+
+/*---------------ordered index-------------*/
+
+/* An ordered keydir also keeps its keys in a B+tree, for scans in key order; the hash table
+ * still answers every lookup. Tree keys are held like row keys: a long key's leaf entry points
+ * at the same arena copy as its row, so the tree costs about KD_TREE_KEY bytes per key over
+ * the hash keydir, plus node slack. Separators in inner nodes own their copies, since they can
+ * outlive the keys they came from.
+ *
+ * Nodes are only merged with or topped up from a neighbour once they fall below a quarter
+ * full, which keeps removals cheap without letting the tree thin out.
+ */
+
+#define KD_TREE_ORDER 32        // keys per leaf, children per inner node
+#define KD_TREE_MIN (KD_TREE_ORDER / 4)
+#define KD_TREE_DEPTH 48        // far deeper than a tree of 2^64 keys at KD_TREE_MIN per node
+
+// a key held the way a row holds it: inline, or a prefix and a pointer to the whole key
+typedef struct kd_tkey {
+    uint32_t key_size;
+    uint8_t key[KD_INLINE_KEY];
+} kd_tkey;
+
+#define KD_TREE_KEY sizeof(kd_tkey)
+
+typedef struct kd_node {
+    uint32_t count;             // keys in a leaf, children in an inner node
+    bool leaf;
+    kd_tkey keys[KD_TREE_ORDER];    // an inner node's keys[i] is the least key under children[i + 1]
+    struct kd_node* children[];     // inner nodes only
+} kd_node;
+
+uint8_t* tkey_key(const kd_tkey* tk) {
+    if (tk->key_size <= KD_INLINE_KEY) return (uint8_t*)tk->key;
+
+    uint8_t* ptr;
+    memcpy(&ptr, tk->key + KD_KEY_PREFIX, sizeof(ptr));
+    return ptr;
+}
+
+/**@brief order *tk* against *key*, like memcmp, with a shorter key first among equal prefixes*/
+int tkey_cmp(const kd_tkey* tk, uint32_t key_size, const uint8_t* key) {
+    uint32_t n = tk->key_size < key_size ? tk->key_size : key_size;
+
+    // the first bytes of a long key are in the entry too, and usually settle it
+    int c = n ? memcmp(tk->key, key, n < KD_KEY_PREFIX ? n : KD_KEY_PREFIX) : 0;
+    if (c == 0 && n > KD_KEY_PREFIX) c = memcmp(tkey_key(tk), key, n);
+    if (c != 0) return c;
+
+    return tk->key_size < key_size ? -1 : tk->key_size > key_size;
+}
+
+/**@brief the first key of leaf *n* not less than *key*, or n->count*/
+uint32_t kd_leaf_lower(const kd_node* n, uint32_t key_size, const uint8_t* key) {
+    uint32_t lo = 0, hi = n->count;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (tkey_cmp(n->keys + mid, key_size, key) < 0) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return lo;
+}
+
+/**@brief the child of inner node *n* whose keys span *key*'s place*/
+uint32_t kd_inner_child(const kd_node* n, uint32_t key_size, const uint8_t* key) {
+    uint32_t lo = 0, hi = n->count - 1;
+    while (lo < hi) {
+        uint32_t mid = (lo + hi) / 2;
+        if (tkey_cmp(n->keys + mid, key_size, key) <= 0) lo = mid + 1;
+        else hi = mid;
+    }
+
+    return lo;
+}
+
+kd_node* kd_node_new(ccask_keydir* kd, bool leaf) {
+    size_t bytes = sizeof(kd_node) + (leaf ? 0 : KD_TREE_ORDER * sizeof(kd_node*));
+    kd_node* n = malloc(bytes);
+    if (!n) {
+        perror("ccask_keydir: tree");
+        exit(1);
+    }
+
+    n->count = 0;
+    n->leaf = leaf;
+    kd->tree_bytes += bytes;
+    return n;
+}
+
+void kd_node_free(ccask_keydir* kd, kd_node* n) {
+    kd->tree_bytes -= sizeof(kd_node) + (n->leaf ? 0 : KD_TREE_ORDER * sizeof(kd_node*));
+    free(n);
+}
+
+/**@brief a separator for *tk* that owns its key*/
+kd_tkey kd_tree_own(ccask_keydir* kd, const kd_tkey* tk) {
+    kd_tkey sep = *tk;
+    if (tk->key_size <= KD_INLINE_KEY) return sep;
+
+    uint8_t* copy = kd_arena_alloc(&kd->arena, tk->key_size);
+    if (!copy) {
+        perror("ccask_keydir: tree");
+        exit(1);
+    }
+    memcpy(copy, tkey_key(tk), tk->key_size);
+    memcpy(sep.key + KD_KEY_PREFIX, &copy, sizeof(copy));
+    return sep;
+}
+
+void kd_tree_disown(ccask_keydir* kd, kd_tkey* sep) {
+    if (sep->key_size > KD_INLINE_KEY) kd_arena_free(&kd->arena, tkey_key(sep), sep->key_size);
+}
+
+/**@brief add *tk* to the subtree under *n*. If *n* has to split, returns its new right
+ * 		  sibling, with the separator between the two in *sep*; otherwise 0.
+ */
+kd_node* kd_tree_insert(ccask_keydir* kd, kd_node* n, const kd_tkey* tk, kd_tkey* sep) {
+    uint32_t key_size = tk->key_size;
+    uint8_t* key = tkey_key(tk);
+
+    if (n->leaf) {
+        uint32_t i = kd_leaf_lower(n, key_size, key);
+        kd_node* right = 0;
+
+        if (n->count == KD_TREE_ORDER) {
+            uint32_t half = KD_TREE_ORDER / 2;
+            right = kd_node_new(kd, true);
+            memcpy(right->keys, n->keys + half, half * sizeof(kd_tkey));
+            right->count = half;
+            n->count = half;
+
+            if (i > half) {
+                n = right;
+                i -= half;
+            }
+        }
+
+        memmove(n->keys + i + 1, n->keys + i, (n->count - i) * sizeof(kd_tkey));
+        n->keys[i] = *tk;
+        n->count++;
+
+        if (right) *sep = kd_tree_own(kd, right->keys);
+        return right;
+    }
+
+    uint32_t c = kd_inner_child(n, key_size, key);
+    kd_tkey child_sep;
+    kd_node* split = kd_tree_insert(kd, n->children[c], tk, &child_sep);
+    if (!split) return 0;
+
+    // lay out the children and separators as they would be with room for one more, then halve
+    kd_tkey keys[KD_TREE_ORDER];
+    kd_node* children[KD_TREE_ORDER + 1];
+    uint32_t count = n->count + 1;
+
+    memcpy(keys, n->keys, c * sizeof(kd_tkey));
+    keys[c] = child_sep;
+    memcpy(keys + c + 1, n->keys + c, (n->count - 1 - c) * sizeof(kd_tkey));
+    memcpy(children, n->children, (c + 1) * sizeof(kd_node*));
+    children[c + 1] = split;
+    memcpy(children + c + 2, n->children + c + 1, (n->count - 1 - c) * sizeof(kd_node*));
+
+    if (count <= KD_TREE_ORDER) {
+        memcpy(n->keys, keys, (count - 1) * sizeof(kd_tkey));
+        memcpy(n->children, children, count * sizeof(kd_node*));
+        n->count = count;
+        return 0;
+    }
+
+    uint32_t left = count / 2;
+    kd_node* right = kd_node_new(kd, false);
+    memcpy(n->keys, keys, (left - 1) * sizeof(kd_tkey));
+    memcpy(n->children, children, left * sizeof(kd_node*));
+    n->count = left;
+
+    *sep = keys[left - 1];
+    memcpy(right->keys, keys + left, (count - left - 1) * sizeof(kd_tkey));
+    memcpy(right->children, children + left, (count - left) * sizeof(kd_node*));
+    right->count = count - left;
+    return right;
+}
+
+/**@brief merge children *l* and *l* + 1 of inner node *p*, or share their entries evenly
+ * 		  between them when they don't fit in one node
+ */
+void kd_tree_rebalance(ccask_keydir* kd, kd_node* p, uint32_t l) {
+    kd_node* a = p->children[l];
+    kd_node* b = p->children[l + 1];
+    kd_tkey keys[2 * KD_TREE_ORDER];
+    kd_node* children[2 * KD_TREE_ORDER];
+    uint32_t count = a->count + b->count;
+
+    // leaves just join up; inner nodes take the separator between them back down
+    memcpy(keys, a->keys, (a->leaf ? a->count : a->count - 1) * sizeof(kd_tkey));
+    if (a->leaf) {
+        memcpy(keys + a->count, b->keys, b->count * sizeof(kd_tkey));
+        kd_tree_disown(kd, p->keys + l);
+    } else {
+        keys[a->count - 1] = p->keys[l];
+        memcpy(keys + a->count, b->keys, (b->count - 1) * sizeof(kd_tkey));
+        memcpy(children, a->children, a->count * sizeof(kd_node*));
+        memcpy(children + a->count, b->children, b->count * sizeof(kd_node*));
+    }
+
+    if (count <= KD_TREE_ORDER) {
+        memcpy(a->keys, keys, (a->leaf ? count : count - 1) * sizeof(kd_tkey));
+        if (!a->leaf) memcpy(a->children, children, count * sizeof(kd_node*));
+        a->count = count;
+        kd_node_free(kd, b);
+
+        memmove(p->keys + l, p->keys + l + 1, (p->count - l - 2) * sizeof(kd_tkey));
+        memmove(p->children + l + 1, p->children + l + 2, (p->count - l - 2) * sizeof(kd_node*));
+        p->count--;
+        return;
+    }
+
+    uint32_t left = count / 2;
+    if (a->leaf) {
+        memcpy(a->keys, keys, left * sizeof(kd_tkey));
+        memcpy(b->keys, keys + left, (count - left) * sizeof(kd_tkey));
+        p->keys[l] = kd_tree_own(kd, b->keys);
+    } else {
+        memcpy(a->keys, keys, (left - 1) * sizeof(kd_tkey));
+        memcpy(a->children, children, left * sizeof(kd_node*));
+        p->keys[l] = keys[left - 1];
+        memcpy(b->keys, keys + left, (count - left - 1) * sizeof(kd_tkey));
+        memcpy(b->children, children + left, (count - left) * sizeof(kd_node*));
+    }
+    a->count = left;
+    b->count = count - left;
+}
+
+/**@brief remove *key* from the subtree under *n*, returning whether it was there. *n* itself may
+ * 		  be left under KD_TREE_MIN; its parent rebalances it.
+ */
+bool kd_tree_remove(ccask_keydir* kd, kd_node* n, uint32_t key_size, const uint8_t* key) {
+    if (n->leaf) {
+        uint32_t i = kd_leaf_lower(n, key_size, key);
+        if (i == n->count || tkey_cmp(n->keys + i, key_size, key) != 0) return false;
+
+        memmove(n->keys + i, n->keys + i + 1, (n->count - i - 1) * sizeof(kd_tkey));
+        n->count--;
+        return true;
+    }
+
+    uint32_t c = kd_inner_child(n, key_size, key);
+    if (!kd_tree_remove(kd, n->children[c], key_size, key)) return false;
+
+    if (n->children[c]->count < KD_TREE_MIN) kd_tree_rebalance(kd, n, c + 1 < n->count ? c : c - 1);
+    return true;
+}
+
+/**@brief add the key of *row* to the tree*/
+void keydir_tree_put(ccask_keydir* kd, const ccask_kdrow* row) {
+    kd_tkey tk = { .key_size = row->key_size };
+    memcpy(tk.key, row->key, KD_INLINE_KEY);
+
+    if (!kd->root) kd->root = kd_node_new(kd, true);
+
+    kd_tkey sep;
+    kd_node* right = kd_tree_insert(kd, kd->root, &tk, &sep);
+    if (!right) return;
+
+    kd_node* root = kd_node_new(kd, false);
+    root->keys[0] = sep;
+    root->children[0] = kd->root;
+    root->children[1] = right;
+    root->count = 2;
+    kd->root = root;
+}
+
+void keydir_tree_remove(ccask_keydir* kd, uint32_t key_size, const uint8_t* key) {
+    if (!kd->root || !kd_tree_remove(kd, kd->root, key_size, key)) return;
+
+    // an inner root left with one child hands over to it
+    if (!kd->root->leaf && kd->root->count == 1) {
+        kd_node* root = kd->root;
+        kd->root = root->children[0];
+        kd_node_free(kd, root);
+    }
+}
+
+void kd_tree_destroy(ccask_keydir* kd, kd_node* n) {
+    if (!n) return;
+
+    if (!n->leaf) {
+        for (uint32_t i = 0; i < n->count; i++) kd_tree_destroy(kd, n->children[i]);
+        for (uint32_t i = 0; i + 1 < n->count; i++) kd_tree_disown(kd, n->keys + i);
+    }
+    kd_node_free(kd, n);
+}
+
+/**@brief hand *p* (*bytes* mapped, or 0 if malloc'd) back once no reader can be looking at it*/
+void keydir_retire(ccask_keydir* kd, void* p, size_t bytes) {
+    if (!p) return;
+
+    kd_limbo* l = kd->limbo + kd->epoch % 3;
+    if (l->count == l->cap) {
+        size_t cap = l->cap ? l->cap * 2 : 16;
+        kd_retired* items = realloc(l->items, cap * sizeof(kd_retired));
+        if (!items) {
+            perror("ccask_keydir: realloc");
+            exit(1);
+        }
+        l->items = items;
+        l->cap = cap;
+    }
+
+    l->items[l->count++] = (kd_retired) {
+        p, bytes
+    };
+}
+
+void kd_limbo_free(kd_limbo* l) {
+    for (size_t i = 0; i < l->count; i++) {
+        if (l->items[i].bytes) kd_free(l->items[i].p, l->items[i].bytes);
+        else free(l->items[i].p);
+    }
+    l->count = 0;
+}
+
+/**@brief retire the arrays of *t*, which readers can no longer reach, and mark it empty*/
+void keydir_retire_table(ccask_keydir* kd, kd_table* t) {
+    keydir_retire(kd, t->ctrl, t->size);
+    keydir_retire(kd, t->seq, t->size / KD_GROUP * sizeof(uint32_t));
+    if (t->entries && t->released < sizeof(ccask_kdrow) * t->size) {
+        keydir_retire(kd, (uint8_t*)t->entries + t->released, sizeof(ccask_kdrow) * t->size - t->released);
+    }
+
+    *t = (kd_table) {
+        0
+    };
+}
+
+/**@brief move to the next epoch if every reader from before the current one has left, freeing
+ * 		  what was retired in the epoch before the current one: any reader that could have seen
+ * 		  it entered no later than that, and has now left.
+ */
+void keydir_reclaim(ccask_keydir* kd) {
+    if (kd->limbo[0].count + kd->limbo[1].count + kd->limbo[2].count == 0) return;
+
+    uint64_t epoch = kd->epoch;
+    for (size_t s = 0; s < KD_STRIPES; s++) {
+        if (__atomic_load_n(&kd->readers[(epoch + 1) & 1][s].count, __ATOMIC_SEQ_CST)) return;
+    }
+
+    kd_limbo_free(kd->limbo + (epoch + 2) % 3);
+    __atomic_store_n(&kd->epoch, epoch + 1, __ATOMIC_SEQ_CST);
+}
+
+__thread size_t kd_thread_stripe = SIZE_MAX;   // this thread's reader stripe, picked on its first read
+size_t kd_next_stripe = 0;
+
+/**@brief count the calling thread as a reader in the current epoch, returning the counter to
+ * 		  decrement once it is done. A reader that races the epoch moving on enters again, so
+ * 		  it is always counted in the parity of the epoch it read.
+ */
+uint64_t* keydir_reader_enter(ccask_keydir* kd) {
+    if (kd_thread_stripe == SIZE_MAX) kd_thread_stripe = __atomic_fetch_add(&kd_next_stripe, 1, __ATOMIC_RELAXED) % KD_STRIPES;
+
+    for (;;) {
+        uint64_t epoch = __atomic_load_n(&kd->epoch, __ATOMIC_SEQ_CST);
+        uint64_t* count = &kd->readers[epoch & 1][kd_thread_stripe].count;
+
+        __atomic_fetch_add(count, 1, __ATOMIC_SEQ_CST);
+        if (__atomic_load_n(&kd->epoch, __ATOMIC_SEQ_CST) == epoch) return count;
+        __atomic_fetch_sub(count, 1, __ATOMIC_SEQ_CST);
+    }
+}
+
+void keydir_reader_exit(uint64_t* count) {
+    __atomic_fetch_sub(count, 1, __ATOMIC_RELEASE);
+}
+
+/**@brief ccask_keydir_init: *size* is the initial count of slots, rounded up to a power of two;
+ * 		  *max_bytes* is the memory the keydir may grow into; *huge* backs its memory with
+ * 		  transparent huge pages; *digest_keys* stores key digests instead of keys; *ordered*
+ * 		  keeps the keys in order too, and as it needs the keys themselves overrides *digest_keys*
+ */
+ccask_keydir* ccask_keydir_init(ccask_keydir* kd, size_t size, size_t max_bytes, bool huge, bool digest_keys, bool ordered) {
     if (kd) {
         *kd = (ccask_keydir) {
-            .load_factor = 70,
-            .size = size,
-            .entries = malloc(size*sizeof(ccask_kdrow)),
+            .load_factor = 87,
             .entry_count = 0,
-            .max_size = max_size,
+            .deleted = 0,
+            .max_bytes = max_bytes,
+            .huge = huge,
+            .digest_keys = digest_keys && !ordered,
+            .ordered = ordered,
+            .hash = ccask_kdhash_wyhash,
+            .seed = ccask_keydir_seed(),
+            .arena = { .huge = huge },
         };
-        init_entries(size, kd->entries);
+        kd_table_init(&kd->cur, keydir_slots(size), huge);
     } else {
         *kd = (ccask_keydir) {
             0
@@ -187,21 +1249,37 @@ ccask_keydir* ccask_keydir_init(ccask_keydir* kd, size_t size, size_t max_size)
     return kd;
 }
 
-ccask_keydir* ccask_keydir_new(size_t size, size_t max_size) {
+ccask_keydir* ccask_keydir_new(size_t size, size_t max_bytes, bool huge, bool digest_keys, bool ordered) {
     ccask_keydir* kd = malloc(sizeof(ccask_keydir));
-    kd = ccask_keydir_init(kd, size, max_size);
+    kd = ccask_keydir_init(kd, size, max_bytes, huge, digest_keys, ordered);
+    return kd;
+}
+
+/**@brief hash *kd*'s keys with *fn* and *seed* from now on. Only an empty keydir, with no
+ * 		  readers yet, can change its hash: returns 0 if *kd* has keys.
+ */
+ccask_keydir* ccask_keydir_set_hash(ccask_keydir* kd, ccask_kdhash_fn fn, uint64_t seed) {
+    if (!kd || !fn || kd->entry_count > 0 || kd->old.size > 0) return 0;
+
+    kd->hash = fn;
+    kd->seed = seed;
     return kd;
 }
 
+uint64_t ccask_keydir_hash_seed(const ccask_keydir* kd) {
+    return kd ? kd->seed : 0;
+}
+
 void ccask_keydir_destroy(ccask_keydir* kd) {
     if (kd) {
-        for (size_t i = 0; i < kd->size; i++) {
-            if (kd->entries[i].key_size != 0) {
-                ccask_kdrow_destroy(kd->entries+i);
-            }
+        kd_table_destroy(&kd->cur, true);
+        kd_table_destroy(&kd->old, true);
+        kd_tree_destroy(kd, kd->root);
+        kd_arena_destroy(&kd->arena);
+        for (size_t i = 0; i < 3; i++) {
+            kd_limbo_free(kd->limbo + i);
+            free(kd->limbo[i].items);
         }
-
-        free(kd->entries);
         *kd = (ccask_keydir) {
             0
         };
@@ -213,122 +1291,534 @@ void ccask_keydir_delete(ccask_keydir* kd) {
     free(kd);
 }
 
-/**@brief ccask_keydir_resize returns 0 on success; 1 when a null pointer is passed; -1 when the keydir is already at its maximum size; -2 when malloc fails; -3 when new size would overflow*/
+/**@brief move the rows of up to *slots* more old slots into the current table, freeing the old
+ * 		  table once it is empty
+ */
+void keydir_migrate(ccask_keydir* kd, size_t slots) {
+    kd_table* old = &kd->old;
+
+    for (; slots > 0 && kd->old_count > 0 && kd->migrated < old->size; slots--) {
+        size_t i = kd->migrated++;
+        if (!(old->ctrl[i] & CTRL_FULL)) continue;
+
+        // rows keep their keys: only the struct moves, to the first free slot of its new probe sequence
+        ccask_kdrow* row = old->entries + i;
+        uint64_t h = kdrow_hash(kd, row);
+        size_t slot = kd_table_free_slot(&kd->cur, h);
+        if (slot == SIZE_MAX) {
+            kd->migrated--;
+            break;
+        }
+
+        // the row is in the current table before it leaves the old one, so a reader looking
+        // in old and then cur can't miss it
+        seq_write_begin(kd->cur.seq + slot / KD_GROUP);
+        if (kd->cur.ctrl[slot] == CTRL_DELETED) kd->deleted--;
+        kd->cur.ctrl[slot] = CTRL_FULL | (h & 0x7F);
+        kd->cur.entries[slot] = *row;
+        seq_write_end(kd->cur.seq + slot / KD_GROUP);
+
+        seq_write_begin(old->seq + i / KD_GROUP);
+        old->ctrl[i] = CTRL_DELETED;
+        seq_write_end(old->seq + i / KD_GROUP);
+        kd->old_count--;
+    }
+
+    // moved rows are never found again (their slots are deleted), so they are released as the
+    // resize goes rather than all at once at the end
+    size_t done = kd->migrated * sizeof(ccask_kdrow) / KD_RELEASE_BYTES * KD_RELEASE_BYTES;
+    if (done > old->released) {
+        keydir_retire(kd, (uint8_t*)old->entries + old->released, done - old->released);
+        old->released = done;
+    }
+
+    if (old->size && kd->old_count == 0) {
+        kd_table done_table = *old;
+        seq_write_begin(&kd->layout);
+        *old = (kd_table) {
+            0
+        };
+        seq_write_end(&kd->layout);
+
+        keydir_retire_table(kd, &done_table);
+        kd->migrated = 0;
+    }
+}
+
+/**@brief whether a resize to a table of *size* slots fits in the memory budget*/
+bool keydir_affords(const ccask_keydir* kd, size_t size) {
+    size_t slot_bytes = sizeof(ccask_kdrow) + 2;
+    if (size > SIZE_MAX / 2 / slot_bytes || kd->cur.size > SIZE_MAX / 2 / slot_bytes) return false;
+
+    size_t bytes = kd_table_bytes(kd->cur.size) + kd_table_bytes(size);
+    return bytes <= kd->max_bytes && kd->arena.bytes + kd->tree_bytes <= kd->max_bytes - bytes;
+}
+
+/**@brief start moving every row to a new table of *size* slots, which sheds all deleted
+ * 		  markers. Returns 0 on success; -1 when a resize is already under way; -2 when
+ * 		  malloc fails; -3 when the size would overflow.
+ */
+int keydir_start_resize(ccask_keydir* kd, size_t size) {
+    if (kd->old.size) return -1;
+
+    kd_table next;
+    int res = kd_table_init(&next, size, kd->huge);
+    if (res != 0) return res;
+
+    seq_write_begin(&kd->layout);
+    kd->old = kd->cur;
+    kd->cur = next;
+    seq_write_end(&kd->layout);
+    kd->old_count = kd->entry_count;
+    kd->migrated = 0;
+    kd->deleted = 0;
+
+    keydir_migrate(kd, KD_MIGRATE_SLOTS);
+    return 0;
+}
+
+/**@brief ccask_keydir_resize returns 0 on success; 1 when a null pointer is passed; -1 when the keydir cannot grow within its budget or is already resizing; -2 when malloc fails; -3 when new size would overflow*/
 int ccask_keydir_resize(ccask_keydir* kd) {
     if (!kd) return 1;
-    if (kd->size >= kd->max_size) return -1;
 
-    size_t old_size = kd->size;
-    if (kd->size * 2 < kd->size || kd->size * 2 > kd->max_size) {
-        kd->size = kd->max_size;
-    } else {
-        kd->size = kd->size * 2;
+    size_t size = kd->cur.size * 2;
+    if (size < kd->cur.size || !keydir_affords(kd, size)) return -1;
+
+    return keydir_start_resize(kd, size);
+}
+
+/**@brief make room for one more key before it is inserted, once full and deleted slots together
+ * 		  reach the load factor. Returns as ccask_keydir_resize.
+ *
+ * While a resize is under way no other starts: rows leave the old table faster than new keys
+ * can fill the current one, so it has room for both.
+ */
+int keydir_reserve(ccask_keydir* kd) {
+    size_t size = kd->cur.size;
+    size_t live = kd->entry_count - kd->old_count;
+    size_t limit = size / 100 * kd->load_factor + size % 100 * kd->load_factor / 100;
+    if (live + kd->deleted + 1 <= limit || kd->old.size) return 0;
+
+    // when deleted markers are most of the load, clearing them frees at least half of it
+    if (live < limit / 2 && keydir_affords(kd, size)) return keydir_start_resize(kd, size);
+    if (size * 2 > size && keydir_affords(kd, size * 2)) return keydir_start_resize(kd, size * 2);
+
+    // once the budget stops its growth the table takes keys until every slot is full, only
+    // clearing deleted markers once enough have piled up to pay for the rehash
+    if (kd->deleted > size / 16 && keydir_affords(kd, size)) return keydir_start_resize(kd, size);
+    return 0;
+}
+
+/**@brief the writer's housekeeping before each call: move up to *slots* slots of a resize on,
+ * 		  and free whatever retired memory readers have let go of
+ */
+void keydir_step(ccask_keydir* kd, size_t slots) {
+    if (kd->old.size) keydir_migrate(kd, slots);
+    keydir_reclaim(kd);
+}
+
+/**@brief what *kd* indexes *key* by, and its hash *h*: the key itself, or in a digest-keyed
+ * 		  keydir its digest, written to *digest*, with *key_size* flagged to match
+ */
+uint8_t* keydir_index_key(const ccask_keydir* kd, uint32_t* key_size, uint8_t* key, uint8_t* digest, uint64_t* h) {
+    if (!kd->digest_keys) {
+        *h = kd_hash(kd, *key_size, key);
+        return key;
     }
 
-    if (kd->size * sizeof(ccask_kdrow) < kd->size) return -3;
-    ccask_kdrow* new_entries = malloc(sizeof(ccask_kdrow) * kd->size);
-    if (!new_entries) return -2;
+    digest128(kd->seed, *key_size, key, digest);
+    *key_size |= KDROW_DIGEST;
+    memcpy(h, digest, sizeof(*h));
+    return digest;
+}
 
-    // TODO: figure out why I need this? if I need this?
-    // a lot of iteration involved here
-    init_entries(kd->size, new_entries);
+/**@brief the row of *key*, whose hash is *h*, in whichever table holds it, or 0. *t* and *slot*
+ * 		  are set to where it is.
+ */
+ccask_kdrow* keydir_find(ccask_keydir* kd, uint32_t key_size, uint8_t* key, uint64_t h, kd_table** t, size_t* slot) {
+    *t = &kd->cur;
+    *slot = kd_table_find(*t, key_size, key, h);
 
-    for (size_t i = 0; i < old_size; i++) {
-        // if there is an entry in this bucket, the timestamp will be nonzero
-        ccask_kdrow row = kd->entries[i];
-        if (row.timestamp != 0) {
-            size_t new_bucket = hash(row.key_size, row.key, kd->size);
-            ccask_kdrow* cpy = ccask_kdrow_copy(&new_entries[new_bucket], &row);
-            if (!cpy) return -2;
-        }
+    if (*slot == SIZE_MAX && kd->old.size) {
+        *t = &kd->old;
+        *slot = kd_table_find(*t, key_size, key, h);
     }
 
-    free(kd->entries);
-    kd->entries = new_entries;
-    return 0;
+    return *slot == SIZE_MAX ? 0 : (*t)->entries + *slot;
 }
 
-/**@brief walk the chain of elements until the next pointer is null, then insert our new element there*/
-ccask_kdrow* keydir_chain_insert(ccask_kdrow* entry, ccask_kdrow* elem) {
-    if(entry->next == 0) {
-        ccask_kdrow* tmp = malloc(sizeof(ccask_kdrow));
-        tmp->key = 0;
-        if (!ccask_kdrow_copy(tmp, elem)) return 0;
-        entry->next = tmp;
-        return entry;
+/**@brief point the row indexed by *key*, as returned by keydir_index_key, at a new record*/
+ccask_keydir* keydir_put_indexed(ccask_keydir* kd, uint32_t key_size, uint8_t* key, uint64_t h, uint32_t file_id,
+                                 uint32_t value_size, size_t value_pos, uint32_t expiry) {
+    kd_table* t;
+    size_t slot;
+    ccask_kdrow* row = keydir_find(kd, key_size, key, h, &t, &slot);
+    if (row) {
+        seq_write_begin(t->seq + slot / KD_GROUP);
+        row->file_id = file_id;
+        row->value_size = value_size;
+        row->value_pos = value_pos;
+        row->expiry = expiry;
+        seq_write_end(t->seq + slot / KD_GROUP);
+        return kd;
     }
 
-    ccask_kdrow* next = entry->next;
-    ccask_kdrow* last = entry;
+    int res = keydir_reserve(kd);
+    if (res != 0) {
+        fprintf(stderr, "error code in ccask_keydir_resize: %d\n", res);
+        exit(1);
+    }
+
+    slot = kd_table_free_slot(&kd->cur, h);
+    if (slot == SIZE_MAX) return 0;
+
+    uint8_t* copy = kdrow_spills(key_size) ? kd_arena_alloc(&kd->arena, key_size) : 0;
+    if (kdrow_spills(key_size) && !copy) return 0;
+
+    seq_write_begin(kd->cur.seq + slot / KD_GROUP);
+    if (kd->cur.ctrl[slot] == CTRL_DELETED) kd->deleted--;
+    kd->cur.ctrl[slot] = CTRL_FULL | (h & 0x7F);
 
-    while(next) {
-        last = next;
-        next = next->next;
+    row = kd->cur.entries + slot;
+    *row = (ccask_kdrow) {
+        .file_id = file_id,
+        .value_size = value_size,
+        .value_pos = value_pos,
+        .expiry = expiry,
+    };
+    kdrow_set_key(row, key_size, key, copy);
+    seq_write_end(kd->cur.seq + slot / KD_GROUP);
+    if (kd->ordered) keydir_tree_put(kd, row);
+
+    kd->entry_count++;
+    return kd;
+}
+
+/**@brief ccask_keydir_put with the expiry time already worked out*/
+ccask_keydir* keydir_put(ccask_keydir* kd, uint32_t key_size, uint8_t* key, uint32_t file_id,
+                         uint32_t value_size, size_t value_pos, uint32_t expiry) {
+    if (!kd || key_size == 0 || (key_size & KDROW_DIGEST) || file_id > UINT16_MAX || value_pos > UINT32_MAX) return 0;
+    keydir_step(kd, KD_MIGRATE_SLOTS);
+
+    uint64_t h;
+    uint8_t digest[16];
+    key = keydir_index_key(kd, &key_size, key, digest, &h);
+    return keydir_put_indexed(kd, key_size, key, h, file_id, value_size, value_pos, expiry);
+}
+
+/**@brief point *key* at a new record: its row is updated in place if it has one, otherwise a row
+ * 		  is built directly in the keydir and the key copied exactly once. A *ttl* of 0 means the
+ * 		  row never expires. Returns 0 if the keydir is full or the location does not fit a
+ * 		  packed row.
+ */
+ccask_keydir* ccask_keydir_put(ccask_keydir* kd, uint32_t key_size, uint8_t* key, uint32_t file_id,
+                               uint32_t value_size, size_t value_pos, time_t timestamp, uint32_t ttl) {
+    return keydir_put(kd, key_size, key, file_id, value_size, value_pos, kdrow_expiry_of(timestamp, ttl));
+}
+
+/**@brief whether a put of *key* would find it a row: it has one already, or the table has a free
+ * 		  slot once it has grown, as far as its budget allows, to make room for one more key. Lets
+ * 		  a caller refuse a key before writing anything else down for it.
+ */
+bool ccask_keydir_room(ccask_keydir* kd, uint32_t key_size, uint8_t* key) {
+    if (!kd || key_size == 0 || (key_size & KDROW_DIGEST)) return false;
+    keydir_step(kd, KD_MIGRATE_SLOTS);
+
+    uint64_t h;
+    uint8_t digest[16];
+    key = keydir_index_key(kd, &key_size, key, digest, &h);
+
+    kd_table* t;
+    size_t slot;
+    if (keydir_find(kd, key_size, key, h, &t, &slot)) return true;
+
+    int res = keydir_reserve(kd);
+    if (res != 0) {
+        fprintf(stderr, "error code in ccask_keydir_resize: %d\n", res);
+        exit(1);
     }
 
-    last->next = malloc(sizeof(ccask_kdrow));
-    last->next->key = 0;
-    last->next = ccask_kdrow_copy(last->next, elem);
+    return kd_table_free_slot(&kd->cur, h) != SIZE_MAX;
+}
+
+/**@brief put back a row saved by its index key (see ccask_kdrow_index_key): the key of a
+ * 		  *key_size* byte key, or in a digest-keyed keydir its digest, which only means the same
+ * 		  key to a keydir hashing with the seed it was made with. *expiry* is absolute, 0 for
+ * 		  never. Returns 0 where ccask_keydir_put would.
+ */
+ccask_keydir* ccask_keydir_restore(ccask_keydir* kd, uint32_t key_size, const uint8_t* index_key, uint32_t file_id,
+                                   uint32_t value_size, size_t value_pos, time_t expiry) {
+    if (!kd || !index_key || key_size == 0 || (key_size & KDROW_DIGEST) || file_id > UINT16_MAX || value_pos > UINT32_MAX) return 0;
+    keydir_step(kd, KD_MIGRATE_SLOTS);
 
-    return last;
+    uint64_t h;
+    if (kd->digest_keys) {
+        key_size |= KDROW_DIGEST;
+        memcpy(&h, index_key, sizeof(h));
+    } else {
+        h = kd_hash(kd, key_size, index_key);
+    }
+
+    uint32_t exp = expiry <= 0 ? 0 : expiry > UINT32_MAX ? UINT32_MAX : expiry;
+    return keydir_put_indexed(kd, key_size, (uint8_t*)index_key, h, file_id, value_size, value_pos, exp);
 }
 
+/**@brief put the key of the standalone row *elem*; a row holding only a digest can't be inserted*/
 ccask_keydir* ccask_keydir_insert(ccask_keydir* kd, ccask_kdrow* elem) {
-    if (!kd || !elem) return 0;
+    if (!elem) return 0;
+    return keydir_put(kd, elem->key_size, kdrow_key(elem), elem->file_id, elem->value_size, elem->value_pos, elem->expiry);
+}
 
-    if (kd->entry_count == SIZE_MAX) return 0;
+/**@brief call *fn* with the row of every key in the keydir, in no particular order. *fn* must
+ * 		  not add or remove rows.
+ */
+void ccask_keydir_foreach(ccask_keydir* kd, ccask_kdrow_fn fn, void* ctx) {
+    if (!kd || !fn) return;
 
-    if (kd->entry_count + 1 / kd->size > kd->load_factor / 100 && kd->size < kd->max_size) {
-        int res = ccask_keydir_resize(kd);
-        if (res != 0) {
-            fprintf(stderr, "error code in ccask_keydir_resize: %d\n", res);
-            exit(1);
+    kd_table* tables[2] = { &kd->cur, &kd->old };
+    for (size_t n = 0; n < 2; n++) {
+        for (size_t i = 0; i < tables[n]->size; i++) {
+            if (tables[n]->ctrl[i] & CTRL_FULL) fn(ctx, tables[n]->entries + i);
+        }
+    }
+}
+
+/**@brief call *fn* with the row of every key from *start* on (every key, when *start_size* is
+ * 		  0) in key order, until it returns false. Keys are ordered like memcmp, a key ahead of
+ * 		  any longer key it begins. *fn* must not add or remove rows.
+ *
+ * @return the number of rows visited, or 0 if the keydir is not ordered
+ */
+size_t ccask_keydir_scan(ccask_keydir* kd, uint32_t start_size, uint8_t* start, ccask_kdscan_fn fn, void* ctx) {
+    if (!kd || !fn || !kd->root) return 0;
+
+    // the path down to the current leaf, and the child taken at each step
+    kd_node* path[KD_TREE_DEPTH];
+    uint32_t at[KD_TREE_DEPTH];
+    size_t depth = 0;
+
+    kd_node* n = kd->root;
+    for (; !n->leaf; n = n->children[at[depth++]]) {
+        path[depth] = n;
+        at[depth] = kd_inner_child(n, start_size, start);
+    }
+
+    size_t visited = 0;
+    for (uint32_t i = kd_leaf_lower(n, start_size, start);; i = 0) {
+        for (; i < n->count; i++) {
+            kd_table* t;
+            size_t slot;
+            uint32_t key_size = n->keys[i].key_size;
+            uint8_t* key = tkey_key(n->keys + i);
+            ccask_kdrow* row = keydir_find(kd, key_size, key, kd_hash(kd, key_size, key), &t, &slot);
+
+            visited++;
+            if (row && !fn(ctx, row)) return visited;
+        }
+
+        // climb to the nearest ancestor with a child left to visit, then down its leftmost path
+        while (depth > 0 && at[depth - 1] + 1 == path[depth - 1]->count) depth--;
+        if (depth == 0) return visited;
+
+        n = path[depth - 1]->children[++at[depth - 1]];
+        for (; !n->leaf; n = n->children[0]) {
+            path[depth] = n;
+            at[depth++] = 0;
         }
     }
+}
+
+/**@brief whether the keydir keeps its keys in order for ccask_keydir_scan*/
+bool ccask_keydir_ordered(const ccask_keydir* kd) {
+    return kd && kd->ordered;
+}
+
+/**@brief the number of keys in the keydir*/
+size_t ccask_keydir_count(const ccask_keydir* kd) {
+    return kd ? kd->entry_count : 0;
+}
+
+/**@brief the memory the keydir holds: its slots, both tables' while resizing, its arena and
+ * 		  any ordered index
+ */
+size_t ccask_keydir_bytes(const ccask_keydir* kd) {
+    if (!kd) return 0;
+
+    return kd_table_bytes(kd->cur.size) + kd_table_bytes(kd->old.size) + kd->arena.bytes + kd->tree_bytes;
+}
+
+/**@brief the row of *key*, or 0 if it has none. The row stays valid until the next call that
+ * 		  takes the keydir, other than the kdrow accessors.
+ */
+ccask_kdrow* ccask_keydir_get(ccask_keydir* kd, uint32_t key_size, uint8_t* key) {
+    if (!kd) return 0;
+    keydir_step(kd, KD_MIGRATE_SLOTS);
+
+    kd_table* t;
+    size_t slot;
+    uint64_t h;
+    uint8_t digest[16];
+    key = keydir_index_key(kd, &key_size, key, digest, &h);
+    return keydir_find(kd, key_size, key, h, &t, &slot);
+}
 
-    size_t index = hash(elem->key_size, elem->key, kd->size);
-    if (kd->entries[index].key_size == 0) {
-        ccask_kdrow* entry = kd->entries + index;
-        entry = ccask_kdrow_copy(entry, elem);
+/**@brief free the row in full slot *slot* of *t* and mark the slot free*/
+void keydir_erase(ccask_keydir* kd, kd_table* t, size_t slot) {
+    ccask_kdrow* row = t->entries + slot;
+    uint32_t key_size = row->key_size;
+    uint8_t* key = kdrow_spills(key_size) ? kdrow_key(row) : 0;
+    uint32_t* seq = t->seq + slot / KD_GROUP;
+    kd->entry_count--;
+    if (kd->ordered) keydir_tree_remove(kd, key_size, kdrow_key(row));
+
+    seq_write_begin(seq);
+    if (t == &kd->old) {
+        // the old table is only ever probed until it is freed, so its slots just stay deleted
+        t->ctrl[slot] = CTRL_DELETED;
+        kd->old_count--;
+    } else if (group_match(t->ctrl + slot / KD_GROUP * KD_GROUP, CTRL_EMPTY)) {
+        // a probe only moves past a group with no empty slot, so if this group has one already,
+        // no probe can be passing through it and the slot can go straight back to empty
+        t->ctrl[slot] = CTRL_EMPTY;
     } else {
-        keydir_chain_insert(&(kd->entries[index]), elem);
+        t->ctrl[slot] = CTRL_DELETED;
+        kd->deleted++;
     }
+    seq_write_end(seq);
 
-    kd->entry_count++;
+    // a reader that copied the row before it went may still compare against its key: arena
+    // chunks stay mapped and the group's count has moved, but a malloc'd key has to wait
+    if (key && key_size > KD_SLAB_MAX) {
+        kd->arena.bytes -= key_size;
+        keydir_retire(kd, key, 0);
+    } else if (key) {
+        kd_arena_free(&kd->arena, key, key_size);
+    }
+
+    if (t == &kd->old && kd->old_count == 0) keydir_migrate(kd, 0);
+}
+
+/**@brief remove the row for *key* from the keydir, freeing its memory.
+ * 		  Returns 0 if the key was not present.
+ */
+ccask_keydir* ccask_keydir_remove(ccask_keydir* kd, uint32_t key_size, uint8_t* key) {
+    if (!kd) return 0;
+    keydir_step(kd, KD_MIGRATE_SLOTS);
+
+    kd_table* t;
+    size_t slot;
+    uint64_t h;
+    uint8_t digest[16];
+    key = keydir_index_key(kd, &key_size, key, digest, &h);
+    if (!keydir_find(kd, key_size, key, h, &t, &slot)) return 0;
+
+    keydir_erase(kd, t, slot);
     return kd;
 }
 
-// To retrieve a keydir entry, we need to
-// 1) get correct hash bucket
-// 2) check the key of the stored value
-// 3) if there is a chain, walk the chain to be sure we don't have a newer one
-// 4) return the newest item from that bucket with a matching key
-//
-// If a value has been stored under that key a bunch of times, it could expensive
-// but eventually should implement chain compression as part of the get process to
-// remove all but the oldest keydir entry.
-//
-// Alternatively could support rollbacks somehow by maintaining the chain...
-
-ccask_kdrow* keydir_chain_get(ccask_kdrow* entry, uint32_t key_size, uint8_t* key) {
-    ccask_kdrow* match = { 0 };
-    ccask_kdrow* next = entry;
-
-    do {
-        if(next->key_size == key_size && memcmp(key, next->key, key_size) == 0) {
-            match = next;
+/**@brief walk every row in the keydir, replacing each row's file_id with remap[file_id] when
+ * file_id < n. Used by merge when data files are renumbered.
+ */
+void ccask_keydir_remap(ccask_keydir* kd, const uint32_t* remap, size_t n) {
+    if (!kd || !remap) return;
+
+    kd_table* tables[2] = { &kd->cur, &kd->old };
+    for (size_t t = 0; t < 2; t++) {
+        for (size_t g = 0; g < tables[t]->size / KD_GROUP; g++) {
+            seq_write_begin(tables[t]->seq + g);
+            for (size_t i = g * KD_GROUP; i < (g + 1) * KD_GROUP; i++) {
+                if (!(tables[t]->ctrl[i] & CTRL_FULL)) continue;
+
+                ccask_kdrow* row = tables[t]->entries + i;
+                if (row->file_id < n) row->file_id = remap[row->file_id];
+            }
+            seq_write_end(tables[t]->seq + g);
         }
-        next = next->next;
-    } while(next);
+    }
+}
 
-    return match;
+/**@brief point *key* at *new_file_id*, *new_pos* if its row still points at *file_id*,
+ * 		  *value_pos*: merge uses this so a set racing it is never undone. Returns 0 if the key
+ * 		  has moved on or is gone, or if the new location does not fit a packed row.
+ */
+ccask_keydir* ccask_keydir_move(ccask_keydir* kd, uint32_t key_size, uint8_t* key, uint32_t file_id, size_t value_pos,
+                                uint32_t new_file_id, size_t new_pos) {
+    if (!kd || new_file_id > UINT16_MAX || new_pos > UINT32_MAX) return 0;
+    keydir_step(kd, KD_MIGRATE_SLOTS);
+
+    kd_table* t;
+    size_t slot;
+    uint64_t h;
+    uint8_t digest[16];
+    key = keydir_index_key(kd, &key_size, key, digest, &h);
+    ccask_kdrow* row = keydir_find(kd, key_size, key, h, &t, &slot);
+    if (!row || row->file_id != file_id || row->value_pos != value_pos) return 0;
+
+    seq_write_begin(t->seq + slot / KD_GROUP);
+    row->file_id = new_file_id;
+    row->value_pos = new_pos;
+    seq_write_end(t->seq + slot / KD_GROUP);
+    return kd;
 }
 
-ccask_kdrow* ccask_keydir_get(ccask_keydir* kd, uint32_t key_size, uint8_t* key) {
-    size_t index = hash(key_size, key, kd->size);
-    ccask_kdrow* match = { 0 };
-    if(kd->entries[index].key_size != 0) {
-        match = keydir_chain_get(&(kd->entries[index]), key_size, key);
+/**@brief copy the location of *key* to *loc*. Unlike the rest of the keydir this may be called
+ * 		  from any number of threads while the writer goes on: it never takes a lock or writes
+ * 		  to the tables. Returns false if the key has no row.
+ */
+bool ccask_keydir_read(ccask_keydir* kd, uint32_t key_size, uint8_t* key, ccask_kdloc* loc) {
+    if (!kd || !loc || key_size == 0 || (key_size & KDROW_DIGEST)) return false;
+
+    uint64_t h;
+    uint8_t digest[16];
+    key = keydir_index_key(kd, &key_size, key, digest, &h);
+
+    bool found;
+    uint64_t* reader = keydir_reader_enter(kd);
+    for (;;) {
+        uint32_t layout = seq_read_begin(&kd->layout);
+        kd_table cur = kd->cur, old = kd->old;
+        if (!seq_read_valid(&kd->layout, layout)) continue;
+
+        // rows of a resize reach the current table before they leave the old one
+        found = kd_table_read(&old, key_size, key, h, loc) || kd_table_read(&cur, key_size, key, h, loc);
+        if (seq_read_valid(&kd->layout, layout)) break;
+    }
+    keydir_reader_exit(reader);
+
+    return found;
+}
+
+/**@brief sweep *buckets* slots of the keydir from *cursor* on, removing every key whose row
+ * 		  has expired by *now*. *fn*, if given, sees each expired row just before it is removed.
+ *
+ * The cursor wraps around the table and is advanced past the slots swept, so repeated calls
+ * eventually visit every slot however the table is resized in between. Rows still waiting to
+ * leave the old table of a resize are swept once they have moved; each sweep moves as many old
+ * slots as it sweeps.
+ *
+ * @return the number of keys removed
+ */
+size_t ccask_keydir_expire(ccask_keydir* kd, size_t* cursor, size_t buckets, time_t now, ccask_kdrow_fn fn, void* ctx) {
+    if (!kd || !cursor || kd->cur.size == 0) return 0;
+    keydir_step(kd, buckets);
+
+    size_t expired = 0;
+    if (buckets > kd->cur.size) buckets = kd->cur.size;
+
+    for (size_t n = 0; n < buckets; n++) {
+        size_t index = *cursor % kd->cur.size;
+        *cursor = index + 1;
+        if (!(kd->cur.ctrl[index] & CTRL_FULL)) continue;
+
+        ccask_kdrow* row = kd->cur.entries + index;
+        time_t expiry = ccask_kdrow_expiry(row);
+        if (expiry == 0 || expiry > now) continue;
+
+        // removal never moves other rows, so the sweep carries on from the same slot
+        if (fn) fn(ctx, row);
+        keydir_erase(kd, &kd->cur, index);
+        expired++;
     }
-    return match;
+
+    return expired;
 }
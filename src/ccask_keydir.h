@@ -3,6 +3,7 @@
 
 #include <inttypes.h>
 #include <stddef.h>
+#include <stdbool.h>
 #include <time.h>
 
 /**@file*/
@@ -11,37 +12,106 @@
 typedef struct ccask_kdrow ccask_kdrow;
 // ccask_kdrow init / delete
 ccask_kdrow* ccask_kdrow_init(ccask_kdrow* kdr, uint32_t key_size, uint8_t* key,
-                              uint32_t file_id, uint32_t value_size, uint32_t value_pos, time_t timestamp);
+                              uint32_t file_id, uint32_t value_size, size_t value_pos);
 ccask_kdrow* ccask_kdrow_new(uint32_t key_size, uint8_t* key, uint32_t file_id,
-                             uint32_t value_size, uint32_t value_pos, time_t timestamp);
+                             uint32_t value_size, size_t value_pos);
 void ccask_kdrow_destroy(ccask_kdrow* kdr);
 void ccask_kdrow_delete(ccask_kdrow* kdr);
 
 // attr accessors
 uint32_t ccask_kdrow_fid(ccask_kdrow* kdr);
+uint8_t* ccask_kdrow_key(ccask_kdrow* kdr);     // 0 for a row of a digest-keyed keydir
+uint32_t ccask_kdrow_ksize(ccask_kdrow* kdr);
 uint32_t ccask_kdrow_vsize(ccask_kdrow* kdr);
 size_t ccask_kdrow_vpos(ccask_kdrow* kdr);
+time_t ccask_kdrow_expiry(ccask_kdrow* kdr);
+
+// a row's key as the keydir indexes it: the key, or in a digest-keyed keydir the digest it keeps
+// instead, CCASK_KDROW_DIGEST_BYTES long. ccask_keydir_restore puts the row back from it.
+#define CCASK_KDROW_DIGEST_BYTES 14
+const uint8_t* ccask_kdrow_index_key(ccask_kdrow* kdr);
+
+// point a standalone row at a new location; rows in a keydir move with ccask_keydir_move
+ccask_kdrow* ccask_kdrow_relocate(ccask_kdrow* kdr, uint32_t file_id, size_t value_pos);
 
 
 void ccask_kdrow_print(ccask_kdrow* kdr);
 
 // ccask_keydir
+// A keydir has one writer thread at a time, which makes every call below except
+// ccask_keydir_read; any number of threads may call ccask_keydir_read alongside it.
 typedef struct ccask_keydir ccask_keydir;
 
+// where a key's value lives, as copied out by ccask_keydir_read
+typedef struct ccask_kdloc {
+    uint32_t file_id;
+    uint32_t value_size;
+    size_t value_pos;
+    time_t expiry;          // 0 if it never expires
+} ccask_kdloc;
+
+// called with a row by ccask_keydir_foreach, and by ccask_keydir_expire just before removing it
+typedef void (*ccask_kdrow_fn)(void* ctx, ccask_kdrow* kdr);
+
+// called with each row by ccask_keydir_scan, in key order; returning false ends the scan
+typedef bool (*ccask_kdscan_fn)(void* ctx, ccask_kdrow* kdr);
+
 // ccask_keydir init / delete
-ccask_keydir* ccask_keydir_init(ccask_keydir* kd, size_t size, size_t max_size);
-ccask_keydir* ccask_keydir_new(size_t size, size_t max_size);
+// *size* is the initial slot count; the keydir grows as far as *max_bytes* of memory allows, on
+// transparent huge pages if *huge* is set. A keydir with *digest_keys* keeps a 112-bit digest of
+// each key instead of the key, so a get may return the row of another key with the same size and
+// digest: the caller has to check the key of the record it points at. An *ordered* keydir also keeps
+// its keys sorted for ccask_keydir_scan, and always keeps the keys themselves.
+ccask_keydir* ccask_keydir_init(ccask_keydir* kd, size_t size, size_t max_bytes, bool huge, bool digest_keys, bool ordered);
+ccask_keydir* ccask_keydir_new(size_t size, size_t max_bytes, bool huge, bool digest_keys, bool ordered);
 void ccask_keydir_destroy(ccask_keydir* kd);
 void ccask_keydir_delete(ccask_keydir* kd);
 
+// the hash a keydir's table is indexed by. Keydirs hash with ccask_kdhash_wyhash and a seed
+// drawn at random once per process, ccask_keydir_seed(); an empty keydir can be given another
+// hash or seed, to compare hashes or to get the same layout on every run.
+typedef uint64_t (*ccask_kdhash_fn)(uint64_t seed, uint32_t key_size, const uint8_t* key);
+uint64_t ccask_kdhash_wyhash(uint64_t seed, uint32_t key_size, const uint8_t* key);
+uint64_t ccask_kdhash_fnv1a(uint64_t seed, uint32_t key_size, const uint8_t* key);
+uint64_t ccask_keydir_seed(void);
+ccask_keydir* ccask_keydir_set_hash(ccask_keydir* kd, ccask_kdhash_fn fn, uint64_t seed);
+uint64_t ccask_keydir_hash_seed(const ccask_keydir* kd);
+
 // get/set
 ccask_keydir* ccask_keydir_insert(ccask_keydir* kd, ccask_kdrow* elem);
+ccask_keydir* ccask_keydir_put(ccask_keydir* kd, uint32_t key_size, uint8_t* key, uint32_t file_id,
+                               uint32_t value_size, size_t value_pos, time_t timestamp, uint32_t ttl);
+ccask_keydir* ccask_keydir_restore(ccask_keydir* kd, uint32_t key_size, const uint8_t* index_key, uint32_t file_id,
+                                   uint32_t value_size, size_t value_pos, time_t expiry);
+// whether ccask_keydir_put has room for *key*, growing the table if it needs to and may
+bool ccask_keydir_room(ccask_keydir* kd, uint32_t key_size, uint8_t* key);
 ccask_kdrow* ccask_keydir_get(ccask_keydir* kd, uint32_t key_size, uint8_t* key);
+ccask_keydir* ccask_keydir_remove(ccask_keydir* kd, uint32_t key_size, uint8_t* key);
+ccask_keydir* ccask_keydir_move(ccask_keydir* kd, uint32_t key_size, uint8_t* key, uint32_t file_id, size_t value_pos,
+                                uint32_t new_file_id, size_t new_pos);
+size_t ccask_keydir_count(const ccask_keydir* kd);
+size_t ccask_keydir_bytes(const ccask_keydir* kd);
+
+// lock-free lookup, safe from any thread: copies the key's location to *loc*
+bool ccask_keydir_read(ccask_keydir* kd, uint32_t key_size, uint8_t* key, ccask_kdloc* loc);
+
+// visit the row of every key
+void ccask_keydir_foreach(ccask_keydir* kd, ccask_kdrow_fn fn, void* ctx);
+
+// in an ordered keydir, visit rows in key order from *start* on
+size_t ccask_keydir_scan(ccask_keydir* kd, uint32_t start_size, uint8_t* start, ccask_kdscan_fn fn, void* ctx);
+bool ccask_keydir_ordered(const ccask_keydir* kd);
+
+// rewrite the file id of every row whose file id is below n to remap[file_id]
+void ccask_keydir_remap(ccask_keydir* kd, const uint32_t* remap, size_t n);
+
+// incrementally remove expired keys, a few buckets per call
+size_t ccask_keydir_expire(ccask_keydir* kd, size_t* cursor, size_t buckets, time_t now, ccask_kdrow_fn fn, void* ctx);
 
 // internal fns that we want to expose for testing only
 #ifdef _TEST_
 ccask_kdrow* ccask_kdrow_copy(ccask_kdrow* dest, const ccask_kdrow* src);
-size_t KDROW_SIZE;
+extern size_t KDROW_SIZE;
 #endif
 
 #endif
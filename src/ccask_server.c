@@ -21,6 +21,8 @@
 #include "util.h"
 
 #define PORT_SIZE 5
+#define EXPIRE_POLL_MS 1000 // longest an idle server waits between sweeps for expired keys
+#define FRAMES_PER_POLL 16 // responses of a streamed result (a scan) rendered per connection per loop iteration
 
 // helpers
 /*@brief get_in_addr ripped directly from beej's guide :+1:*/
@@ -157,11 +159,24 @@ int recv_cmd(int sockfd, uint8_t* buf, size_t bufsz, size_t max_msg_size) {
 }
 
 // ----- end helpers -----
+
+// a client connection's state, kept alongside its entry in the server's pfds
+typedef struct ccask_conn {
+    uint64_t id;            // tags its asynchronous queries; never reused, 0 for non-client entries
+    uint8_t* out;           // rendered responses not sent yet
+    size_t out_len;
+    size_t out_off;         // bytes of out already sent
+    size_t out_cap;
+    ccask_result* stream;   // a result with responses left to render, e.g. a scan
+} ccask_conn;
+
 struct ccask_server {
     int sd;
     unsigned int fd_count;
     unsigned int fd_size;
     struct pollfd* pfds;
+    ccask_conn* conns;      // conns[i] belongs to pfds[i]
+    uint64_t next_id;
     char* port;
     ccask_db* db;
     size_t maxconn;
@@ -176,6 +191,8 @@ ccask_server* ccask_server_init(ccask_server* srv, ccask_db* db, ccask_config* c
         srv->fd_count = 0;
         srv->fd_size = 5;
         srv->pfds = malloc(sizeof(*srv->pfds) * srv->fd_size);
+        srv->conns = calloc(srv->fd_size, sizeof(*srv->conns));
+        srv->next_id = 1;
         srv->db = db;
         srv->maxconn = ccask_config_maxconn(cfg);
         srv->max_msg_size = ccask_config_maxmsg(cfg);
@@ -186,6 +203,7 @@ ccask_server* ccask_server_init(ccask_server* srv, ccask_db* db, ccask_config* c
         if (rv <= 0) {
             free(srv->port);
             free(srv->pfds);
+            free(srv->conns);
             *srv = (ccask_server) {
                 0
             };
@@ -216,7 +234,12 @@ ccask_server* ccask_server_new(ccask_db* db, ccask_config* cfg) {
 
 void ccask_server_destroy(ccask_server* srv) {
     if (srv) {
+        for (unsigned int i = 0; i < srv->fd_count; i++) {
+            free(srv->conns[i].out);
+            if (srv->conns[i].stream) ccask_res_delete(srv->conns[i].stream);
+        }
         free(srv->pfds);
+        free(srv->conns);
         free(srv->port);
         *srv = (ccask_server) {
             0
@@ -233,12 +256,14 @@ void ccask_server_print(ccask_server* srv) {
     printf("sd: %d\nfd_count: %d\nfd_size: %d\n", srv->sd, srv->fd_count, srv->fd_size);
 }
 
-int add_to_pfds(ccask_server* srv, int newfd) {
+/**@brief add *newfd* to the polled sockets; a client connection gets the next connection id*/
+int add_to_pfds(ccask_server* srv, int newfd, bool client) {
     if (srv->fd_count == srv->fd_size) {
         srv->fd_size *= 2;
 
         srv->pfds = realloc(srv->pfds, sizeof(*srv->pfds) * (srv->fd_size));
-        if (!srv->pfds) {
+        srv->conns = realloc(srv->conns, sizeof(*srv->conns) * (srv->fd_size));
+        if (!srv->pfds || !srv->conns) {
             perror("realloc");
             return -1;
         }
@@ -246,6 +271,9 @@ int add_to_pfds(ccask_server* srv, int newfd) {
 
     srv->pfds[srv->fd_count].fd = newfd;
     srv->pfds[srv->fd_count].events = POLLIN;
+    srv->conns[srv->fd_count] = (ccask_conn) {
+        .id = client ? srv->next_id++ : 0,
+    };
 
     srv->fd_count++;
 
@@ -254,9 +282,118 @@ int add_to_pfds(ccask_server* srv, int newfd) {
 
 void del_from_pfds(ccask_server* srv, int i) {
     srv->pfds[i] = srv->pfds[srv->fd_count - 1];
+    srv->conns[i] = srv->conns[srv->fd_count - 1];
     srv->fd_count--;
 }
 
+/**@brief close client connection *i*, dropping whatever it has not been sent yet. Results of
+ * 		  its queries still in flight find no connection with its id and are dropped too.
+ */
+void close_conn(ccask_server* srv, int i) {
+    ccask_conn* c = srv->conns + i;
+    free(c->out);
+    if (c->stream) ccask_res_delete(c->stream);
+
+    close(srv->pfds[i].fd);
+    del_from_pfds(srv, i);
+}
+
+/**@brief the index of the connection with id *id*, or -1 if it has been closed*/
+int find_conn(ccask_server* srv, uint64_t id) {
+    for (unsigned int i = 0; i < srv->fd_count; i++) {
+        if (id != 0 && srv->conns[i].id == id) return i;
+    }
+
+    return -1;
+}
+
+/**@brief render the next response of *res* onto the end of connection *c*'s output
+ *
+ * @return 0 on success, -1 on error
+ */
+int conn_render(ccask_server* srv, ccask_conn* c, ccask_result* res) {
+    if (c->out_cap - c->out_len < srv->max_msg_size) {
+        size_t cap = c->out_len + srv->max_msg_size;
+        uint8_t* out = realloc(c->out, cap);
+        if (!out) return -1;
+
+        c->out = out;
+        c->out_cap = cap;
+    }
+
+    uint32_t rv = ccask_res_bytes(res, c->out + c->out_len, srv->max_msg_size);
+    if (rv == UINT32_MAX) return -1;
+
+    if (ccask_res_type(res) != SCAN_SUCCESS) {
+        puts("response: ");
+        for (size_t j = 0; j < rv; j++) {
+            printf("0x%.2x ", c->out[c->out_len + j]);
+        }
+        puts("");
+    }
+
+    c->out_len += rv;
+    return 0;
+}
+
+/**@brief send what connection *i* has waiting without blocking, rendering at most FRAMES_PER_POLL
+ * 		  more responses of its streamed result, so that one long scan or slow reader can't hold
+ * 		  up the other connections. The connection is polled for writing while anything is left
+ * 		  and, so that its responses stay in order, not read from until it has all been sent.
+ *
+ * @return 0 on success, -1 if the connection failed and should be closed
+ */
+int conn_flush(ccask_server* srv, int i) {
+    ccask_conn* c = srv->conns + i;
+
+    for (size_t frames = 0;;) {
+        if (c->out_off == c->out_len) {
+            c->out_off = c->out_len = 0;
+            if (!c->stream || frames == FRAMES_PER_POLL) break;
+
+            if (conn_render(srv, c, c->stream) != 0) {
+                fprintf(stderr, "ccask_server: result render error on socket %d\n", srv->pfds[i].fd);
+                return -1;
+            }
+            frames++;
+
+            if (!ccask_res_more(c->stream)) {
+                ccask_res_delete(c->stream);
+                c->stream = 0;
+            }
+        }
+
+        // the client may hang up at any point; that must not raise SIGPIPE
+        ssize_t n = send(srv->pfds[i].fd, c->out + c->out_off, c->out_len - c->out_off, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) break;
+        if (n < 0) {
+            perror("send");
+            return -1;
+        }
+
+        c->out_off += n;
+    }
+
+    srv->pfds[i].events = c->stream || c->out_off < c->out_len ? POLLOUT : POLLIN;
+    return 0;
+}
+
+/**@brief ccask_query_fn: render the result of an asynchronous query and send it to the connection
+ * 		  it came from, if that is still open
+ */
+void send_result(void* ctx, uint64_t tag, ccask_result* res) {
+    ccask_server* srv = ctx;
+    int i = find_conn(srv, tag);
+
+    // queued behind any output the connection has waiting; asynchronous results are never streamed
+    if (i >= 0 && conn_render(srv, srv->conns + i, res) != 0) {
+        fprintf(stderr, "ccask_server: result render error on socket %d\n", srv->pfds[i].fd);
+    }
+    ccask_res_delete(res);
+
+    if (i >= 0 && conn_flush(srv, i) != 0) close_conn(srv, i);
+}
+
 // TODO: re-write ccask_server_run to use in-struct
 // 		 pfds. Then wire up to ccask query interface from ccask_db
 int ccask_server_run(ccask_server* srv) {
@@ -279,8 +416,16 @@ int ccask_server_run(ccask_server* srv) {
 
     srv->fd_count = 1;
 
+    // completions of asynchronous queries are polled for along with the sockets
+    int async_fd = ccask_db_async_fd(srv->db);
+    if (async_fd >= 0 && add_to_pfds(srv, async_fd, false) < 0) return 1;
+
     for (;;) {
-        int poll_count = poll(srv->pfds, srv->fd_count, -1);
+        // while a merge is running, don't block in poll so it can make progress between requests;
+        // otherwise wake up in time for the next interval sync, and to sweep for expired keys
+        int timeout = ccask_db_merging(srv->db) ? 0 : ccask_db_commit_timeout(srv->db);
+        if (ccask_db_expiring(srv->db) && (timeout < 0 || timeout > EXPIRE_POLL_MS)) timeout = EXPIRE_POLL_MS;
+        int poll_count = poll(srv->pfds, srv->fd_count, timeout);
 
         if (poll_count == -1) {
             perror("poll");
@@ -288,15 +433,24 @@ int ccask_server_run(ccask_server* srv) {
         }
 
         for (int i = 0; i < srv->fd_count; i++) {
-            if (srv->pfds[i].revents & POLLIN) {
-                if (srv->pfds[i].fd == srv->sd) {
+            if (srv->conns[i].id != 0 && srv->pfds[i].events & POLLOUT && srv->pfds[i].revents) {
+                // a connection with responses waiting: send more of them (or find it has hung up)
+                if (conn_flush(srv, i) != 0) {
+                    fprintf(stderr, "pollserver: socket %d failed while sending\n", srv->pfds[i].fd);
+                    close_conn(srv, i);
+                    break;
+                }
+            } else if (srv->pfds[i].revents & POLLIN) {
+                if (srv->pfds[i].fd == async_fd) {
+                    ccask_db_async_reap(srv->db, send_result, srv);
+                } else if (srv->pfds[i].fd == srv->sd) {
                     addrlen = sizeof(remote);
                     newfd = accept(srv->sd, (struct sockaddr *)&remote, &addrlen);
 
                     if (newfd == -1) {
                         perror("accept");
                     } else {
-                        if(add_to_pfds(srv, newfd) < 0) return 1;
+                        if(add_to_pfds(srv, newfd, true) < 0) return 1;
 
                         printf("ccask_server: new connection from %s on socket %d\n",
                                inet_ntop(remote.ss_family,
@@ -321,36 +475,50 @@ int ccask_server_run(ccask_server* srv) {
                             fprintf(stderr, "recv_cmd: %d\n", rv);
                         }
 
-                        close(srv->pfds[i].fd);
-                        del_from_pfds(srv, i);
+                        free(buf);
+                        close_conn(srv, i);
                         break;
                     }
-                    ccask_result* res = ccask_query_interp(srv->db, buf);
+                    ccask_result* res = 0;
+                    if (ccask_query_start(srv->db, buf, srv->conns[i].id, &res)) {
+                        // answered by send_result once its I/O completes
+                        free(buf);
+                        continue;
+                    }
+
+                    free(buf);
                     if (res == 0) {
                         fprintf(stderr, "ccask_server: query interp error from socket %d\n", sender_fd);
                         break;
                     }
 
-                    //TODO: should we use a new buffer? should it be allocated to a different size?
-                    rv = ccask_res_bytes(res, buf, srv->max_msg_size);
-                    if (rv < 0) {
-                        fprintf(stderr, "ccask_server: result render error on socket %d\n", sender_fd);
+                    // a scan streams as many responses as its pairs need, a few per iteration;
+                    // anything else sends one
+                    srv->conns[i].stream = res;
+                    if (conn_flush(srv, i) != 0) {
+                        close_conn(srv, i);
                         break;
                     }
-
-                    puts("response: ");
-                    for (size_t j = 0; j < rv; j++) {
-                        printf("0x%.2x ", buf[j]);
-                    }
-                    puts("");
-                    if (send(sender_fd, buf, rv, 0) == -1) {
-                        perror("send");
-                    }
-
-                    if (res != 0) ccask_res_delete(res);
                 }
             }
         }
+
+        // the sets and deletes of this iteration are written (and synced) together, and every
+        // query started in this iteration goes to the kernel in one batch
+        ccask_db_commit(srv->db);
+        if (ccask_db_async_submit(srv->db) < 0) {
+            fprintf(stderr, "ccask_server: async submit failed\n");
+        }
+
+        // without a ring, a synchronous commit has just made its writes durable
+        if (!ccask_db_async(srv->db)) ccask_db_async_reap(srv->db, send_result, srv);
+
+        ccask_db_expire_step(srv->db);
+        ccask_db_checkpoint_step(srv->db);
+
+        if (ccask_db_merging(srv->db) && ccask_db_merge_step(srv->db) < 0) {
+            fprintf(stderr, "ccask_server: merge failed\n");
+        }
     }
     return 0;
 }
@@ -0,0 +1,297 @@
+#define _DEFAULT_SOURCE
+
+#include "ccask_uring.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/eventfd.h>
+#include <linux/io_uring.h>
+
+/**@file
+ * @brief ccask_uring.c implements the io_uring wrapper. There is no liburing dependency: the
+ * 		  rings are mapped and driven by hand, following the layout described in io_uring(7).
+ */
+
+struct ccask_uring {
+    int fd;
+    int evfd;               // registered eventfd, readable whenever completions are posted
+    unsigned entries;
+
+    // submission queue
+    void* sq_ring;
+    size_t sq_ring_bytes;
+    unsigned* sq_head;
+    unsigned* sq_tail;
+    unsigned sq_mask;
+    unsigned* sq_array;
+    struct io_uring_sqe* sqes;
+    size_t sqes_bytes;
+    unsigned sq_local_tail; // tail including sqes that have not been published yet
+    unsigned to_submit;
+
+    // completion queue
+    void* cq_ring;          // same mapping as sq_ring on kernels with IORING_FEAT_SINGLE_MMAP
+    size_t cq_ring_bytes;
+    unsigned* cq_head;
+    unsigned* cq_tail;
+    unsigned cq_mask;
+    struct io_uring_cqe* cqes;
+};
+
+/*-----------------syscalls-------------------*/
+
+int uring_setup(unsigned entries, struct io_uring_params* p) {
+    return syscall(__NR_io_uring_setup, entries, p);
+}
+
+int uring_enter(int fd, unsigned to_submit, unsigned min_complete, unsigned flags) {
+    return syscall(__NR_io_uring_enter, fd, to_submit, min_complete, flags, NULL, 0);
+}
+
+int uring_register(int fd, unsigned opcode, void* arg, unsigned nr_args) {
+    return syscall(__NR_io_uring_register, fd, opcode, arg, nr_args);
+}
+
+/*-----------------init / destroy-------------------*/
+
+ccask_uring* ccask_uring_new(unsigned entries) {
+    ccask_uring* u = calloc(1, sizeof(ccask_uring));
+    if (!u) return 0;
+
+    u->fd = -1;
+    u->evfd = -1;
+    u->sq_ring = MAP_FAILED;
+    u->cq_ring = MAP_FAILED;
+    u->sqes = MAP_FAILED;
+
+    struct io_uring_params p;
+    memset(&p, 0, sizeof(p));
+
+    u->fd = uring_setup(entries, &p);
+    if (u->fd < 0) {
+        perror("ccask_uring: io_uring_setup");
+        ccask_uring_delete(u);
+        return 0;
+    }
+
+    // IORING_OP_READ and IORING_OP_WRITE arrived alongside (or before) these features
+    if (!(p.features & IORING_FEAT_NODROP) || !(p.features & IORING_FEAT_FAST_POLL)) {
+        fprintf(stderr, "ccask_uring: kernel io_uring is too old\n");
+        ccask_uring_delete(u);
+        return 0;
+    }
+
+    u->entries = p.sq_entries;
+    u->sq_ring_bytes = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    u->cq_ring_bytes = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        if (u->cq_ring_bytes > u->sq_ring_bytes) u->sq_ring_bytes = u->cq_ring_bytes;
+        u->cq_ring_bytes = u->sq_ring_bytes;
+    }
+
+    u->sq_ring = mmap(0, u->sq_ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQ_RING);
+    if (u->sq_ring == MAP_FAILED) {
+        perror("ccask_uring: mmap");
+        ccask_uring_delete(u);
+        return 0;
+    }
+
+    if (p.features & IORING_FEAT_SINGLE_MMAP) {
+        u->cq_ring = u->sq_ring;
+    } else {
+        u->cq_ring = mmap(0, u->cq_ring_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_CQ_RING);
+        if (u->cq_ring == MAP_FAILED) {
+            perror("ccask_uring: mmap");
+            ccask_uring_delete(u);
+            return 0;
+        }
+    }
+
+    u->sqes_bytes = p.sq_entries * sizeof(struct io_uring_sqe);
+    u->sqes = mmap(0, u->sqes_bytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, u->fd, IORING_OFF_SQES);
+    if (u->sqes == MAP_FAILED) {
+        perror("ccask_uring: mmap");
+        ccask_uring_delete(u);
+        return 0;
+    }
+
+    uint8_t* sq = u->sq_ring;
+    u->sq_head = (unsigned*)(sq + p.sq_off.head);
+    u->sq_tail = (unsigned*)(sq + p.sq_off.tail);
+    u->sq_mask = *(unsigned*)(sq + p.sq_off.ring_mask);
+    u->sq_array = (unsigned*)(sq + p.sq_off.array);
+    u->sq_local_tail = *u->sq_tail;
+
+    uint8_t* cq = u->cq_ring;
+    u->cq_head = (unsigned*)(cq + p.cq_off.head);
+    u->cq_tail = (unsigned*)(cq + p.cq_off.tail);
+    u->cq_mask = *(unsigned*)(cq + p.cq_off.ring_mask);
+    u->cqes = (struct io_uring_cqe*)(cq + p.cq_off.cqes);
+
+    u->evfd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    if (u->evfd < 0 || uring_register(u->fd, IORING_REGISTER_EVENTFD, &u->evfd, 1) != 0) {
+        perror("ccask_uring: eventfd");
+        ccask_uring_delete(u);
+        return 0;
+    }
+
+    return u;
+}
+
+void ccask_uring_delete(ccask_uring* u) {
+    if (!u) return;
+
+    if (u->sqes != MAP_FAILED) munmap(u->sqes, u->sqes_bytes);
+    if (u->cq_ring != MAP_FAILED && u->cq_ring != u->sq_ring) munmap(u->cq_ring, u->cq_ring_bytes);
+    if (u->sq_ring != MAP_FAILED) munmap(u->sq_ring, u->sq_ring_bytes);
+    if (u->evfd >= 0) close(u->evfd);
+    if (u->fd >= 0) close(u->fd);
+
+    free(u);
+}
+
+/*-----------------submission-------------------*/
+
+/**@brief claim the next free sqe, or return 0 if the submission queue is full*/
+struct io_uring_sqe* uring_get_sqe(ccask_uring* u) {
+    unsigned head = __atomic_load_n(u->sq_head, __ATOMIC_ACQUIRE);
+    if (u->sq_local_tail - head >= u->entries) return 0;
+
+    unsigned index = u->sq_local_tail & u->sq_mask;
+    struct io_uring_sqe* sqe = u->sqes + index;
+    memset(sqe, 0, sizeof(*sqe));
+
+    u->sq_array[index] = index;
+    u->sq_local_tail++;
+    u->to_submit++;
+
+    return sqe;
+}
+
+int uring_prep_rw(ccask_uring* u, uint8_t op, int fd, const void* buf, size_t len, size_t pos, uint64_t user_data) {
+    if (!u || len > UINT32_MAX) return -1;
+
+    struct io_uring_sqe* sqe = uring_get_sqe(u);
+    if (!sqe) return -1;
+
+    sqe->opcode = op;
+    sqe->fd = fd;
+    sqe->addr = (uintptr_t)buf;
+    sqe->len = len;
+    sqe->off = pos;
+    sqe->user_data = user_data;
+
+    return 0;
+}
+
+int ccask_uring_prep_read(ccask_uring* u, int fd, void* buf, size_t len, size_t pos, uint64_t user_data) {
+    return uring_prep_rw(u, IORING_OP_READ, fd, buf, len, pos, user_data);
+}
+
+int ccask_uring_prep_write(ccask_uring* u, int fd, const void* buf, size_t len, size_t pos, uint64_t user_data) {
+    return uring_prep_rw(u, IORING_OP_WRITE, fd, buf, len, pos, user_data);
+}
+
+int ccask_uring_prep_fsync(ccask_uring* u, int fd, bool datasync, uint64_t user_data) {
+    if (!u) return -1;
+
+    struct io_uring_sqe* sqe = uring_get_sqe(u);
+    if (!sqe) return -1;
+
+    sqe->opcode = IORING_OP_FSYNC;
+    sqe->fd = fd;
+    sqe->fsync_flags = datasync ? IORING_FSYNC_DATASYNC : 0;
+    sqe->user_data = user_data;
+
+    return 0;
+}
+
+/**@brief make the most recently queued sqe a prerequisite of the next one: the next one only
+ * 		  starts once it has completed, and is cancelled with -ECANCELED if it fails or comes up short.
+ */
+void ccask_uring_link(ccask_uring* u) {
+    if (!u || u->to_submit == 0) return;
+    u->sqes[(u->sq_local_tail - 1) & u->sq_mask].flags |= IOSQE_IO_LINK;
+}
+
+/**@brief hand every queued sqe to the kernel in one syscall, then block until at least *wait*
+ * 		  completions are available.
+ *
+ * @return the number of sqes submitted, or -1 on error
+ */
+int ccask_uring_submit(ccask_uring* u, unsigned wait) {
+    if (!u) return -1;
+
+    __atomic_store_n(u->sq_tail, u->sq_local_tail, __ATOMIC_RELEASE);
+
+    unsigned flags = wait ? IORING_ENTER_GETEVENTS : 0;
+    int submitted = 0;
+
+    while (u->to_submit > 0 || wait > 0) {
+        int res = uring_enter(u->fd, u->to_submit, wait, flags);
+        if (res < 0) {
+            if (errno == EINTR) continue;
+            perror("ccask_uring: io_uring_enter");
+            return -1;
+        }
+
+        u->to_submit -= res;
+        submitted += res;
+        if (res == 0 && wait == 0) break;
+
+        wait = 0;
+        flags = 0;
+    }
+
+    return submitted;
+}
+
+/*-----------------completion-------------------*/
+
+/**@brief call *fn* for every completion posted so far and clear the eventfd
+ *
+ * @return the number of completions handled
+ */
+size_t ccask_uring_reap(ccask_uring* u, ccask_uring_fn fn, void* ctx) {
+    if (!u) return 0;
+
+    uint64_t count;
+    if (read(u->evfd, &count, sizeof(count)) < 0) errno = 0;
+
+    size_t n = 0;
+    unsigned head = *u->cq_head;
+    unsigned tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+
+    while (head != tail) {
+        struct io_uring_cqe* cqe = u->cqes + (head & u->cq_mask);
+        fn(ctx, cqe->user_data, cqe->res);
+
+        head++;
+        n++;
+
+        // release the slot before the callback for the next one runs, it may submit more work
+        __atomic_store_n(u->cq_head, head, __ATOMIC_RELEASE);
+        tail = __atomic_load_n(u->cq_tail, __ATOMIC_ACQUIRE);
+    }
+
+    return n;
+}
+
+/**@brief make the eventfd readable, e.g. for completions that were reaped before their owner could handle them*/
+void ccask_uring_notify(ccask_uring* u) {
+    if (u) eventfd_write(u->evfd, 1);
+}
+
+int ccask_uring_eventfd(const ccask_uring* u) {
+    return u ? u->evfd : -1;
+}
+
+unsigned ccask_uring_entries(const ccask_uring* u) {
+    return u ? u->entries : 0;
+}
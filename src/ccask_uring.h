@@ -0,0 +1,39 @@
+#ifndef _CCASK_URING_H
+#define _CCASK_URING_H
+
+#include <stddef.h>
+#include <stdbool.h>
+#include <inttypes.h>
+
+/**@file
+ * @brief ccask_uring is a minimal io_uring wrapper built directly on the io_uring syscalls.
+ *
+ * Reads and writes are queued with the prep functions and handed to the kernel together by
+ * ccask_uring_submit. Completions are signalled on an eventfd so they can be waited on by poll
+ * along with sockets, and are collected with ccask_uring_reap.
+ */
+
+typedef struct ccask_uring ccask_uring;
+
+// called once per completion with the user data of its submission and the syscall-style result
+typedef void (*ccask_uring_fn)(void* ctx, uint64_t user_data, int32_t res);
+
+// init / destroy: new returns 0 if io_uring is not available on this system
+ccask_uring* ccask_uring_new(unsigned entries);
+void ccask_uring_delete(ccask_uring* u);
+
+// queue an operation; returns -1 if the submission queue is full
+int ccask_uring_prep_read(ccask_uring* u, int fd, void* buf, size_t len, size_t pos, uint64_t user_data);
+int ccask_uring_prep_write(ccask_uring* u, int fd, const void* buf, size_t len, size_t pos, uint64_t user_data);
+int ccask_uring_prep_fsync(ccask_uring* u, int fd, bool datasync, uint64_t user_data);
+void ccask_uring_link(ccask_uring* u);
+
+int ccask_uring_submit(ccask_uring* u, unsigned wait);
+size_t ccask_uring_reap(ccask_uring* u, ccask_uring_fn fn, void* ctx);
+void ccask_uring_notify(ccask_uring* u);
+
+// getters
+int ccask_uring_eventfd(const ccask_uring* u);
+unsigned ccask_uring_entries(const ccask_uring* u);
+
+#endif
@@ -1,64 +1,364 @@
 #include <inttypes.h>
 #include <stddef.h>
 #include <stdio.h>
+#include <string.h>
 #include "crc.h"
 
+#if defined(__x86_64__) && defined(__GNUC__)
+#include <nmmintrin.h>
+#define CRC_HAVE_SSE42
+#endif
+
 /**@file
- * @brief crc.c implements the CRC32 cyclic redundancy check
+ * @brief crc.c implements the CRC-32 and CRC-32C cyclic redundancy checks
+ *
+ * Each has a byte-at-a-time, a slice-by-8 and a slice-by-16 table-driven implementation;
+ * CRC-32C also has one using the SSE4.2 crc32 instruction. crc_init picks the fastest one the
+ * CPU supports for crc_extend to use.
  */
 
-uint32_t CRC_TABLE[256];
+#define CRC32_POLY 0xEDB88320   // the crc polynomials, reflected
+#define CRC32C_POLY 0x82F63B78
+
+#define SSE42_LONG 8192         // bytes per stream in the three-way interleaved hardware loop
+#define SSE42_SHORT 256         // and in its loop for shorter data
+
+// CRC_TABLES[type][k][n] is the crc of byte n followed by k zero bytes
+uint32_t CRC_TABLES[2][16][256];
 
-/**@brief crc_init sets up the lookup table for the CRC computation
+crc_fn CRC_IMPLS[2];
+const char* CRC_IMPL_NAMES[2];
+
+/*-----------------table generation-------------------*/
+
+/**@brief crc_table_init sets up the lookup tables for the CRC with reflected polynomial *poly*
  *
  * Adapted from code fragment 8: https://en.wikipedia.org/wiki/Computation_of_cyclic_redundancy_checks#Generating_the_tables
  * */
-void crc_init() {
+void crc_table_init(uint32_t tables[16][256], uint32_t poly) {
     uint32_t crc = 1;
-    CRC_TABLE[0] = 0;
+    tables[0][0] = 0;
     for (size_t i = 128; i > 0; i >>= 1) {
         if (crc & 1) {
-            crc = (crc >> 1) ^ 0xEDB88320; // this magic number is the crc polynomial reflected
+            crc = (crc >> 1) ^ poly;
         } else {
             crc >>= 1;
         }
 
         for (size_t j = 0; j < 255; j += 2*i) {
-            CRC_TABLE[i + j] = crc ^ CRC_TABLE[j];
+            tables[0][i + j] = crc ^ tables[0][j];
         }
     }
+
+    // each further table advances the previous one's crcs over one more zero byte
+    for (size_t k = 1; k < 16; k++) {
+        for (size_t n = 0; n < 256; n++) {
+            uint32_t prev = tables[k-1][n];
+            tables[k][n] = (prev >> 8) ^ tables[0][prev & 0xff];
+        }
+    }
+}
+
+/*-----------------software implementations-------------------*/
+
+uint32_t le32(const uint8_t* p) {
+    return (uint32_t)p[0] | (uint32_t)p[1] << 8 | (uint32_t)p[2] << 16 | (uint32_t)p[3] << 24;
+}
+
+/**@brief the classic algorithm: one table lookup per byte
+ *
+ * Adapted from https://en.wikipedia.org/wiki/Cyclic_redundancy_check#CRC-32_algorithm
+ */
+uint32_t crc_bytewise(uint32_t tables[16][256], uint32_t crc, const uint8_t* data, size_t data_length) {
+    crc = ~crc;
+
+    for (size_t i = 0; i < data_length; i++) {
+        const uint32_t lookupIndex = (crc ^ data[i]) & 0xff;
+        crc = (crc >> 8) ^ tables[0][lookupIndex];
+    }
+
+    return ~crc;
+}
+
+/**@brief slicing-by-8: eight independent table lookups per eight bytes*/
+uint32_t crc_slice8(uint32_t t[16][256], uint32_t crc, const uint8_t* data, size_t data_length) {
+    crc = ~crc;
+
+    while (data_length >= 8) {
+        uint32_t a = crc ^ le32(data);
+        uint32_t b = le32(data + 4);
+
+        crc = t[7][a & 0xff] ^ t[6][(a >> 8) & 0xff] ^ t[5][(a >> 16) & 0xff] ^ t[4][a >> 24]
+              ^ t[3][b & 0xff] ^ t[2][(b >> 8) & 0xff] ^ t[1][(b >> 16) & 0xff] ^ t[0][b >> 24];
+
+        data += 8;
+        data_length -= 8;
+    }
+
+    return crc_bytewise(t, ~crc, data, data_length);
+}
+
+/**@brief slicing-by-16: as slicing-by-8, sixteen bytes at a time*/
+uint32_t crc_slice16(uint32_t t[16][256], uint32_t crc, const uint8_t* data, size_t data_length) {
+    crc = ~crc;
+
+    while (data_length >= 16) {
+        uint32_t a = crc ^ le32(data);
+        uint32_t b = le32(data + 4);
+        uint32_t c = le32(data + 8);
+        uint32_t d = le32(data + 12);
+
+        crc = t[15][a & 0xff] ^ t[14][(a >> 8) & 0xff] ^ t[13][(a >> 16) & 0xff] ^ t[12][a >> 24]
+              ^ t[11][b & 0xff] ^ t[10][(b >> 8) & 0xff] ^ t[9][(b >> 16) & 0xff] ^ t[8][b >> 24]
+              ^ t[7][c & 0xff] ^ t[6][(c >> 8) & 0xff] ^ t[5][(c >> 16) & 0xff] ^ t[4][c >> 24]
+              ^ t[3][d & 0xff] ^ t[2][(d >> 8) & 0xff] ^ t[1][(d >> 16) & 0xff] ^ t[0][d >> 24];
+
+        data += 16;
+        data_length -= 16;
+    }
+
+    return crc_bytewise(t, ~crc, data, data_length);
+}
+
+uint32_t crc32_bytewise(uint32_t crc, const uint8_t* data, size_t data_length) {
+    return crc_bytewise(CRC_TABLES[CRC_32], crc, data, data_length);
+}
+
+uint32_t crc32_slice8(uint32_t crc, const uint8_t* data, size_t data_length) {
+    return crc_slice8(CRC_TABLES[CRC_32], crc, data, data_length);
+}
+
+uint32_t crc32_slice16(uint32_t crc, const uint8_t* data, size_t data_length) {
+    return crc_slice16(CRC_TABLES[CRC_32], crc, data, data_length);
+}
+
+uint32_t crc32c_bytewise(uint32_t crc, const uint8_t* data, size_t data_length) {
+    return crc_bytewise(CRC_TABLES[CRC_32C], crc, data, data_length);
+}
+
+uint32_t crc32c_slice8(uint32_t crc, const uint8_t* data, size_t data_length) {
+    return crc_slice8(CRC_TABLES[CRC_32C], crc, data, data_length);
+}
+
+uint32_t crc32c_slice16(uint32_t crc, const uint8_t* data, size_t data_length) {
+    return crc_slice16(CRC_TABLES[CRC_32C], crc, data, data_length);
+}
+
+/*-----------------hardware implementation-------------------*/
+
+#ifdef CRC_HAVE_SSE42
+
+/* The crc32 instruction has a latency of three cycles but a throughput of one per cycle, so
+ * long inputs are split in three streams whose crcs are computed together and combined
+ * afterwards. Combining means advancing a crc over the length of the next stream's worth of
+ * zero bytes, which is linear in the crc: it is done with four table lookups, using tables
+ * built by squaring the GF(2) matrix that advances a crc by one zero bit.
+ *
+ * Adapted from Mark Adler's crc32c.c: https://stackoverflow.com/a/17646775
+ */
+
+uint32_t SSE42_LONG_ZEROS[4][256];
+uint32_t SSE42_SHORT_ZEROS[4][256];
+
+uint32_t gf2_matrix_times(const uint32_t* mat, uint32_t vec) {
+    uint32_t sum = 0;
+    while (vec) {
+        if (vec & 1) sum ^= *mat;
+        vec >>= 1;
+        mat++;
+    }
+    return sum;
+}
+
+void gf2_matrix_square(uint32_t* square, const uint32_t* mat) {
+    for (size_t n = 0; n < 32; n++) square[n] = gf2_matrix_times(mat, mat[n]);
+}
+
+/**@brief build the tables that advance a crc over *len* zero bytes; *len* must be a power of two*/
+void crc32c_zeros(uint32_t zeros[4][256], size_t len) {
+    uint32_t even[32];      // operators for an even power of two zero bits
+    uint32_t odd[32];
+
+    // one zero bit
+    odd[0] = CRC32C_POLY;
+    uint32_t row = 1;
+    for (size_t n = 1; n < 32; n++) {
+        odd[n] = row;
+        row <<= 1;
+    }
+
+    gf2_matrix_square(even, odd); // two zero bits
+    gf2_matrix_square(odd, even); // four zero bits
+
+    // square up to one zero byte, then keep squaring until len is used up
+    uint32_t* op = even;
+    do {
+        gf2_matrix_square(even, odd);
+        op = even;
+        len >>= 1;
+        if (len == 0) break;
+
+        gf2_matrix_square(odd, even);
+        op = odd;
+        len >>= 1;
+    } while (len);
+
+    for (uint32_t n = 0; n < 256; n++) {
+        zeros[0][n] = gf2_matrix_times(op, n);
+        zeros[1][n] = gf2_matrix_times(op, n << 8);
+        zeros[2][n] = gf2_matrix_times(op, n << 16);
+        zeros[3][n] = gf2_matrix_times(op, n << 24);
+    }
+}
+
+uint32_t crc32c_shift(uint32_t zeros[4][256], uint32_t crc) {
+    return zeros[0][crc & 0xff] ^ zeros[1][(crc >> 8) & 0xff] ^ zeros[2][(crc >> 16) & 0xff] ^ zeros[3][crc >> 24];
+}
+
+__attribute__((target("sse4.2")))
+uint64_t sse42_u64(uint64_t crc, const uint8_t* p) {
+    uint64_t v;
+    memcpy(&v, p, sizeof(v));
+    return _mm_crc32_u64(crc, v);
+}
+
+/**@brief crc32c over *len* bytes as three interleaved streams of *stride* bytes each, as long as there are enough*/
+__attribute__((target("sse4.2")))
+uint64_t sse42_streams(uint32_t zeros[4][256], size_t stride, uint64_t crc0, const uint8_t** data, size_t* len) {
+    const uint8_t* next = *data;
+
+    while (*len >= stride * 3) {
+        uint64_t crc1 = 0;
+        uint64_t crc2 = 0;
+        const uint8_t* end = next + stride;
+
+        do {
+            crc0 = sse42_u64(crc0, next);
+            crc1 = sse42_u64(crc1, next + stride);
+            crc2 = sse42_u64(crc2, next + stride * 2);
+            next += 8;
+        } while (next < end);
+
+        crc0 = crc32c_shift(zeros, crc0) ^ crc1;
+        crc0 = crc32c_shift(zeros, crc0) ^ crc2;
+        next += stride * 2;
+        *len -= stride * 3;
+    }
+
+    *data = next;
+    return crc0;
+}
+
+__attribute__((target("sse4.2")))
+uint32_t crc32c_sse42(uint32_t crc, const uint8_t* data, size_t data_length) {
+    uint64_t crc0 = ~crc;
+
+    // bring the data to an eight-byte boundary
+    while (data_length && ((uintptr_t)data & 7) != 0) {
+        crc0 = _mm_crc32_u8(crc0, *data++);
+        data_length--;
+    }
+
+    crc0 = sse42_streams(SSE42_LONG_ZEROS, SSE42_LONG, crc0, &data, &data_length);
+    crc0 = sse42_streams(SSE42_SHORT_ZEROS, SSE42_SHORT, crc0, &data, &data_length);
+
+    while (data_length >= 8) {
+        crc0 = sse42_u64(crc0, data);
+        data += 8;
+        data_length -= 8;
+    }
+
+    while (data_length) {
+        crc0 = _mm_crc32_u8(crc0, *data++);
+        data_length--;
+    }
+
+    return ~(uint32_t)crc0;
 }
 
-/**@brief crc_print_table prints the computed CRC_TABLE to stdout for review.
+bool crc_sse42_available() {
+    return __builtin_cpu_supports("sse4.2");
+}
+
+#else
+
+uint32_t crc32c_sse42(uint32_t crc, const uint8_t* data, size_t data_length) {
+    return crc32c_slice16(crc, data, data_length);
+}
+
+bool crc_sse42_available() {
+    return false;
+}
+
+#endif
+
+/*-----------------interface-------------------*/
+
+/**@brief crc_init sets up the lookup tables for the CRC computations and picks the
+ * 		  implementation each algorithm uses
+ */
+void crc_init() {
+    crc_table_init(CRC_TABLES[CRC_32], CRC32_POLY);
+    crc_table_init(CRC_TABLES[CRC_32C], CRC32C_POLY);
+
+    CRC_IMPLS[CRC_32] = crc32_slice16;
+    CRC_IMPL_NAMES[CRC_32] = "slice-by-16";
+    CRC_IMPLS[CRC_32C] = crc32c_slice16;
+    CRC_IMPL_NAMES[CRC_32C] = "slice-by-16";
+
+#ifdef CRC_HAVE_SSE42
+    if (crc_sse42_available()) {
+        crc32c_zeros(SSE42_LONG_ZEROS, SSE42_LONG);
+        crc32c_zeros(SSE42_SHORT_ZEROS, SSE42_SHORT);
+        CRC_IMPLS[CRC_32C] = crc32c_sse42;
+        CRC_IMPL_NAMES[CRC_32C] = "sse4.2";
+    }
+#endif
+}
+
+/**@brief crc_print_table prints the CRC-32 lookup table to stdout for review.
  *
  * **Must not** be called before crc_init()
  */
 void crc_print_table() {
     for (size_t i = 0; i < 32; i++) {
         for (size_t j = 0; j < 8; j++) {
-            printf("%X ", CRC_TABLE[i*8 + j]);
+            printf("%X ", CRC_TABLES[CRC_32][0][i*8 + j]);
         }
     }
 }
 
-/**@brief crc_compute computes the CRC32 result for given data
+/**@brief crc_compute computes the CRC-32 result for given data
  *
  * **MUST NOT** be called before crc_init()
  *
- * Adapted from https://en.wikipedia.org/wiki/Cyclic_redundancy_check#CRC-32_algorithm
- *
  * @param data an array of length data_length containing the data to compute the CRC value for
  * @param data_length the size of the data array
  * @return the CRC value as a uint32_t
  */
 uint32_t crc_compute(const uint8_t* data, size_t data_length) {
-    uint32_t crc32 = 0xFFFFFFFFu;
+    return CRC_IMPLS[CRC_32](0, data, data_length);
+}
 
-    for (size_t i = 0; i < data_length; i++) {
-        const uint32_t lookupIndex = (crc32 ^ data[i]) & 0xff;
-        crc32 = (crc32 >> 8) ^ CRC_TABLE[lookupIndex];
-    }
+/**@brief crc_extend continues a checksum of type *type* over more data, so a record can be
+ * 		  checksummed piece by piece: crc_extend(t, crc_extend(t, 0, a, n), b, m) is the checksum
+ * 		  of a followed by b.
+ *
+ * **MUST NOT** be called before crc_init()
+ */
+uint32_t crc_extend(crc_type type, uint32_t crc, const uint8_t* data, size_t data_length) {
+    return CRC_IMPLS[type == CRC_32C ? CRC_32C : CRC_32](crc, data, data_length);
+}
+
+bool crc_type_valid(uint32_t type) {
+    return type == CRC_32 || type == CRC_32C;
+}
+
+const char* crc_type_name(crc_type type) {
+    return type == CRC_32C ? "crc32c" : "crc32";
+}
 
-    crc32 ^= 0xFFFFFFFFu;
-    return crc32;
+/**@brief name of the implementation crc_extend uses for *type*, e.g. for a startup message*/
+const char* crc_impl_name(crc_type type) {
+    return CRC_IMPL_NAMES[type == CRC_32C ? CRC_32C : CRC_32];
 }
@@ -3,10 +3,36 @@
 
 #include <inttypes.h>
 #include <stddef.h>
+#include <stdbool.h>
+
+// checksum algorithms. These values are stored in data file headers: never renumber them
+enum crc_type {
+    CRC_32 = 0,     // CRC-32 (IEEE 802.3), used by every file written before file headers
+    CRC_32C = 1,    // CRC-32C (Castagnoli), which x86 computes in hardware
+};
+
+typedef enum crc_type crc_type;
+
+// extend *crc*, the checksum of some preceding data (0 for none), over *data_length* more bytes
+typedef uint32_t (*crc_fn)(uint32_t crc, const uint8_t* data, size_t data_length);
 
 void crc_init();
 void crc_print_table();
 
 uint32_t crc_compute(const uint8_t* data, size_t data_length);
+uint32_t crc_extend(crc_type type, uint32_t crc, const uint8_t* data, size_t data_length);
+bool crc_type_valid(uint32_t type);
+const char* crc_type_name(crc_type type);
+const char* crc_impl_name(crc_type type);
+
+// the individual implementations, for tests and benchmarks; crc_extend dispatches to the fastest
+uint32_t crc32_bytewise(uint32_t crc, const uint8_t* data, size_t data_length);
+uint32_t crc32_slice8(uint32_t crc, const uint8_t* data, size_t data_length);
+uint32_t crc32_slice16(uint32_t crc, const uint8_t* data, size_t data_length);
+uint32_t crc32c_bytewise(uint32_t crc, const uint8_t* data, size_t data_length);
+uint32_t crc32c_slice8(uint32_t crc, const uint8_t* data, size_t data_length);
+uint32_t crc32c_slice16(uint32_t crc, const uint8_t* data, size_t data_length);
+uint32_t crc32c_sse42(uint32_t crc, const uint8_t* data, size_t data_length);
+bool crc_sse42_available();
 
 #endif
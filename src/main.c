@@ -1,5 +1,6 @@
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "crc.h"
 #include "ccask_kv.h"
@@ -8,7 +9,9 @@
 #include "ccask_server.h"
 #include "ccask_config.h"
 
-int main(void) {
+#define DB_PATH "./ccask_file"
+
+int main(int argc, char** argv) {
     ccask_config* cfg = ccask_config_from_env();
     if (!cfg) {
         fprintf(stderr, "ccask: failure to configure\n");
@@ -16,7 +19,20 @@ int main(void) {
     }
 
     crc_init();
-    ccask_db* db = ccask_db_new("./ccask_file", cfg);
+
+    // ccask upgrade [dir]: rewrite data files of older format versions, then exit
+    if (argc > 1 && strcmp(argv[1], "upgrade") == 0) {
+        int upgraded = ccask_db_upgrade(argc > 2 ? argv[2] : DB_PATH, cfg);
+        ccask_config_delete(cfg);
+        if (upgraded < 0) return 1;
+
+        printf("ccask: %d files upgraded\n", upgraded);
+        return EXIT_SUCCESS;
+    } else if (argc > 1) {
+        fprintf(stderr, "usage: %s [upgrade [dir]]\n", argv[0]);
+        return 1;
+    }
+    ccask_db* db = ccask_db_new(DB_PATH, cfg);
 
     if (db == NULL) {
         fprintf(stderr, "error initializing ccask\n");
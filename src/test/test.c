@@ -5,6 +5,12 @@
 #include <time.h>
 #include <assert.h>
 #include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <pthread.h>
 
 #define _TEST_
 
@@ -14,9 +20,26 @@
 #include "ccask_keydir.h"
 #include "ccask_db.h"
 #include "ccask_config.h"
+#include "ccask_hint.h"
+#include "ccask_checkpoint.h"
 #include "util.h"
 
 #define TEST_DIR "CCASK_TEST"
+#define MERGE_TEST_DIR "CCASK_TEST_MERGE"
+#define HINT_TEST_DIR "CCASK_TEST_HINT"
+#define DEL_TEST_DIR "CCASK_TEST_DEL"
+#define MMAP_TEST_DIR "CCASK_TEST_MMAP"
+#define ASYNC_TEST_DIR "CCASK_TEST_ASYNC"
+#define COMMIT_TEST_DIR "CCASK_TEST_COMMIT"
+#define LEGACY_TEST_DIR "CCASK_TEST_LEGACY"
+#define RECOVERY_TEST_DIR "CCASK_TEST_RECOVERY"
+#define TTL_TEST_DIR "CCASK_TEST_TTL"
+#define ITER_TEST_DIR "CCASK_TEST_ITER"
+#define BACKUP_TEST_DIR "CCASK_TEST_BACKUP"
+#define DIGEST_TEST_DIR "CCASK_TEST_DIGEST"
+#define SCAN_TEST_DIR "CCASK_TEST_SCAN"
+#define CHECKPOINT_TEST_DIR "CCASK_TEST_CHECKPOINT"
+#define BACKUP_TEST_DEST "CCASK_TEST_BACKUP_COPY"
 
 void test_kdrow(void) {
     puts("\t===== starting ccask_kdrow tests =====");
@@ -24,9 +47,8 @@ void test_kdrow(void) {
     uint32_t fid = 10;
     uint32_t vsz = 5;
     uint32_t vpos = 15;
-    time_t time = 123456789;
     uint8_t key1[5] = { 0, 1, 2, 3, 4 };
-    ccask_kdrow* kdr1 = ccask_kdrow_new(ksz, key1, fid, vsz, vpos, time);
+    ccask_kdrow* kdr1 = ccask_kdrow_new(ksz, key1, fid, vsz, vpos);
 
     // asserts
     puts("kdr1 non-null after ccask_kdrow_new");
@@ -62,30 +84,52 @@ void test_kdrow(void) {
     puts("\t===== completed ccask_kdrow tests =====");
 }
 
+// collects the keys ccask_keydir_scan visits, up to *limit*
+typedef struct kd_scan_test {
+    uint32_t sizes[4096];
+    uint8_t keys[4096][40];
+    size_t count;
+    size_t limit;
+} kd_scan_test;
+
+bool collect_scan(void* ctx, ccask_kdrow* kdr) {
+    kd_scan_test* st = ctx;
+    st->sizes[st->count] = ccask_kdrow_ksize(kdr);
+    memcpy(st->keys[st->count], ccask_kdrow_key(kdr), ccask_kdrow_ksize(kdr));
+    return ++st->count < st->limit;
+}
+
+// orders keys like the keydir: memcmp, shorter first among equal prefixes
+int scan_key_cmp(uint32_t asz, const uint8_t* a, uint32_t bsz, const uint8_t* b) {
+    int c = memcmp(a, b, asz < bsz ? asz : bsz);
+    if (c != 0) return c;
+    return asz < bsz ? -1 : asz > bsz;
+}
+
 void test_keydir(void) {
     puts("\t===== starting ccask_keydir tests =====");
     ccask_keydir* kd = 0;
     size_t kdsz = 64;
 
     puts("keydir non-null after ccask_keydir_new");
-    kd = ccask_keydir_new(kdsz, kdsz*2);
+    kd = ccask_keydir_new(kdsz, 1 << 20, false, false, false);
     assert(kd != 0);
 
     puts("keydir non-null after insert");
     ccask_kdrow* kdr = 0;
     uint8_t key[5] = { 0, 1, 2, 3, 4 };
     size_t vpos1 = 2;
-    kdr = ccask_kdrow_new(5, key, 0, 0, vpos1, 0);
+    kdr = ccask_kdrow_new(5, key, 0, 0, vpos1);
 
     assert(ccask_keydir_insert(kd, kdr) != 0);
 
     puts("element retrievable after insert");
     assert(ccask_keydir_get(kd, 5, key) != 0);
 
-    puts("chained insert succeeds with same key");
+    puts("insert succeeds with same key");
     ccask_kdrow* kdr2 = 0;
     size_t vpos2 = 5;
-    kdr2 = ccask_kdrow_new(5, key, 0, 0, vpos2, 1);
+    kdr2 = ccask_kdrow_new(5, key, 0, 0, vpos2);
     assert(ccask_keydir_insert(kd, kdr2) != 0);
 
     puts("most recent insert selected when multiple entries with identical key");
@@ -93,15 +137,205 @@ void test_keydir(void) {
     assert(res != 0);
     assert(ccask_kdrow_vpos(res) == vpos2);
 
+    puts("overwriting a key updates its row in place and leaves the key count alone");
+    for (size_t i = 0; i < 1000; i++) {
+        assert(ccask_keydir_put(kd, 5, key, 1, 0, i, 2, 0) == kd);
+    }
+    assert(ccask_keydir_count(kd) == 1);
+    assert(ccask_keydir_get(kd, 5, key) == res);
+    assert(ccask_kdrow_fid(res) == 1 && ccask_kdrow_vpos(res) == 999);
+
     ccask_keydir_delete(kd);
 
-    puts("with keydir size 1 (i.e. all vals mapped to same key hash) we can still discriminate btwn keys");
-    kd = ccask_keydir_new(1, 1);
+    puts("every row is still found while and after the keydir grows");
+    kd = ccask_keydir_new(4, 1 << 20, false, false, false);
+    assert(kd != 0);
+    for (uint32_t k = 0; k < 2000; k++) {
+        assert(ccask_keydir_put(kd, sizeof(k), (uint8_t*)&k, 0, 0, k, 1, 0) == kd);
+    }
+    assert(ccask_keydir_count(kd) == 2000);
+    for (uint32_t k = 0; k < 2000; k++) {
+        res = ccask_keydir_get(kd, sizeof(k), (uint8_t*)&k);
+        assert(res != 0 && ccask_kdrow_vpos(res) == k);
+    }
+    for (uint32_t k = 0; k < 2000; k += 2) {
+        assert(ccask_keydir_remove(kd, sizeof(k), (uint8_t*)&k) == kd);
+    }
+    for (uint32_t k = 0; k < 2000; k++) {
+        assert((ccask_keydir_get(kd, sizeof(k), (uint8_t*)&k) != 0) == (k % 2 == 1));
+    }
+    assert(ccask_keydir_count(kd) == 1000);
+
+    ccask_keydir_delete(kd);
+
+    // budgets that let a keydir reach 64 slots but not 128, and that keep one at 16
+    kd = ccask_keydir_new(64, 0, false, false, false);
+    size_t budget64 = ccask_keydir_bytes(kd) / 2 * 3;
+    ccask_keydir_delete(kd);
+    kd = ccask_keydir_new(16, 0, false, false, false);
+    size_t budget16 = ccask_keydir_bytes(kd);
+    ccask_keydir_delete(kd);
+
+    puts("keys stay reachable through remove/insert churn once the budget stops growth");
+    kd = ccask_keydir_new(16, budget64, false, false, false);
+    for (uint32_t round = 0; round < 100; round++) {
+        for (uint32_t k = round * 48; k < round * 48 + 48; k++) {
+            assert(ccask_keydir_put(kd, sizeof(k), (uint8_t*)&k, 0, 0, k, 1, 0) == kd);
+        }
+        for (uint32_t k = round * 48; k < round * 48 + 48; k++) {
+            res = ccask_keydir_get(kd, sizeof(k), (uint8_t*)&k);
+            assert(res != 0 && ccask_kdrow_vpos(res) == k);
+            assert(ccask_keydir_remove(kd, sizeof(k), (uint8_t*)&k) == kd);
+        }
+    }
+    assert(ccask_keydir_count(kd) == 0);
+    assert(ccask_keydir_bytes(kd) <= budget64);
+
+    ccask_keydir_delete(kd);
+
+    puts("put fails once every slot of a keydir that cannot grow is full");
+    kd = ccask_keydir_new(16, budget16, false, false, false);
+    for (uint32_t k = 0; k < 16; k++) {
+        assert(ccask_keydir_room(kd, sizeof(k), (uint8_t*)&k));
+        assert(ccask_keydir_put(kd, sizeof(k), (uint8_t*)&k, 0, 0, k, 1, 0) == kd);
+    }
+    uint32_t extra = 16, present = 3;
+    assert(!ccask_keydir_room(kd, sizeof(extra), (uint8_t*)&extra));
+    assert(ccask_keydir_room(kd, sizeof(present), (uint8_t*)&present));
+    assert(ccask_keydir_put(kd, sizeof(extra), (uint8_t*)&extra, 0, 0, 0, 1, 0) == 0);
+    assert(ccask_keydir_get(kd, sizeof(extra), (uint8_t*)&extra) == 0);
+
+    ccask_keydir_delete(kd);
+
+    puts("keys too long for a row, including ones sharing the row's prefix, round-trip through the arena");
+    kd = ccask_keydir_new(16, 1 << 24, false, false, false);
+    uint8_t long_key[600];
+    memset(long_key, 'k', sizeof(long_key));
+    uint32_t lens[] = { 15, 20, 512, 513, 600 };
+    for (size_t round = 0; round < 2; round++) {
+        for (size_t i = 0; i < 5; i++) {
+            assert(ccask_keydir_put(kd, lens[i], long_key, 0, 0, lens[i], 1, 0) == kd);
+        }
+        for (size_t i = 0; i < 5; i++) {
+            res = ccask_keydir_get(kd, lens[i], long_key);
+            assert(res != 0 && ccask_kdrow_vpos(res) == lens[i]);
+            assert(memcmp(ccask_kdrow_key(res), long_key, lens[i]) == 0);
+            assert(ccask_keydir_remove(kd, lens[i], long_key) == kd);
+        }
+    }
+
+    puts("a location that does not fit a packed row is refused");
+    assert(ccask_keydir_put(kd, 5, key, UINT16_MAX + 1, 0, 0, 1, 0) == 0);
+    assert(ccask_keydir_put(kd, 5, key, 0, 0, (size_t)UINT32_MAX + 1, 1, 0) == 0);
+    assert(ccask_keydir_count(kd) == 0);
+
+    ccask_keydir_delete(kd);
+
+    puts("a digest-keyed keydir finds long keys without keeping them");
+    kd = ccask_keydir_new(16, 1 << 24, false, true, false);
+    for (size_t i = 0; i < 5; i++) {
+        assert(ccask_keydir_put(kd, lens[i], long_key, 0, 0, lens[i], 1, 0) == kd);
+    }
+    assert(ccask_keydir_bytes(kd) == 16 * (KDROW_SIZE + 1) + sizeof(uint32_t));
+    for (size_t i = 0; i < 5; i++) {
+        res = ccask_keydir_get(kd, lens[i], long_key);
+        assert(res != 0 && ccask_kdrow_vpos(res) == lens[i] && ccask_kdrow_ksize(res) == lens[i]);
+        assert(ccask_kdrow_key(res) == 0);
+    }
+    long_key[0] = 'x';
+    assert(ccask_keydir_get(kd, 20, long_key) == 0);
+    long_key[0] = 'k';
+    assert(ccask_keydir_remove(kd, 20, long_key) == kd);
+    assert(ccask_keydir_get(kd, 20, long_key) == 0 && ccask_keydir_count(kd) == 4);
+
+    ccask_keydir_delete(kd);
+
+    puts("an ordered keydir scans its keys in order from any start key, through splits and merges");
+    kd = ccask_keydir_new(16, SIZE_MAX, false, true, true);
+    kd_scan_test* st = malloc(sizeof(kd_scan_test));
+    uint8_t okey[40];
+    uint64_t seed = 0x9E3779B97F4A7C15ull;
+    bool live[3000] = { false };
+
+    // key k is { 'o', k's two bytes, big-endian }, padded out to a length of 3 to 39 bytes
+    for (size_t round = 0; round < 6; round++) {
+        for (uint32_t n = 0; n < 3000; n++) {
+            seed ^= seed << 13;
+            seed ^= seed >> 7;
+            seed ^= seed << 17;
+            uint32_t k = seed % 3000;
+            uint32_t ksz = 3 + k % 37;
+            memset(okey, 'p', sizeof(okey));
+            okey[0] = 'o', okey[1] = k >> 8, okey[2] = k & 0xFF;
+
+            if (round % 2 == 0) assert(ccask_keydir_put(kd, ksz, okey, 0, 0, k, 1, 0) == kd);
+            else if (live[k]) assert(ccask_keydir_remove(kd, ksz, okey) == kd);
+            live[k] = round % 2 == 0;
+        }
+
+        size_t expect = 0;
+        for (uint32_t k = 0; k < 3000; k++) expect += live[k];
+        assert(ccask_keydir_count(kd) == expect);
+
+        st->count = 0;
+        st->limit = SIZE_MAX;
+        assert(ccask_keydir_scan(kd, 0, 0, collect_scan, st) == expect);
+        for (size_t i = 1; i < st->count; i++) {
+            assert(scan_key_cmp(st->sizes[i - 1], st->keys[i - 1], st->sizes[i], st->keys[i]) < 0);
+        }
+    }
+
+    // keys from 1000 on (okey[1] == 3, okey[2] == 0xE8), stopping after 10
+    uint8_t from[3] = { 'o', 1000 >> 8, 1000 & 0xFF };
+    st->count = 0;
+    st->limit = 10;
+    assert(ccask_keydir_scan(kd, sizeof(from), from, collect_scan, st) == 10);
+    for (size_t i = 0; i < st->count; i++) {
+        assert(scan_key_cmp(st->sizes[i], st->keys[i], sizeof(from), from) >= 0);
+        if (i == 0) {
+            uint32_t k = 1000;
+            while (!live[k]) k++;
+            assert(st->keys[0][1] == k >> 8 && st->keys[0][2] == (k & 0xFF));
+        }
+    }
+    free(st);
+    ccask_keydir_delete(kd);
+
+    st = 0;
+    kd = ccask_keydir_new(16, SIZE_MAX, false, false, false);
+    assert(!ccask_keydir_ordered(kd) && ccask_keydir_scan(kd, 0, 0, collect_scan, st) == 0);
+    ccask_keydir_delete(kd);
+
+    puts("keys hash with seeded wyhash, which an empty keydir can swap for another hash");
+    const char* vectors[] = { "", "a", "abc", "message digest", "abcdefghijklmnopqrstuvwxyz" };
+    uint64_t wyhashes[] = {
+        0x93228a4de0eec5a2ull, 0xc5bac3db178713c4ull, 0xa97f2f7b1d9b3314ull, 0x786d1f1df3801df4ull, 0xdca5a8138ad37c87ull,
+    };
+    for (uint64_t i = 0; i < 5; i++) {
+        assert(ccask_kdhash_wyhash(i, strlen(vectors[i]), (const uint8_t*)vectors[i]) == wyhashes[i]);
+    }
+    assert(ccask_keydir_seed() != 0 && ccask_keydir_seed() == ccask_keydir_seed());
+    assert(ccask_kdhash_wyhash(1, 5, key) != ccask_kdhash_wyhash(2, 5, key));
+
+    kd = ccask_keydir_new(16, SIZE_MAX, false, false, false);
+    assert(ccask_keydir_set_hash(kd, ccask_kdhash_fnv1a, 7) == kd);
+    for (uint32_t i = 0; i < 500; i++) {
+        assert(ccask_keydir_put(kd, sizeof(i), (uint8_t*)&i, 0, 0, i, 1, 0) == kd);
+    }
+    for (uint32_t i = 0; i < 500; i++) {
+        res = ccask_keydir_get(kd, sizeof(i), (uint8_t*)&i);
+        assert(res != 0 && ccask_kdrow_vpos(res) == i);
+    }
+    assert(ccask_keydir_set_hash(kd, ccask_kdhash_wyhash, 7) == 0);
+    ccask_keydir_delete(kd);
+
+    puts("with keydir size 1 (i.e. all keys probe the same single group) we can still discriminate btwn keys");
+    kd = ccask_keydir_new(1, 1, false, false, false);
     assert(kd != 0);
 
     uint8_t key2[5] = { 0, 0, 1, 0, 0 };
     size_t vpos3 = 15;
-    ccask_kdrow* kdr3 = ccask_kdrow_new(5, key2, 0, 0, vpos3, 0);
+    ccask_kdrow* kdr3 = ccask_kdrow_new(5, key2, 0, 0, vpos3);
     assert(ccask_keydir_insert(kd, kdr) != 0);
     assert(ccask_keydir_insert(kd, kdr3) != 0);
 
@@ -118,6 +352,88 @@ void test_keydir(void) {
     puts("\t===== completed ccask_keydir tests =====");
 }
 
+typedef struct kd_reader_test {
+    ccask_keydir* kd;
+    volatile int* running;
+    size_t reads;
+    size_t misses;
+    size_t corrupt;
+} kd_reader_test;
+
+// keys 0..999 are never removed, and always point at file 1 and a position of 24 times the key
+void* read_stable_keys(void* arg) {
+    kd_reader_test* r = arg;
+    uint8_t key[20];
+    memset(key, 'r', sizeof(key));
+
+    for (uint64_t k = 0; __atomic_load_n(r->running, __ATOMIC_RELAXED) || r->reads < 1000; k = (k + 1) % 1000) {
+        ccask_kdloc loc;
+        memcpy(key, &k, sizeof(k));
+        if (!ccask_keydir_read(r->kd, sizeof(key), key, &loc)) r->misses++;
+        else if (loc.file_id != 1 || loc.value_pos != k * 24) r->corrupt++;
+        r->reads++;
+    }
+
+    return 0;
+}
+
+void test_keydir_readers(void) {
+    puts("\t===== starting ccask_keydir concurrent reader tests =====");
+
+    puts("readers never miss a key or see a torn row while the writer resizes and removes around them");
+    ccask_keydir* kd = ccask_keydir_new(16, SIZE_MAX, false, false, false);
+    uint8_t key[20];
+    memset(key, 'r', sizeof(key));
+    for (uint64_t k = 0; k < 1000; k++) {
+        memcpy(key, &k, sizeof(k));
+        assert(ccask_keydir_put(kd, sizeof(key), key, 1, 8, k * 24, 1, 0) == kd);
+    }
+
+    volatile int running = 1;
+    kd_reader_test readers[3];
+    pthread_t threads[3];
+    for (size_t t = 0; t < 3; t++) readers[t] = (kd_reader_test) {
+        .kd = kd, .running = &running
+    };
+    for (size_t t = 0; t < 3; t++) assert(pthread_create(threads + t, 0, read_stable_keys, readers + t) == 0);
+
+    for (size_t round = 0; round < 20; round++) {
+        // overwrite the stable keys in place, and churn others through growth and removal
+        for (uint64_t k = 0; k < 1000; k++) {
+            memcpy(key, &k, sizeof(k));
+            assert(ccask_keydir_put(kd, sizeof(key), key, 1, 8 + round, k * 24, 1, 0) == kd);
+        }
+        for (uint64_t k = 1000; k < 5000; k++) {
+            memcpy(key, &k, sizeof(k));
+            assert(ccask_keydir_put(kd, sizeof(key), key, 2, 8, k, 1, 0) == kd);
+        }
+        for (uint64_t k = 1000; k < 5000; k++) {
+            memcpy(key, &k, sizeof(k));
+            assert(ccask_keydir_remove(kd, sizeof(key), key) == kd);
+        }
+    }
+    running = 0;
+
+    for (size_t t = 0; t < 3; t++) {
+        pthread_join(threads[t], 0);
+        assert(readers[t].reads >= 1000);
+        assert(readers[t].misses == 0 && readers[t].corrupt == 0);
+    }
+    assert(ccask_keydir_count(kd) == 1000);
+
+    puts("the writer moves a row only from where the caller last saw it");
+    uint64_t k = 7;
+    memcpy(key, &k, sizeof(k));
+    assert(ccask_keydir_move(kd, sizeof(key), key, 1, 0, 3, 0) == 0);
+    assert(ccask_keydir_move(kd, sizeof(key), key, 1, 7 * 24, 3, 64) == kd);
+    ccask_kdloc loc;
+    assert(ccask_keydir_read(kd, sizeof(key), key, &loc));
+    assert(loc.file_id == 3 && loc.value_pos == 64);
+
+    ccask_keydir_delete(kd);
+    puts("\t===== completed ccask_keydir concurrent reader tests =====");
+}
+
 void test_db(void) {
     puts("\t===== ccask_db tests ======");
     ccask_config* cfg = ccask_config_from_env();
@@ -280,6 +596,1401 @@ void test_db(void) {
     return;
 }
 
+/**@brief assert that a get of *key* succeeds and returns *vsz* bytes equal to *val* */
+void assert_get(ccask_db* db, uint32_t ksz, uint8_t* key, uint32_t vsz, uint8_t* val) {
+    ccask_get_result* gr = ccask_db_get(db, ksz, key);
+    assert(gr != 0);
+    assert(ccask_gr_vsz(gr) == vsz);
+
+    uint8_t* gr_val = malloc(vsz);
+    gr_val = ccask_gr_val(gr_val, gr);
+    assert(memcmp(gr_val, val, vsz) == 0);
+
+    free(gr_val);
+    ccask_gr_delete(gr);
+}
+
+void test_merge(void) {
+    puts("\t===== ccask_db merge tests =====");
+    ccask_config* cfg = ccask_config_from_env();
+
+    ccask_db* db = ccask_db_new(MERGE_TEST_DIR, cfg);
+    assert(db != 0);
+
+    uint8_t key1[4] = { 0xC0, 0xFF, 0xEE, 0x01 };
+    uint8_t key2[4] = { 0xC0, 0xFF, 0xEE, 0x02 };
+    uint8_t val1[64], val2[64];
+    memset(val1, 0x11, sizeof(val1));
+
+    // key1 is written once and then sealed away under many overwritten copies of key2
+    assert(ccask_db_set(db, 4, key1, 64, val1) != 0);
+    for (size_t i = 0; i < 64; i++) {
+        memset(val2, i, sizeof(val2));
+        assert(ccask_db_set(db, 4, key2, 64, val2) != 0);
+    }
+
+    size_t fid_before = ccask_db_fid(db);
+    printf("Asserting overwrites rotated files and left dead bytes (fid %zu, %zu%% dead)...\n", fid_before, ccask_db_dead_pct(db));
+    assert(fid_before > 1);
+    assert(ccask_db_dead_pct(db) > 0);
+
+    puts("Merge runs to completion...");
+    assert(ccask_db_merge(db) != 0);
+    assert(!ccask_db_merging(db));
+
+    size_t fid_after = ccask_db_fid(db);
+    printf("Asserting sealed files were compacted (fid %zu -> %zu)...\n", fid_before, fid_after);
+    assert(fid_after < fid_before);
+    assert(ccask_db_dead_pct(db) == 0);
+
+    puts("Both keys still return their latest values after the merge...");
+    assert_get(db, 4, key1, 64, val1);
+    assert_get(db, 4, key2, 64, val2);
+
+    ccask_db_delete(db);
+
+    puts("Merged files are read back after a restart...");
+    db = ccask_db_new(MERGE_TEST_DIR, cfg);
+    assert(db != 0);
+    assert_get(db, 4, key1, 64, val1);
+    assert_get(db, 4, key2, 64, val2);
+
+    ccask_db_delete(db);
+    ccask_config_delete(cfg);
+    puts("\t===== ccask_db merge tests complete =====");
+}
+
+/**@brief the settings the db tests start from: a 64 MiB keydir budget and no checkpoints, with
+ * 		  mmap reads on if *use_mmap*
+ */
+ccask_config_opts test_opts(bool use_mmap) {
+    ccask_config_opts opts = ccask_config_defaults();
+    opts.keydir_budget_mb = 64;
+    opts.use_mmap = use_mmap;
+    opts.checkpoint_mb = 0;
+    return opts;
+}
+
+void test_hint(void) {
+    puts("\t===== ccask_db hint file tests =====");
+    ccask_config* cfg = ccask_config_from_env();
+
+    ccask_db* db = ccask_db_new(HINT_TEST_DIR, cfg);
+    assert(db != 0);
+
+    uint8_t key[4] = { 0x48, 0x49, 0x4E, 0 };
+    uint8_t val[64];
+    for (uint8_t i = 0; i < 32; i++) {
+        key[3] = i;
+        memset(val, i, sizeof(val));
+        assert(ccask_db_set(db, 4, key, 64, val) != 0);
+    }
+
+    // key 0 is rewritten in the newest file, which must win over the copy in file 0
+    key[3] = 0;
+    memset(val, 0xEE, sizeof(val));
+    assert(ccask_db_set(db, 4, key, 64, val) != 0);
+
+    assert(ccask_db_fid(db) > 0);
+    ccask_db_delete(db);
+
+    char* hint = HINT_TEST_DIR "/" HINT_TEST_DIR "_0.hint";
+    puts("Sealing a file writes its hint...");
+    assert(access(hint, F_OK) == 0);
+
+    puts("Keydir rebuilt from hints serves every key...");
+    db = ccask_db_new(HINT_TEST_DIR, cfg);
+    assert(db != 0);
+    for (uint8_t i = 0; i < 32; i++) {
+        key[3] = i;
+        memset(val, i == 0 ? 0xEE : i, sizeof(val));
+        assert_get(db, 4, key, 64, val);
+    }
+    ccask_db_delete(db);
+
+    puts("Loading on a single thread gives the same keydir...");
+    ccask_config_opts opts1 = test_opts(false);
+    opts1.load_threads = 1;
+    ccask_config* cfg1 = ccask_config_new(&opts1);
+    db = ccask_db_new(HINT_TEST_DIR, cfg1);
+    assert(db != 0);
+    for (uint8_t i = 0; i < 32; i++) {
+        key[3] = i;
+        memset(val, i == 0 ? 0xEE : i, sizeof(val));
+        assert_get(db, 4, key, 64, val);
+    }
+    ccask_db_delete(db);
+    ccask_config_delete(cfg1);
+
+    puts("A corrupt hint is ignored in favor of scanning the data file...");
+    FILE* f = fopen(hint, "r+b");
+    assert(f != 0);
+    assert(fseek(f, 24, SEEK_SET) == 0); // first byte of the first key
+    fputc(0xFF, f);
+    fclose(f);
+
+    db = ccask_db_new(HINT_TEST_DIR, cfg);
+    assert(db != 0);
+    for (uint8_t i = 0; i < 32; i++) {
+        key[3] = i;
+        memset(val, i == 0 ? 0xEE : i, sizeof(val));
+        assert_get(db, 4, key, 64, val);
+    }
+
+    ccask_db_delete(db);
+    ccask_config_delete(cfg);
+    puts("\t===== ccask_db hint file tests complete =====");
+}
+
+void test_del(void) {
+    puts("\t===== ccask_db delete tests =====");
+    ccask_config* cfg = ccask_config_from_env();
+
+    ccask_db* db = ccask_db_new(DEL_TEST_DIR, cfg);
+    assert(db != 0);
+
+    uint8_t key1[3] = { 0xDE, 0x1E, 0x01 };
+    uint8_t key2[3] = { 0xDE, 0x1E, 0x02 };
+    uint8_t filler_key[3] = { 0xF1, 0x11, 0x00 };
+    uint8_t val[64];
+    memset(val, 0x5A, sizeof(val));
+
+    assert(ccask_db_set(db, 3, key1, 64, val) != 0);
+    assert(ccask_db_set(db, 3, key2, 64, val) != 0);
+
+    // push both keys into sealed files so the tombstones land in a newer one
+    for (uint8_t i = 0; i < 16; i++) {
+        filler_key[2] = i;
+        assert(ccask_db_set(db, 3, filler_key, 64, val) != 0);
+    }
+
+    puts("Delete removes the key from the keydir...");
+    assert(ccask_db_del(db, 3, key1) != 0);
+    assert(ccask_db_get(db, 3, key1) == 0);
+    assert_get(db, 3, key2, 64, val);
+
+    puts("Deleting a missing key fails...");
+    assert(ccask_db_del(db, 3, key1) == 0);
+
+    puts("DEL command through query interp...");
+    uint32_t cmdsz = 4 + 1 + 4 + 4 + 3;
+    uint8_t cmd[16];
+    u32_to_nwk_byte_arr(cmd, cmdsz);
+    cmd[4] = 3; // DEL command
+    u32_to_nwk_byte_arr(cmd+5, 3);
+    u32_to_nwk_byte_arr(cmd+9, 0);
+    memcpy(cmd+13, key2, 3);
+
+    ccask_result* res = ccask_query_interp(db, cmd);
+    assert(ccask_res_type(res) == DEL_SUCCESS);
+    ccask_res_delete(res);
+
+    res = ccask_query_interp(db, cmd);
+    assert(ccask_res_type(res) == DEL_FAIL);
+    ccask_res_delete(res);
+    assert(ccask_db_get(db, 3, key2) == 0);
+
+    ccask_db_delete(db);
+
+    puts("Tombstones are honored after a restart...");
+    db = ccask_db_new(DEL_TEST_DIR, cfg);
+    assert(db != 0);
+    assert(ccask_db_get(db, 3, key1) == 0);
+    assert(ccask_db_get(db, 3, key2) == 0);
+    filler_key[2] = 15;
+    assert_get(db, 3, filler_key, 64, val);
+
+    puts("Merge drops tombstones and the records they delete...");
+    assert(ccask_db_merge(db) != 0);
+    assert(ccask_db_dead_pct(db) == 0);
+    assert(ccask_db_get(db, 3, key1) == 0);
+    assert(ccask_db_get(db, 3, key2) == 0);
+    assert_get(db, 3, filler_key, 64, val);
+
+    ccask_db_delete(db);
+
+    db = ccask_db_new(DEL_TEST_DIR, cfg);
+    assert(db != 0);
+    assert(ccask_db_get(db, 3, key1) == 0);
+    assert(ccask_db_get(db, 3, key2) == 0);
+    ccask_db_delete(db);
+
+    ccask_config_delete(cfg);
+    puts("\t===== ccask_db delete tests complete =====");
+}
+
+void test_mmap(void) {
+    puts("\t===== ccask_db mmap read tests =====");
+    ccask_config_opts opts = test_opts(true);
+    ccask_config* cfg = ccask_config_new(&opts);
+    ccask_db* db = ccask_db_new(MMAP_TEST_DIR, cfg);
+    assert(db != 0);
+
+    uint8_t key[3] = { 0x11, 0xAA, 0x00 };
+    uint8_t filler_key[3] = { 0xF1, 0x11, 0x00 };
+    uint8_t val[64];
+    memset(val, 0x3C, sizeof(val));
+
+    // the active file is new at startup, so the first record lands at its start
+    size_t fid = ccask_db_fid(db);
+    assert(ccask_db_set(db, 3, key, 64, val) != 0);
+    for (uint8_t i = 0; i < 16; i++) {
+        filler_key[2] = i;
+        assert(ccask_db_set(db, 3, filler_key, 64, val) != 0);
+    }
+    assert(ccask_db_fid(db) > fid);
+
+    puts("Gets from a sealed file are served from its mapping...");
+    assert_get(db, 3, key, 64, val);
+
+    puts("CRC is checked against the mapped bytes...");
+    char path[64];
+    snprintf(path, sizeof(path), "%s/%s_%zu", MMAP_TEST_DIR, MMAP_TEST_DIR, fid);
+    int fd = open(path, O_RDWR);
+    assert(fd >= 0);
+
+    uint8_t bad = 0xFF;
+    assert(pwrite_full(fd, &bad, 1, CCASK_FILE_HEADER_BYTES + CCASK_RECORD_HEADER_BYTES + 3) == 0);
+
+    uint8_t buf[128];
+    ccask_get_result* gr = ccask_db_get(db, 3, key);
+    assert(gr != 0);
+    assert(ccask_gr_bytes(gr, buf, sizeof(buf)) != UINT32_MAX);
+    assert(buf[4] == GET_FAIL);
+    ccask_gr_delete(gr);
+
+    assert(pwrite_full(fd, val, 1, CCASK_FILE_HEADER_BYTES + CCASK_RECORD_HEADER_BYTES + 3) == 0);
+    close(fd);
+    assert_get(db, 3, key, 64, val);
+
+    ccask_db_delete(db);
+    ccask_config_delete(cfg);
+    puts("\t===== ccask_db mmap read tests complete =====");
+}
+
+/**@brief fill *buf* with a query in wire format and return it*/
+uint8_t* make_cmd(uint8_t* buf, uint8_t cmd, uint32_t ksz, uint8_t* key, uint32_t vsz, uint8_t* val) {
+    u32_to_nwk_byte_arr(buf, 4 + 1 + 4 + 4 + ksz + vsz);
+    buf[4] = cmd;
+    u32_to_nwk_byte_arr(buf+5, ksz);
+    u32_to_nwk_byte_arr(buf+9, vsz);
+    memcpy(buf+13, key, ksz);
+    if (vsz) memcpy(buf+13+ksz, val, vsz);
+    return buf;
+}
+
+#define ASYNC_KEYS 40
+
+typedef struct async_results {
+    size_t count;
+    uint8_t types[ASYNC_KEYS];
+    uint8_t first_bytes[ASYNC_KEYS];
+} async_results;
+
+void collect_result(void* ctx, uint64_t tag, ccask_result* res) {
+    async_results* ar = ctx;
+    assert(tag < ASYNC_KEYS);
+
+    ar->types[tag] = ccask_res_type(res);
+    if (ccask_res_type(res) == GET_SUCCESS) {
+        uint8_t val[64];
+        assert(ccask_res_vsz(res) == 64);
+        ccask_res_value(val, res);
+        ar->first_bytes[tag] = val[0];
+    }
+
+    ar->count++;
+    ccask_res_delete(res);
+}
+
+// drive the db the way the server loop does until *n* results have been collected
+void reap_all(ccask_db* db, async_results* ar, size_t n) {
+    while (ar->count < n) {
+        ccask_db_commit(db);
+        assert(ccask_db_async_submit(db) >= 0);
+        ccask_db_async_wait(db);
+        ccask_db_async_reap(db, collect_result, ar);
+    }
+}
+
+void test_async(void) {
+    puts("\t===== ccask_db io_uring tests =====");
+    // without mmap every get of a sealed file has to be read from disk
+    ccask_config_opts opts = test_opts(false);
+    opts.use_uring = true;
+    ccask_config* cfg = ccask_config_new(&opts);
+    ccask_db* db = ccask_db_new(ASYNC_TEST_DIR, cfg);
+    assert(db != 0);
+
+    if (!ccask_db_async(db)) {
+        puts("io_uring unavailable, skipping");
+        ccask_db_delete(db);
+        ccask_config_delete(cfg);
+        return;
+    }
+
+    uint8_t cmd[128];
+    uint8_t key[3] = { 0xA5, 0x1C, 0x00 };
+    uint8_t val[64];
+    ccask_result* res = 0;
+    async_results ar = { 0 };
+
+    puts("Sets are queued and batched across files...");
+    for (uint8_t i = 0; i < ASYNC_KEYS; i++) {
+        key[2] = i;
+        memset(val, i, sizeof(val));
+        assert(ccask_query_start(db, make_cmd(cmd, 1, 3, key, 64, val), i, &res));
+        assert(res == 0);
+    }
+
+    // the last set may not have been written yet, but it is already visible
+    assert_get(db, 3, key, 64, val);
+
+    reap_all(db, &ar, ASYNC_KEYS);
+    for (size_t i = 0; i < ASYNC_KEYS; i++) assert(ar.types[i] == SET_SUCCESS);
+
+    puts("Gets are served from completions...");
+    memset(&ar, 0, sizeof(ar));
+    size_t queued = 0;
+    for (uint8_t i = 0; i < ASYNC_KEYS; i++) {
+        key[2] = i;
+        if (ccask_query_start(db, make_cmd(cmd, 0, 3, key, 0, 0), i, &res)) {
+            queued++;
+        } else {
+            collect_result(&ar, i, res);
+        }
+    }
+
+    assert(queued > 0);
+    reap_all(db, &ar, ASYNC_KEYS);
+    for (uint8_t i = 0; i < ASYNC_KEYS; i++) {
+        assert(ar.types[i] == GET_SUCCESS);
+        assert(ar.first_bytes[i] == i);
+    }
+
+    puts("Deletes are queued too...");
+    memset(&ar, 0, sizeof(ar));
+    key[2] = 0;
+    assert(ccask_query_start(db, make_cmd(cmd, 3, 3, key, 0, 0), 0, &res));
+    reap_all(db, &ar, 1);
+    assert(ar.types[0] == DEL_SUCCESS);
+    assert(ccask_db_get(db, 3, key) == 0);
+
+    puts("Queued writes are on disk after a restart...");
+    ccask_db_delete(db);
+    db = ccask_db_new(ASYNC_TEST_DIR, cfg);
+    assert(db != 0);
+    assert(ccask_db_get(db, 3, key) == 0);
+    for (uint8_t i = 1; i < ASYNC_KEYS; i++) {
+        key[2] = i;
+        memset(val, i, sizeof(val));
+        assert_get(db, 3, key, 64, val);
+    }
+
+    ccask_db_delete(db);
+    ccask_config_delete(cfg);
+    puts("\t===== ccask_db io_uring tests complete =====");
+}
+
+/**@brief bytes on disk of the file *db* is writing*/
+size_t active_file_size(ccask_db* db) {
+    char fn[64];
+    snprintf(fn, sizeof(fn), "%s/%s_%zu", COMMIT_TEST_DIR, COMMIT_TEST_DIR, ccask_db_fid(db));
+
+    struct stat st;
+    assert(stat(fn, &st) == 0);
+    return st.st_size;
+}
+
+/**@brief open a db with *policy* and start one set through it*/
+ccask_db* commit_test_open(ccask_config** cfg, ccask_sync_policy policy, size_t sync_ms, bool* queued, ccask_result** res) {
+    ccask_config_opts opts = test_opts(false);
+    opts.sync_policy = policy;
+    opts.sync_ms = sync_ms;
+    *cfg = ccask_config_new(&opts);
+    ccask_db* db = ccask_db_new(COMMIT_TEST_DIR, *cfg);
+    assert(db != 0);
+    assert(active_file_size(db) == CCASK_FILE_HEADER_BYTES);
+
+    uint8_t cmd[128];
+    uint8_t key[3] = { 0xC0, 0x33, (uint8_t)policy };
+    uint8_t val[64];
+    memset(val, (uint8_t)policy, sizeof(val));
+
+    *res = 0;
+    *queued = ccask_query_start(db, make_cmd(cmd, 1, 3, key, 64, val), 0, res);
+
+    // the set is visible right away whatever the policy
+    assert_get(db, 3, key, 64, val);
+    return db;
+}
+
+void test_commit(void) {
+    puts("\t===== ccask_db group commit tests =====");
+    ccask_config* cfg = 0;
+    ccask_result* res = 0;
+    async_results ar = { 0 };
+    bool queued;
+    size_t record = 24 + 3 + 64 + 5; // header, key, value, padding to 8 bytes
+
+    puts("batch: a set is acknowledged by the commit that writes and syncs it...");
+    ccask_db* db = commit_test_open(&cfg, SYNC_BATCH, 1000, &queued, &res);
+    assert(queued && res == 0);
+    assert(active_file_size(db) == CCASK_FILE_HEADER_BYTES);
+    assert(ccask_db_async_reap(db, collect_result, &ar) == 0);
+    assert(ccask_db_commit_timeout(db) == -1);
+
+    ccask_db_commit(db);
+    assert(active_file_size(db) == CCASK_FILE_HEADER_BYTES + record);
+    assert(ccask_db_async_reap(db, collect_result, &ar) == 1);
+    assert(ar.types[0] == SET_SUCCESS);
+    ccask_db_delete(db);
+    ccask_config_delete(cfg);
+
+    puts("never: a set is acknowledged once buffered and written by the next commit...");
+    db = commit_test_open(&cfg, SYNC_NEVER, 1000, &queued, &res);
+    assert(!queued && ccask_res_type(res) == SET_SUCCESS);
+    ccask_res_delete(res);
+    assert(active_file_size(db) == CCASK_FILE_HEADER_BYTES);
+    ccask_db_commit(db);
+    assert(active_file_size(db) == CCASK_FILE_HEADER_BYTES + record);
+    ccask_db_delete(db);
+    ccask_config_delete(cfg);
+
+    puts("always: a set is on disk before it is acknowledged...");
+    db = commit_test_open(&cfg, SYNC_ALWAYS, 1000, &queued, &res);
+    assert(!queued && ccask_res_type(res) == SET_SUCCESS);
+    ccask_res_delete(res);
+    assert(active_file_size(db) == CCASK_FILE_HEADER_BYTES + record);
+    ccask_db_delete(db);
+    ccask_config_delete(cfg);
+
+    puts("interval: a set waits for the next interval sync...");
+    memset(&ar, 0, sizeof(ar));
+    db = commit_test_open(&cfg, SYNC_INTERVAL, 200, &queued, &res);
+    assert(queued && res == 0);
+    int timeout = ccask_db_commit_timeout(db);
+    assert(timeout > 0 && timeout <= 200);
+
+    // the record is written out right away, but not acknowledged before the sync
+    ccask_db_commit(db);
+    assert(active_file_size(db) == CCASK_FILE_HEADER_BYTES + record);
+    assert(ccask_db_async_reap(db, collect_result, &ar) == 0);
+
+    struct timespec pause = { 0, 250 * 1000 * 1000 };
+    nanosleep(&pause, 0);
+    assert(ccask_db_commit_timeout(db) == 0);
+    ccask_db_commit(db);
+    assert(ccask_db_async_reap(db, collect_result, &ar) == 1);
+    assert(ar.types[0] == SET_SUCCESS);
+    assert(ccask_db_commit_timeout(db) == -1);
+    ccask_db_delete(db);
+    ccask_config_delete(cfg);
+
+    puts("Every policy's writes survive a restart...");
+    cfg = ccask_config_from_env();
+    db = ccask_db_new(COMMIT_TEST_DIR, cfg);
+    assert(db != 0);
+
+    uint8_t key[3] = { 0xC0, 0x33, 0 };
+    uint8_t val[64];
+    ccask_sync_policy policies[] = { SYNC_NEVER, SYNC_INTERVAL, SYNC_BATCH, SYNC_ALWAYS };
+    for (size_t i = 0; i < 4; i++) {
+        key[2] = policies[i];
+        memset(val, policies[i], sizeof(val));
+        assert_get(db, 3, key, 64, val);
+    }
+
+    ccask_db_delete(db);
+    ccask_config_delete(cfg);
+
+    puts("A big value is written straight away, along with what was buffered before it...");
+    ccask_config_opts opts = test_opts(false);
+    opts.sync_policy = SYNC_NEVER;
+    cfg = ccask_config_new(&opts);
+    db = ccask_db_new(COMMIT_TEST_DIR, cfg);
+    assert(db != 0);
+
+    uint8_t small_key[3] = { 0xC0, 0x34, 0 };
+    uint8_t big_key[3] = { 0xC0, 0x34, 1 };
+    size_t big_size = 64 * 1024;
+    uint8_t* big = malloc(big_size);
+    for (size_t i = 0; i < big_size; i++) big[i] = i * 31;
+
+    size_t before = active_file_size(db);
+    assert(ccask_db_set(db, 3, small_key, sizeof(val), val) != 0);
+    assert(ccask_db_set(db, 3, big_key, big_size, big) != 0);
+    assert(active_file_size(db) >= CCASK_RECORD_HEADER_BYTES + 3 + big_size);
+    assert(active_file_size(db) > before);
+    assert_get(db, 3, small_key, sizeof(val), val);
+    assert_get(db, 3, big_key, big_size, big);
+    ccask_db_delete(db);
+
+    db = ccask_db_new(COMMIT_TEST_DIR, cfg);
+    assert(db != 0);
+    assert_get(db, 3, small_key, sizeof(val), val);
+    assert_get(db, 3, big_key, big_size, big);
+
+    free(big);
+    ccask_db_delete(db);
+    ccask_config_delete(cfg);
+    puts("\t===== ccask_db group commit tests complete =====");
+}
+
+void test_crc(void) {
+    puts("\t===== crc tests =====");
+    const uint8_t* check = (const uint8_t*)"123456789";
+
+    puts("Every implementation gives the standard check values...");
+    assert(crc_compute(check, 9) == 0xCBF43926);
+    crc_fn crc32s[] = { crc32_bytewise, crc32_slice8, crc32_slice16 };
+    for (size_t i = 0; i < 3; i++) assert(crc32s[i](0, check, 9) == 0xCBF43926);
+
+    crc_fn crc32cs[] = { crc32c_bytewise, crc32c_slice8, crc32c_slice16, crc32c_sse42 };
+    for (size_t i = 0; i < 4; i++) assert(crc32cs[i](0, check, 9) == 0xE3069283);
+    assert(crc_extend(CRC_32C, 0, check, 9) == 0xE3069283);
+    printf("crc32c uses %s\n", crc_impl_name(CRC_32C));
+
+    puts("Implementations agree on every length and alignment...");
+    size_t cap = 3 * 8192 * 2 + 64;
+    uint8_t* buf = malloc(cap);
+    assert(buf != 0);
+    uint32_t x = 12345;
+    for (size_t i = 0; i < cap; i++) {
+        x = x * 1103515245 + 12345;
+        buf[i] = x >> 16;
+    }
+
+    size_t lens[] = { 0, 1, 7, 8, 15, 16, 17, 255, 767, 768, 769, 4096, 3 * 8192, 3 * 8192 + 777, cap - 8 };
+    for (size_t off = 0; off < 8; off++) {
+        for (size_t l = 0; l < sizeof(lens) / sizeof(lens[0]); l++) {
+            uint32_t want = crc32_bytewise(0, buf + off, lens[l]);
+            for (size_t i = 1; i < 3; i++) assert(crc32s[i](0, buf + off, lens[l]) == want);
+
+            want = crc32c_bytewise(0, buf + off, lens[l]);
+            for (size_t i = 1; i < 4; i++) assert(crc32cs[i](0, buf + off, lens[l]) == want);
+        }
+    }
+
+    puts("A checksum can be extended piece by piece...");
+    for (size_t split = 0; split < 100; split += 7) {
+        assert(crc_extend(CRC_32, crc_extend(CRC_32, 0, buf, split), buf + split, 100 - split) == crc_compute(buf, 100));
+        assert(crc_extend(CRC_32C, crc_extend(CRC_32C, 0, buf, split), buf + split, 100 - split) == crc_extend(CRC_32C, 0, buf, 100));
+    }
+
+    free(buf);
+    puts("\t===== crc tests complete =====");
+}
+
+/**@brief remove every file in *path*, creating it if needed*/
+void clear_test_dir(const char* path) {
+    DIR* dir = opendir(path);
+    if (!dir) {
+        assert(mkdir(path, 0700) == 0);
+        return;
+    }
+
+    char fn[512];
+    for (struct dirent* d = readdir(dir); d; d = readdir(dir)) {
+        if (strcmp(d->d_name, ".") == 0 || strcmp(d->d_name, "..") == 0) continue;
+        snprintf(fn, sizeof(fn), "%s/%s", path, d->d_name);
+        unlink(fn);
+    }
+
+    closedir(dir);
+}
+
+/**@brief assert that *key* reads back as *val* and passes its checksum*/
+void assert_get_valid(ccask_db* db, uint32_t ksz, uint8_t* key, uint32_t vsz, uint8_t* val) {
+    assert_get(db, ksz, key, vsz, val);
+
+    uint8_t buf[128];
+    ccask_get_result* gr = ccask_db_get(db, ksz, key);
+    assert(ccask_gr_bytes(gr, buf, sizeof(buf)) != UINT32_MAX);
+    assert(buf[4] == GET_SUCCESS);
+    ccask_gr_delete(gr);
+}
+
+/**@brief write file *fid* of the legacy test dir in the v1 record layout: *count* records of
+ * 		  keys { 0x01, 0xD0, i } and values of 32 bytes of i + *fill*, after a v1 file header
+ * 		  naming *type* unless *headerless*
+ */
+void write_v1_file(size_t fid, bool headerless, crc_type type, uint8_t count, uint8_t fill) {
+    char fn[64];
+    snprintf(fn, sizeof(fn), "%s/%s_%zu", LEGACY_TEST_DIR, LEGACY_TEST_DIR, fid);
+    int fd = open(fn, O_RDWR | O_CREAT | O_TRUNC, 0644);
+    assert(fd >= 0);
+
+    size_t pos = 0;
+    if (!headerless) {
+        uint8_t hdr[CCASK_FILE_HEADER_V1_BYTES] = { 0xFF, 0x2C, 0xCA, 0x0C, 1, 0, type, 0 };
+        uint32_t crc = crc_compute(hdr, 12);
+        memcpy(hdr + 12, &crc, 4);
+        assert(pwrite_full(fd, hdr, sizeof(hdr), 0) == 0);
+        pos = sizeof(hdr);
+    }
+
+    uint8_t key[3] = { 0x01, 0xD0, 0x00 };
+    uint8_t row[20 + 3 + 32];
+    for (uint8_t i = 0; i < count; i++) {
+        key[2] = i;
+
+        int64_t ts = 1600000000 + i;
+        uint32_t ksz = 3, vsz = 32;
+        memcpy(row + 4, &ts, 8);
+        memcpy(row + 12, &ksz, 4);
+        memcpy(row + 16, &vsz, 4);
+        memcpy(row + 20, key, 3);
+        memset(row + 23, i + fill, 32);
+
+        uint32_t crc = crc_extend(type, 0, row + 4, sizeof(row) - 4);
+        memcpy(row, &crc, 4);
+        assert(pwrite_full(fd, row, sizeof(row), pos) == 0);
+        pos += sizeof(row);
+    }
+    close(fd);
+}
+
+/**@brief format version in the file header of file *fid* of the legacy test dir*/
+uint16_t legacy_file_version(size_t fid) {
+    char fn[64];
+    snprintf(fn, sizeof(fn), "%s/%s_%zu", LEGACY_TEST_DIR, LEGACY_TEST_DIR, fid);
+    int fd = open(fn, O_RDONLY);
+    assert(fd >= 0);
+
+    uint8_t hdr[8];
+    assert(pread_full(fd, hdr, sizeof(hdr), 0) == 0);
+    close(fd);
+    return hdr[4] | hdr[5] << 8;
+}
+
+void test_legacy(void) {
+    puts("\t===== ccask_db legacy file tests =====");
+    clear_test_dir(LEGACY_TEST_DIR);
+
+    // a data file as written before file headers: bare records, checksummed with CRC-32
+    uint8_t key[3] = { 0x01, 0xD0, 0x00 };
+    uint8_t val[32];
+    write_v1_file(0, true, CRC_32, 8, 0);
+
+    ccask_config* cfg = ccask_config_from_env();
+    ccask_db* db = ccask_db_new(LEGACY_TEST_DIR, cfg);
+    assert(db != 0);
+
+    puts("Records of a headerless file are read and checksummed as CRC-32...");
+    for (uint8_t i = 0; i < 8; i++) {
+        key[2] = i;
+        memset(val, i, sizeof(val));
+        assert_get_valid(db, 3, key, 32, val);
+    }
+
+    puts("New records use CRC-32C alongside them...");
+    key[2] = 0xFF;
+    memset(val, 0xFF, sizeof(val));
+    assert(ccask_db_set(db, 3, key, 32, val) != 0);
+    assert_get_valid(db, 3, key, 32, val);
+
+    puts("Merge rewrites old records with the new checksum...");
+    assert(ccask_db_merge(db) != 0);
+    ccask_db_delete(db);
+
+    db = ccask_db_new(LEGACY_TEST_DIR, cfg);
+    assert(db != 0);
+    for (uint8_t i = 0; i < 8; i++) {
+        key[2] = i;
+        memset(val, i, sizeof(val));
+        assert_get_valid(db, 3, key, 32, val);
+    }
+    key[2] = 0xFF;
+    memset(val, 0xFF, sizeof(val));
+    assert_get_valid(db, 3, key, 32, val);
+    ccask_db_delete(db);
+
+    puts("Upgrade rewrites headerless and v1 files in the current format...");
+    clear_test_dir(LEGACY_TEST_DIR);
+    write_v1_file(0, true, CRC_32, 8, 0);
+    write_v1_file(1, false, CRC_32C, 4, 0x40); // overwrites the first 4 keys of file 0
+
+    assert(ccask_db_upgrade(LEGACY_TEST_DIR, cfg) == 2);
+    assert(legacy_file_version(0) == 2 && legacy_file_version(1) == 2);
+    assert(ccask_db_upgrade(LEGACY_TEST_DIR, cfg) == 0);
+
+    db = ccask_db_new(LEGACY_TEST_DIR, cfg);
+    assert(db != 0);
+    for (uint8_t i = 0; i < 8; i++) {
+        key[2] = i;
+        memset(val, i < 4 ? i + 0x40 : i, sizeof(val));
+        assert_get_valid(db, 3, key, 32, val);
+    }
+
+    ccask_db_delete(db);
+    ccask_config_delete(cfg);
+    puts("\t===== ccask_db legacy file tests complete =====");
+}
+
+/**@brief path of data file *fid* of the recovery test dir, followed by *suffix**/
+char* recovery_file(char* buf, size_t buflen, size_t fid, const char* suffix) {
+    snprintf(buf, buflen, "%s/%s_%zu%s", RECOVERY_TEST_DIR, RECOVERY_TEST_DIR, fid, suffix);
+    return buf;
+}
+
+size_t file_size(const char* fn) {
+    struct stat st;
+    assert(stat(fn, &st) == 0);
+    return st.st_size;
+}
+
+void test_recovery(void) {
+    puts("\t===== ccask_db crash recovery tests =====");
+    clear_test_dir(RECOVERY_TEST_DIR);
+
+    // 15 records of 64 bytes fill file 0, the other 5 go to file 1
+    uint8_t key[3] = { 0x0E, 0xC0, 0x00 };
+    uint8_t val[32];
+    size_t record = 64, count = 20;
+
+    ccask_config* cfg = ccask_config_from_env();
+    ccask_db* db = ccask_db_new(RECOVERY_TEST_DIR, cfg);
+    assert(db != 0 && ccask_db_fid(db) == 0);
+    for (uint8_t i = 0; i < count; i++) {
+        key[2] = i;
+        memset(val, i, sizeof(val));
+        assert(ccask_db_set(db, 3, key, sizeof(val), val) != 0);
+    }
+    assert(ccask_db_fid(db) == 1);
+    ccask_db_delete(db);
+
+    char fn[128];
+    size_t rec3 = CCASK_FILE_HEADER_BYTES + 3 * record;
+    size_t rec7 = CCASK_FILE_HEADER_BYTES + 7 * record;
+    int fd = open(recovery_file(fn, sizeof(fn), 0, ""), O_RDWR);
+    assert(fd >= 0);
+
+    // a flipped value byte, and a key size that runs past the end of the file
+    uint8_t bad[4] = { 0xFF, 0xFF, 0xFF, 0x0F };
+    assert(pwrite_full(fd, bad, 1, rec3 + CCASK_RECORD_HEADER_BYTES + 3) == 0);
+    assert(pwrite_full(fd, bad, 4, rec7 + 4) == 0);
+    close(fd);
+
+    // like the hint, a checkpoint would vouch for the records without reading them
+    unlink(recovery_file(fn, sizeof(fn), 0, HINT_SUFFIX));
+    unlink(RECOVERY_TEST_DIR "/" CHECKPOINT_NAME);
+
+    // an append to the last file cut short by a crash
+    fd = open(recovery_file(fn, sizeof(fn), 1, ""), O_RDWR);
+    assert(fd >= 0);
+    size_t valid_end = file_size(fn);
+    uint8_t torn[CCASK_RECORD_HEADER_BYTES + 10];
+    memset(torn, 0xAB, sizeof(torn));
+    assert(pwrite_full(fd, torn, sizeof(torn), valid_end) == 0);
+    close(fd);
+
+    // and the lockfile of the crashed process
+    pid_t pid = fork();
+    assert(pid >= 0);
+    if (pid == 0) _exit(0);
+    assert(waitpid(pid, 0, 0) == pid);
+
+    FILE* lock = fopen(RECOVERY_TEST_DIR "/ccask.lock", "w");
+    assert(lock != 0);
+    fprintf(lock, "%d", pid);
+    fclose(lock);
+
+    puts("Startup takes over a stale lock, skips corrupt records and cuts off the torn tail...");
+    db = ccask_db_new(RECOVERY_TEST_DIR, cfg);
+    assert(db != 0);
+    assert(file_size(recovery_file(fn, sizeof(fn), 1, "")) == valid_end);
+
+    for (uint8_t i = 0; i < count; i++) {
+        key[2] = i;
+        memset(val, i, sizeof(val));
+        if (i == 3 || i == 7) {
+            assert(ccask_db_get(db, 3, key) == 0);
+        } else {
+            assert_get_valid(db, 3, key, sizeof(val), val);
+        }
+    }
+
+    puts("New records go after the last valid one...");
+    key[2] = 3;
+    memset(val, 0x33, sizeof(val));
+    assert(ccask_db_set(db, 3, key, sizeof(val), val) != 0);
+
+    puts("Merge skips the corrupt regions too...");
+    assert(ccask_db_merge(db) != 0);
+    ccask_db_delete(db);
+
+    db = ccask_db_new(RECOVERY_TEST_DIR, cfg);
+    assert(db != 0);
+    for (uint8_t i = 0; i < count; i++) {
+        key[2] = i;
+        memset(val, i == 3 ? 0x33 : i, sizeof(val));
+        if (i == 7) {
+            assert(ccask_db_get(db, 3, key) == 0);
+        } else {
+            assert_get_valid(db, 3, key, sizeof(val), val);
+        }
+    }
+
+    ccask_db_delete(db);
+    ccask_config_delete(cfg);
+    puts("\t===== ccask_db crash recovery tests complete =====");
+}
+
+/**@brief whether any file in *path* contains the *len* bytes at *pattern**/
+bool dir_holds(const char* path, const uint8_t* pattern, size_t len) {
+    DIR* dir = opendir(path);
+    assert(dir != 0);
+
+    char fn[512];
+    bool found = false;
+    for (struct dirent* d = readdir(dir); d && !found; d = readdir(dir)) {
+        snprintf(fn, sizeof(fn), "%s/%s", path, d->d_name);
+        FILE* f = fopen(fn, "rb");
+        if (!f) continue;
+
+        uint8_t buf[4096];
+        size_t n = fread(buf, 1, sizeof(buf), f);
+        for (size_t i = 0; i + len <= n && !found; i++) found = memcmp(buf + i, pattern, len) == 0;
+        fclose(f);
+    }
+
+    closedir(dir);
+    return found;
+}
+
+void test_ttl(void) {
+    puts("\t===== ccask_db ttl tests =====");
+    clear_test_dir(TTL_TEST_DIR);
+
+    uint8_t short_key[3] = { 0x77, 0x11, 0x01 };
+    uint8_t swept_key[3] = { 0x77, 0x11, 0x02 };
+    uint8_t long_key[3] = { 0x77, 0x11, 0x03 };
+    uint8_t plain_key[3] = { 0x77, 0x11, 0x04 };
+    uint8_t filler_key[3] = { 0xF1, 0x77, 0x00 };
+    uint8_t val[64];
+    memset(val, 0x7A, sizeof(val));
+
+    ccask_config* cfg = ccask_config_from_env();
+    ccask_db* db = ccask_db_new(TTL_TEST_DIR, cfg);
+    assert(db != 0);
+    assert(!ccask_db_expiring(db));
+
+    puts("SET with a ttl through query interp...");
+    uint8_t cmd[128];
+    make_cmd(cmd, 1, 3, short_key, sizeof(val), val);
+    u32_to_nwk_byte_arr(cmd, 4 + 1 + 4 + 4 + 4 + 3 + sizeof(val));
+    cmd[4] = 4; // SET_TTL command
+    u32_to_nwk_byte_arr(cmd+13, 1);
+    memcpy(cmd+17, short_key, 3);
+    memcpy(cmd+20, val, sizeof(val));
+
+    ccask_result* res = ccask_query_interp(db, cmd);
+    assert(ccask_res_type(res) == SET_SUCCESS);
+    ccask_res_delete(res);
+    assert(ccask_db_expiring(db));
+
+    assert(ccask_db_set_ttl(db, 3, swept_key, sizeof(val), val, 1) != 0);
+    assert(ccask_db_set_ttl(db, 3, long_key, sizeof(val), val, 3600) != 0);
+    assert(ccask_db_set(db, 3, plain_key, sizeof(val), val) != 0);
+
+    // push the keys into sealed files so merge gets to see them
+    for (uint8_t i = 0; i < 16; i++) {
+        filler_key[2] = i;
+        assert(ccask_db_set(db, 3, filler_key, sizeof(val), val) != 0);
+    }
+
+    puts("Keys read normally until they expire...");
+    assert_get_valid(db, 3, short_key, sizeof(val), val);
+    assert_get_valid(db, 3, swept_key, sizeof(val), val);
+
+    struct timespec pause = { 2, 0 };
+    nanosleep(&pause, 0);
+
+    puts("An expired key is a miss...");
+    assert(ccask_db_get(db, 3, short_key) == 0);
+    assert(ccask_db_del(db, 3, short_key) == 0);
+    assert_get_valid(db, 3, long_key, sizeof(val), val);
+    assert_get_valid(db, 3, plain_key, sizeof(val), val);
+
+    puts("The sweep drops expired keys nobody reads...");
+    size_t before = ccask_db_dead_pct(db);
+    size_t swept = 0;
+    for (size_t i = 0; i < (1 << 16) && swept == 0; i++) swept += ccask_db_expire_step(db);
+    assert(swept == 1);
+    assert(ccask_db_dead_pct(db) > before);
+    assert(ccask_db_get(db, 3, swept_key) == 0);
+    ccask_db_delete(db);
+
+    puts("Expired records stay expired after a restart...");
+    db = ccask_db_new(TTL_TEST_DIR, cfg);
+    assert(db != 0);
+    assert(ccask_db_get(db, 3, short_key) == 0);
+    assert(ccask_db_get(db, 3, swept_key) == 0);
+    assert_get_valid(db, 3, long_key, sizeof(val), val);
+    assert_get_valid(db, 3, plain_key, sizeof(val), val);
+    assert(dir_holds(TTL_TEST_DIR, short_key, 3));
+
+    puts("Merge drops expired records and keeps the ttl of live ones...");
+    assert(ccask_db_merge(db) != 0);
+    assert(!dir_holds(TTL_TEST_DIR, short_key, 3));
+    assert(!dir_holds(TTL_TEST_DIR, swept_key, 3));
+    assert_get_valid(db, 3, long_key, sizeof(val), val);
+    ccask_db_delete(db);
+
+    db = ccask_db_new(TTL_TEST_DIR, cfg);
+    assert(db != 0);
+    assert(ccask_db_expiring(db));
+    assert(ccask_db_get(db, 3, short_key) == 0);
+    assert_get_valid(db, 3, long_key, sizeof(val), val);
+    assert_get_valid(db, 3, plain_key, sizeof(val), val);
+    ccask_db_delete(db);
+
+    ccask_config_delete(cfg);
+    puts("\t===== ccask_db ttl tests complete =====");
+}
+
+void test_iterator(void) {
+    puts("\t===== ccask_db snapshot iterator tests =====");
+    clear_test_dir(ITER_TEST_DIR);
+
+    // keys { 0x17, i } start out with values of 48 bytes of i; key 5 is deleted and key 9 overwritten
+    uint8_t key[2] = { 0x17, 0x00 };
+    uint8_t val[48];
+    size_t count = 30;
+
+    ccask_config* cfg = ccask_config_from_env();
+    ccask_db* db = ccask_db_new(ITER_TEST_DIR, cfg);
+    assert(db != 0);
+
+    for (uint8_t i = 0; i < count; i++) {
+        key[1] = i;
+        memset(val, i, sizeof(val));
+        assert(ccask_db_set(db, 2, key, sizeof(val), val) != 0);
+    }
+
+    key[1] = 5;
+    assert(ccask_db_del(db, 2, key) != 0);
+    key[1] = 9;
+    memset(val, 0x99, sizeof(val));
+    assert(ccask_db_set(db, 2, key, sizeof(val), val) != 0);
+
+    puts("A snapshot holds every live key...");
+    ccask_db_iterator* it = ccask_db_iterator_new(db);
+    assert(it != 0);
+    assert(ccask_db_iterator_count(it) == count - 1);
+    assert(ccask_db_iterator_key(it) == 0);
+
+    puts("Writes and a merge after the snapshot don't change what it sees...");
+    for (uint8_t i = 0; i < count; i++) {
+        key[1] = i;
+        memset(val, 0xEE, sizeof(val));
+        assert(ccask_db_set(db, 2, key, sizeof(val), val) != 0);
+    }
+    key[1] = 0x80;
+    assert(ccask_db_set(db, 2, key, sizeof(val), val) != 0);
+    key[1] = 0;
+    assert(ccask_db_del(db, 2, key) != 0);
+    assert(ccask_db_merge(db) != 0);
+
+    bool seen[256] = { false };
+    size_t visited = 0;
+    uint8_t buf[128];
+    while (ccask_db_iterator_next(it)) {
+        assert(ccask_db_iterator_ksz(it) == 2);
+        const uint8_t* k = ccask_db_iterator_key(it);
+        assert(k[0] == 0x17 && k[1] < count && k[1] != 5 && !seen[k[1]]);
+        seen[k[1]] = true;
+
+        ccask_get_result* gr = ccask_db_iterator_get(it);
+        assert(gr != 0 && ccask_gr_vsz(gr) == sizeof(val));
+        assert(ccask_gr_bytes(gr, buf, sizeof(buf)) != UINT32_MAX && buf[4] == GET_SUCCESS);
+        memset(val, k[1] == 9 ? 0x99 : k[1], sizeof(val));
+        assert(memcmp(ccask_gr_val(buf, gr), val, sizeof(val)) == 0);
+        ccask_gr_delete(gr);
+        visited++;
+    }
+    assert(visited == count - 1);
+    assert(!ccask_db_iterator_next(it));
+    ccask_db_iterator_delete(it);
+
+    puts("A new snapshot sees the new state...");
+    it = ccask_db_iterator_new(db);
+    assert(it != 0);
+    assert(ccask_db_iterator_count(it) == count);
+    while (ccask_db_iterator_next(it)) {
+        ccask_get_result* gr = ccask_db_iterator_get(it);
+        assert(gr != 0 && ccask_gr_bytes(gr, buf, sizeof(buf)) != UINT32_MAX && buf[4] == GET_SUCCESS);
+        assert(ccask_gr_val(buf, gr)[0] == 0xEE);
+        ccask_gr_delete(gr);
+    }
+    ccask_db_iterator_delete(it);
+
+    puts("Only an ordered keydir iterates from a start key...");
+    key[1] = 10;
+    assert(ccask_db_iterator_from(db, 2, key) == 0);
+    ccask_db_delete(db);
+    ccask_config_delete(cfg);
+
+    ccask_config_opts opts = test_opts(true);
+    opts.kd_ordered = true;
+    cfg = ccask_config_new(&opts);
+    db = ccask_db_new(ITER_TEST_DIR, cfg);
+    assert(db != 0);
+
+    // keys 10 to 29 and 0x80 are from key 10 on
+    it = ccask_db_iterator_from(db, 2, key);
+    assert(it != 0);
+    assert(ccask_db_iterator_count(it) == count - 10 + 1);
+    int last = -1;
+    while (ccask_db_iterator_next(it)) {
+        const uint8_t* k = ccask_db_iterator_key(it);
+        assert(k[0] == 0x17 && k[1] >= 10 && k[1] > last);
+        last = k[1];
+
+        ccask_get_result* gr = ccask_db_iterator_get(it);
+        assert(gr != 0 && ccask_gr_bytes(gr, buf, sizeof(buf)) != UINT32_MAX && buf[4] == GET_SUCCESS);
+        assert(ccask_gr_val(buf, gr)[0] == 0xEE);
+        ccask_gr_delete(gr);
+    }
+    assert(last == 0x80);
+    ccask_db_iterator_delete(it);
+
+    ccask_db_delete(db);
+    ccask_config_delete(cfg);
+    puts("\t===== ccask_db snapshot iterator tests complete =====");
+}
+
+/**@brief fill *buf* with a SCAN query in wire format and return it*/
+uint8_t* make_scan_cmd(uint8_t* buf, uint32_t limit, uint8_t flags, uint32_t ksz, uint8_t* key, uint32_t esz, uint8_t* end) {
+    u32_to_nwk_byte_arr(buf, 4 + 1 + 4 + 4 + 5 + ksz + esz);
+    buf[4] = 6;
+    u32_to_nwk_byte_arr(buf+5, ksz);
+    u32_to_nwk_byte_arr(buf+9, esz);
+    u32_to_nwk_byte_arr(buf+13, limit);
+    buf[17] = flags;
+    if (ksz) memcpy(buf+18, key, ksz);
+    if (esz) memcpy(buf+18+ksz, end, esz);
+    return buf;
+}
+
+// key { p, i } of test_scan holds scan_value_size bytes of p ^ i
+size_t scan_value_size(const uint8_t* key) {
+    return key[0] == 'e' ? 128 * 1024 : key[0] == 'd' ? 300 : 20 + key[1];
+}
+
+void set_scan_key(ccask_db* db, uint8_t p, uint8_t i) {
+    uint8_t key[2] = { p, i };
+    size_t vsz = scan_value_size(key);
+    uint8_t* val = malloc(vsz);
+    assert(val != 0);
+    memset(val, p ^ i, vsz);
+    assert(ccask_db_set(db, 2, key, vsz, val) != 0);
+    free(val);
+}
+
+/**@brief render every response of the scan in *res*, *buflen* bytes at a time, checking that
+ * 		  its pairs come in key order with the right values. Returns the number of pairs, with
+ * 		  the first key in *first* and the type of the final response in *last*.
+ */
+size_t render_scan(ccask_result* res, size_t buflen, uint8_t* first, uint8_t* last, size_t* frames) {
+    uint8_t* buf = malloc(buflen);
+    uint8_t prev[2] = { 0, 0 };
+    size_t pairs = 0;
+    assert(buf != 0);
+
+    *frames = 0;
+    do {
+        uint32_t len = ccask_res_bytes(res, buf, buflen);
+        assert(len != UINT32_MAX && len <= buflen && NWK_BYTE_ARR_U32(buf) == len);
+        *last = buf[4];
+        (*frames)++;
+        if (buf[4] != SCAN_SUCCESS) continue;
+
+        uint32_t n = NWK_BYTE_ARR_U32((buf+5));
+        size_t off = 9;
+        assert(n > 0);
+        for (uint32_t j = 0; j < n; j++, pairs++) {
+            uint32_t ksz = NWK_BYTE_ARR_U32((buf+off));
+            uint32_t vsz = NWK_BYTE_ARR_U32((buf+off+4));
+            uint8_t* k = buf + off + 8;
+            assert(ksz == 2 && vsz == scan_value_size(k));
+            assert(pairs == 0 || memcmp(prev, k, 2) < 0);
+            assert(k[2] == (k[0] ^ k[1]) && k[2 + vsz - 1] == (k[0] ^ k[1]));
+
+            if (pairs == 0) memcpy(first, k, 2);
+            memcpy(prev, k, 2);
+            off += 8 + ksz + vsz;
+        }
+        assert(off == len);
+    } while (ccask_res_more(res));
+
+    assert(ccask_res_bytes(res, buf, buflen) == UINT32_MAX);
+    free(buf);
+    return pairs;
+}
+
+void test_scan(void) {
+    puts("\t===== ccask_db SCAN tests =====");
+    clear_test_dir(SCAN_TEST_DIR);
+
+    uint8_t cmd[64], first[2], last;
+    uint8_t start[2] = { 'b', 0 }, end[2];
+    size_t frames;
+
+    puts("SCAN needs an ordered keydir...");
+    ccask_config* cfg = ccask_config_from_env();
+    ccask_db* db = ccask_db_new(SCAN_TEST_DIR, cfg);
+    assert(db != 0);
+    set_scan_key(db, 'a', 0);
+
+    ccask_result* res = ccask_query_interp(db, make_scan_cmd(cmd, 0, 0, 0, 0, 0, 0));
+    assert(ccask_res_type(res) == SCAN_FAIL && !ccask_res_more(res));
+    ccask_res_delete(res);
+    ccask_db_delete(db);
+    ccask_config_delete(cfg);
+
+    // keys { 'a'..'c', 0..39 }, but for { 'b', 5 }, which is deleted
+    ccask_config_opts opts = test_opts(true);
+    opts.kd_ordered = true;
+    cfg = ccask_config_new(&opts);
+    db = ccask_db_new(SCAN_TEST_DIR, cfg);
+    assert(db != 0);
+    for (uint8_t p = 'a'; p <= 'c'; p++) {
+        for (uint8_t i = 0; i < 40; i++) set_scan_key(db, p, i);
+    }
+    assert(ccask_db_del(db, 2, (uint8_t[]) { 'b', 5 }) != 0);
+
+    puts("A full scan streams every pair in key order, a few per response...");
+    res = ccask_query_interp(db, make_scan_cmd(cmd, 0, 0, 0, 0, 0, 0));
+    assert(ccask_res_type(res) == SCAN_SUCCESS && ccask_res_more(res));
+    assert(render_scan(res, 256, first, &last, &frames) == 119);
+    assert(first[0] == 'a' && first[1] == 0 && last == SCAN_DONE && frames > 10);
+    ccask_res_delete(res);
+
+    puts("A prefix scan stops at the end of the prefix...");
+    res = ccask_query_interp(db, make_scan_cmd(cmd, 0, 0x01, 0, 0, 1, start));
+    assert(render_scan(res, 1024, first, &last, &frames) == 39);
+    assert(first[0] == 'b' && first[1] == 0 && last == SCAN_DONE);
+    ccask_res_delete(res);
+
+    puts("A range scan runs from its start key up to its end key...");
+    start[0] = 'a';
+    start[1] = 30;
+    end[0] = 'b';
+    end[1] = 10;
+    res = ccask_query_interp(db, make_scan_cmd(cmd, 0, 0, 2, start, 2, end));
+    assert(render_scan(res, 1024, first, &last, &frames) == 10 + 9);
+    assert(first[0] == 'a' && first[1] == 30 && last == SCAN_DONE);
+    ccask_res_delete(res);
+
+    puts("...and a limit cuts it short");
+    res = ccask_query_interp(db, make_scan_cmd(cmd, 7, 0, 1, (uint8_t*)"c", 0, 0));
+    assert(render_scan(res, 1024, first, &last, &frames) == 7);
+    assert(first[0] == 'c' && first[1] == 0 && last == SCAN_DONE);
+    ccask_res_delete(res);
+
+    puts("Values are read a batch at a time...");
+    for (uint8_t i = 0; i < 40; i++) set_scan_key(db, 'e', 39 - i);
+    res = ccask_query_interp(db, make_scan_cmd(cmd, 0, 0x01, 0, 0, 1, (uint8_t*)"e"));
+    assert(render_scan(res, 256 * 1024, first, &last, &frames) == 40);
+    assert(first[0] == 'e' && first[1] == 0 && last == SCAN_DONE && frames == 41);
+    ccask_res_delete(res);
+
+    puts("A pair that doesn't fit in a response fails the scan...");
+    set_scan_key(db, 'd', 0);
+    start[0] = 'c';
+    start[1] = 35;
+    res = ccask_query_interp(db, make_scan_cmd(cmd, 0, 0, 2, start, 0, 0));
+    assert(render_scan(res, 256, first, &last, &frames) == 5);
+    assert(first[0] == 'c' && first[1] == 35 && last == SCAN_FAIL);
+    ccask_res_delete(res);
+
+    puts("A SCAN whose keys run past the message fails...");
+    make_scan_cmd(cmd, 0, 0, 2, start, 0, 0);
+    u32_to_nwk_byte_arr(cmd+9, 40);
+    res = ccask_query_interp(db, cmd);
+    assert(ccask_res_type(res) == SCAN_FAIL);
+    ccask_res_delete(res);
+
+    ccask_db_delete(db);
+    ccask_config_delete(cfg);
+    puts("\t===== ccask_db SCAN tests complete =====");
+}
+
+void test_backup(void) {
+    puts("\t===== ccask_db online backup tests =====");
+    clear_test_dir(BACKUP_TEST_DIR);
+    clear_test_dir(BACKUP_TEST_DEST);
+
+    uint8_t key[2] = { 0xBA, 0x00 };
+    uint8_t val[40];
+    size_t count = 25;
+
+    // BACKUP may only write under the working directory
+    ccask_config_opts opts = test_opts(true);
+    opts.backup_dir = ".";
+    ccask_config* cfg = ccask_config_new(&opts);
+    ccask_db* db = ccask_db_new(BACKUP_TEST_DIR, cfg);
+    assert(db != 0);
+    for (uint8_t i = 0; i < count; i++) {
+        key[1] = i;
+        memset(val, i, sizeof(val));
+        assert(ccask_db_set(db, 2, key, sizeof(val), val) != 0);
+    }
+    size_t files = ccask_db_fid(db) + 1;
+    assert(files > 1);
+
+    puts("BACKUP only takes a single name to put under CCASK_BACKUP_DIR...");
+    uint8_t cmd[64];
+    const char* names[] = { "", ".", "..", "../" BACKUP_TEST_DEST, "/tmp/" BACKUP_TEST_DEST, BACKUP_TEST_DEST "/x" };
+    for (size_t i = 0; i < sizeof(names) / sizeof(names[0]); i++) {
+        make_cmd(cmd, 5, strlen(names[i]), (uint8_t*)names[i], 0, 0);
+        ccask_result* res = ccask_query_interp(db, cmd);
+        assert(ccask_res_type(res) == BACKUP_FAIL);
+        ccask_res_delete(res);
+    }
+    assert(access("/tmp/" BACKUP_TEST_DEST, F_OK) != 0 && access("../" BACKUP_TEST_DEST, F_OK) != 0);
+
+    puts("BACKUP through query interp seals the active file and links every file...");
+    make_cmd(cmd, 5, strlen(BACKUP_TEST_DEST), (uint8_t*)BACKUP_TEST_DEST, 0, 0);
+    ccask_result* res = ccask_query_interp(db, cmd);
+    assert(ccask_res_type(res) == BACKUP_SUCCESS);
+    ccask_res_delete(res);
+
+    struct stat st;
+    char fn[128];
+    for (size_t fid = 0; fid < files; fid++) {
+        snprintf(fn, sizeof(fn), "%s/%s_%zu", BACKUP_TEST_DEST, BACKUP_TEST_DEST, fid);
+        assert(stat(fn, &st) == 0 && st.st_nlink == 2);
+        strcat(fn, HINT_SUFFIX);
+        assert(stat(fn, &st) == 0 && st.st_nlink == 2);
+    }
+    assert(ccask_db_fid(db) == files);
+
+    puts("A backup only goes to an empty directory...");
+    assert(ccask_db_backup(db, BACKUP_TEST_DEST) == -1);
+
+    puts("Writes and merges after the backup don't reach it...");
+    for (uint8_t i = 0; i < count; i++) {
+        key[1] = i;
+        memset(val, 0xEE, sizeof(val));
+        assert(ccask_db_set(db, 2, key, sizeof(val), val) != 0);
+    }
+    key[1] = 0x80;
+    assert(ccask_db_set(db, 2, key, sizeof(val), val) != 0);
+    assert(ccask_db_merge(db) != 0);
+    ccask_db_delete(db);
+
+    db = ccask_db_new(BACKUP_TEST_DEST, cfg);
+    assert(db != 0);
+    for (uint8_t i = 0; i < count; i++) {
+        key[1] = i;
+        memset(val, i, sizeof(val));
+        assert_get_valid(db, 2, key, sizeof(val), val);
+    }
+    key[1] = 0x80;
+    assert(ccask_db_get(db, 2, key) == 0);
+    ccask_db_delete(db);
+
+    puts("A backup that would leave too few file ids is refused, and the db goes on...");
+    rmdir(BACKUP_TEST_DEST "_FULL");
+    db = ccask_db_new(BACKUP_TEST_DIR, cfg);
+    assert(db != 0);
+    uint8_t many[4] = { 0xBB };
+    for (uint16_t i = 0; ccask_db_fid(db) < MAX_FILES - 8; i++) {
+        memcpy(many + 1, &i, sizeof(i));
+        assert(ccask_db_set(db, sizeof(many), many, sizeof(val), val) != 0);
+    }
+    files = ccask_db_fid(db);
+    make_cmd(cmd, 5, strlen(BACKUP_TEST_DEST "_FULL"), (uint8_t*)BACKUP_TEST_DEST "_FULL", 0, 0);
+    res = ccask_query_interp(db, cmd);
+    assert(ccask_res_type(res) == BACKUP_FAIL && ccask_db_fid(db) == files);
+    assert(access(BACKUP_TEST_DEST "_FULL", F_OK) != 0);
+    ccask_res_delete(res);
+    assert(ccask_db_set(db, sizeof(many), many, sizeof(val), val) != 0);
+    ccask_db_delete(db);
+
+    puts("Without CCASK_BACKUP_DIR, BACKUP is refused...");
+    rmdir(BACKUP_TEST_DEST "_OFF");
+    ccask_config_opts off_opts = test_opts(true);
+    ccask_config* off = ccask_config_new(&off_opts);
+    db = ccask_db_new(BACKUP_TEST_DIR, off);
+    assert(db != 0);
+    make_cmd(cmd, 5, strlen(BACKUP_TEST_DEST "_OFF"), (uint8_t*)BACKUP_TEST_DEST "_OFF", 0, 0);
+    res = ccask_query_interp(db, cmd);
+    assert(ccask_res_type(res) == BACKUP_FAIL && access(BACKUP_TEST_DEST "_OFF", F_OK) != 0);
+    ccask_res_delete(res);
+    ccask_db_delete(db);
+
+    ccask_config_delete(off);
+    ccask_config_delete(cfg);
+    puts("\t===== ccask_db online backup tests complete =====");
+}
+
+void test_digest(void) {
+    puts("\t===== ccask_db digest-keyed keydir tests =====");
+    clear_test_dir(DIGEST_TEST_DIR);
+
+    // 200-byte keys that differ only in their last byte, with 48 bytes of that byte as value
+    uint8_t key[200];
+    uint8_t val[48];
+    size_t count = 40;
+    memset(key, '/', sizeof(key));
+
+    ccask_config_opts opts = test_opts(true);
+    opts.kd_digest = true;
+    ccask_config* cfg = ccask_config_new(&opts);
+    ccask_db* db = ccask_db_new(DIGEST_TEST_DIR, cfg);
+    assert(db != 0);
+
+    for (uint8_t i = 0; i < count; i++) {
+        key[199] = i;
+        memset(val, i, sizeof(val));
+        assert(ccask_db_set(db, sizeof(key), key, sizeof(val), val) != 0);
+    }
+    key[199] = 3;
+    assert(ccask_db_del(db, sizeof(key), key) != 0);
+
+    puts("Gets find every key, and miss deleted and unknown ones...");
+    for (uint8_t i = 0; i < count; i++) {
+        key[199] = i;
+        memset(val, i, sizeof(val));
+        if (i == 3) assert(ccask_db_get(db, sizeof(key), key) == 0);
+        else assert_get_valid(db, sizeof(key), key, sizeof(val), val);
+    }
+    key[199] = count;
+    assert(ccask_db_get(db, sizeof(key), key) == 0);
+
+    puts("Iterators read keys back from their records...");
+    ccask_db_iterator* it = ccask_db_iterator_new(db);
+    assert(it != 0 && ccask_db_iterator_count(it) == count - 1);
+    bool seen[256] = { false };
+    while (ccask_db_iterator_next(it)) {
+        assert(ccask_db_iterator_ksz(it) == sizeof(key));
+        const uint8_t* k = ccask_db_iterator_key(it);
+        assert(k != 0 && memcmp(k, key, sizeof(key) - 1) == 0 && k[199] < count && k[199] != 3 && !seen[k[199]]);
+        seen[k[199]] = true;
+    }
+    ccask_db_iterator_delete(it);
+
+    puts("Keys survive a merge and a restart...");
+    assert(ccask_db_merge(db) != 0);
+    ccask_db_delete(db);
+    db = ccask_db_new(DIGEST_TEST_DIR, cfg);
+    assert(db != 0);
+    for (uint8_t i = 0; i < count; i++) {
+        key[199] = i;
+        memset(val, i, sizeof(val));
+        if (i == 3) assert(ccask_db_get(db, sizeof(key), key) == 0);
+        else assert_get_valid(db, sizeof(key), key, sizeof(val), val);
+    }
+
+    ccask_db_delete(db);
+    ccask_config_delete(cfg);
+    puts("\t===== ccask_db digest-keyed keydir tests complete =====");
+}
+
 void test_server(void) {
     return;
 }
@@ -320,9 +2031,263 @@ void test_util(void) {
     assert(HST_BYTE_ARR_U32(narr) == 25467);
     puts("u32->byte array tests complete!");
 
+    printf("positional I/O......");
+    FILE* tmp = tmpfile();
+    int fd = fileno(tmp);
+    uint8_t out[8] = { 1, 2, 3, 4, 5, 6, 7, 8 };
+    uint8_t in[8] = { 0 };
+    assert(pwrite_full(fd, out, 8, 4) == 0);
+    assert(pread_full(fd, in, 4, 8) == 0);
+    assert(memcmp(in, out + 4, 4) == 0);
+    assert(pread_full(fd, in, 8, 8) == -1); // runs past the end of the file
+    assert(lseek(fd, 0, SEEK_CUR) == 0);    // neither call moves the file offset
+    fclose(tmp);
+    puts("worked!");
+
     puts("\t===== done =====");
 }
 
+/**@brief set key { 0xC4, *i* } of the checkpoint test to 32 bytes of *v*, or delete it if *v* < 0,
+ * 		  tracking it in *want*
+ */
+void checkpoint_set(ccask_db* db, int* want, uint8_t i, int v) {
+    uint8_t key[2] = { 0xC4, i };
+    uint8_t val[32];
+    memset(val, v, sizeof(val));
+
+    if (v < 0) assert(ccask_db_del(db, 2, key) != 0);
+    else assert(ccask_db_set(db, 2, key, sizeof(val), val) != 0);
+    want[i] = v;
+}
+
+/**@brief assert that key { 0xC4, i } holds 32 bytes of want[i], or is missing where want[i] < 0*/
+void assert_checkpoint_keys(ccask_db* db, const int* want, size_t count) {
+    uint8_t key[2] = { 0xC4, 0 };
+    uint8_t val[32];
+    for (size_t i = 0; i < count; i++) {
+        key[1] = i;
+        memset(val, want[i], sizeof(val));
+        if (want[i] < 0) assert(ccask_db_get(db, 2, key) == 0);
+        else assert_get_valid(db, 2, key, sizeof(val), val);
+    }
+}
+
+/**@brief the number of entries in the checkpoint test's checkpoint, which must be intact*/
+size_t checkpoint_entries(void) {
+    ccask_checkpoint* cp = ccask_checkpoint_open(CHECKPOINT_TEST_DIR "/" CHECKPOINT_NAME);
+    assert(cp != 0);
+    size_t count = ccask_checkpoint_count(cp);
+    ccask_checkpoint_close(cp);
+    return count;
+}
+
+/**@brief flip the first byte of the first copy of *pattern* in a file of *path**/
+void dir_flip(const char* path, const uint8_t* pattern, size_t len) {
+    DIR* dir = opendir(path);
+    assert(dir != 0);
+
+    char fn[512];
+    bool found = false;
+    for (struct dirent* d = readdir(dir); d && !found; d = readdir(dir)) {
+        snprintf(fn, sizeof(fn), "%s/%s", path, d->d_name);
+        int fd = open(fn, O_RDWR);
+        if (fd < 0) continue;
+
+        uint8_t buf[4096];
+        ssize_t n = read(fd, buf, sizeof(buf));
+        for (ssize_t i = 0; i + (ssize_t)len <= n && !found; i++) {
+            if (memcmp(buf + i, pattern, len) != 0) continue;
+
+            buf[i] ^= 0xFF;
+            assert(pwrite_full(fd, buf + i, 1, i) == 0);
+            found = true;
+        }
+        close(fd);
+    }
+
+    closedir(dir);
+    assert(found);
+}
+
+/**@brief ccask_checkpoint_fn that adds an entry to the checkpoint writer *ctx**/
+int checkpoint_copy(void* ctx, uint32_t key_size, const uint8_t* index_key, uint32_t file_id,
+                    uint32_t value_size, size_t value_pos, uint32_t expiry) {
+    return ccask_checkpoint_writer_add(ctx, key_size, index_key, file_id, value_size, value_pos, expiry) == 0;
+}
+
+/**@brief rewrite the checkpoint test's checkpoint with one more entry, in a file it does not cover*/
+void checkpoint_add_stray(uint8_t i) {
+    ccask_checkpoint* cp = ccask_checkpoint_open(CHECKPOINT_TEST_DIR "/" CHECKPOINT_NAME);
+    assert(cp != 0);
+
+    ccask_checkpoint_file files[MAX_FILES];
+    uint32_t file_count = ccask_checkpoint_file_count(cp);
+    for (uint32_t fid = 0; fid < file_count; fid++) files[fid] = ccask_checkpoint_file_at(cp, fid);
+
+    ccask_checkpoint_writer* w = ccask_checkpoint_writer_new(CHECKPOINT_TEST_DIR "/" CHECKPOINT_NAME, ccask_checkpoint_digest(cp),
+                                 ccask_checkpoint_seed(cp), ccask_checkpoint_next_seq(cp), files, file_count);
+    assert(w != 0 && ccask_checkpoint_load(cp, checkpoint_copy, w) == 0);
+
+    uint8_t key[2] = { 0xC4, i };
+    assert(ccask_checkpoint_writer_add(w, 2, key, file_count, 32, 0, 0) != 0);
+    assert(ccask_checkpoint_writer_commit(w) == 0);
+    ccask_checkpoint_writer_delete(w);
+    ccask_checkpoint_close(cp);
+}
+
+/**@brief ccask_kdrow_fn that restores a row into the keydir *ctx**/
+void restore_row(void* ctx, ccask_kdrow* kdr) {
+    assert(ccask_keydir_restore(ctx, ccask_kdrow_ksize(kdr), ccask_kdrow_index_key(kdr), ccask_kdrow_fid(kdr),
+                                ccask_kdrow_vsize(kdr), ccask_kdrow_vpos(kdr), ccask_kdrow_expiry(kdr)) != 0);
+}
+
+void test_checkpoint(void) {
+    puts("\t===== ccask_db keydir checkpoint tests =====");
+    clear_test_dir(CHECKPOINT_TEST_DIR);
+
+    int want[40];
+    size_t count = sizeof(want) / sizeof(want[0]);
+    for (size_t i = 0; i < count; i++) want[i] = -1;
+
+    // checkpoints every MiB appended, and at close; or never
+    ccask_config_opts on_opts = test_opts(true);
+    on_opts.checkpoint_mb = 1;
+    ccask_config* on = ccask_config_new(&on_opts);
+    ccask_config_opts off_opts = test_opts(true);
+    ccask_config* off = ccask_config_new(&off_opts);
+
+    ccask_db* db = ccask_db_new(CHECKPOINT_TEST_DIR, off);
+    assert(db != 0);
+    for (uint8_t i = 0; i < 25; i++) checkpoint_set(db, want, i, i);
+    checkpoint_set(db, want, 5, -1);
+
+    puts("A checkpoint holds every live key...");
+    assert(ccask_db_checkpoint(db) == 0);
+    assert(checkpoint_entries() == 24);
+
+    puts("Records appended after it are replayed on top of it...");
+    checkpoint_set(db, want, 9, 0x99);
+    checkpoint_set(db, want, 2, -1);
+    for (uint8_t i = 25; i < 36; i++) checkpoint_set(db, want, i, i);
+    ccask_db_delete(db);
+
+    db = ccask_db_new(CHECKPOINT_TEST_DIR, on);
+    assert(db != 0);
+    assert_checkpoint_keys(db, want, count);
+
+    puts("A checkpoint is written in the background, one at a time...");
+    checkpoint_set(db, want, 36, 36);
+    assert(ccask_db_checkpoint_start(db) == 0);
+    assert(ccask_db_checkpoint_start(db) != 0);
+    struct timespec pause = { 0, 1000 * 1000 };
+    while (ccask_db_checkpoint_step(db)) nanosleep(&pause, 0);
+    assert(checkpoint_entries() == 35);
+    ccask_db_delete(db);
+
+    puts("A merge leaves the checkpoint behind, and startup loads the data files instead...");
+    db = ccask_db_new(CHECKPOINT_TEST_DIR, off);
+    assert(db != 0);
+    checkpoint_set(db, want, 0, 0x40);
+    assert(ccask_db_merge(db) != 0);
+    ccask_db_delete(db);
+
+    db = ccask_db_new(CHECKPOINT_TEST_DIR, on);
+    assert(db != 0);
+    assert_checkpoint_keys(db, want, count);
+    ccask_db_delete(db);
+
+    puts("A damaged checkpoint is ignored...");
+    int fd = open(CHECKPOINT_TEST_DIR "/" CHECKPOINT_NAME, O_RDWR);
+    uint8_t byte;
+    assert(fd >= 0 && pread_full(fd, &byte, 1, 40) == 0);
+    byte ^= 0xFF;
+    assert(pwrite_full(fd, &byte, 1, 40) == 0);
+    close(fd);
+    assert(ccask_checkpoint_open(CHECKPOINT_TEST_DIR "/" CHECKPOINT_NAME) == 0);
+
+    db = ccask_db_new(CHECKPOINT_TEST_DIR, on);
+    assert(db != 0);
+    assert_checkpoint_keys(db, want, count);
+    ccask_db_delete(db);
+
+    puts("A checkpoint that cannot be restored is dropped, and the data files are loaded instead...");
+    size_t covered = checkpoint_entries();
+    checkpoint_add_stray(39);
+    assert(checkpoint_entries() == covered + 1);
+
+    db = ccask_db_new(CHECKPOINT_TEST_DIR, on);
+    assert(db != 0);
+    assert_checkpoint_keys(db, want, count);
+    ccask_db_delete(db);
+    assert(checkpoint_entries() == covered);
+
+    puts("Records it covers are not read at startup, not even from hints...");
+    char fn[512];
+    for (size_t fid = 0; fid < MAX_FILES; fid++) {
+        snprintf(fn, sizeof(fn), "%s/%s_%zu%s", CHECKPOINT_TEST_DIR, CHECKPOINT_TEST_DIR, fid, HINT_SUFFIX);
+        unlink(fn);
+    }
+    uint8_t key[2] = { 0xC4, 17 };
+    uint8_t val[32];
+    memset(val, 17, sizeof(val));
+    dir_flip(CHECKPOINT_TEST_DIR, val, sizeof(val));
+
+    // a scan would have dropped the corrupt record; restored, its key is there and fails its checksum
+    db = ccask_db_new(CHECKPOINT_TEST_DIR, on);
+    assert(db != 0);
+    uint8_t buf[128];
+    ccask_get_result* gr = ccask_db_get(db, 2, key);
+    assert(gr != 0 && ccask_gr_bytes(gr, buf, sizeof(buf)) != UINT32_MAX && buf[4] != GET_SUCCESS);
+    ccask_gr_delete(gr);
+    ccask_db_delete(db);
+
+    puts("Digest-keyed rows are restored under the seed they were made with...");
+    ccask_keydir* kd = ccask_keydir_new(16, SIZE_MAX, false, true, false);
+    ccask_keydir* copy = ccask_keydir_new(16, SIZE_MAX, false, true, false);
+    assert(kd != 0 && copy != 0);
+    assert(ccask_keydir_set_hash(kd, ccask_kdhash_wyhash, 0x5EED) != 0);
+    uint8_t long_key[40];
+    memset(long_key, 'c', sizeof(long_key));
+    for (uint8_t i = 0; i < 100; i++) {
+        long_key[0] = i;
+        assert(ccask_keydir_put(kd, sizeof(long_key), long_key, 1, 10, i * 64, 0, 0) != 0);
+    }
+
+    assert(ccask_keydir_set_hash(copy, ccask_kdhash_wyhash, ccask_keydir_hash_seed(kd)) != 0);
+    ccask_keydir_foreach(kd, restore_row, copy);
+    assert(ccask_keydir_count(copy) == 100);
+    for (uint8_t i = 0; i < 100; i++) {
+        long_key[0] = i;
+        assert(ccask_kdrow_vpos(ccask_keydir_get(copy, sizeof(long_key), long_key)) == (size_t)i * 64);
+    }
+    ccask_keydir_delete(kd);
+    ccask_keydir_delete(copy);
+
+    ccask_config_delete(on);
+    ccask_config_delete(off);
+
+    // and by a db, which adopts the checkpoint's seed
+    clear_test_dir(CHECKPOINT_TEST_DIR);
+    for (size_t i = 0; i < count; i++) want[i] = -1;
+    ccask_config_opts digest_opts = test_opts(true);
+    digest_opts.kd_digest = true;
+    digest_opts.checkpoint_mb = 1;
+    ccask_config* digest = ccask_config_new(&digest_opts);
+    db = ccask_db_new(CHECKPOINT_TEST_DIR, digest);
+    assert(db != 0);
+    for (uint8_t i = 0; i < 20; i++) checkpoint_set(db, want, i, i + 1);
+    checkpoint_set(db, want, 7, -1);
+    ccask_db_delete(db);
+
+    db = ccask_db_new(CHECKPOINT_TEST_DIR, digest);
+    assert(db != 0);
+    assert_checkpoint_keys(db, want, count);
+    ccask_db_delete(db);
+    ccask_config_delete(digest);
+
+    puts("\t===== ccask_db keydir checkpoint tests complete =====");
+}
+
 void test_config(void) {
     puts("\t===== test ccask_config =====");
     int yes_replace = 1;
@@ -360,13 +2325,45 @@ void test_config(void) {
 }
 
 int main(void) {
+    crc_init();
     test_kdrow();
     puts("");
     test_keydir();
     puts("");
+    test_keydir_readers();
+    puts("");
     test_util();
     puts("");
+    test_crc();
+    puts("");
     test_db();
     puts("");
+    test_merge();
+    puts("");
+    test_hint();
+    puts("");
+    test_del();
+    puts("");
+    test_mmap();
+    puts("");
+    test_async();
+    test_commit();
+    puts("");
+    test_legacy();
+    puts("");
+    test_recovery();
+    puts("");
+    test_ttl();
+    puts("");
+    test_iterator();
+    puts("");
+    test_scan();
+    puts("");
+    test_backup();
+    puts("");
+    test_digest();
+    puts("");
+    test_checkpoint();
+    puts("");
     test_config();
 }
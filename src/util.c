@@ -1,5 +1,10 @@
+#define _DEFAULT_SOURCE
+
 #include "util.h"
 
+#include <errno.h>
+#include <unistd.h>
+
 uint8_t* u32_to_nwk_byte_arr(uint8_t* dest, uint32_t src) {
     if (!dest) return 0;
 
@@ -30,3 +35,68 @@ uint8_t* u32_to_host_byte_arr(uint8_t* dest, uint32_t src) {
 
     return dest;
 }
+
+/**@brief read exactly *len* bytes at offset *pos* of *fd* without touching the file offset*/
+int pread_full(int fd, void* buf, size_t len, size_t pos) {
+    uint8_t* ptr = buf;
+
+    while (len > 0) {
+        ssize_t n = pread(fd, ptr, len, pos);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+
+        ptr += n;
+        pos += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/**@brief write exactly *len* bytes at offset *pos* of *fd* without touching the file offset*/
+int pwrite_full(int fd, const void* buf, size_t len, size_t pos) {
+    const uint8_t* ptr = buf;
+
+    while (len > 0) {
+        ssize_t n = pwrite(fd, ptr, len, pos);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+
+        ptr += n;
+        pos += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+/**@brief write every buffer of *iov*, back to back, at offset *pos* of *fd* without touching the
+ * 		  file offset. *iov* is consumed: its entries are advanced past what has been written.
+ */
+int pwritev_full(int fd, struct iovec* iov, int iovcnt, size_t pos) {
+    while (iovcnt > 0) {
+        if (iov->iov_len == 0) {
+            iov++;
+            iovcnt--;
+            continue;
+        }
+
+        ssize_t n = pwritev(fd, iov, iovcnt, pos);
+        if (n < 0 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+
+        pos += n;
+        while (n > 0) {
+            size_t step = (size_t)n < iov->iov_len ? (size_t)n : iov->iov_len;
+            iov->iov_base = (uint8_t*)iov->iov_base + step;
+            iov->iov_len -= step;
+            n -= step;
+            if (iov->iov_len == 0) {
+                iov++;
+                iovcnt--;
+            }
+        }
+    }
+
+    return 0;
+}
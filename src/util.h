@@ -1,8 +1,10 @@
 #ifndef _UTIL_H
 #define _UTIL_H
 
+#include <stddef.h>
 #include <inttypes.h>
 #include <arpa/inet.h>
+#include <sys/uio.h>
 
 #define NWK_BYTE_ARR_U32(src) ntohl(src[0] | src[1] << 8 | src[2] << 16 | src[3] << 24)
 #define HST_BYTE_ARR_U32(src) src[0] | src[1] << 8 | src[2] << 16 | src[3] << 24
@@ -10,4 +12,9 @@
 uint8_t* u32_to_nwk_byte_arr(uint8_t* dest, uint32_t src);
 uint8_t* u32_to_host_byte_arr(uint8_t* dest, uint32_t src);
 
+// positional I/O that retries short transfers and EINTR; 0 on success, -1 on error or EOF
+int pread_full(int fd, void* buf, size_t len, size_t pos);
+int pwrite_full(int fd, const void* buf, size_t len, size_t pos);
+int pwritev_full(int fd, struct iovec* iov, int iovcnt, size_t pos);
+
 #endif